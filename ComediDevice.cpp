@@ -0,0 +1,435 @@
+#ifdef USE_COMEDI
+
+#include <QtCore>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <limits>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "ComediDevice.h"
+
+#define DeviceCheck(x) check(#x,x)
+
+
+static qint64 monotonicNs()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return qint64(now.tv_sec)*1000000000 + now.tv_nsec;
+}
+
+
+ComediDevice::ComediDevice(int deviceNumber_,
+        const QVector<Channel>& channels_, double dt_, int queueLength,
+        int targetLatency_) :
+    queue(channels_.count(), queueLength),
+    deviceNumber(deviceNumber_),
+    channels(channels_),
+    dt(dt_),
+    targetLatency(qMax(1, targetLatency_)),
+    priority(0),
+    cpu(-1),
+    dev(NULL),
+    chanlist(channels_.count()),
+    crange(channels_.count()),
+    maxdata(channels_.count()),
+    overSampling(1),
+    overSampleSum(channels_.count()),
+    overSampleCount(0),
+    nextChan(0),
+    pendingPadding(0),
+    shouldStop(false),
+    controlFd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)),
+    triggerNs(0),
+    numScansPadded(0)
+{
+}
+
+
+ComediDevice::~ComediDevice()
+{
+    stop();
+    QThread::wait();
+
+    if (controlFd >= 0)
+        ::close(controlFd);
+}
+
+
+void ComediDevice::setRealtime(int priority_, int cpu_)
+{
+    priority = priority_;
+    cpu = cpu_;
+}
+
+
+QStringList ComediDevice::realtimeProblems()
+{
+    QMutexLocker lock(&statusMutex);
+    return problems;
+}
+
+
+bool ComediDevice::waitUntilStarted()
+{
+    started.acquire();
+    return !failed();
+}
+
+
+// The first scan is taken somewhere within the trigger call, so it's
+// timed as the middle of it.  A board that can't hold its command for an
+// internal trigger has been running since it was loaded.
+bool ComediDevice::trigger()
+{
+    const int subdevice = 0;
+    qint64 beforeNs = monotonicNs();
+    bool ok = true;
+
+    if (cmd.start_src == TRIG_INT)
+        ok = DeviceCheck( comedi_internal_trigger(dev, subdevice, 0) );
+
+    triggerNs = (beforeNs + monotonicNs())/2;
+
+    triggered.release();
+    return ok;
+}
+
+
+void ComediDevice::stop()
+{
+    shouldStop = true;
+
+    // in case the board is still waiting for a trigger that won't come
+    triggered.release();
+
+    quint64 one = 1;
+    ssize_t written = ::write(controlFd, &one, sizeof(one));
+    Q_UNUSED(written);
+}
+
+
+bool ComediDevice::failed()
+{
+    QMutexLocker lock(&statusMutex);
+    return !error.isEmpty();
+}
+
+
+QString ComediDevice::errorMessage()
+{
+    QMutexLocker lock(&statusMutex);
+    return error;
+}
+
+
+qint64 ComediDevice::scansPadded()
+{
+    QMutexLocker lock(&statusMutex);
+    return numScansPadded;
+}
+
+
+bool ComediDevice::check(const char* command, int result)
+{
+    if (result >= 0)
+        return true;
+
+    int errorNumber = comedi_errno();
+
+    QMutexLocker lock(&statusMutex);
+    if (error.isEmpty()) {
+        error = QString("/dev/comedi%1: %2: \"%3\"\nWhile processing "
+                "command:\n\"%4\"").arg(deviceNumber).arg(errorNumber)
+            .arg(comedi_strerror(errorNumber)).arg(command);
+    }
+
+    shouldStop = true;
+    return false;
+}
+
+
+// Opens the board and starts its command; the board's share of the
+// aggregate rate goes to oversampling as on a single board.
+bool ComediDevice::startCommand()
+{
+    const int subdevice = 0;
+    const int numChans = channels.count();
+
+    dev = comedi_open(qPrintable(QString("/dev/comedi%1").arg(deviceNumber)));
+
+    if (dev == NULL)
+        return DeviceCheck(-1);
+
+    overSampling = qMax(1, int(250000/numChans*dt));
+
+    for (int chan = 0; chan < numChans; ++chan) {
+        const Channel& channel = channels[chan];
+        int range;
+
+        if (!DeviceCheck( range = comedi_find_range(dev, subdevice,
+                        channel.input, UNIT_volt,
+                        channel.minVoltage, channel.maxVoltage) ))
+            return false;
+
+        crange[chan] = comedi_get_range(dev, subdevice, channel.input, range);
+        maxdata[chan] = comedi_get_maxdata(dev, subdevice, channel.input);
+        chanlist[chan] = CR_PACK(channel.input, range, AREF_DIFF);
+    }
+
+    memset(&cmd, 0, sizeof(cmd));
+
+    if (!DeviceCheck( comedi_get_cmd_generic_timed(dev, subdevice, &cmd,
+                    numChans, (unsigned int)(1e9*dt/overSampling)) ))
+        return false;
+
+    cmd.chanlist = chanlist.data();
+    cmd.chanlist_len = numChans;
+    cmd.convert_arg /= numChans;
+    cmd.scan_end_arg = numChans;
+    cmd.stop_src = TRIG_NONE;
+    cmd.stop_arg = 0;
+    // loaded, but held until trigger() if the board can
+    cmd.start_src = TRIG_INT;
+    cmd.start_arg = 0;
+
+    comedi_command_test(dev, &cmd);
+
+    // boards without an internal trigger start straight away
+    if (cmd.start_src == 0) {
+        cmd.start_src = TRIG_NOW;
+        comedi_command_test(dev, &cmd);
+    }
+
+    if (!DeviceCheck( comedi_command_test(dev, &cmd) == 0 ? 0 : -1 )
+            || !DeviceCheck( comedi_command(dev, &cmd) ))
+        return false;
+
+    dt = cmd.scan_begin_arg*1.0e-9*overSampling;
+    return true;
+}
+
+
+void ComediDevice::run()
+{
+    // what fails is passed on to DAQReader, which warns about it
+    QStringList failures;
+
+    if (cpu >= 0) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(cpu, &cpus);
+
+        int error = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+        if (error != 0) {
+            failures << QString("could not run /dev/comedi%1 on CPU %2 "
+                    "only: %3").arg(deviceNumber).arg(cpu)
+                .arg(strerror(error));
+        }
+    }
+
+    if (priority > 0) {
+        struct sched_param param;
+        param.sched_priority = priority;
+
+        int error = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        if (error != 0) {
+            failures << QString("could not use SCHED_FIFO priority %1 for "
+                    "/dev/comedi%2: %3").arg(priority).arg(deviceNumber)
+                .arg(strerror(error));
+        }
+    }
+
+    {
+        QMutexLocker lock(&statusMutex);
+        problems = failures;
+    }
+
+    bool ok = startCommand();
+    started.release();
+
+    if (ok) {
+        triggered.acquire();
+        ok = !shouldStop;
+    }
+
+    if (ok) {
+        const int subdevice = 0;
+        const int fd = comedi_fileno(dev);
+        QVector<sampl_t> buffer(250000/10);
+        const int bufferBytes = buffer.count()*sizeof(sampl_t);
+
+        converted.resize((buffer.count()/channels.count() + 1)
+                * channels.count());
+        padding.fill(std::numeric_limits<qreal>::quiet_NaN(),
+                converted.count());
+
+        struct timespec now;
+        qint64 commandStartNs = triggerNs;
+        qint64 commandScans = 0;
+
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+        while (!shouldStop) {
+            struct pollfd fds[2];
+            fds[0].fd = fd;
+            fds[0].events = POLLIN;
+            fds[0].revents = 0;
+            fds[1].fd = controlFd;
+            fds[1].events = POLLIN;
+            fds[1].revents = 0;
+
+            if (poll(fds, 2, 1000) < 0 && errno != EINTR) {
+                DeviceCheck(-1);
+                break;
+            }
+
+            if (shouldStop)
+                break;
+
+            forever {
+                int bytesRead = read(fd, buffer.data(), bufferBytes);
+
+                if (bytesRead < 0 && errno == EAGAIN)
+                    break;
+
+                if (bytesRead < 0 && errno == EPIPE) {
+                    // Overflowed: restart, and owe the queue the scans
+                    // the clock says were missed.
+                    comedi_cancel(dev, subdevice);
+
+                    if (!DeviceCheck( comedi_command(dev, &cmd) ))
+                        break;
+
+                    if (cmd.start_src == TRIG_INT && !DeviceCheck(
+                                comedi_internal_trigger(dev, subdevice, 0) ))
+                        break;
+
+                    clock_gettime(CLOCK_MONOTONIC, &now);
+                    qint64 nowNs = qint64(now.tv_sec)*1000000000 + now.tv_nsec;
+                    qint64 missed = qint64((nowNs - commandStartNs)*1e-9/dt)
+                        - commandScans;
+
+                    if (missed > 0) {
+                        pendingPadding += missed;
+
+                        QMutexLocker lock(&statusMutex);
+                        numScansPadded += missed;
+                    }
+
+                    commandStartNs = nowNs;
+                    commandScans = 0;
+                    nextChan = 0;
+                    overSampleCount = 0;
+                    overSampleSum.fill(0.0);
+                    break;
+                }
+
+                if (!DeviceCheck(bytesRead) || bytesRead == 0) {
+                    shouldStop = true;
+                    break;
+                }
+
+                commandScans += convertSamples(buffer.constData(),
+                        bytesRead/sizeof(sampl_t));
+
+                if (bytesRead < bufferBytes)
+                    break;
+            }
+
+            // let a target latency's worth collect before reading again
+            waitForControl(targetLatency);
+        }
+
+        comedi_cancel(dev, subdevice);
+    }
+
+    if (dev != NULL) {
+        comedi_close(dev);
+        dev = NULL;
+    }
+}
+
+
+// Sleeps for up to timeoutMs, returning early if stop() is called.
+void ComediDevice::waitForControl(int timeoutMs)
+{
+    struct pollfd fds;
+    fds.fd = controlFd;
+    fds.events = POLLIN;
+    fds.revents = 0;
+
+    if (poll(&fds, 1, timeoutMs) > 0) {
+        quint64 count;
+        ssize_t numRead = ::read(controlFd, &count, sizeof(count));
+        Q_UNUSED(numRead);
+    }
+}
+
+
+// As DAQReader::convertSamples, into this board's queue; returns the
+// number of scans converted.
+int ComediDevice::convertSamples(const sampl_t* buffer, int numSamples)
+{
+    const int numChans = channels.count();
+    double* sums = overSampleSum.data();
+    qreal* out = converted.data();
+    int numScans = 0;
+
+    for (int i = 0; i < numSamples; ++i) {
+        sums[nextChan] += comedi_to_phys(
+                buffer[i], crange[nextChan], maxdata[nextChan]);
+
+        if (++nextChan == numChans) {
+            nextChan = 0;
+
+            if (++overSampleCount == overSampling) {
+                overSampleCount = 0;
+                for (int chan = 0; chan < numChans; ++chan) {
+                    *out++ = sums[chan]/overSampling;
+                    sums[chan] = 0.0;
+                }
+                ++numScans;
+            }
+        }
+    }
+
+    queueScans(converted.constData(), numScans);
+    return numScans;
+}
+
+
+// Queues any NaN scans still owed, then the new ones; whatever doesn't fit
+// is owed in turn, so the scans that do get through stay aligned.
+void ComediDevice::queueScans(const qreal* scans, int numScans)
+{
+    const int numChans = channels.count();
+
+    while (pendingPadding > 0) {
+        int numPad = int(qMin(pendingPadding,
+                    qint64(padding.count()/numChans)));
+        int numQueued = queue.push(padding.constData(), numPad);
+        pendingPadding -= numQueued;
+
+        if (numQueued < numPad)
+            break;
+    }
+
+    int numQueued = pendingPadding > 0 ? 0 : queue.push(scans, numScans);
+
+    if (numQueued < numScans) {
+        pendingPadding += numScans - numQueued;
+
+        QMutexLocker lock(&statusMutex);
+        numScansPadded += numScans - numQueued;
+    }
+}
+
+#endif
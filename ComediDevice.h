@@ -0,0 +1,111 @@
+#ifndef COMEDIDEVICE_H
+#define COMEDIDEVICE_H
+
+#ifdef USE_COMEDI
+
+#include <QThread>
+#include <QMutex>
+#include <QSemaphore>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <comedilib.h>
+#include "ScanQueue.h"
+
+// One board of a recording spread over several comedi devices.  Each runs
+// its own acquisition command on its own thread and converts its samples
+// into its own ScanQueue, which DAQReader merges with the other boards'.
+// Nothing on the data path is shared between boards, so they never wait
+// on each other.  Each board's command is loaded held on an internal
+// trigger, so that DAQReader can start them all back to back once they're
+// all ready.
+//
+// If the board's buffer or the queue overflows, the missing scans are
+// queued as NaN, so that scan i from every board is still the same scan.
+class ComediDevice : public QThread
+{
+    public:
+        struct Channel
+        {
+            int input;
+            double minVoltage;
+            double maxVoltage;
+        };
+
+        ComediDevice(int deviceNumber, const QVector<Channel>& channels,
+                double dt, int queueLength, int targetLatency);
+        ~ComediDevice();
+
+        // the realtime settings for this board's thread, and those that
+        // couldn't be applied, once started
+        void setRealtime(int priority, int cpu);
+        QStringList realtimeProblems();
+
+        // blocks until the command has been loaded (or has failed), and
+        // returns false if it failed
+        bool waitUntilStarted();
+        // Starts the loaded command, on the calling thread; returns false
+        // if it failed.
+        bool trigger();
+        // CLOCK_MONOTONIC when the first scan was taken, once triggered
+        qint64 startNs() const { return triggerNs; }
+
+        void stop();
+        bool failed();
+        QString errorMessage();
+
+        int numChannels() const { return channels.count(); }
+        double scanInterval() const { return dt; }
+        qint64 scansPadded();
+
+        // the range and top code each channel was given, once started
+        const comedi_range* range(int chan) const { return crange[chan]; }
+        lsampl_t maxValue(int chan) const { return maxdata[chan]; }
+
+        ScanQueue queue;
+
+    protected:
+        void run();
+
+    private:
+        bool startCommand();
+        bool check(const char* cmd, int error);
+        int convertSamples(const sampl_t* buffer, int numSamples);
+        void queueScans(const qreal* scans, int numScans);
+        void waitForControl(int timeoutMs);
+
+        int deviceNumber;
+        QVector<Channel> channels;
+        double dt;
+        int targetLatency;
+        int priority;
+        int cpu;
+
+        comedi_t* dev;
+        comedi_cmd cmd;
+        QVector<unsigned int> chanlist;
+        QVector<comedi_range*> crange;
+        QVector<lsampl_t> maxdata;
+        int overSampling;
+        QVector<double> overSampleSum;
+        int overSampleCount;
+        int nextChan;
+        QVector<qreal> converted;
+        QVector<qreal> padding;     // NaN, as much as converted holds
+        qint64 pendingPadding;  // scans owed to the queue as NaN
+
+        volatile bool shouldStop;
+        int controlFd;
+        QSemaphore started;
+        QSemaphore triggered;
+        qint64 triggerNs;
+
+        QMutex statusMutex;     // for the three below only
+        QString error;
+        QStringList problems;
+        qint64 numScansPadded;
+};
+
+#endif
+
+#endif
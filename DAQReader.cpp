@@ -1,13 +1,33 @@
 #include <QtGui>
+#include <algorithm>
 #include <cmath>
+#include <ctime>
+#include <cerrno>
+#include <cstring>
 
 #include "DAQReader.h"
+#ifdef USE_COMEDI
+#include "ComediDevice.h"
+#endif
+
+#ifdef Q_OS_LINUX
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 
 #if defined(USE_NIDAQMXBASE)
 #include <NIDAQmxBase.h>
 #elif defined(USE_COMEDI)
+#include <fcntl.h>
+#include <poll.h>
 #include <unistd.h>
-#include <comedilib.h>
+#elif defined(USE_SIMULATED_DAQ)
+#include <QElapsedTimer>
 #else
 #error No DAQ library was defined!
 #endif
@@ -17,56 +37,773 @@
 
 DAQReader::DAQReader() :
     shouldStop(false),
+    targetLatency(20),
+    controlFd(-1),
     numChannels(1),
     dt(0.01),
+    numScansAcquired(0),
+    numScansDropped(0),
+    bufferUsed(0),
+    bufferHighWater(0),
+    bufferSize(0),
+    startSkewNs(0),
+    numScansPadded(0),
+    readMonotonicNs(0),
+    readRealtimeNs(0),
+    storedScans(0),
     mutex(QMutex::Recursive)
 {
-    Vmins[0] = -10.0;
-    Vmaxes[0] = 10.0;
+    DAQSettings settings;
+    settings.setNumChannels(1);
+    updateDAQSettings(settings);
+
+#ifdef USE_COMEDI
+    overSampling = 1;
+    resetOverSampling();
+#endif
+
+#ifdef Q_OS_LINUX
+    controlFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+#endif
+}
+
+
+DAQReader::~DAQReader()
+{
+#ifdef Q_OS_LINUX
+    if (controlFd >= 0)
+        ::close(controlFd);
+#endif
+}
+
+
+void DAQReader::updateDAQSettings(const DAQSettings& settings)
+{
+    // only called between recordings, but the GUI thread's appendData and
+    // the stats readers still look at these
+    QMutexLocker lock(&mutex);
+    daqSettings = settings;
+    numChannels = settings.numChannels;
+    dt = 1.0/settings.samplingRate;
+    targetLatency = qMax(1, settings.targetLatency);
+
+    devices = settings.device.mid(0, numChannels);
+    inputs = settings.input.mid(0, numChannels);
+    Vmins = settings.minVoltage.mid(0, numChannels);
+    Vmaxes = settings.maxVoltage.mid(0, numChannels);
+
+    // nominally 16 bits over the channel's range, until a board says
+    // otherwise
+    calibration.resize(numChannels);
+    for (int chan = 0; chan < numChannels; ++chan) {
+        calibration[chan] = SampleStore::Calibration::forRange(
+                Vmins[chan], Vmaxes[chan], SampleStore::maxCode);
+    }
+
+    // the buffers are empty between recordings
+    newDataBuffer.resize(numChannels);
+    blockScans.resize(numChannels);
+    filteredBuffer.resize(numChannels);
+    keptScans.resize(numChannels);
+
+#ifdef USE_COMEDI
+    crange.resize(numChannels);
+    maxdata.resize(numChannels);
+    overSampleSum.resize(numChannels);
+    convertOut.resize(numChannels);
+#endif
+}
+
+
+// Takes everything read so far.  If filtered is given, it gets the same
+// scans as store, but filtered when only the display is.  When only the
+// scans around triggers are recorded, both get just those, unfiltered
+// unless the recording is.
+int DAQReader::appendData(SampleStore* store, SampleStore* filtered)
+{
+    QMutexLocker lock(&mutex);
+    int numScans = newDataBuffer[0].count();
+
+    if (triggerGate.isActive()) {
+        appendKept(store);
+        if (filtered != NULL)
+            appendKept(filtered);
+
+        const QVector<TriggerGate::Run>& runs = triggerGate.runs();
+        if (!runs.isEmpty())
+            storedScans = runs.last().firstScan + runs.last().numScans;
+
+        triggerGate.take();
+    }
+    else {
+        appendBuffer(newDataBuffer, store);
+
+        if (filtered != NULL) {
+            bool displayFiltered = filterThread.isActive()
+                && daqSettings.filterMode == DAQSettings::filterDisplay
+                && filteredBuffer[0].count() == numScans;
+
+            appendBuffer(displayFiltered ? filteredBuffer : newDataBuffer,
+                    filtered);
+        }
+    }
+
+    // keeps the capacity, so the acquisition thread needn't reallocate
+    for (int chan = 0; chan < numChannels; ++chan) {
+        newDataBuffer[chan].resize(0);
+        filteredBuffer[chan].resize(0);
+    }
+
+    dropBufferGaps(numScans);
+    return numScans;
+}
+
+
+// Appends the scans of buffer (newDataBuffer or one like it) to store;
+// must be called with the mutex held.
+void DAQReader::appendBuffer(const QVector<QVector<qreal> >& buffer,
+        SampleStore* store)
+{
+    int numScans = buffer[0].count();
+
+    store->setLayout(numChannels, daqSettings.rawStorage
+            ? calibration : QVector<SampleStore::Calibration>());
+
+    for (int chan = 0; chan < numChannels; ++chan) {
+        blockScans[chan] = buffer[chan].constData();
+    }
+
+    // scans the device lost leave a gap in the time axis
+    int scan = 0;
+
+    for (int gap = 0; gap <= bufferGaps.count(); ++gap) {
+        int end = gap < bufferGaps.count() ? bufferGaps[gap].first : numScans;
+
+        store->appendScans(blockScans.constData(), end - scan, dt);
+
+        for (int chan = 0; chan < numChannels; ++chan) {
+            blockScans[chan] += end - scan;
+        }
+
+        if (gap < bufferGaps.count())
+            store->skipScans(bufferGaps[gap].second, dt);
+
+        scan = end;
+    }
+}
+
+
+// Appends the runs of scans kept around triggers to store, leaving the
+// time between them empty; must be called with the mutex held.
+void DAQReader::appendKept(SampleStore* store)
+{
+    const QVector<QVector<qreal> >& kept = triggerGate.scans();
+    qint64 next = storedScans;
+
+    store->setLayout(numChannels, daqSettings.rawStorage
+            ? calibration : QVector<SampleStore::Calibration>());
+
+    foreach (const TriggerGate::Run& run, triggerGate.runs()) {
+        if (run.firstScan > next)
+            store->skipScans(run.firstScan - next, dt);
+
+        for (int chan = 0; chan < numChannels; ++chan) {
+            keptScans[chan] = kept[chan].constData() + run.index;
+        }
+
+        store->appendScans(keptScans.constData(), run.numScans, dt);
+        next = run.firstScan + run.numScans;
+    }
+}
+
+
+// For when nothing displays the data (the sinks have already had it), so
+// that the buffer doesn't grow without bound.
+int DAQReader::discardData()
+{
+    QMutexLocker lock(&mutex);
+    int numScans = newDataBuffer[0].count();
+
+    triggerGate.take();
+
+    for (int chan = 0; chan < numChannels; ++chan) {
+        newDataBuffer[chan].resize(0);
+        filteredBuffer[chan].resize(0);
+    }
+
+    dropBufferGaps(numScans);
+    return numScans;
+}
+
+
+// Forgets the gaps before the first numScans of newDataBuffer, which have
+// just been taken; a gap after the last of them stays for the next scan.
+void DAQReader::dropBufferGaps(int numScans)
+{
+    while (!bufferGaps.isEmpty() && bufferGaps.first().first < numScans) {
+        bufferGaps.removeFirst();
+    }
+
+    for (int i = 0; i < bufferGaps.count(); ++i) {
+        bufferGaps[i].first -= numScans;
+    }
+}
+
+
+void DAQReader::setCalibration(int chan, double min, double max,
+        unsigned long maxData)
+{
+    QMutexLocker lock(&mutex);
+    calibration[chan] = SampleStore::Calibration::forRange(min, max, maxData);
+}
+
+
+void DAQReader::stop()
+{
+    shouldStop=true;
+    wake();
+}
+
+
+// Interrupts waitForControl(), from any thread.
+void DAQReader::wake()
+{
+#ifdef Q_OS_LINUX
+    if (controlFd >= 0) {
+        quint64 one = 1;
+        ssize_t written = ::write(controlFd, &one, sizeof(one));
+        Q_UNUSED(written);
+    }
+#endif
+}
+
+
+// Sleeps on the acquisition thread for up to timeoutMs, returning early
+// (true) if stop() is called or the settings change.
+bool DAQReader::waitForControl(int timeoutMs)
+{
+    if (timeoutMs <= 0)
+        return false;
+
+#ifdef Q_OS_LINUX
+    struct pollfd fds;
+    fds.fd = controlFd;
+    fds.events = POLLIN;
+    fds.revents = 0;
+
+    if (controlFd >= 0 && poll(&fds, 1, timeoutMs) > 0) {
+        clearControl();
+        return true;
+    }
+
+    return false;
+#else
+    msleep(timeoutMs);
+    return false;
+#endif
+}
+
+
+void DAQReader::clearControl()
+{
+#ifdef Q_OS_LINUX
+    quint64 count;
+    ssize_t numRead = ::read(controlFd, &count, sizeof(count));
+    Q_UNUSED(numRead);
+#endif
+}
+
+
+qint64 DAQReader::scansAcquired()
+{
+    QMutexLocker lock(&mutex);
+    return numScansAcquired;
+}
+
+
+qint64 DAQReader::scansDropped()
+{
+    QMutexLocker lock(&mutex);
+    return numScansDropped;
+}
+
+
+double DAQReader::recordingTime()
+{
+    QMutexLocker lock(&mutex);
+    return (numScansAcquired + numScansDropped)*dt;
+}
+
+
+AcquisitionStats DAQReader::acquisitionStats()
+{
+    QMutexLocker lock(&mutex);
+
+    AcquisitionStats stats;
+    stats.scansAcquired = numScansAcquired;
+    stats.scansDropped = numScansDropped;
+    stats.numGaps = gaps.count();
+    stats.bufferUsed = bufferUsed;
+    stats.bufferHighWater = bufferHighWater;
+    stats.bufferSize = bufferSize;
+    stats.skewNs = startSkewNs;
+    stats.scansPadded = numScansPadded;
+    stats.filterNsPerScan = filterThread.isActive()
+        ? filterThread.nsPerScan() : 0.0;
+    stats.numTriggers = triggerGate.numTriggers();
+    stats.scansKept = triggerGate.isActive() ? triggerGate.scansKept() : 0;
+
+    return stats;
+}
+
+
+QList<ScanGap> DAQReader::scanGaps()
+{
+    QMutexLocker lock(&mutex);
+    return gaps;
+}
+
+
+// Writes the statistics and gaps of the last recording next to its data,
+// as key=value lines followed by one "gap" line per gap.
+bool DAQReader::writeStats(const QString& fileName)
+{
+    AcquisitionStats stats = acquisitionStats();
+    QList<ScanGap> recordedGaps = scanGaps();
+
+    FILE* file = fopen(QFile::encodeName(fileName), "w");
+
+    if (file == NULL) {
+        return false;
+    }
+
+    fprintf(file, "sampling_rate=%.6f\n", 1.0/dt);
+
+    // the board input each column of the data came from, as device:input
+    // if there's more than one board
+    QStringList inputNames;
+    for (int chan = 0; chan < inputs.count(); ++chan) {
+        if (daqSettings.numDevices() > 1)
+            inputNames << QString("%1:%2").arg(devices[chan]).arg(inputs[chan]);
+        else
+            inputNames << QString::number(inputs[chan]);
+    }
+    fprintf(file, "inputs=%s\n", qPrintable(inputNames.join(",")));
+    fprintf(file, "scans_acquired=%lld\n", stats.scansAcquired);
+    fprintf(file, "scans_dropped=%lld\n", stats.scansDropped);
+    fprintf(file, "device_buffer_scans=%lld\n", stats.bufferSize);
+    fprintf(file, "device_buffer_high_water=%lld\n", stats.bufferHighWater);
+    fprintf(file, "gaps=%d\n", stats.numGaps);
+
+    if (daqSettings.numDevices() > 1) {
+        fprintf(file, "start_skew_ns=%lld\n", stats.skewNs);
+        fprintf(file, "scans_padded=%lld\n", stats.scansPadded);
+    }
+
+    if (stats.filterNsPerScan > 0.0)
+        fprintf(file, "filter_ns_per_scan=%.1f\n", stats.filterNsPerScan);
+
+    if (daqSettings.triggeredRecording) {
+        fprintf(file, "triggers=%lld\n", stats.numTriggers);
+        fprintf(file, "scans_kept=%lld\n", stats.scansKept);
+    }
+
+    // gap,time of the first lost scan (s),scans lost,when it was noticed
+    foreach (const ScanGap& gap, recordedGaps) {
+        fprintf(file, "gap,%.6f,%lld,%s\n", gap.firstScan*dt, gap.numScans,
+                qPrintable(QDateTime::fromMSecsSinceEpoch(
+                        gap.realtimeNs/1000000).toUTC().toString(
+                        "yyyy-MM-ddThh:mm:ss.zzzZ")));
+    }
+
+    fclose(file);
+    return true;
+}
+
+
+void DAQReader::resetScanCounts()
+{
+    QMutexLocker lock(&mutex);
+    numScansAcquired = 0;
+    numScansDropped = 0;
+    bufferUsed = 0;
+    bufferHighWater = 0;
+    bufferSize = 0;
+    startSkewNs = 0;
+    numScansPadded = 0;
+    gaps.clear();
+}
+
+
+// A trigger at the next scan acquired, from any thread.
+bool DAQReader::trigger()
+{
+    QMutexLocker lock(&mutex);
+
+    if (!triggerGate.isActive())
+        return false;
+
+    triggerGate.trigger();
+    return true;
+}
+
+
+// Sinks may only be added or removed while the reader isn't running.
+void DAQReader::addSink(DAQSink* sink)
+{
+    QMutexLocker lock(&mutex);
+    sinks.append(sink);
+}
+
+
+void DAQReader::removeSink(DAQSink* sink)
+{
+    QMutexLocker lock(&mutex);
+    sinks.removeAll(sink);
+}
+
+
+// The filters start afresh with the sinks, since they're fed the same way.
+void DAQReader::startSinks()
+{
+    QMutexLocker lock(&mutex);
+
+    filterThread.open(daqSettings, dt);
+    pendingGaps.clear();
+    triggerGate.configure(daqSettings, dt);
+    storedScans = 0;
+
+    foreach (DAQSink* sink, sinks) {
+        sink->startedRecording(daqSettings, dt);
+    }
+}
+
+
+// Hands the scans from firstScan to the end of newDataBuffer to the sinks,
+// or when they're filtered, to the filter thread, and whatever it has
+// finished to the sinks; must be called with the mutex held.
+void DAQReader::deliverScans(int firstScan)
+{
+    int numScans = newDataBuffer[0].count() - firstScan;
+
+    if (numScans <= 0)
+        return;
+
+    for (int chan = 0; chan < numChannels; ++chan) {
+        blockScans[chan] = newDataBuffer[chan].constData() + firstScan;
+    }
+
+    qint64 first = numScansAcquired + numScansDropped - numScans;
+
+    if (filterThread.isActive()) {
+        filterThread.push(blockScans.constData(), numScans, first,
+                readMonotonicNs, readRealtimeNs);
+
+        // they come back from the filter thread
+        for (int chan = 0; chan < numChannels; ++chan) {
+            newDataBuffer[chan].resize(firstScan);
+        }
+
+        deliverFiltered();
+    }
+    else {
+        deliverBlock(firstScan, first, numScans, readMonotonicNs,
+                readRealtimeNs);
+    }
+}
+
+
+// Takes what the filter thread has finished into newDataBuffer, filtered
+// for recording, or unfiltered with the filtered copy in filteredBuffer
+// for display only, and hands it to the sinks, with any gaps that were
+// waiting on it; must be called with the mutex held.
+void DAQReader::deliverFiltered()
+{
+    filterThread.take(filterRaw, filterFiltered, filterChunks);
+
+    bool recording = daqSettings.filterMode == DAQSettings::filterRecording;
+    int offset = 0;
+
+    foreach (const FilterThread::Chunk& chunk, filterChunks) {
+        // where a flush ended, which is where a gap goes
+        if (chunk.padding) {
+            if (!pendingGaps.isEmpty())
+                reportGap(pendingGaps.takeFirst());
+            continue;
+        }
+
+        int firstScan = newDataBuffer[0].count();
+
+        for (int chan = 0; chan < numChannels; ++chan) {
+            const qreal* raw = filterRaw[chan].constData() + offset;
+            const qreal* filtered = filterFiltered[chan].constData() + offset;
+            const qreal* in = recording ? filtered : raw;
+            QVector<qreal>& buffer = newDataBuffer[chan];
+
+            buffer.resize(firstScan + chunk.numScans);
+            std::copy(in, in + chunk.numScans, buffer.data() + firstScan);
+
+            if (recording)
+                continue;
+
+            QVector<qreal>& display = filteredBuffer[chan];
+
+            // scans from before the filters started go in as they were
+            if (display.count() != firstScan)
+                display = buffer.mid(0, firstScan);
+
+            display.resize(firstScan + chunk.numScans);
+            std::copy(filtered, filtered + chunk.numScans,
+                    display.data() + firstScan);
+        }
+
+        deliverBlock(firstScan, chunk.firstScan, chunk.numScans,
+                chunk.monotonicNs, chunk.realtimeNs);
+        offset += chunk.numScans;
+    }
+}
+
+
+// Hands numScans of newDataBuffer from index on to the sinks, as scans
+// from firstScan on; must be called with the mutex held.
+void DAQReader::deliverBlock(int index, qint64 firstScan, int numScans,
+        qint64 monotonicNs, qint64 realtimeNs)
+{
+    for (int chan = 0; chan < numChannels; ++chan) {
+        blockScans[chan] = newDataBuffer[chan].constData() + index;
+    }
+
+    ScanBlock block;
+    block.scans = blockScans.constData();
+    block.numScans = numScans;
+    block.firstScan = firstScan;
+    block.monotonicNs = monotonicNs;
+    block.realtimeNs = realtimeNs;
+
+    // what's recorded, when that's only the scans around triggers
+    bool gated = triggerGate.isActive();
+    int numKept = triggerGate.count();
+
+    if (gated) {
+        triggerGate.process(block.scans, block.firstScan, numScans);
+    }
+
+    foreach (DAQSink* sink, sinks) {
+        if (!gated || !sink->storesRecording())
+            sink->newScans(block);
+    }
+
+    if (gated)
+        deliverKept(numKept, monotonicNs, realtimeNs);
+}
+
+
+// Hands the scans kept around triggers from index first on to the sinks
+// that store the recording, a run at a time; must be called with the
+// mutex held.
+void DAQReader::deliverKept(int first, qint64 monotonicNs, qint64 realtimeNs)
+{
+    const QVector<QVector<qreal> >& kept = triggerGate.scans();
+
+    foreach (const TriggerGate::Run& run, triggerGate.runs()) {
+        int start = qMax(first, run.index);
+        int end = run.index + run.numScans;
+
+        if (start >= end)
+            continue;
+
+        for (int chan = 0; chan < numChannels; ++chan) {
+            keptScans[chan] = kept[chan].constData() + start;
+        }
+
+        ScanBlock block;
+        block.scans = keptScans.constData();
+        block.numScans = end - start;
+        block.firstScan = run.firstScan + (start - run.index);
+        block.monotonicNs = monotonicNs;
+        block.realtimeNs = realtimeNs;
+
+        foreach (DAQSink* sink, sinks) {
+            if (sink->storesRecording())
+                sink->newScans(block);
+        }
+    }
+}
+
+
+// Records that numScans were lost before the next scan to be added to
+// newDataBuffer; must be called with the mutex held.  When the scans are
+// filtered, the ones still in the filters go before the gap, so it's
+// reported once they've come back from the filter thread, which doesn't
+// wait on it.
+void DAQReader::recordGap(qint64 numScans)
+{
+    if (numScans <= 0)
+        return;
+
+    const int maxGaps = 10000; // beyond this only the total is kept
+
+    ScanGap gap;
+    gap.firstScan = numScansAcquired + numScansDropped;
+    gap.numScans = numScans;
+    gap.realtimeNs = readRealtimeNs;
+
+    numScansDropped += numScans;
+
+    if (gaps.count() < maxGaps)
+        gaps.append(gap);
+
+    if (filterThread.isActive()) {
+        filterThread.flush();
+        pendingGaps.append(gap);
+        deliverFiltered();
+    }
+    else {
+        reportGap(gap);
+    }
+}
+
+
+// Marks the gap in newDataBuffer and tells the sinks; must be called with
+// the mutex held.
+void DAQReader::reportGap(const ScanGap& gap)
+{
+    bufferGaps.append(qMakePair(newDataBuffer[0].count(), gap.numScans));
+    triggerGate.skip();
+
+    foreach (DAQSink* sink, sinks) {
+        sink->scansLost(gap);
+    }
+}
+
+
+// Notes how many scans were waiting in the device's buffer when it was
+// read; must be called with the mutex held.
+void DAQReader::updateBufferFill(qint64 used, qint64 size)
+{
+    bufferUsed = used;
+    bufferSize = size;
+    bufferHighWater = qMax(bufferHighWater, used);
 }
 
 
-void DAQReader::updateDAQSettings(const DAQSettings& settings)
+// Called as soon as a read from the device returns, so that sinks can
+// timestamp the data without the conversion time mixed in.
+void DAQReader::markReadTime()
 {
-    numChannels = settings.numChannels;
-    dt = 1.0/settings.samplingRate;
+    struct timespec now;
 
-    for (int chan = 0; chan < numChannels; ++chan) {
-        Vmins[chan] = settings.minVoltage[chan];
-        Vmaxes[chan] = settings.maxVoltage[chan];
-    }
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    readMonotonicNs = qint64(now.tv_sec)*1000000000 + now.tv_nsec;
+    clock_gettime(CLOCK_REALTIME, &now);
+    readRealtimeNs = qint64(now.tv_sec)*1000000000 + now.tv_nsec;
 }
 
 
-int DAQReader::appendData(QMap<int, QVector<QPointF> >* curveMap)
+// Applies the realtime settings to the calling (acquisition) thread, and
+// reserves and touches a couple of seconds of buffer so that the first
+// reads don't page-fault or reallocate.  Anything that fails, usually for
+// lack of privileges, is reported with realtimeWarning and recording
+// carries on without it.
+void DAQReader::setUpRealtime()
 {
-    QMutexLocker lock(&mutex);
-    int numScans = newDataBuffer[0].count();
+    QStringList problems;
+
+#ifdef Q_OS_LINUX
+    if (daqSettings.lockMemory) {
+        if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+            problems << tr("could not lock memory: %1")
+                .arg(strerror(errno));
+        }
+    }
+    else {
+        munlockall();
+    }
 
-    double tStart = ((*curveMap)[0].isEmpty()
-            ? 0.0 : ((*curveMap)[0].last().x() + dt));
+    if (daqSettings.cpuAffinity >= 0) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(daqSettings.cpuAffinity, &cpus);
 
-    for (int chan = 0; chan < numChannels; ++chan) {
-        QVector<QPointF>& points = (*curveMap)[chan];
-        points.reserve(points.count() + newDataBuffer[chan].count());
-
-        for (int scan = 0; scan < newDataBuffer[chan].count(); ++scan) {
-            points.push_back(QPointF(
-                        qreal(tStart + scan*dt),
-                        newDataBuffer[chan][scan]
-                        ));
+        int error = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+        if (error != 0) {
+            problems << tr("could not run on CPU %1 only: %2")
+                .arg(daqSettings.cpuAffinity).arg(strerror(error));
+        }
+    }
+
+    if (daqSettings.realtimePriority > 0) {
+        struct sched_param param;
+        param.sched_priority = daqSettings.realtimePriority;
+
+        int error = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        if (error != 0) {
+            problems << tr("could not use SCHED_FIFO priority %1: %2")
+                .arg(daqSettings.realtimePriority).arg(strerror(error));
+        }
+    }
+#else
+    if (daqSettings.lockMemory || daqSettings.cpuAffinity >= 0
+            || daqSettings.realtimePriority > 0) {
+        problems << tr("realtime settings are only supported on Linux");
+    }
+#endif
+
+    if (daqSettings.lockMemory) {
+        const int bufferLength = 2; // seconds
+        QMutexLocker lock(&mutex);
+
+        for (int chan = 0; chan < numChannels; ++chan) {
+            QVector<qreal>& buffer = newDataBuffer[chan];
+            int numScans = buffer.count();
+
+            buffer.reserve(qMax(numScans, int(bufferLength/dt)));
+            buffer.resize(buffer.capacity());
+            buffer.resize(numScans);
         }
 
-        newDataBuffer[chan].clear();
+        // and the display's copies, if it has its own filtered data
+        if (daqSettings.hasFilters()
+                && daqSettings.filterMode == DAQSettings::filterDisplay) {
+            for (int chan = 0; chan < numChannels; ++chan) {
+                QVector<qreal>& buffer = filteredBuffer[chan];
+                int numScans = buffer.count();
+
+                buffer.reserve(qMax(numScans, int(bufferLength/dt)));
+                buffer.resize(buffer.capacity());
+                buffer.resize(numScans);
+            }
+        }
     }
 
-    return numScans;
+    if (!problems.isEmpty()) {
+        emit realtimeWarning(problems.join("\n"));
+    }
 }
 
 
-void DAQReader::stop()
+void DAQReader::stopSinks()
 {
-    shouldStop=true;
+    bool filtered = filterThread.isRunning();
+
+    // the last scans come out of the filters before the sinks hear it's
+    // over; the GUI needn't wait on the filter thread meanwhile
+    if (filtered)
+        filterThread.close();
+
+    QMutexLocker lock(&mutex);
+
+    if (filtered)
+        deliverFiltered();
+
+    foreach (DAQSink* sink, sinks) {
+        sink->stoppedRecording();
+    }
+
+    lock.unlock();
+
+    if (filtered)
+        emit newData();
 }
 
 #ifdef USE_NIDAQMXBASE
@@ -75,78 +812,121 @@ void DAQReader::run()
 {
     TaskHandle recordingTask = NULL;
 
-    char channelNames[256];
-    sprintf(channelNames, "Dev1/ai0:%d", numChannels-1);
+    setUpRealtime();
+
+    const int deviceBufferLength = 2; // seconds
+    const uInt32 deviceBufferScans = uInt32(deviceBufferLength/dt);
 
     if (
             DAQCheck( DAQmxBaseCreateTask("",&recordingTask) )
-            && DAQCheck( DAQmxBaseCreateAIVoltageChan(
-                    recordingTask, channelNames, NULL,
-                    DAQmx_Val_Diff, Vmins[0], Vmaxes[0], DAQmx_Val_Volts, NULL))
+            && createChannels(recordingTask)
             && DAQCheck( DAQmxBaseCfgSampClkTiming(
                     recordingTask, "OnboardClock", int(1/dt),
                     DAQmx_Val_Rising, DAQmx_Val_ContSamps, 0))
+            && DAQCheck( DAQmxBaseCfgInputBuffer(
+                    recordingTask, deviceBufferScans) )
             && DAQCheck(DAQmxBaseStartTask(recordingTask))
        ) {
 
-        const int updateInterval = 10; // ms
-        float64 buffer[maxChannels*maxScansPerSecond*updateInterval/1000];
-        const int scansPerRead = int(1/dt)*updateInterval/1000;
-        const float64 timeout = 0.1; // seconds
+        // Channel-grouped, so each channel's scans arrive contiguously and
+        // can be appended to newDataBuffer as a block.  Big enough for the
+        // whole device buffer, so a single read always empties it.
+        QVector<float64> buffer(numChannels*int(deviceBufferScans));
+
+        // for working out how much an overrun lost
+        qint64 taskStartNs;
+        qint64 taskFirstScan = 0;
 
+        resetScanCounts();
+        startSinks();
         emit startedRecording();
 
+        markReadTime();
+        taskStartNs = readMonotonicNs;
+
         while (!shouldStop) {
-            int32 numScansRead;
-
-            // HACK: because we need to run this on the GUI thread on the mac,
-            // it may take longer than our update interval to run the emit call
-            // and thus we may need to read more than one update's worth of
-            // data per emit to avoid having large amounts of data queue up.
-            // The only way to find out if there's queued data is to do a read
-            // with a timeout of zero and see if you get a timeout error, so
-            // that's what we do.
-
-            float64 nextTimeout = timeout;
-            bool emitNewData = false;
-            int daqReadError;
-
-            while (0 == (daqReadError = DAQmxBaseReadAnalogF64(
-                            recordingTask, scansPerRead, nextTimeout,
-                            DAQmx_Val_GroupByScanNumber, buffer,
-                            scansPerRead*numChannels, &numScansRead, NULL
-                            ))) {
+            int32 numScansRead = 0;
+
+            // Wait for a target latency's worth, but if more than that has
+            // queued up (we may be held up by the GUI thread on the mac)
+            // take all of it in the same call.  The timeout is short enough
+            // that a stop is noticed promptly.
+            uInt32 available = 0;
+            DAQmxBaseGetReadAttribute(recordingTask,
+                    DAQmx_Read_AvailSampPerChan, &available);
+
+            const int32 scansPerRead = qBound(1,
+                    qMax(int(available), int(targetLatency*1e-3/dt)),
+                    int(deviceBufferScans));
+            const float64 timeout = 2e-3*targetLatency; // seconds
+
+            int daqReadError = DAQmxBaseReadAnalogF64(
+                    recordingTask, scansPerRead, timeout,
+                    DAQmx_Val_GroupByChannel, buffer.data(),
+                    scansPerRead*numChannels, &numScansRead, NULL);
+
+            const int32 timeoutError = -200284;
+            const int32 overrunError = -200279;
+
+            // A timeout still hands over whatever it read, and those scans
+            // are as real as any others; one that read nothing is just an
+            // idle poll.
+            if (numScansRead > 0 && (daqReadError == 0
+                    || daqReadError == timeoutError)) {
+                markReadTime();
 
                 QMutexLocker lock(&mutex);
 
-                nextTimeout = 0;
-                emitNewData = true;
+                updateBufferFill(qMax(qint64(available), qint64(numScansRead)),
+                        deviceBufferScans);
+
+                int firstScan = newDataBuffer[0].count();
 
                 for (int chan = 0; chan < numChannels; ++chan) {
-                    newDataBuffer[chan].reserve(
-                            newDataBuffer[chan].count() + numScansRead
-                            );
-                }
+                    const float64* in = buffer.constData() + chan*scansPerRead;
 
-                for (int scan = 0; scan < numScansRead; ++scan) {
-                    for (int chan = 0; chan < numChannels; ++chan) {
-                        newDataBuffer[chan].push_back(
-                                buffer[scan*numChannels + chan]
-                                );
-                    }
+                    newDataBuffer[chan].resize(firstScan + numScansRead);
+                    std::copy(in, in + numScansRead,
+                            newDataBuffer[chan].data() + firstScan);
                 }
-            }
 
-            if (emitNewData)
+                numScansAcquired += numScansRead;
+                deliverScans(firstScan);
+                lock.unlock();
+
                 emit newData();
+            }
 
-            const int32 timeoutError = -200284;
-            if (daqReadError != timeoutError)
+            if (daqReadError == overrunError) {
+                // The buffer overflowed and the task stopped.  Start it
+                // again and carry on, with a gap for the scans the clock
+                // says we missed.
+                DAQmxBaseStopTask(recordingTask);
+
+                if (DAQCheck(DAQmxBaseStartTask(recordingTask))) {
+                    markReadTime();
+
+                    QMutexLocker lock(&mutex);
+                    qint64 scansDue = qint64(
+                            (readMonotonicNs - taskStartNs)*1e-9/dt);
+                    recordGap(scansDue
+                            - (numScansAcquired + numScansDropped
+                                - taskFirstScan));
+                    updateBufferFill(deviceBufferScans, deviceBufferScans);
+
+                    taskStartNs = readMonotonicNs;
+                    taskFirstScan = numScansAcquired + numScansDropped;
+                }
+            }
+            else if (daqReadError != timeoutError) {
                 DAQCheck(daqReadError);
+            }
         }
 
         shouldStop = false;
 
+        stopSinks();
+
         emit stoppedRecording();
     }
 
@@ -157,6 +937,24 @@ void DAQReader::run()
 }
 
 
+// One voltage channel per recorded input, each with its own range, in the
+// order they're recorded.
+bool DAQReader::createChannels(TaskHandle task)
+{
+    for (int chan = 0; chan < numChannels; ++chan) {
+        char channelName[32];
+        sprintf(channelName, "Dev%d/ai%d", devices[chan] + 1, inputs[chan]);
+
+        if (!DAQCheck( DAQmxBaseCreateAIVoltageChan(
+                        task, channelName, NULL, DAQmx_Val_Diff,
+                        Vmins[chan], Vmaxes[chan], DAQmx_Val_Volts, NULL) ))
+            return false;
+    }
+
+    return true;
+}
+
+
 bool DAQReader::DAQCheckHandler(const char* cmd, int error)
 {
     if( DAQmxFailed(error) ) {
@@ -188,39 +986,53 @@ bool DAQReader::DAQCheckHandler(const char* cmd, int error)
 
 void DAQReader::run()
 {
+    if (daqSettings.numDevices() > 1) {
+        runDevices();
+        return;
+    }
+
     comedi_t *dev;
     comedi_cmd c,*cmd=&c;
-    unsigned int chanlist[maxChannels];
+    QVector<unsigned int> chanlist(numChannels);
     int aref = AREF_DIFF;
     int subdevice = 0;
-    const int updateInterval = 100; // ms
 
     const int targetSamplingRate = 250000/numChannels;
-    int overSampling = std::max(1, int(targetSamplingRate*dt));
+    overSampling = std::max(1, int(targetSamplingRate*dt));
 
-    dev = comedi_open("/dev/comedi0");
+    setUpRealtime();
+
+    dev = comedi_open(qPrintable(QString("/dev/comedi%1").arg(devices[0])));
 
     if(!dev){
         DAQCheckHandler("comedi_open",-1);
     }
     else {
-        int range[maxChannels];
-        comedi_range* crange[maxChannels];
-        int maxdata[maxChannels];
-
-        /* Set up channel list */
-        for(int chan=0; chan<numChannels; ++chan){
-            range[chan] = comedi_find_range(dev, subdevice, chan,
-                    UNIT_volt, Vmins[chan], Vmaxes[chan]);
-            crange[chan] = comedi_get_range(dev, subdevice, chan, range[chan]);
-            maxdata[chan] = comedi_get_maxdata(dev, subdevice, chan);
-
-            chanlist[chan]=CR_PACK(chan,range[chan],aref);
+        QVector<int> range(numChannels);
+        bool channelsFound = true;
+
+        /* Set up channel list, with only the inputs we record */
+        for(int chan=0; chan<numChannels && channelsFound; ++chan){
+            int input = inputs[chan];
+
+            // the smallest of the input's ranges that covers the channel's
+            channelsFound = DAQCheck( range[chan] = comedi_find_range(
+                        dev, subdevice, input,
+                        UNIT_volt, Vmins[chan], Vmaxes[chan]) );
+            crange[chan] = comedi_get_range(dev, subdevice, input, range[chan]);
+            maxdata[chan] = comedi_get_maxdata(dev, subdevice, input);
+
+            if (channelsFound) {
+                setCalibration(chan, crange[chan]->min, crange[chan]->max,
+                        maxdata[chan]);
+            }
+
+            chanlist[chan]=CR_PACK(input,range[chan],aref);
         }
 
         memset(cmd,0,sizeof(*cmd));
 
-        if (DAQCheck(
+        if (channelsFound && DAQCheck(
                     comedi_get_cmd_generic_timed(dev,subdevice,cmd,
                         numChannels,
                         (unsigned int)(1e9*dt/overSampling)))
@@ -228,7 +1040,7 @@ void DAQReader::run()
 
 
             /* Modify parts of the command */
-            cmd->chanlist     = chanlist;
+            cmd->chanlist     = chanlist.data();
             cmd->chanlist_len = numChannels;
             cmd->convert_arg /= numChannels;
 
@@ -247,69 +1059,140 @@ void DAQReader::run()
                 // make sure we have an accurate sampling rate
                 dt = cmd->scan_begin_arg*1.0e-9*overSampling;
 
+                resetScanCounts();
+                startSinks();
                 emit startedRecording();
 
-                const int bufferSize =
-                    maxChannels*maxScansPerSecond/1000*updateInterval;
-                sampl_t buffer[bufferSize];
+                // enough for 100 ms at the highest rate, so one wake-up
+                // rarely needs more than one read
+                QVector<sampl_t> buffer(250000/10);
+                const int bufferBytes = buffer.count()*sizeof(sampl_t);
+                const int fd = comedi_fileno(dev);
                 int bytesRead;
-                int nextChan = 0;
                 bool stopping = false;
-                double overSampleSum[maxChannels];
-                int overSampleCount = 0;
-
-                for (int chan = 0; chan < numChannels; ++chan) {
-                    overSampleSum[chan] = 0.0;
-                }
+                bool finished = false;
+
+                // for working out how much an overrun lost
+                const int bytesPerScan =
+                    sizeof(sampl_t)*numChannels*overSampling;
+                const qint64 deviceBufferScans =
+                    comedi_get_buffer_size(dev, subdevice)/bytesPerScan;
+                qint64 commandStartNs;
+                qint64 commandFirstScan = 0;
+
+                markReadTime();
+                commandStartNs = readMonotonicNs;
+                resetOverSampling();
+
+                fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+                while (!finished) {
+                    // Sleep until the driver has data or we're told to stop.
+                    struct pollfd fds[2];
+                    fds[0].fd = fd;
+                    fds[0].events = POLLIN;
+                    fds[0].revents = 0;
+                    fds[1].fd = controlFd;
+                    fds[1].events = POLLIN;
+                    fds[1].revents = 0;
+
+                    const int idleTimeout = 1000; // ms
+                    if (!shouldStop && poll(fds, 2, idleTimeout) < 0
+                            && errno != EINTR) {
+                        DAQCheck(-1);
+                        break;
+                    }
 
-                while (DAQCheck(bytesRead =
-                            read(comedi_fileno(dev),buffer, bufferSize))
-                        && bytesRead > 0) {
+                    if (!shouldStop && (fds[1].revents & POLLIN))
+                        clearControl();
 
-                    if (shouldStop) {
+                    if (shouldStop && !stopping) {
                         shouldStop = false;
                         stopping = true;
                         comedi_cancel(dev, subdevice);
                     }
 
-                    {
-                        QMutexLocker lock(&mutex);
+                    // take everything that's there, however much that is
+                    bool readAny = false;
 
-                        DAQCheck((bytesRead & 1) ? -1 : 0); // no partial samples!
+                    forever {
+                        bytesRead = read(fd, buffer.data(), bufferBytes);
 
-                        int numScansRead = bytesRead/sizeof(sampl_t)/numChannels;
+                        if (bytesRead < 0 && errno == EAGAIN)
+                            break;
 
-                        for (int chan = 0; chan < numChannels; ++chan) {
-                            newDataBuffer[chan].reserve(
-                                    newDataBuffer[chan].count()
-                                    + numScansRead/overSampling + 1
-                                    );
-                        }
+                        if (bytesRead < 0 && errno == EPIPE && !stopping) {
+                            // The driver's buffer overflowed and the command
+                            // stopped.  Start it again and carry on, with a
+                            // gap for the scans the clock says we missed.
+                            comedi_cancel(dev, subdevice);
 
-                        for (unsigned i = 0; i < bytesRead/sizeof(sampl_t); ++i,
-                                nextChan = (nextChan+1)%numChannels) {
-                            overSampleSum[nextChan] += comedi_to_phys(
-                                    buffer[i], crange[nextChan], maxdata[nextChan]
-                                    );
-
-                            if (nextChan == numChannels-1) {
-                                ++overSampleCount;
-
-                                if (overSampleCount == overSampling) {
-                                    overSampleCount = 0;
-                                    for (int chan = 0; chan < numChannels; ++chan) {
-                                        newDataBuffer[chan].push_back(
-                                                overSampleSum[chan]/overSampling);
-                                        overSampleSum[chan] = 0.0;
-                                    }
-                                }
+                            if (!DAQCheck(comedi_command(dev, cmd))) {
+                                finished = true;
+                                break;
                             }
+
+                            markReadTime();
+
+                            QMutexLocker lock(&mutex);
+                            qint64 scansDue = qint64(
+                                    (readMonotonicNs - commandStartNs)*1e-9/dt);
+                            recordGap(scansDue
+                                    - (numScansAcquired + numScansDropped
+                                        - commandFirstScan));
+                            updateBufferFill(deviceBufferScans,
+                                    deviceBufferScans);
+
+                            commandStartNs = readMonotonicNs;
+                            commandFirstScan =
+                                numScansAcquired + numScansDropped;
+                            resetOverSampling();
+                            break;
+                        }
+
+                        if (!DAQCheck(bytesRead) || bytesRead == 0) {
+                            finished = true;
+                            break;
                         }
+
+                        markReadTime();
+
+                        DAQCheck((bytesRead & 1) ? -1 : 0); // no partial samples!
+
+                        {
+                            QMutexLocker lock(&mutex);
+                            updateBufferFill((bytesRead
+                                        + comedi_get_buffer_contents(
+                                            dev, subdevice))/bytesPerScan,
+                                    deviceBufferScans);
+                        }
+
+                        convertSamples(buffer.constData(),
+                                bytesRead/sizeof(sampl_t));
+                        readAny = true;
+
+                        if (bytesRead < bufferBytes)
+                            break;
                     }
 
-                    emit newData();
+                    if (readAny)
+                        emit newData();
+
+                    // Let a target latency's worth collect before reading
+                    // again, rather than waking for every few samples; a
+                    // stop still gets through straight away.
+                    if (readAny && !finished && !stopping) {
+                        struct timespec now;
+                        clock_gettime(CLOCK_MONOTONIC, &now);
+                        qint64 sinceReadMs = (qint64(now.tv_sec)*1000000000
+                                + now.tv_nsec - readMonotonicNs)/1000000;
+
+                        waitForControl(targetLatency - int(sinceReadMs));
+                    }
                 }
 
+                stopSinks();
+
                 emit stoppedRecording();
             }
         }
@@ -318,6 +1201,295 @@ void DAQReader::run()
     }
 }
 
+// Records from several boards at once, each on its own thread with its
+// own queue (see ComediDevice).  This thread is the merge stage: every
+// target latency it takes as many scans as every board has delivered,
+// scan i from each board together, and hands them on as one set of
+// channels in the order they're configured.  The boards are started
+// back to back, and how far apart their first scans were taken is
+// reported as skew; their clocks aren't locked together, so they drift
+// apart from there.
+void DAQReader::runDevices()
+{
+    // the boards in the order their first channels appear, and which of
+    // our channels each board's channels are
+    QList<int> deviceNumbers;
+    QList<QVector<int> > deviceChannels;
+
+    for (int chan = 0; chan < numChannels; ++chan) {
+        int index = deviceNumbers.indexOf(devices[chan]);
+
+        if (index < 0) {
+            index = deviceNumbers.count();
+            deviceNumbers.append(devices[chan]);
+            deviceChannels.append(QVector<int>());
+        }
+
+        deviceChannels[index].append(chan);
+    }
+
+    setUpRealtime();
+
+    const int queueLength = 2; // seconds
+    QList<ComediDevice*> boards;
+    bool started = true;
+
+    // This thread has the CPU setUpRealtime() gave it, and each board the
+    // next one along, so that their SCHED_FIFO threads never queue behind
+    // each other; boards past the last CPU aren't pinned.
+    const int numCpus = int(sysconf(_SC_NPROCESSORS_ONLN));
+    int firstUnpinned = -1;
+
+    for (int d = 0; d < deviceNumbers.count(); ++d) {
+        QVector<ComediDevice::Channel> channels;
+
+        foreach (int chan, deviceChannels[d]) {
+            ComediDevice::Channel channel;
+            channel.input = inputs[chan];
+            channel.minVoltage = Vmins[chan];
+            channel.maxVoltage = Vmaxes[chan];
+            channels.append(channel);
+        }
+
+        ComediDevice* board = new ComediDevice(deviceNumbers[d], channels,
+                dt, int(queueLength/dt), targetLatency);
+        int cpu = -1;
+
+        if (daqSettings.cpuAffinity >= 0) {
+            cpu = daqSettings.cpuAffinity + 1 + d;
+
+            if (cpu >= numCpus) {
+                cpu = -1;
+                if (firstUnpinned < 0)
+                    firstUnpinned = deviceNumbers[d];
+            }
+        }
+
+        board->setRealtime(daqSettings.realtimePriority, cpu);
+        board->start();
+        boards.append(board);
+    }
+
+    QStringList problems;
+
+    if (firstUnpinned >= 0) {
+        problems << tr("only %1 CPUs, so /dev/comedi%2 and the boards after "
+                "it aren't pinned to one").arg(numCpus).arg(firstUnpinned);
+    }
+
+    foreach (ComediDevice* board, boards) {
+        if (!board->waitUntilStarted()) {
+            if (started)
+                emit daqError(board->errorMessage());
+            started = false;
+        }
+
+        problems << board->realtimeProblems();
+    }
+
+    if (!problems.isEmpty()) {
+        emit realtimeWarning(problems.join("\n"));
+    }
+
+    // Every board's command is loaded and held; start them back to back,
+    // so that their first scans are as close together as they can be.
+    qint64 skewNs = 0;
+
+    if (started) {
+        foreach (ComediDevice* board, boards) {
+            board->trigger();
+        }
+
+        qint64 firstNs = boards.first()->startNs();
+        qint64 lastNs = firstNs;
+
+        foreach (ComediDevice* board, boards) {
+            firstNs = qMin(firstNs, board->startNs());
+            lastNs = qMax(lastNs, board->startNs());
+
+            if (started && board->failed()) {
+                emit daqError(board->errorMessage());
+                started = false;
+            }
+        }
+
+        skewNs = lastNs - firstNs;
+    }
+
+    if (started) {
+        // the first board's interval; they should all agree to the ns
+        dt = boards.first()->scanInterval();
+
+        for (int d = 0; d < boards.count(); ++d) {
+            for (int k = 0; k < deviceChannels[d].count(); ++k) {
+                const comedi_range* range = boards[d]->range(k);
+                setCalibration(deviceChannels[d][k], range->min, range->max,
+                        boards[d]->maxValue(k));
+            }
+        }
+
+        // where each board's scans go, reused for every merge
+        QList<QVector<qreal*> > outputs;
+        for (int d = 0; d < boards.count(); ++d) {
+            outputs.append(QVector<qreal*>(deviceChannels[d].count()));
+        }
+
+        resetScanCounts();
+        startSinks();
+
+        {
+            QMutexLocker lock(&mutex);
+            startSkewNs = skewNs;
+        }
+
+        emit startedRecording();
+
+        while (!shouldStop) {
+            waitForControl(targetLatency);
+
+            if (shouldStop)
+                break;
+
+            bool failed = false;
+            foreach (ComediDevice* board, boards) {
+                if (board->failed()) {
+                    emit daqError(board->errorMessage());
+                    failed = true;
+                    break;
+                }
+            }
+
+            if (failed)
+                break;
+
+            markReadTime();
+
+            int numScans = boards.first()->queue.available();
+            int mostScans = numScans;
+            qint64 padded = 0;
+
+            foreach (ComediDevice* board, boards) {
+                int available = board->queue.available();
+                numScans = qMin(numScans, available);
+                mostScans = qMax(mostScans, available);
+                padded += board->scansPadded();
+            }
+
+            QMutexLocker lock(&mutex);
+
+            numScansPadded = padded;
+            updateBufferFill(mostScans, int(queueLength/dt));
+
+            if (numScans == 0)
+                continue;
+
+            int firstScan = newDataBuffer[0].count();
+
+            for (int chan = 0; chan < numChannels; ++chan) {
+                newDataBuffer[chan].resize(firstScan + numScans);
+            }
+
+            for (int d = 0; d < boards.count(); ++d) {
+                ScanQueue& queue = boards[d]->queue;
+                const QVector<int>& chans = deviceChannels[d];
+                const int numChans = chans.count();
+                qreal** out = outputs[d].data();
+
+                for (int k = 0; k < numChans; ++k) {
+                    out[k] = newDataBuffer[chans[k]].data() + firstScan;
+                }
+
+                for (int done = 0; done < numScans; ) {
+                    int runLength;
+                    const qreal* in = queue.peek(numScans - done, &runLength);
+
+                    for (int scan = 0; scan < runLength; ++scan) {
+                        for (int k = 0; k < numChans; ++k) {
+                            *out[k]++ = *in++;
+                        }
+                    }
+
+                    queue.release(runLength);
+                    done += runLength;
+                }
+            }
+
+            numScansAcquired += numScans;
+            deliverScans(firstScan);
+            lock.unlock();
+
+            emit newData();
+        }
+
+        shouldStop = false;
+
+        stopSinks();
+
+        emit stoppedRecording();
+    }
+
+    foreach (ComediDevice* board, boards) {
+        board->stop();
+    }
+    qDeleteAll(boards);
+}
+
+void DAQReader::resetOverSampling()
+{
+    nextChan = 0;
+    overSampleCount = 0;
+
+    for (int chan = 0; chan < numChannels; ++chan) {
+        overSampleSum[chan] = 0.0;
+    }
+}
+
+
+// Converts interleaved samples, which may start and end part way through
+// a scan, averaging each overSampling scans into one.  Each scan's values
+// are written straight into place, so the cost is the same per sample
+// however many channels there are.
+void DAQReader::convertSamples(const sampl_t* buffer, int numSamples)
+{
+    QMutexLocker lock(&mutex);
+
+    int firstScan = newDataBuffer[0].count();
+    int samplesPerScan = numChannels*overSampling;
+    int numScansRead = (overSampleCount*numChannels + nextChan + numSamples)
+        / samplesPerScan;
+
+    for (int chan = 0; chan < numChannels; ++chan) {
+        newDataBuffer[chan].resize(firstScan + numScansRead);
+        convertOut[chan] = newDataBuffer[chan].data() + firstScan;
+    }
+
+    double* sums = overSampleSum.data();
+    qreal* const* out = convertOut.constData();
+    int scan = 0;
+
+    for (int i = 0; i < numSamples; ++i) {
+        sums[nextChan] += comedi_to_phys(
+                buffer[i], crange[nextChan], maxdata[nextChan]
+                );
+
+        if (++nextChan == numChannels) {
+            nextChan = 0;
+
+            if (++overSampleCount == overSampling) {
+                overSampleCount = 0;
+                for (int chan = 0; chan < numChannels; ++chan) {
+                    out[chan][scan] = sums[chan]/overSampling;
+                    sums[chan] = 0.0;
+                }
+                ++scan;
+            }
+        }
+    }
+
+    numScansAcquired += numScansRead;
+    deliverScans(firstScan);
+}
+
 bool DAQReader::DAQCheckHandler(const char* cmd, int error)
 {
     if( error < 0 ) {
@@ -341,3 +1513,100 @@ bool DAQReader::DAQCheckHandler(const char* cmd, int error)
 }
 
 #endif
+
+#ifdef USE_SIMULATED_DAQ
+
+// Generates test signals in place of a DAQ board, paced by the system clock,
+// so the rest of the program can be exercised on machines without
+// hardware.  Like a real board, it only buffers a limited amount of data;
+// if this thread falls further behind than that, the excess is dropped.
+void DAQReader::run()
+{
+    const int deviceBufferLength = 1000; // ms
+    const double twoPi = 6.28318530717958647692;
+
+    const qint64 maxScansPerRead = qint64(deviceBufferLength*1e-3/dt);
+    qint64 scansDue = 0;
+    QElapsedTimer clock;
+
+    setUpRealtime();
+    resetScanCounts();
+    startSinks();
+    emit startedRecording();
+    clock.start();
+
+    while (!shouldStop) {
+        waitForControl(targetLatency);
+
+        if (shouldStop)
+            break;
+
+        markReadTime();
+
+        qint64 now = qint64(clock.nsecsElapsed()*1e-9/dt);
+        qint64 numScans = now - scansDue;
+        scansDue = now;
+
+        {
+            QMutexLocker lock(&mutex);
+
+            updateBufferFill(qMin(numScans, maxScansPerRead), maxScansPerRead);
+
+            if (numScans > maxScansPerRead) {
+                recordGap(numScans - maxScansPerRead);
+                numScans = maxScansPerRead;
+            }
+
+            int firstNewScan = newDataBuffer[0].count();
+            qint64 firstScan = scansDue - numScans;
+
+            for (int chan = 0; chan < numChannels; ++chan) {
+                double amplitude = 0.5*Vmaxes[chan];
+
+                newDataBuffer[chan].reserve(
+                        newDataBuffer[chan].count() + numScans);
+
+                for (qint64 scan = firstScan; scan < scansDue; ++scan) {
+                    double t = scan*dt;
+                    newDataBuffer[chan].push_back(
+                            amplitude*sin(twoPi*(inputs[chan] + 1)*t)
+                            + 0.01*amplitude*(qrand() % 201 - 100)/100.0
+                            );
+                }
+            }
+
+            numScansAcquired += numScans;
+            deliverScans(firstNewScan);
+        }
+
+        emit newData();
+    }
+
+    shouldStop = false;
+
+    stopSinks();
+
+    emit stoppedRecording();
+}
+
+
+bool DAQReader::DAQCheckHandler(const char* cmd, int error)
+{
+    if( error < 0 ) {
+
+        shouldStop = true;
+
+        emit daqError(
+                QString::number(error)
+                + tr("\nWhile processing command:\n\"") + QString(cmd)
+                );
+
+        return false;
+    }
+    else
+    {
+        return true;
+    }
+}
+
+#endif
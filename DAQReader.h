@@ -6,7 +6,45 @@
 #include <QMap>
 #include <QVector>
 #include <QPointF>
+#include <QList>
+#include <QPair>
 #include "DAQSettingsDialog/DAQSettingsDialog.h"
+#include "DAQSink.h"
+#include "FilterThread.h"
+#include "SampleStore.h"
+#include "TriggerGate.h"
+
+#if defined(USE_COMEDI)
+#include <comedilib.h>
+#elif defined(USE_NIDAQMXBASE)
+#include <NIDAQmxBase.h>
+#endif
+
+// Health of the current (or last) recording.  The device buffer figures
+// are in scans; bufferSize is 0 if the backend can't tell.
+struct AcquisitionStats
+{
+    qint64 scansAcquired;
+    qint64 scansDropped;
+    int numGaps;
+    qint64 bufferUsed;
+    qint64 bufferHighWater;
+    qint64 bufferSize;
+
+    // recordings spread over several boards: how far apart the boards'
+    // first scans were taken, in ns, and scans one board lost while the
+    // others didn't, which are recorded as NaN
+    qint64 skewNs;
+    qint64 scansPadded;
+
+    // what the filters cost, 0 if nothing is filtered
+    double filterNsPerScan;
+
+    // recordings only around triggers: the triggers so far, and the scans
+    // kept around them
+    qint64 numTriggers;
+    qint64 scansKept;
+};
 
 class DAQReader : public QThread
 {
@@ -14,14 +52,29 @@ class DAQReader : public QThread
 
     public:
         DAQReader();
-        int appendData(QMap<int, QVector<QPointF> >* curveMap);
+        ~DAQReader();
+        int appendData(SampleStore* store, SampleStore* filtered = NULL);
+        int discardData();
         void stop();
+        qint64 scansAcquired();
+        qint64 scansDropped();
+        // seconds from the first scan to the next, on the same timebase
+        // as the recorded times (lost scans included, the device's dt)
+        double recordingTime();
+        AcquisitionStats acquisitionStats();
+        QList<ScanGap> scanGaps();
+        bool writeStats(const QString& fileName);
+        void addSink(DAQSink* sink);
+        void removeSink(DAQSink* sink);
+        // for recordings only around triggers; false if this isn't one
+        bool trigger();
 
     signals:
         void newData();
         void daqError(const QString& errorMessage);
         void startedRecording();
         void stoppedRecording();
+        void realtimeWarning(const QString& message);
 
     public:
         void run();
@@ -29,17 +82,90 @@ class DAQReader : public QThread
 
     protected:
         bool DAQCheckHandler(const char* cmd, int error);
-
-        enum { maxChannels = 8, maxScansPerSecond = 35000 };
+        void setUpRealtime();
+        void wake();
+        bool waitForControl(int timeoutMs);
+        void clearControl();
+        void resetScanCounts();
+        void startSinks();
+        void markReadTime();
+        void deliverScans(int firstScan);
+        void deliverFiltered();
+        void deliverBlock(int index, qint64 firstScan, int numScans,
+                qint64 monotonicNs, qint64 realtimeNs);
+        void deliverKept(int first, qint64 monotonicNs, qint64 realtimeNs);
+        void recordGap(qint64 numScans);
+        void reportGap(const ScanGap& gap);
+        void updateBufferFill(qint64 used, qint64 size);
+        void dropBufferGaps(int numScans);
+        void appendBuffer(const QVector<QVector<qreal> >& buffer,
+                SampleStore* store);
+        void appendKept(SampleStore* store);
+        void setCalibration(int chan, double min, double max,
+                unsigned long maxData);
+        void stopSinks();
 
         volatile bool shouldStop;
+        volatile int targetLatency; // ms
+        int controlFd;              // eventfd that wakes the loop
 
+        DAQSettings daqSettings;
         int numChannels;
         double dt;
-        double Vmins[maxChannels], Vmaxes[maxChannels];
+        QVector<int> devices;
+        QVector<int> inputs;
+        QVector<double> Vmins, Vmaxes;
+        // how codes map to volts, for SampleStore's rawStorage
+        QVector<SampleStore::Calibration> calibration;
+
+        qint64 numScansAcquired;
+        qint64 numScansDropped;
+        qint64 bufferUsed;
+        qint64 bufferHighWater;
+        qint64 bufferSize;
+        qint64 startSkewNs;
+        qint64 numScansPadded;
+        QList<ScanGap> gaps;
+        qint64 readMonotonicNs;
+        qint64 readRealtimeNs;
 
-        QVector<qreal> newDataBuffer[maxChannels];
+        // one vector per channel, so appending a scan touches each once
+        QVector<QVector<qreal> > newDataBuffer;
+        QVector<const qreal*> blockScans;   // for deliverScans()
+        // filtered copies of newDataBuffer, when only the display is
+        // filtered, and what the filter thread hands back
+        FilterThread filterThread;
+        QVector<QVector<qreal> > filteredBuffer;
+        QVector<QVector<qreal> > filterRaw, filterFiltered;
+        QVector<FilterThread::Chunk> filterChunks;
+        QList<ScanGap> pendingGaps;     // waiting for the filter thread
+        // the scans around triggers, when only those are recorded, and
+        // the scan after the last of them appended to a store
+        TriggerGate triggerGate;
+        QVector<const qreal*> keptScans;
+        qint64 storedScans;
+        // (index in newDataBuffer, scans lost just before it)
+        QList<QPair<int, qint64> > bufferGaps;
         QMutex mutex;
+        QList<DAQSink*> sinks;
+
+#ifdef USE_NIDAQMXBASE
+        bool createChannels(TaskHandle task);
+#endif
+
+#ifdef USE_COMEDI
+        void runDevices();
+        void resetOverSampling();
+        void convertSamples(const sampl_t* buffer, int numSamples);
+
+        int overSampling;
+        QVector<comedi_range*> crange;
+        QVector<lsampl_t> maxdata;
+        QVector<double> overSampleSum;
+        QVector<qreal*> convertOut;         // for convertSamples()
+        int overSampleCount;
+        int nextChan;
+#endif
 };
 
 #endif
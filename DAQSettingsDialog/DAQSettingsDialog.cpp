@@ -1,8 +1,32 @@
 #include <QtGui>
 #include "DAQSettingsDialog.h"
 
-DAQSettings::DAQSettings()
+DAQSettings::DAQSettings() :
+   samplingRate(100),
+   numChannels(0),
+   spikeAdaptive(false),
+   spikeRefractory(1.0),
+   triggerChannel(-1),
+   triggerLevel(1.0),
+   triggerPre(10.0),
+   triggerPost(50.0),
+   averageEvents(averageNone),
+   averageSpikeChannel(0),
+   triggeredRecording(false),
+   legacyTimestamp(true),
+   rawStorage(false),
+   retention(0),
+   filterMode(filterDisplay),
+   streamEnabled(false),
+   streamTcpPort(0),
+   streamPolicy(0),
+   streamBufferLength(2000),
+   realtimePriority(0),
+   cpuAffinity(-1),
+   lockMemory(false),
+   targetLatency(20)
 {
+   setNumChannels(2);
 }
 
 
@@ -14,15 +38,42 @@ void DAQSettings::save()
    settings.setValue("samplingRate", samplingRate);
    settings.setValue("bgColor", bgColor);
    settings.setValue("fgColor", fgColor);
-
-   for (int i = 0; i < maxChannels; ++i) {
-      settings.setValue(QString("maxVoltage") + QString::number(i+1), 
-            maxVoltage[i]);
-      settings.setValue(QString("minVoltage") + QString::number(i+1), 
-            minVoltage[i]);
-      settings.setValue(QString("color") + QString::number(i+1), 
-            color[i]);
+   settings.setValue("spikeAdaptive", spikeAdaptive);
+   settings.setValue("spikeRefractory", spikeRefractory);
+   settings.setValue("triggerChannel", triggerChannel);
+   settings.setValue("triggerLevel", triggerLevel);
+   settings.setValue("triggerPre", triggerPre);
+   settings.setValue("triggerPost", triggerPost);
+   settings.setValue("averageEvents", averageEvents);
+   settings.setValue("averageSpikeChannel", averageSpikeChannel);
+   settings.setValue("triggeredRecording", triggeredRecording);
+   settings.setValue("legacyTimestamp", legacyTimestamp);
+   settings.setValue("rawStorage", rawStorage);
+   settings.setValue("retention", retention);
+   settings.setValue("filterMode", filterMode);
+   settings.setValue("streamEnabled", streamEnabled);
+   settings.setValue("streamTcpPort", streamTcpPort);
+   settings.setValue("streamPolicy", streamPolicy);
+   settings.setValue("streamBufferLength", streamBufferLength);
+   settings.setValue("realtimePriority", realtimePriority);
+   settings.setValue("cpuAffinity", cpuAffinity);
+   settings.setValue("lockMemory", lockMemory);
+   settings.setValue("targetLatency", targetLatency);
+
+   settings.beginWriteArray("channels", maxVoltage.count());
+   for (int i = 0; i < maxVoltage.count(); ++i) {
+      settings.setArrayIndex(i);
+      settings.setValue("device", device[i]);
+      settings.setValue("input", input[i]);
+      settings.setValue("maxVoltage", maxVoltage[i]);
+      settings.setValue("minVoltage", minVoltage[i]);
+      settings.setValue("color", color[i]);
+      settings.setValue("highpass", highpass[i]);
+      settings.setValue("lowpass", lowpass[i]);
+      settings.setValue("notch", notch[i]);
+      settings.setValue("spikeThreshold", spikeThreshold[i]);
    }
+   settings.endArray();
 }
 
 void DAQSettings::restore() 
@@ -33,21 +84,165 @@ void DAQSettings::restore()
    samplingRate = settings.value("samplingRate", 100).toInt();
    bgColor = settings.value("bgColor", Qt::black).value<QColor>();
    fgColor = settings.value("fgColor", Qt::white).value<QColor>();
+   spikeAdaptive = settings.value("spikeAdaptive", false).toBool();
+   spikeRefractory = settings.value("spikeRefractory", 1.0).toDouble();
+   triggerChannel = settings.value("triggerChannel", -1).toInt();
+   triggerLevel = settings.value("triggerLevel", 1.0).toDouble();
+   triggerPre = settings.value("triggerPre", 10.0).toDouble();
+   triggerPost = settings.value("triggerPost", 50.0).toDouble();
+   averageEvents = settings.value("averageEvents", int(averageNone)).toInt();
+   averageSpikeChannel = settings.value("averageSpikeChannel", 0).toInt();
+   triggeredRecording = settings.value("triggeredRecording", false).toBool();
+   legacyTimestamp = settings.value("legacyTimestamp", true).toBool();
+   rawStorage = settings.value("rawStorage", false).toBool();
+   retention = settings.value("retention", 0).toInt();
+   filterMode = settings.value("filterMode", int(filterDisplay)).toInt();
+   streamEnabled = settings.value("streamEnabled", false).toBool();
+   streamTcpPort = settings.value("streamTcpPort", 0).toInt();
+   streamPolicy = settings.value("streamPolicy", 0).toInt();
+   streamBufferLength = settings.value("streamBufferLength", 2000).toInt();
+   realtimePriority = settings.value("realtimePriority", 0).toInt();
+   cpuAffinity = settings.value("cpuAffinity", -1).toInt();
+   lockMemory = settings.value("lockMemory", false).toBool();
+   targetLatency = settings.value("targetLatency", 20).toInt();
+
+   // older versions kept 8 channels in maxVoltage1..maxVoltage8 etc.
+   int numSaved = settings.beginReadArray("channels");
+   bool legacy = (numSaved == 0);
+
+   if (legacy) {
+      settings.endArray();
+      numSaved = 8;
+   }
+
+   device.resize(0);
+   input.resize(0);
+   maxVoltage.resize(0);
+   minVoltage.resize(0);
+   color.resize(0);
+   highpass.resize(0);
+   lowpass.resize(0);
+   notch.resize(0);
+   spikeThreshold.resize(0);
+
+   for (int i = 0; i < numSaved; ++i) {
+      QString suffix;
+
+      if (legacy)
+         suffix = QString::number(i+1);
+      else
+         settings.setArrayIndex(i);
+
+      device.append(legacy ? 0 : settings.value("device", 0).toInt());
+      input.append(legacy ? i : settings.value("input", i).toInt());
+      maxVoltage.append(settings.value("maxVoltage" + suffix, 10.0).toDouble());
+      minVoltage.append(settings.value("minVoltage" + suffix, -10.0).toDouble());
+      color.append(settings.value("color" + suffix,
+               defaultColor(i)).value<QColor>());
+      highpass.append(legacy ? 0.0
+            : settings.value("highpass", 0.0).toDouble());
+      lowpass.append(legacy ? 0.0
+            : settings.value("lowpass", 0.0).toDouble());
+      notch.append(legacy ? 0.0 : settings.value("notch", 0.0).toDouble());
+      spikeThreshold.append(legacy ? 0.0
+            : settings.value("spikeThreshold", 0.0).toDouble());
+   }
+
+   if (!legacy)
+      settings.endArray();
+
+   setNumChannels(numChannels);
+}
+
+// Sets the number of channels, giving any that haven't been used before
+// the default range and colour.  Each channel gets an input of its own; new
+// ones go on the same device as the channel before.
+void DAQSettings::setNumChannels(int numChannels_)
+{
+   numChannels = qBound(1, numChannels_, int(maxChannels));
+
+   for (int i = 0; i < numChannels; ++i) {
+      if (i < input.count() && findChannel(device[i], input[i], i) < 0)
+         continue;
+
+      int dev = (i < device.count()) ? device[i] : (i > 0 ? device[i-1] : 0);
+      int next = 0;
+      while (findChannel(dev, next, i) >= 0)
+         ++next;
+
+      if (i < input.count()) {
+         input[i] = next;
+         continue;
+      }
+
+      device.append(dev);
+      input.append(next);
+      maxVoltage.append(10.0);
+      minVoltage.append(-10.0);
+      color.append(defaultColor(i));
+      highpass.append(0.0);
+      lowpass.append(0.0);
+      notch.append(0.0);
+      spikeThreshold.append(0.0);
+   }
+}
+
+// The first of the first numChannels channels recording the given input,
+// or -1 if none do.
+int DAQSettings::findChannel(int device_, int input_, int numChannels_) const
+{
+   for (int i = 0; i < numChannels_ && i < input.count(); ++i) {
+      if (device[i] == device_ && input[i] == input_)
+         return i;
+   }
+
+   return -1;
+}
+
+int DAQSettings::numDevices() const
+{
+   QList<int> devices;
+
+   for (int i = 0; i < numChannels; ++i) {
+      if (!devices.contains(device[i]))
+         devices.append(device[i]);
+   }
+
+   return devices.count();
+}
+
+bool DAQSettings::hasFilters() const
+{
+   for (int i = 0; i < numChannels; ++i) {
+      if (highpass[i] > 0.0 || lowpass[i] > 0.0 || notch[i] > 0.0)
+         return true;
+   }
+
+   return false;
+}
 
+QString DAQSettings::channelName(int chan)
+{
+   if (chan == 0)
+      return QObject::tr("Length In");
+   else if (chan == 1)
+      return QObject::tr("Force In");
+   else
+      return QObject::tr("Aux %1").arg(chan - 1);
+}
+
+QColor DAQSettings::defaultColor(int chan)
+{
    static const QColor defaultColors[8] = {
        Qt::yellow,   Qt::green,  Qt::white,     Qt::red, 
        Qt::blue,     Qt::cyan,   Qt::magenta,   Qt::darkGreen
     };
 
-   for (int i = 0; i < maxChannels; ++i) {
-      maxVoltage[i] = settings.value(
-            QString("maxVoltage") + QString::number(i+1), 10.0).toDouble();
-      minVoltage[i] = settings.value(
-            QString("minVoltage") + QString::number(i+1), -10.0).toDouble();
-      color[i] = settings.value(
-            QString("color") + QString::number(i+1), 
-            defaultColors[i]).value<QColor>();
-   }
+   if (chan < 8)
+      return defaultColors[chan];
+
+   // spread the rest around the colour wheel
+   return QColor::fromHsv((chan*137) % 360, 200, 255);
 }
 
 DAQSettingsDialog::DAQSettingsDialog(const DAQSettings& settings_, 
@@ -57,78 +252,101 @@ DAQSettingsDialog::DAQSettingsDialog(const DAQSettings& settings_,
    setupUi(this);
    settings = settings_;
 
+   // one row per channel, grown and shrunk with the number of channels
+   channelModel = new QStandardItemModel(0, 8, this);
+   channelModel->setHorizontalHeaderLabels(QStringList() << tr("Device")
+         << tr("Input") << tr("Max Voltage") << tr("Highpass (Hz)")
+         << tr("Lowpass (Hz)") << tr("Notch (Hz)") << tr("Spike Threshold")
+         << tr("Colour"));
+   channelTable->setModel(channelModel);
+   channelTable->horizontalHeader()->setStretchLastSection(true);
+   channelTable->verticalHeader()->setDefaultSectionSize(
+         channelTable->fontMetrics().height() + 6);
+
+   numChannels->setMaximum(DAQSettings::maxChannels);
    numChannels->setValue(settings.numChannels);
    samplingRate->setText(QString::number(settings.samplingRate));
-   maxV1->setText(QString::number(settings.maxVoltage[0],'f',2));
-   maxV2->setText(QString::number(settings.maxVoltage[1],'f',2));
-   maxV3->setText(QString::number(settings.maxVoltage[2],'f',2));
-   maxV4->setText(QString::number(settings.maxVoltage[3],'f',2));
-   maxV5->setText(QString::number(settings.maxVoltage[4],'f',2));
-   maxV6->setText(QString::number(settings.maxVoltage[5],'f',2));
-   maxV7->setText(QString::number(settings.maxVoltage[6],'f',2));
-   maxV8->setText(QString::number(settings.maxVoltage[7],'f',2));
 
    numChannelsChanged(settings.numChannels);
+   legacyTimestamp->setChecked(settings.legacyTimestamp);
+   rawStorage->setChecked(settings.rawStorage);
+   retention->setValue(settings.retention);
+   streamGroup->setChecked(settings.streamEnabled);
+   streamTcpPort->setValue(settings.streamTcpPort);
+   streamPolicy->setCurrentIndex(settings.streamPolicy);
+   streamBufferLength->setValue(settings.streamBufferLength);
+   realtimePriority->setValue(settings.realtimePriority);
+   cpuAffinity->setValue(settings.cpuAffinity);
+   lockMemory->setChecked(settings.lockMemory);
+   targetLatency->setValue(settings.targetLatency);
+   spikeAdaptive->setChecked(settings.spikeAdaptive);
+   spikeRefractory->setValue(settings.spikeRefractory);
+   filterMode->setCurrentIndex(settings.filterMode);
+   triggerLevel->setValue(settings.triggerLevel);
+   triggerPre->setValue(settings.triggerPre);
+   triggerPost->setValue(settings.triggerPost);
+   triggeredRecording->setChecked(settings.triggeredRecording);
 
    samplingRate->setValidator(
          new QRegExpValidator(QRegExp(
                "(500000|[1-4][0-9]{5}|[1-9][0-9]{,4})"), this));
-   QRegExp voltageRegExp(
-         "(([1-9][0-9]?\\.?[0-9]*)|([0-9]{,2}\\.[0-9]?[1-9][0-9]*))"
-         );
-   maxV1->setValidator(new QRegExpValidator(voltageRegExp, this));
-   maxV2->setValidator(new QRegExpValidator(voltageRegExp, this));
-   maxV3->setValidator(new QRegExpValidator(voltageRegExp, this));
-   maxV4->setValidator(new QRegExpValidator(voltageRegExp, this));
-   maxV5->setValidator(new QRegExpValidator(voltageRegExp, this));
-   maxV6->setValidator(new QRegExpValidator(voltageRegExp, this));
-   maxV7->setValidator(new QRegExpValidator(voltageRegExp, this));
-   maxV8->setValidator(new QRegExpValidator(voltageRegExp, this));
 
    bgColor->setPalette(settings.bgColor);
    fgColor->setPalette(settings.fgColor);
-   color1->setPalette(settings.color[0]);
-   color2->setPalette(settings.color[1]);
-   color3->setPalette(settings.color[2]);
-   color4->setPalette(settings.color[3]);
-   color5->setPalette(settings.color[4]);
-   color6->setPalette(settings.color[5]);
-   color7->setPalette(settings.color[6]);
-   color8->setPalette(settings.color[7]);
 
    connect(okButton, SIGNAL(clicked()), this, SLOT(accept()));
    connect(cancelButton, SIGNAL(clicked()), this, SLOT(reject()));
    connect(fgColor, SIGNAL(clicked()), this, SLOT(fgColorClicked()));
    connect(bgColor, SIGNAL(clicked()), this, SLOT(bgColorClicked()));
-   connect(color1, SIGNAL(clicked()), this, SLOT(color1Clicked()));
-   connect(color2, SIGNAL(clicked()), this, SLOT(color2Clicked()));
-   connect(color3, SIGNAL(clicked()), this, SLOT(color3Clicked()));
-   connect(color4, SIGNAL(clicked()), this, SLOT(color4Clicked()));
-   connect(color5, SIGNAL(clicked()), this, SLOT(color5Clicked()));
-   connect(color6, SIGNAL(clicked()), this, SLOT(color6Clicked()));
-   connect(color7, SIGNAL(clicked()), this, SLOT(color7Clicked()));
-   connect(color8, SIGNAL(clicked()), this, SLOT(color8Clicked()));
+   connect(channelTable, SIGNAL(clicked(const QModelIndex&)), this,
+         SLOT(channelClicked(const QModelIndex&)));
+   connect(channelModel, SIGNAL(itemChanged(QStandardItem*)), this,
+         SLOT(channelChanged(QStandardItem*)));
 
    connect(numChannels, SIGNAL(valueChanged(int)), this, 
          SLOT(numChannelsChanged(int)));
+   connect(legacyTimestamp, SIGNAL(toggled(bool)), this,
+         SLOT(legacyTimestampToggled(bool)));
+   connect(rawStorage, SIGNAL(toggled(bool)), this,
+         SLOT(rawStorageToggled(bool)));
+   connect(retention, SIGNAL(valueChanged(int)), this,
+         SLOT(retentionChanged(int)));
+   connect(streamGroup, SIGNAL(toggled(bool)), this,
+         SLOT(streamSettingsChanged()));
+   connect(streamTcpPort, SIGNAL(valueChanged(int)), this,
+         SLOT(streamSettingsChanged()));
+   connect(streamPolicy, SIGNAL(currentIndexChanged(int)), this,
+         SLOT(streamSettingsChanged()));
+   connect(streamBufferLength, SIGNAL(valueChanged(int)), this,
+         SLOT(streamSettingsChanged()));
+   connect(realtimePriority, SIGNAL(valueChanged(int)), this,
+         SLOT(realtimeSettingsChanged()));
+   connect(cpuAffinity, SIGNAL(valueChanged(int)), this,
+         SLOT(realtimeSettingsChanged()));
+   connect(lockMemory, SIGNAL(toggled(bool)), this,
+         SLOT(realtimeSettingsChanged()));
+   connect(targetLatency, SIGNAL(valueChanged(int)), this,
+         SLOT(realtimeSettingsChanged()));
+   connect(spikeAdaptive, SIGNAL(toggled(bool)), this,
+         SLOT(spikeSettingsChanged()));
+   connect(spikeRefractory, SIGNAL(valueChanged(double)), this,
+         SLOT(spikeSettingsChanged()));
+   connect(filterMode, SIGNAL(currentIndexChanged(int)), this,
+         SLOT(filterModeChanged(int)));
+   connect(triggerChannel, SIGNAL(currentIndexChanged(int)), this,
+         SLOT(triggerSettingsChanged()));
+   connect(triggerLevel, SIGNAL(valueChanged(double)), this,
+         SLOT(triggerSettingsChanged()));
+   connect(triggerPre, SIGNAL(valueChanged(double)), this,
+         SLOT(triggerSettingsChanged()));
+   connect(triggerPost, SIGNAL(valueChanged(double)), this,
+         SLOT(triggerSettingsChanged()));
+   connect(averageEvents, SIGNAL(currentIndexChanged(int)), this,
+         SLOT(triggerSettingsChanged()));
+   connect(triggeredRecording, SIGNAL(toggled(bool)), this,
+         SLOT(triggerSettingsChanged()));
    connect(samplingRate, SIGNAL(textChanged(const QString&)), this, 
          SLOT(textChanged()));
-   connect(maxV1, SIGNAL(textChanged(const QString&)), this, 
-         SLOT(textChanged()));
-   connect(maxV2, SIGNAL(textChanged(const QString&)), this, 
-         SLOT(textChanged()));
-   connect(maxV3, SIGNAL(textChanged(const QString&)), this,
-         SLOT(textChanged()));
-   connect(maxV4, SIGNAL(textChanged(const QString&)), this,
-         SLOT(textChanged()));
-   connect(maxV5, SIGNAL(textChanged(const QString&)), this,
-         SLOT(textChanged()));
-   connect(maxV6, SIGNAL(textChanged(const QString&)), this,
-         SLOT(textChanged()));
-   connect(maxV7, SIGNAL(textChanged(const QString&)), this, 
-         SLOT(textChanged()));
-   connect(maxV8, SIGNAL(textChanged(const QString&)), this,
-         SLOT(textChanged()));
 }
 
 void DAQSettingsDialog::fgColorClicked()
@@ -153,105 +371,125 @@ void DAQSettingsDialog::bgColorClicked()
 }
 
 
-void DAQSettingsDialog::color1Clicked()
+void DAQSettingsDialog::fillChannelRow(int chan)
 {
-   QColor color = QColorDialog::getColor(settings.color[0], this);
-   
-   if (color.isValid()) {
-      color1->setPalette(QPalette(color));
-      settings.color[0] = color;
-   }
-}
+   QStandardItem* device = new QStandardItem;
+   device->setData(settings.device[chan], Qt::EditRole);
 
+   QStandardItem* input = new QStandardItem;
+   input->setData(settings.input[chan], Qt::EditRole);
 
-void DAQSettingsDialog::color2Clicked()
-{
-   QColor color = QColorDialog::getColor(settings.color[1], this);
-   
-   if (color.isValid()) {
-      color2->setPalette(QPalette(color));
-      settings.color[1] = color;
-   }
-}
+   QStandardItem* range = new QStandardItem;
+   range->setData(settings.maxVoltage[chan], Qt::EditRole);
 
+   QStandardItem* highpass = new QStandardItem;
+   highpass->setData(settings.highpass[chan], Qt::EditRole);
 
-void DAQSettingsDialog::color3Clicked()
-{
-   QColor color = QColorDialog::getColor(settings.color[2], this);
-   
-   if (color.isValid()) {
-      color3->setPalette(QPalette(color));
-      settings.color[2] = color;
-   }
-}
+   QStandardItem* lowpass = new QStandardItem;
+   lowpass->setData(settings.lowpass[chan], Qt::EditRole);
 
+   QStandardItem* notch = new QStandardItem;
+   notch->setData(settings.notch[chan], Qt::EditRole);
 
-void DAQSettingsDialog::color4Clicked()
-{
-   QColor color = QColorDialog::getColor(settings.color[3], this);
-   
-   if (color.isValid()) {
-      color4->setPalette(QPalette(color));
-      settings.color[3] = color;
-   }
-}
+   QStandardItem* spike = new QStandardItem;
+   spike->setData(settings.spikeThreshold[chan], Qt::EditRole);
 
+   QStandardItem* color = new QStandardItem;
+   color->setEditable(false);
+   color->setData(settings.color[chan], Qt::BackgroundRole);
 
-void DAQSettingsDialog::color5Clicked()
-{
-   QColor color = QColorDialog::getColor(settings.color[4], this);
-   
-   if (color.isValid()) {
-      color5->setPalette(QPalette(color));
-      settings.color[4] = color;
-   }
+   channelModel->setVerticalHeaderItem(chan,
+         new QStandardItem(DAQSettings::channelName(chan)));
+   channelModel->setItem(chan, deviceColumn, device);
+   channelModel->setItem(chan, inputColumn, input);
+   channelModel->setItem(chan, rangeColumn, range);
+   channelModel->setItem(chan, highpassColumn, highpass);
+   channelModel->setItem(chan, lowpassColumn, lowpass);
+   channelModel->setItem(chan, notchColumn, notch);
+   channelModel->setItem(chan, spikeColumn, spike);
+   channelModel->setItem(chan, colorColumn, color);
 }
 
 
-void DAQSettingsDialog::color6Clicked()
+void DAQSettingsDialog::channelClicked(const QModelIndex& index)
 {
-   QColor color = QColorDialog::getColor(settings.color[5], this);
-   
-   if (color.isValid()) {
-      color6->setPalette(QPalette(color));
-      settings.color[5] = color;
-   }
-}
+   if (index.column() != colorColumn)
+      return;
 
+   int chan = index.row();
+   QColor color = QColorDialog::getColor(settings.color[chan], this);
 
-void DAQSettingsDialog::color7Clicked()
-{
-   QColor color = QColorDialog::getColor(settings.color[6], this);
-   
    if (color.isValid()) {
-      color7->setPalette(QPalette(color));
-      settings.color[6] = color;
+      settings.color[chan] = color;
+      channelModel->item(chan, colorColumn)->setData(color,
+            Qt::BackgroundRole);
    }
 }
 
 
-void DAQSettingsDialog::color8Clicked()
+// Ranges are symmetric; anything outside (0, 100) V goes back to what it
+// was, as does an input that doesn't exist or is already being recorded,
+// or a filter frequency that's negative or not below half the sampling
+// rate.
+void DAQSettingsDialog::channelChanged(QStandardItem* item)
 {
-   QColor color = QColorDialog::getColor(settings.color[7], this);
-   
-   if (color.isValid()) {
-      color8->setPalette(QPalette(color));
-      settings.color[7] = color;
+   int chan = item->row();
+
+   if (item->column() == deviceColumn || item->column() == inputColumn) {
+      if (channelModel->item(chan, deviceColumn) == NULL
+            || channelModel->item(chan, inputColumn) == NULL)
+         return; // still being filled in
+
+      int device = channelModel->item(chan, deviceColumn)->data(
+            Qt::EditRole).toInt();
+      int input = channelModel->item(chan, inputColumn)->data(
+            Qt::EditRole).toInt();
+      int other = settings.findChannel(device, input, settings.numChannels);
+
+      if (device >= 0 && device < DAQSettings::maxDevices
+            && input >= 0 && input < DAQSettings::maxInputs
+            && (other < 0 || other == chan)) {
+         settings.device[chan] = device;
+         settings.input[chan] = input;
+      }
+      else {
+         item->setData(item->column() == deviceColumn
+               ? settings.device[chan] : settings.input[chan], Qt::EditRole);
+      }
+   }
+   else if (item->column() == rangeColumn) {
+      double maxVoltage = item->data(Qt::EditRole).toDouble();
+
+      if (maxVoltage > 0.0 && maxVoltage < 100.0) {
+         settings.maxVoltage[chan] = maxVoltage;
+         settings.minVoltage[chan] = -maxVoltage;
+      }
+      else {
+         item->setData(settings.maxVoltage[chan], Qt::EditRole);
+      }
+   }
+   else if (item->column() == highpassColumn
+         || item->column() == lowpassColumn
+         || item->column() == notchColumn) {
+      QVector<double>& frequencies = item->column() == highpassColumn
+         ? settings.highpass : item->column() == lowpassColumn
+         ? settings.lowpass : settings.notch;
+      double frequency = item->data(Qt::EditRole).toDouble();
+
+      if (frequency >= 0.0 && frequency < 0.5*settings.samplingRate)
+         frequencies[chan] = frequency;
+      else
+         item->setData(frequencies[chan], Qt::EditRole);
+   }
+   else if (item->column() == spikeColumn) {
+      settings.spikeThreshold[chan] = item->data(Qt::EditRole).toDouble();
    }
 }
 
 
 void DAQSettingsDialog::textChanged() 
 {
-   bool valid = samplingRate->hasAcceptableInput()
-         && maxV1->hasAcceptableInput()
-         && maxV2->hasAcceptableInput()
-         && maxV3->hasAcceptableInput()
-         && maxV4->hasAcceptableInput()
-         && maxV5->hasAcceptableInput()
-         && maxV6->hasAcceptableInput()
-         && maxV7->hasAcceptableInput()
-         && maxV8->hasAcceptableInput();
+   bool valid = samplingRate->hasAcceptableInput();
 
    if (valid) 
    {
@@ -265,24 +503,6 @@ void DAQSettingsDialog::textChanged()
       if (numChannels->value() > maxChannels) {
          numChannels->setValue(maxChannels);
       }
-
-      settings.minVoltage[0] = 
-         -(settings.maxVoltage[0] = maxV1->text().toDouble());
-      settings.minVoltage[1] = 
-         -(settings.maxVoltage[1] = maxV2->text().toDouble());
-      settings.minVoltage[2] = 
-         -(settings.maxVoltage[2] = maxV3->text().toDouble());
-      settings.minVoltage[3] = 
-         -(settings.maxVoltage[3] = maxV4->text().toDouble());
-      settings.minVoltage[4] = 
-         -(settings.maxVoltage[4] = maxV5->text().toDouble());
-      settings.minVoltage[5] = 
-         -(settings.maxVoltage[5] = maxV6->text().toDouble());
-      settings.minVoltage[6] = 
-         -(settings.maxVoltage[6] = maxV7->text().toDouble());
-      settings.minVoltage[7] = 
-         -(settings.maxVoltage[7] = maxV8->text().toDouble());
-
    }
 
    okButton->setEnabled(valid);
@@ -290,7 +510,7 @@ void DAQSettingsDialog::textChanged()
 
 void DAQSettingsDialog::numChannelsChanged(int newNumChannels) 
 {
-   settings.numChannels = newNumChannels;
+   settings.setNumChannels(newNumChannels);
 
    if (newNumChannels > 1) {
       int maxSamplingRate = 250000/newNumChannels;
@@ -300,20 +520,113 @@ void DAQSettingsDialog::numChannelsChanged(int newNumChannels)
       }
    }
 
-   maxV2->setEnabled(newNumChannels >= 2);
-   maxV3->setEnabled(newNumChannels >= 3);
-   maxV4->setEnabled(newNumChannels >= 4);
-   maxV5->setEnabled(newNumChannels >= 5);
-   maxV6->setEnabled(newNumChannels >= 6);
-   maxV7->setEnabled(newNumChannels >= 7);
-   maxV8->setEnabled(newNumChannels >= 8);
-
-   color2->setEnabled(newNumChannels >= 2);
-   color3->setEnabled(newNumChannels >= 3);
-   color4->setEnabled(newNumChannels >= 4);
-   color5->setEnabled(newNumChannels >= 5);
-   color6->setEnabled(newNumChannels >= 6);
-   color7->setEnabled(newNumChannels >= 7);
-   color8->setEnabled(newNumChannels >= 8);
+   int oldNumChannels = channelModel->rowCount();
+   channelModel->setRowCount(settings.numChannels);
+
+   for (int chan = oldNumChannels; chan < settings.numChannels; ++chan) {
+      fillChannelRow(chan);
+   }
+
+   fillTriggerChannels();
+   fillAverageEvents();
 }
 
+// "None", then each channel; a trigger channel that's gone becomes none.
+void DAQSettingsDialog::fillTriggerChannels()
+{
+   if (settings.triggerChannel >= settings.numChannels)
+      settings.triggerChannel = -1;
+
+   triggerChannel->blockSignals(true);
+   triggerChannel->clear();
+   triggerChannel->addItem(tr("None"));
+
+   for (int chan = 0; chan < settings.numChannels; ++chan)
+      triggerChannel->addItem(DAQSettings::channelName(chan));
+
+   triggerChannel->setCurrentIndex(settings.triggerChannel + 1);
+   triggerChannel->blockSignals(false);
+}
+
+void DAQSettingsDialog::legacyTimestampToggled(bool checked)
+{
+   settings.legacyTimestamp = checked;
+}
+
+void DAQSettingsDialog::rawStorageToggled(bool checked)
+{
+   settings.rawStorage = checked;
+}
+
+void DAQSettingsDialog::retentionChanged(int minutes)
+{
+   settings.retention = minutes;
+}
+
+void DAQSettingsDialog::streamSettingsChanged()
+{
+   settings.streamEnabled = streamGroup->isChecked();
+   settings.streamTcpPort = streamTcpPort->value();
+   settings.streamPolicy = streamPolicy->currentIndex();
+   settings.streamBufferLength = streamBufferLength->value();
+}
+
+void DAQSettingsDialog::realtimeSettingsChanged()
+{
+   settings.realtimePriority = realtimePriority->value();
+   settings.cpuAffinity = cpuAffinity->value();
+   settings.lockMemory = lockMemory->isChecked();
+   settings.targetLatency = targetLatency->value();
+}
+
+void DAQSettingsDialog::spikeSettingsChanged()
+{
+   settings.spikeAdaptive = spikeAdaptive->isChecked();
+   settings.spikeRefractory = spikeRefractory->value();
+}
+
+// "None", the sweep trigger, then each channel's spikes.
+void DAQSettingsDialog::fillAverageEvents()
+{
+   if (settings.averageEvents == DAQSettings::averageSpikes
+         && settings.averageSpikeChannel >= settings.numChannels)
+      settings.averageEvents = DAQSettings::averageNone;
+
+   averageEvents->blockSignals(true);
+   averageEvents->clear();
+   averageEvents->addItem(tr("None"));
+   averageEvents->addItem(tr("Sweep trigger"));
+
+   for (int chan = 0; chan < settings.numChannels; ++chan) {
+      averageEvents->addItem(tr("Spikes on %1")
+            .arg(DAQSettings::channelName(chan)));
+   }
+
+   averageEvents->setCurrentIndex(
+         settings.averageEvents == DAQSettings::averageSpikes
+         ? 2 + settings.averageSpikeChannel : settings.averageEvents);
+   averageEvents->blockSignals(false);
+}
+
+void DAQSettingsDialog::triggerSettingsChanged()
+{
+   settings.triggerChannel = triggerChannel->currentIndex() - 1;
+   settings.triggerLevel = triggerLevel->value();
+   settings.triggerPre = triggerPre->value();
+   settings.triggerPost = triggerPost->value();
+   settings.triggeredRecording = triggeredRecording->isChecked();
+
+   int events = averageEvents->currentIndex();
+   if (events >= 2) {
+      settings.averageEvents = DAQSettings::averageSpikes;
+      settings.averageSpikeChannel = events - 2;
+   }
+   else {
+      settings.averageEvents = qMax(0, events);
+   }
+}
+
+void DAQSettingsDialog::filterModeChanged(int mode)
+{
+   settings.filterMode = mode;
+}
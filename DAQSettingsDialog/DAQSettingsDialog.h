@@ -2,24 +2,80 @@
 #define DAQSETTINGSDIALOG_H 
 
 #include <QDialog>
+#include <QVector>
 #include <ui_DAQSettingsDialog.h>
 
+class QStandardItem;
+class QStandardItemModel;
+
 struct DAQSettings 
 {
-   enum { maxChannels = 8 };
+   enum { maxChannels = 64, maxInputs = 256, maxDevices = 16 };
+   enum FilterMode { filterDisplay, filterRecording };
+   enum AverageEvents { averageNone, averageTriggers, averageSpikes };
 
    int samplingRate;
    int numChannels;
    QColor fgColor;
    QColor bgColor;
-   double maxVoltage[maxChannels];
-   double minVoltage[maxChannels];
-   QColor color[maxChannels];
+   // per channel; at least numChannels long, and longer if the number of
+   // channels has been reduced, so that the others' settings are kept
+   QVector<int> device;       // which board: /dev/comediN, or DevN+1
+   QVector<int> input;        // the board's analog input to record
+   QVector<double> maxVoltage;
+   QVector<double> minVoltage;
+   QVector<QColor> color;
+   // filters (FilterBank), in Hz, 0 for none
+   QVector<double> highpass;
+   QVector<double> lowpass;
+   QVector<double> notch;
+   // spike detection (SpikeDetector): a crossing of the threshold in the
+   // direction of its sign, 0 for none; with spikeAdaptive, in multiples
+   // of the channel's noise level rather than volts
+   QVector<double> spikeThreshold;
+   bool spikeAdaptive;
+   double spikeRefractory;    // ms
+   // sweeps (SweepCollector): a crossing of triggerLevel (volts) on
+   // triggerChannel in the direction of the level's sign, and the window
+   // around it
+   int triggerChannel;        // -1 for none
+   double triggerLevel;
+   double triggerPre;         // ms
+   double triggerPost;        // ms
+   // event-triggered averages (EventAverage) over the same window, of
+   // the sweep triggers or one channel's spikes
+   int averageEvents;         // AverageEvents
+   int averageSpikeChannel;
+   // keep only the scans in the window around each trigger (TriggerGate)
+   bool triggeredRecording;
+   bool legacyTimestamp;
+   bool rawStorage;           // keep ADC codes rather than volts in memory
+   int retention;             // minutes kept in memory, 0 for all
+   int filterMode;            // FilterMode: what the filtered data replaces
+
+   // live data server (StreamServer)
+   bool streamEnabled;
+   int streamTcpPort;         // 0 for local socket only
+   int streamPolicy;          // StreamServer::Policy
+   int streamBufferLength;    // ms of data queued per client
+
+   // acquisition thread (Linux only)
+   int realtimePriority;      // SCHED_FIFO priority, 0 for normal
+   int cpuAffinity;           // CPU to run on, -1 for any
+   bool lockMemory;           // mlockall and pre-fault buffers
+   int targetLatency;         // ms between reads of the device
 
    DAQSettings();
    
    void save();
    void restore();
+   void setNumChannels(int numChannels);
+   int findChannel(int device, int input, int numChannels) const;
+   int numDevices() const;
+   bool hasFilters() const;
+
+   static QString channelName(int chan);
+   static QColor defaultColor(int chan);
 };
 
 class DAQSettingsDialog : public QDialog, public Ui::DAQSettingsDialog 
@@ -36,16 +92,28 @@ public:
 private slots:
       void bgColorClicked();
       void fgColorClicked();
-      void color1Clicked();
-      void color2Clicked();
-      void color3Clicked();
-      void color4Clicked();
-      void color5Clicked();
-      void color6Clicked();
-      void color7Clicked();
-      void color8Clicked();
+      void channelClicked(const QModelIndex& index);
+      void channelChanged(QStandardItem* item);
       void textChanged();
       void numChannelsChanged(int numChannels);
+      void legacyTimestampToggled(bool checked);
+      void rawStorageToggled(bool checked);
+      void retentionChanged(int minutes);
+      void streamSettingsChanged();
+      void realtimeSettingsChanged();
+      void spikeSettingsChanged();
+      void triggerSettingsChanged();
+      void filterModeChanged(int mode);
+
+private:
+      enum { deviceColumn, inputColumn, rangeColumn, highpassColumn,
+         lowpassColumn, notchColumn, spikeColumn, colorColumn };
+
+      void fillChannelRow(int chan);
+      void fillTriggerChannels();
+      void fillAverageEvents();
+
+      QStandardItemModel* channelModel;
 };
 
 #endif /* DAQSETTINGSDIALOG_H */
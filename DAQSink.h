@@ -0,0 +1,59 @@
+#ifndef DAQSINK_H
+#define DAQSINK_H
+
+#include <QtGlobal>
+#include "DAQSettingsDialog/DAQSettingsDialog.h"
+
+// One read's worth of converted data, as handed to the sinks.
+struct ScanBlock
+{
+    const qreal* const* scans;  // scans[chan][i], in volts
+    int numScans;
+    qint64 firstScan;           // scans since the recording started,
+                                // counting any the device lost
+
+    // CLOCK_MONOTONIC and CLOCK_REALTIME when the read that delivered the
+    // last scan of the block returned (for filtered scans, worked back
+    // from a later read by the filters' delay)
+    qint64 monotonicNs;
+    qint64 realtimeNs;
+};
+
+// Scans the device clocked but that never reached us, because its buffer
+// overflowed before they were read.
+struct ScanGap
+{
+    qint64 firstScan;
+    qint64 numScans;
+    qint64 realtimeNs;          // when the loss was noticed
+};
+
+// Receives data on the acquisition thread as soon as DAQReader has
+// converted it, before the GUI sees it.  Sinks are called with DAQReader's
+// buffer locked and must never block; the device keeps filling its buffer
+// while they run.
+class DAQSink
+{
+    public:
+        virtual ~DAQSink() {}
+
+        // dt is the actual scan interval, which may differ slightly from
+        // the requested sampling rate
+        virtual void startedRecording(const DAQSettings& /* settings */,
+                double /* dt */) {}
+
+        virtual void newScans(const ScanBlock& block) = 0;
+
+        // called before the block that follows the gap
+        virtual void scansLost(const ScanGap& /* gap */) {}
+
+        virtual void stoppedRecording() {}
+
+        // Sinks that store the recording (DiskWriter) are only given the
+        // scans kept around triggers when DAQSettings::triggeredRecording
+        // is set, a run of contiguous scans per block; the rest are given
+        // every scan.
+        virtual bool storesRecording() const { return false; }
+};
+
+#endif
@@ -0,0 +1,180 @@
+#include <QtCore>
+
+#include "DiskWriter.h"
+
+DiskWriter::DiskWriter() :
+    file(NULL),
+    finished(true),
+    numChannels(0),
+    dt(0.01),
+    maxPendingScans(0),
+    numScansWritten(0),
+    numScansLost(0),
+    numBytesWritten(0),
+    maxPendingSeen(0)
+{
+}
+
+DiskWriter::~DiskWriter()
+{
+    close();
+}
+
+bool DiskWriter::open(const QString& fileName)
+{
+    close();
+
+    file = fopen(QFile::encodeName(fileName), "w");
+
+    if (file == NULL)
+        return false;
+
+    QMutexLocker lock(&mutex);
+    pending.resize(0);
+    finished = false;
+    numScansWritten = 0;
+    numScansLost = 0;
+    numBytesWritten = 0;
+    maxPendingSeen = 0;
+
+    start();
+    return true;
+}
+
+void DiskWriter::close()
+{
+    {
+        QMutexLocker lock(&mutex);
+        finished = true;
+        dataReady.wakeOne();
+    }
+
+    wait();
+}
+
+qint64 DiskWriter::scansWritten()
+{
+    QMutexLocker lock(&mutex);
+    return numScansWritten;
+}
+
+qint64 DiskWriter::scansLost()
+{
+    QMutexLocker lock(&mutex);
+    return numScansLost;
+}
+
+qint64 DiskWriter::bytesWritten()
+{
+    QMutexLocker lock(&mutex);
+    return numBytesWritten;
+}
+
+int DiskWriter::backlog()
+{
+    QMutexLocker lock(&mutex);
+    return numChannels > 0 ? pending.count()/(numChannels + 1) : 0;
+}
+
+int DiskWriter::maxBacklog()
+{
+    QMutexLocker lock(&mutex);
+    return maxPendingSeen;
+}
+
+void DiskWriter::startedRecording(const DAQSettings& settings, double dt_)
+{
+    QMutexLocker lock(&mutex);
+
+    numChannels = settings.numChannels;
+    dt = dt_;
+    maxPendingScans = int(maxBacklogSeconds/dt);
+
+    // a second's worth up front, so the first blocks don't reallocate
+    pending.reserve(int(1/dt)*(numChannels + 1));
+}
+
+void DiskWriter::newScans(const ScanBlock& block)
+{
+    QMutexLocker lock(&mutex);
+
+    if (file == NULL || finished)
+        return;
+
+    int numPending = pending.count()/(numChannels + 1);
+
+    if (numPending + block.numScans > maxPendingScans) {
+        numScansLost += block.numScans;
+        return;
+    }
+
+    int first = pending.count();
+    pending.resize(first + block.numScans*(numChannels + 1));
+    qreal* out = pending.data() + first;
+
+    for (int scan = 0; scan < block.numScans; ++scan) {
+        *out++ = (block.firstScan + scan)*dt;
+
+        for (int chan = 0; chan < numChannels; ++chan) {
+            *out++ = block.scans[chan][scan];
+        }
+    }
+
+    maxPendingSeen = qMax(maxPendingSeen, numPending + block.numScans);
+    dataReady.wakeOne();
+}
+
+void DiskWriter::stoppedRecording()
+{
+    QMutexLocker lock(&mutex);
+    finished = true;
+    dataReady.wakeOne();
+}
+
+void DiskWriter::run()
+{
+    QVector<qreal> writing;
+    int stride;
+
+    forever {
+        {
+            QMutexLocker lock(&mutex);
+
+            while (pending.isEmpty() && !finished)
+                dataReady.wait(&mutex);
+
+            if (pending.isEmpty())
+                break;
+
+            // take everything pending, and hand back our old buffer so
+            // that neither side allocates once they've both grown
+            qSwap(writing, pending);
+            pending.resize(0);
+            stride = numChannels + 1;
+        }
+
+        qint64 bytes = 0;
+        const qreal* in = writing.constData();
+        const qreal* end = in + writing.count();
+
+        while (in < end) {
+            bytes += fprintf(file, "%.6f", *in++);
+
+            for (int chan = 1; chan < stride; ++chan) {
+                bytes += fprintf(file, ",%.6f", *in++);
+            }
+
+            bytes += fprintf(file, "\n");
+        }
+
+        fflush(file);
+
+        QMutexLocker lock(&mutex);
+        numScansWritten += writing.count()/stride;
+        numBytesWritten += bytes;
+    }
+
+    QMutexLocker lock(&mutex);
+    fclose(file);
+    file = NULL;
+}
@@ -0,0 +1,62 @@
+#ifndef DISKWRITER_H
+#define DISKWRITER_H
+
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QVector>
+#include <cstdio>
+#include "DAQSink.h"
+
+// Streams a recording to disk as it's acquired, in the same CSV format
+// Plotter saves.  The acquisition thread only copies each block into a
+// pending buffer; formatting and writing happen on the writer's own
+// thread.  If the disk falls more than maxBacklogSeconds behind, new
+// blocks are dropped (and counted) rather than holding up acquisition;
+// dropped scans show up as a jump in the time column, as do the scans
+// between triggers that a triggered recording doesn't keep.
+class DiskWriter : public QThread, public DAQSink
+{
+    public:
+        enum { maxBacklogSeconds = 30 };
+
+        DiskWriter();
+        ~DiskWriter();
+
+        // call before the recording starts
+        bool open(const QString& fileName);
+        // waits until everything pending has been written
+        void close();
+
+        qint64 scansWritten();
+        qint64 scansLost();
+        qint64 bytesWritten();
+        int backlog();
+        int maxBacklog();
+
+        void startedRecording(const DAQSettings& settings, double dt);
+        void newScans(const ScanBlock& block);
+        void stoppedRecording();
+        bool storesRecording() const { return true; }
+
+    protected:
+        void run();
+
+    private:
+        FILE* file;
+
+        QMutex mutex;
+        QWaitCondition dataReady;
+        QVector<qreal> pending;     // time, then each channel, scan by scan
+        bool finished;
+        int numChannels;
+        double dt;
+        int maxPendingScans;
+
+        qint64 numScansWritten;
+        qint64 numScansLost;
+        qint64 numBytesWritten;
+        int maxPendingSeen;
+};
+
+#endif
@@ -0,0 +1,211 @@
+#include <QtCore>
+#include <cmath>
+#include <limits>
+
+#include "EventAverage.h"
+#include "SampleStore.h"
+
+EventAverage::EventAverage() :
+    pre(0),
+    post(0),
+    eventCount(0)
+{
+}
+
+void EventAverage::reset(int numChannels, int preScans, int postScans)
+{
+    pre = qMax(0, preScans);
+    post = qMax(1, postScans);
+    eventCount = 0;
+
+    sums.fill(QVector<double>(pre + post, 0.0), numChannels);
+    squares.fill(QVector<double>(pre + post, 0.0), numChannels);
+    counts.fill(QVector<int>(pre + post, 0), numChannels);
+    pending.clear();
+}
+
+void EventAverage::addEvent(qint64 scan)
+{
+    Pending event;
+    event.scan = scan;
+    event.filled = 0;
+
+    pending.append(event);
+    ++eventCount;
+}
+
+// Only the offsets that weren't there last time are read, so the work
+// per call follows the scans that have arrived, not the events so far.
+void EventAverage::update(const SampleStore& store)
+{
+    for (int i = 0; i < pending.count(); ) {
+        Pending& event = pending[i];
+        int available = int(qMin(qint64(pre + post),
+                    store.count() - (event.scan - pre)));
+
+        if (available > event.filled) {
+            add(store, event.scan, event.filled, available);
+            event.filled = available;
+        }
+
+        if (event.filled == pre + post)
+            pending.remove(i);
+        else
+            ++i;
+    }
+}
+
+void EventAverage::computeAll(const SampleStore& store,
+        const QVector<qint64>& events, int markerChannel, double level)
+{
+    reset(sums.count(), pre, post);
+
+    // events are split evenly, or the scans they're looked for in
+    qint64 total = markerChannel >= 0 ? store.count() : events.count();
+    int numChunks = int(qBound(qint64(1),
+                qint64(QThread::idealThreadCount()), qMax(qint64(1), total)));
+    QList<QFuture<EventAverage> > chunks;
+
+    for (int c = 0; c < numChunks; ++c) {
+        Chunk chunk;
+        chunk.store = &store;
+        chunk.events = &events;
+        chunk.first = c*total/numChunks;
+        chunk.end = (c + 1)*total/numChunks;
+        chunk.markerChannel = markerChannel;
+        chunk.level = level;
+        chunk.numChannels = sums.count();
+        chunk.pre = pre;
+        chunk.post = post;
+
+        chunks.append(QtConcurrent::run(&EventAverage::averageChunk, chunk));
+    }
+
+    for (int c = 0; c < chunks.count(); ++c)
+        merge(chunks[c].result());
+}
+
+void EventAverage::band(int chan, QVector<double>* mean,
+        QVector<double>* halfWidth) const
+{
+    const double nan = std::numeric_limits<double>::quiet_NaN();
+    int numOffsets = pre + post;
+
+    mean->resize(numOffsets);
+    halfWidth->resize(numOffsets);
+
+    for (int k = 0; k < numOffsets; ++k) {
+        int n = counts[chan][k];
+        double sum = sums[chan][k];
+
+        (*mean)[k] = n > 0 ? sum/n : nan;
+
+        if (n < 2) {
+            (*halfWidth)[k] = nan;
+            continue;
+        }
+
+        double variance = qMax(0.0, (squares[chan][k] - sum*sum/n)/(n - 1));
+        (*halfWidth)[k] = 1.96*std::sqrt(variance/n);
+    }
+}
+
+// Runs on a pool thread, reading the store but never changing it.
+EventAverage EventAverage::averageChunk(Chunk chunk)
+{
+    EventAverage average;
+    average.reset(chunk.numChannels, chunk.pre, chunk.post);
+
+    if (chunk.markerChannel < 0) {
+        for (int i = int(chunk.first); i < chunk.end; ++i) {
+            average.add(*chunk.store, (*chunk.events)[i], 0,
+                    chunk.pre + chunk.post);
+            ++average.eventCount;
+        }
+
+        return average;
+    }
+
+    // compare in the level's direction, so both signs are "rising"
+    const double sign = chunk.level < 0.0 ? -1.0 : 1.0;
+    const double threshold = sign*chunk.level;
+    const int blockScans = 4096;
+    QVector<double> values(blockScans);
+    double last = std::numeric_limits<double>::quiet_NaN();
+
+    if (chunk.first > 0) {
+        chunk.store->values(chunk.markerChannel, chunk.first - 1, 1, &last);
+        last *= sign;
+    }
+
+    for (qint64 block = chunk.first; block < chunk.end; block += blockScans) {
+        int numScans = int(qMin(qint64(blockScans), chunk.end - block));
+        chunk.store->values(chunk.markerChannel, block, numScans,
+                values.data());
+
+        for (int j = 0; j < numScans; ++j) {
+            double value = sign*values[j];
+
+            if (value >= threshold && last < threshold) {
+                average.add(*chunk.store, block + j, 0,
+                        chunk.pre + chunk.post);
+                ++average.eventCount;
+            }
+
+            last = value;
+        }
+    }
+
+    return average;
+}
+
+// Adds offsets from to to - 1 of the window around scan.
+void EventAverage::add(const SampleStore& store, qint64 scan, int from,
+        int to)
+{
+    qint64 first = scan - pre + from;
+
+    if (first < 0) {
+        from -= int(first);
+        first = 0;
+    }
+
+    int count = int(qMin(qint64(to - from), store.count() - first));
+    if (count <= 0)
+        return;
+
+    buffer.resize(count);
+
+    for (int chan = 0; chan < sums.count() && chan < store.numChannels();
+            ++chan) {
+        store.values(chan, first, count, buffer.data());
+
+        double* sum = sums[chan].data() + from;
+        double* square = squares[chan].data() + from;
+        int* n = counts[chan].data() + from;
+
+        for (int i = 0; i < count; ++i) {
+            double value = buffer[i];
+
+            if (value == value) {
+                sum[i] += value;
+                square[i] += value*value;
+                ++n[i];
+            }
+        }
+    }
+}
+
+void EventAverage::merge(const EventAverage& other)
+{
+    for (int chan = 0; chan < sums.count() && chan < other.sums.count();
+            ++chan) {
+        for (int k = 0; k < pre + post; ++k) {
+            sums[chan][k] += other.sums[chan][k];
+            squares[chan][k] += other.squares[chan][k];
+            counts[chan][k] += other.counts[chan][k];
+        }
+    }
+
+    eventCount += other.eventCount;
+}
@@ -0,0 +1,87 @@
+#ifndef EVENTAVERAGE_H
+#define EVENTAVERAGE_H
+
+#include <QVector>
+#include <QtGlobal>
+
+class SampleStore;
+
+// Event-triggered averages of every channel of a SampleStore, over a window
+// of preScans before to postScans after each event, kept as running sums
+// and sums of squares per channel and offset so the mean and its
+// confidence interval can be read at any time.
+//
+// While recording, addEvent() queues each event as it's found and update()
+// adds whatever of its window has arrived since, so an event counts as
+// soon as it's seen and its window fills in behind it.  For data that are
+// all there already, computeAll() splits the store into chunks and
+// averages each on a thread of its own, then adds the chunks together.
+//
+// Events are scans of the store.  Samples that are NaN, or outside the
+// store, are left out of the offsets they fall on.
+class EventAverage
+{
+    public:
+        EventAverage();
+
+        // sets the window and forgets everything
+        void reset(int numChannels, int preScans, int postScans);
+
+        void addEvent(qint64 scan);
+        void update(const SampleStore& store);
+
+        // Averages the store afresh, over the window and channels reset()
+        // set, around each of the events (in order), or, if markerChannel
+        // isn't -1, around each crossing of level on it in the direction
+        // of the level's sign, as SweepCollector triggers.
+        void computeAll(const SampleStore& store,
+                const QVector<qint64>& events, int markerChannel,
+                double level);
+
+        int numEvents() const { return eventCount; }
+        int numChannels() const { return sums.count(); }
+        int preScans() const { return pre; }
+        int postScans() const { return post; }
+
+        // per offset from -preScans: the mean, and the half-width of its
+        // 95% confidence interval (NaN with fewer than two samples)
+        void band(int chan, QVector<double>* mean,
+                QVector<double>* halfWidth) const;
+
+    private:
+        struct Pending
+        {
+            qint64 scan;
+            int filled;         // offsets of the window added so far
+        };
+
+        struct Chunk
+        {
+            const SampleStore* store;
+            const QVector<qint64>* events;
+            qint64 first;       // events or crossings in first to end - 1
+            qint64 end;
+            int markerChannel;
+            double level;
+            int numChannels;
+            int pre;
+            int post;
+        };
+
+        static EventAverage averageChunk(Chunk chunk);
+        void add(const SampleStore& store, qint64 scan, int from, int to);
+        void merge(const EventAverage& other);
+
+        int pre;
+        int post;
+        int eventCount;
+        // [chan][offset + preScans]
+        QVector<QVector<double> > sums;
+        QVector<QVector<double> > squares;
+        QVector<QVector<int> > counts;
+
+        QVector<Pending> pending;
+        QVector<double> buffer;
+};
+
+#endif
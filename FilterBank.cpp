@@ -0,0 +1,266 @@
+#include <QtCore>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "FilterBank.h"
+#include "DAQSettingsDialog/DAQSettingsDialog.h"
+
+enum { highpassSection, notchSection, lowpassSection };
+
+static const double pi = 3.14159265358979323846;
+
+FilterBank::FilterBank() :
+    numChans(0),
+    stride(0),
+    active(false),
+    useFir(false),
+    averageNs(0.0),
+    averagingScans(1.0)
+{
+    for (int s = 0; s < numSections; ++s)
+        sectionUsed[s] = false;
+}
+
+bool FilterBank::configure(const DAQSettings& settings, double dt)
+{
+    const double nyquist = 0.5/dt;
+    const int middle = (numTaps - 1)/2;
+
+    numChans = settings.numChannels;
+    stride = (numChans + 3) & ~3;
+
+    // every section and the FIR start out passing samples through
+    b0.fill(1.0, numSections*stride);
+    b1.fill(0.0, numSections*stride);
+    b2.fill(0.0, numSections*stride);
+    a1.fill(0.0, numSections*stride);
+    a2.fill(0.0, numSections*stride);
+    taps.fill(0.0, numTaps*stride);
+
+    active = false;
+    useFir = false;
+    for (int s = 0; s < numSections; ++s)
+        sectionUsed[s] = false;
+
+    for (int chan = 0; chan < stride; ++chan)
+        taps[middle*stride + chan] = 1.0;
+
+    // frequencies the sampling rate can't represent are ignored
+    for (int chan = 0; chan < numChans; ++chan) {
+        double highpass = settings.highpass[chan];
+        double notch = settings.notch[chan];
+        double lowpass = settings.lowpass[chan];
+
+        if (highpass > 0.0 && highpass < nyquist) {
+            setHighpass(chan, highpass, dt);
+            sectionUsed[highpassSection] = true;
+        }
+
+        if (notch > 0.0 && notch < nyquist) {
+            setNotch(chan, notch, dt);
+            sectionUsed[notchSection] = true;
+        }
+
+        // the FIR's passband can't be narrower than its main lobe
+        if (lowpass > 0.0 && lowpass*dt < 2.0/numTaps) {
+            setLowpass(chan, lowpass, dt);
+            sectionUsed[lowpassSection] = true;
+        }
+        else if (lowpass > 0.0 && lowpass < nyquist) {
+            setFirLowpass(chan, lowpass, dt);
+            useFir = true;
+        }
+    }
+
+    for (int s = 0; s < numSections; ++s)
+        active = active || sectionUsed[s];
+    active = active || useFir;
+
+    sum.fill(0.0, stride);
+    reset();
+
+    averageNs = 0.0;
+    averagingScans = qMax(1.0, 2.0/dt);
+
+    return active;
+}
+
+void FilterBank::reset()
+{
+    const int history = useFir ? numTaps - 1 : 0;
+
+    z1.fill(0.0, numSections*stride);
+    z2.fill(0.0, numSections*stride);
+    work.fill(0.0, history*stride);
+    missing.fill(0, history*stride);
+    lastGood.fill(0.0, stride);
+}
+
+// RBJ cookbook designs, normalised so that a0 is 1.
+void FilterBank::setHighpass(int chan, double frequency, double dt)
+{
+    const int i = highpassSection*stride + chan;
+    double w0 = 2.0*pi*frequency*dt;
+    double alpha = std::sin(w0)/(2.0*std::sqrt(0.5));
+    double a0 = 1.0 + alpha;
+
+    b0[i] = 0.5*(1.0 + std::cos(w0))/a0;
+    b1[i] = -(1.0 + std::cos(w0))/a0;
+    b2[i] = b0[i];
+    a1[i] = -2.0*std::cos(w0)/a0;
+    a2[i] = (1.0 - alpha)/a0;
+}
+
+void FilterBank::setLowpass(int chan, double frequency, double dt)
+{
+    const int i = lowpassSection*stride + chan;
+    double w0 = 2.0*pi*frequency*dt;
+    double alpha = std::sin(w0)/(2.0*std::sqrt(0.5));
+    double a0 = 1.0 + alpha;
+
+    b0[i] = 0.5*(1.0 - std::cos(w0))/a0;
+    b1[i] = (1.0 - std::cos(w0))/a0;
+    b2[i] = b0[i];
+    a1[i] = -2.0*std::cos(w0)/a0;
+    a2[i] = (1.0 - alpha)/a0;
+}
+
+void FilterBank::setNotch(int chan, double frequency, double dt)
+{
+    const int i = notchSection*stride + chan;
+    const double q = 30.0;
+    double w0 = 2.0*pi*frequency*dt;
+    double alpha = std::sin(w0)/(2.0*q);
+    double a0 = 1.0 + alpha;
+
+    b0[i] = 1.0/a0;
+    b1[i] = -2.0*std::cos(w0)/a0;
+    b2[i] = b0[i];
+    a1[i] = b1[i];
+    a2[i] = (1.0 - alpha)/a0;
+}
+
+// A Hamming-windowed sinc, scaled for unity gain at DC.
+void FilterBank::setFirLowpass(int chan, double frequency, double dt)
+{
+    const int middle = (numTaps - 1)/2;
+    const double fc = frequency*dt;     // cycles per scan
+    double total = 0.0;
+
+    for (int k = 0; k < numTaps; ++k) {
+        int m = k - middle;
+        double h = (m == 0) ? 2.0*fc : std::sin(2.0*pi*fc*m)/(pi*m);
+        h *= 0.54 - 0.46*std::cos(2.0*pi*k/(numTaps - 1));
+
+        taps[k*stride + chan] = h;
+        total += h;
+    }
+
+    for (int k = 0; k < numTaps; ++k)
+        taps[k*stride + chan] /= total;
+}
+
+void FilterBank::process(const qreal* const* in, qreal* const* out,
+        int numScans)
+{
+    if (!active || numScans <= 0)
+        return;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    const double nan = std::numeric_limits<double>::quiet_NaN();
+    const int history = useFir ? numTaps - 1 : 0;
+    const int delay = this->delay();
+
+    // the history stays at the front
+    work.resize((history + numScans)*stride);
+    missing.resize((history + numScans)*stride);
+
+    for (int chan = 0; chan < stride; ++chan) {
+        double* x = work.data() + history*stride + chan;
+        char* gone = missing.data() + history*stride + chan;
+
+        if (chan >= numChans) {
+            for (int i = 0; i < numScans; ++i)
+                x[i*stride] = 0.0;
+            continue;
+        }
+
+        const qreal* scans = in[chan];
+        double held = lastGood[chan];
+
+        for (int i = 0; i < numScans; ++i) {
+            bool isNan = scans[i] != scans[i];
+            if (!isNan)
+                held = scans[i];
+            x[i*stride] = held;
+            gone[i*stride] = isNan;
+        }
+
+        lastGood[chan] = held;
+    }
+
+    // one scan at a time, but every channel in each step
+    for (int s = 0; s < numSections; ++s) {
+        if (!sectionUsed[s])
+            continue;
+
+        const double* B0 = b0.constData() + s*stride;
+        const double* B1 = b1.constData() + s*stride;
+        const double* B2 = b2.constData() + s*stride;
+        const double* A1 = a1.constData() + s*stride;
+        const double* A2 = a2.constData() + s*stride;
+        double* Z1 = z1.data() + s*stride;
+        double* Z2 = z2.data() + s*stride;
+
+        for (int i = 0; i < numScans; ++i) {
+            double* x = work.data() + (history + i)*stride;
+
+            for (int c = 0; c < stride; ++c) {
+                double y = B0[c]*x[c] + Z1[c];
+                Z1[c] = B1[c]*x[c] - A1[c]*y + Z2[c];
+                Z2[c] = B2[c]*x[c] - A2[c]*y;
+                x[c] = y;
+            }
+        }
+    }
+
+    for (int i = 0; i < numScans; ++i) {
+        const double* x = work.constData() + (history + i)*stride;
+        const char* gone = missing.constData() + (history + i - delay)*stride;
+        const double* y = x;
+
+        if (useFir) {
+            double* acc = sum.data();
+
+            for (int c = 0; c < stride; ++c)
+                acc[c] = 0.0;
+
+            for (int k = 0; k < numTaps; ++k) {
+                const double* h = taps.constData() + k*stride;
+                const double* xk = x - k*stride;
+
+                for (int c = 0; c < stride; ++c)
+                    acc[c] += h[c]*xk[c];
+            }
+
+            y = acc;
+        }
+
+        for (int chan = 0; chan < numChans; ++chan)
+            out[chan][i] = gone[chan] ? nan : y[chan];
+    }
+
+    if (history > 0) {
+        std::copy(work.constEnd() - history*stride, work.constEnd(),
+                work.begin());
+        std::copy(missing.constEnd() - history*stride, missing.constEnd(),
+                missing.begin());
+    }
+
+    double ns = double(timer.nsecsElapsed())/numScans;
+    double weight = qMin(1.0, numScans/averagingScans);
+    averageNs = (averageNs == 0.0) ? ns : averageNs + weight*(ns - averageNs);
+}
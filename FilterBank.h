@@ -0,0 +1,78 @@
+#ifndef FILTERBANK_H
+#define FILTERBANK_H
+
+#include <QVector>
+#include <QtGlobal>
+
+struct DAQSettings;
+
+// The per-channel filters of DAQSettings (highpass, notch, lowpass), run
+// by FilterThread as blocks arrive.  The highpass (2nd-order Butterworth)
+// and notch (Q of 30) are biquads; the lowpass is a linear-phase FIR, so
+// it doesn't smear spike shapes, except below 2/numTaps of the sampling
+// rate, narrower than the FIR can resolve, where it's a 2nd-order
+// Butterworth biquad too.  Every channel runs the same cascade, with the
+// sections it doesn't use set to pass samples straight through, so each
+// section is one loop across all the channels at once, which the compiler
+// can vectorize.  When any channel has the FIR, every channel is delayed
+// by its (numTaps - 1)/2 scans, so they stay lined up with each other.
+//
+// NaN samples (padding for lost scans) come out as NaN, without upsetting
+// the filters' state.
+class FilterBank
+{
+    public:
+        enum { numSections = 3, numTaps = 63 };
+
+        FilterBank();
+
+        // Sets up the first settings.numChannels channels' filters at the
+        // given scan interval, and clears their state; returns isActive().
+        bool configure(const DAQSettings& settings, double dt);
+        // Clears the filters' state but keeps their settings, for when the
+        // scans fed in stop following on from the last ones.
+        void reset();
+        // whether any channel is filtered
+        bool isActive() const { return active; }
+        // scans the output is behind the input
+        int delay() const { return useFir ? (numTaps - 1)/2 : 0; }
+
+        // Filters numScans scans of each channel from in to out, which may
+        // be the same.
+        void process(const qreal* const* in, qreal* const* out,
+                int numScans);
+
+        // the time process() has taken per scan, averaged over the last
+        // few seconds
+        double nsPerScan() const { return averageNs; }
+
+    private:
+        void setHighpass(int chan, double frequency, double dt);
+        void setNotch(int chan, double frequency, double dt);
+        void setLowpass(int chan, double frequency, double dt);
+        void setFirLowpass(int chan, double frequency, double dt);
+
+        int numChans;
+        int stride;             // numChans rounded up to a multiple of 4
+        bool active;
+        bool sectionUsed[numSections];
+        bool useFir;
+
+        // [section*stride + chan]; transposed direct form II
+        QVector<double> b0, b1, b2, a1, a2;
+        QVector<double> z1, z2;
+        // [tap*stride + chan], the newest sample's tap first
+        QVector<double> taps;
+
+        // scans interleaved [scan*stride + chan]: the FIR's history, then
+        // the block being filtered
+        QVector<double> work;
+        QVector<char> missing;      // laid out the same, for NaN samples
+        QVector<double> lastGood;   // per channel, fed in place of NaN
+        QVector<double> sum;
+
+        double averageNs;
+        double averagingScans;  // the scans in the averaging time
+};
+
+#endif
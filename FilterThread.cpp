@@ -0,0 +1,275 @@
+#include <QtCore>
+#include <algorithm>
+#include <limits>
+
+#include "FilterThread.h"
+#include "DAQSettingsDialog/DAQSettingsDialog.h"
+
+FilterThread::FilterThread() :
+    active(false),
+    numChannels(0),
+    delayNs(0),
+    finished(true),
+    dirty(false),
+    averageNs(0.0),
+    resetScan(-1)
+{
+}
+
+FilterThread::~FilterThread()
+{
+    close();
+}
+
+bool FilterThread::open(const DAQSettings& settings, double dt)
+{
+    close();
+
+    QMutexLocker lock(&mutex);
+
+    active = filterBank.configure(settings, dt);
+    numChannels = settings.numChannels;
+    delayNs = qRound64(filterBank.delay()*dt*1e9);
+
+    QVector<QVector<qreal> >* buffers[] = {
+        &input, &outputRaw, &outputFiltered, &working, &rawPending,
+        &filtered, &doneRaw, &doneFiltered
+    };
+
+    // a second's worth up front, so the first blocks don't reallocate
+    for (unsigned b = 0; b < sizeof(buffers)/sizeof(buffers[0]); ++b) {
+        buffers[b]->resize(numChannels);
+
+        for (int chan = 0; chan < numChannels; ++chan) {
+            (*buffers[b])[chan].resize(0);
+            (*buffers[b])[chan].reserve(int(1/dt));
+        }
+    }
+
+    inputChunks.resize(0);
+    outputChunks.resize(0);
+    in.resize(numChannels);
+    out.resize(numChannels);
+
+    finished = false;
+    dirty = false;
+    last.firstScan = 0;
+    last.numScans = 0;
+    last.monotonicNs = 0;
+    last.realtimeNs = 0;
+    averageNs = 0.0;
+    resetScan = -1;
+
+    if (active)
+        QThread::start();
+
+    return active;
+}
+
+void FilterThread::close()
+{
+    if (!isRunning())
+        return;
+
+    flush();
+
+    {
+        QMutexLocker lock(&mutex);
+        finished = true;
+        dataReady.wakeOne();
+    }
+
+    wait();
+}
+
+void FilterThread::push(const qreal* const* scans, int numScans,
+        qint64 firstScan, qint64 monotonicNs, qint64 realtimeNs)
+{
+    QMutexLocker lock(&mutex);
+
+    for (int chan = 0; chan < numChannels; ++chan) {
+        QVector<qreal>& to = input[chan];
+        int first = to.count();
+
+        to.resize(first + numScans);
+        std::copy(scans[chan], scans[chan] + numScans, to.data() + first);
+    }
+
+    last.firstScan = firstScan;
+    last.numScans = numScans;
+    last.monotonicNs = monotonicNs;
+    last.realtimeNs = realtimeNs;
+    last.padding = false;
+
+    inputChunks.append(last);
+    dirty = true;
+    dataReady.wakeOne();
+}
+
+void FilterThread::take(QVector<QVector<qreal> >& raw,
+        QVector<QVector<qreal> >& filtered, QVector<Chunk>& chunks)
+{
+    QMutexLocker lock(&mutex);
+
+    qSwap(raw, outputRaw);
+    qSwap(filtered, outputFiltered);
+    qSwap(chunks, outputChunks);
+
+    outputRaw.resize(numChannels);
+    outputFiltered.resize(numChannels);
+
+    for (int chan = 0; chan < numChannels; ++chan) {
+        outputRaw[chan].resize(0);
+        outputFiltered[chan].resize(0);
+    }
+
+    outputChunks.resize(0);
+}
+
+// The scans still in the filters come out as NaN goes in behind them, a
+// chunk of it after the last scan pushed, which the thread takes as its
+// cue to start afresh.  With nothing pushed since the last flush the
+// chunk is empty, but still marks its place.
+void FilterThread::flush()
+{
+    QMutexLocker lock(&mutex);
+
+    const double nan = std::numeric_limits<double>::quiet_NaN();
+    const int delay = dirty ? filterBank.delay() : 0;
+
+    for (int chan = 0; chan < numChannels; ++chan) {
+        QVector<qreal>& to = input[chan];
+        int first = to.count();
+
+        to.resize(first + delay);
+        std::fill(to.begin() + first, to.end(), nan);
+    }
+
+    Chunk padding = last;
+    padding.firstScan = last.firstScan + last.numScans;
+    padding.numScans = delay;
+    padding.monotonicNs += delayNs;
+    padding.realtimeNs += delayNs;
+    padding.padding = true;
+
+    inputChunks.append(padding);
+    dirty = false;
+    dataReady.wakeOne();
+}
+
+double FilterThread::nsPerScan()
+{
+    QMutexLocker lock(&mutex);
+    return averageNs;
+}
+
+void FilterThread::run()
+{
+    forever {
+        {
+            QMutexLocker lock(&mutex);
+
+            while (inputChunks.isEmpty() && !finished)
+                dataReady.wait(&mutex);
+
+            if (inputChunks.isEmpty())
+                break;
+
+            // as in DiskWriter, swapping means neither side allocates
+            // once they've both grown
+            qSwap(working, input);
+            qSwap(workingChunks, inputChunks);
+
+            for (int chan = 0; chan < numChannels; ++chan)
+                input[chan].resize(0);
+            inputChunks.resize(0);
+        }
+
+        int offset = 0;
+
+        foreach (const Chunk& chunk, workingChunks) {
+            filter(chunk, offset);
+            offset += chunk.numScans;
+        }
+
+        QMutexLocker lock(&mutex);
+
+        for (int chan = 0; chan < numChannels; ++chan) {
+            outputRaw[chan] += doneRaw[chan];
+            outputFiltered[chan] += doneFiltered[chan];
+            doneRaw[chan].resize(0);
+            doneFiltered[chan].resize(0);
+        }
+
+        outputChunks += doneChunks;
+        doneChunks.resize(0);
+
+        averageNs = filterBank.nsPerScan();
+    }
+}
+
+// Filters the chunk that starts at offset in working, and adds the scans
+// whose filtered output that completes to the done vectors.
+void FilterThread::filter(const Chunk& chunk, int offset)
+{
+    const int delay = filterBank.delay();
+    const int numScans = chunk.numScans;
+
+    if (resetScan < 0)
+        resetScan = chunk.firstScan;
+
+    for (int chan = 0; chan < numChannels; ++chan) {
+        in[chan] = working[chan].constData() + offset;
+        filtered[chan].resize(numScans);
+        out[chan] = filtered[chan].data();
+    }
+
+    filterBank.process(in.constData(), out.constData(), numScans);
+
+    if (!chunk.padding)
+        append(rawPending, working, offset, numScans);
+
+    // what comes out first after a reset is from before it
+    qint64 first = qMax(chunk.firstScan - delay, resetScan);
+    int numOut = int(chunk.firstScan + numScans - delay - first);
+
+    if (numOut > 0) {
+        append(doneFiltered, filtered, numScans - numOut, numOut);
+        append(doneRaw, rawPending, 0, numOut);
+
+        for (int chan = 0; chan < numChannels; ++chan)
+            rawPending[chan].remove(0, numOut);
+
+        Chunk done = chunk;
+        done.firstScan = first;
+        done.numScans = numOut;
+        done.monotonicNs -= delayNs;
+        done.realtimeNs -= delayNs;
+        done.padding = false;
+        doneChunks.append(done);
+    }
+
+    if (chunk.padding) {
+        Chunk end = chunk;
+        end.numScans = 0;
+        doneChunks.append(end);
+
+        filterBank.reset();
+        resetScan = -1;
+
+        for (int chan = 0; chan < numChannels; ++chan)
+            rawPending[chan].resize(0);
+    }
+}
+
+void FilterThread::append(QVector<QVector<qreal> >& to,
+        const QVector<QVector<qreal> >& from, int offset, int numScans)
+{
+    for (int chan = 0; chan < numChannels; ++chan) {
+        const qreal* scans = from[chan].constData() + offset;
+        int first = to[chan].count();
+
+        to[chan].resize(first + numScans);
+        std::copy(scans, scans + numScans, to[chan].data() + first);
+    }
+}
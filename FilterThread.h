@@ -0,0 +1,101 @@
+#ifndef FILTERTHREAD_H
+#define FILTERTHREAD_H
+
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QVector>
+#include "FilterBank.h"
+
+struct DAQSettings;
+
+// Runs a FilterBank on its own thread, so that the acquisition thread only
+// copies each block in and takes back whatever has been filtered so far,
+// as DiskWriter does.  What comes back is labelled with the scans it
+// belongs to, its delay taken off: the FIR's output for a scan only
+// appears (numTaps - 1)/2 scans later, so the unfiltered scans are held
+// back to match, and the times are moved back by the same amount.  When
+// the scans stop following on (a gap, or the end of the recording),
+// flush() queues a push of the last of them through, and the filters start
+// afresh after it; where those scans end comes back as a chunk of its own,
+// so that a gap can be reported in its place.
+class FilterThread : public QThread
+{
+    public:
+        // a run of contiguous scans, and CLOCK_MONOTONIC and
+        // CLOCK_REALTIME for the last of them, as in ScanBlock
+        struct Chunk
+        {
+            qint64 firstScan;
+            int numScans;
+            qint64 monotonicNs;
+            qint64 realtimeNs;
+            // going in, pushed by flush() rather than acquired; coming
+            // out, no scans, just where a flush's scans end
+            bool padding;
+        };
+
+        FilterThread();
+        ~FilterThread();
+
+        // Sets up the filters and, if anything is filtered, starts the
+        // thread; returns isActive().
+        bool open(const DAQSettings& settings, double dt);
+        // flushes, then waits for the thread to finish
+        void close();
+        bool isActive() const { return active; }
+
+        // copies numScans scans of each channel in
+        void push(const qreal* const* scans, int numScans, qint64 firstScan,
+                qint64 monotonicNs, qint64 realtimeNs);
+        // Swaps out everything filtered so far: the unfiltered and
+        // filtered scans, per channel, and the chunks they make up.  Pass
+        // the same vectors each time, so that neither side allocates once
+        // they've grown.
+        void take(QVector<QVector<qreal> >& raw,
+                QVector<QVector<qreal> >& filtered, QVector<Chunk>& chunks);
+        // Queues the scans still in the filters to be pushed through,
+        // without waiting for them.
+        void flush();
+
+        double nsPerScan();
+
+    protected:
+        void run();
+
+    private:
+        void filter(const Chunk& chunk, int offset);
+        void append(QVector<QVector<qreal> >& to,
+                const QVector<QVector<qreal> >& from, int offset,
+                int numScans);
+
+        FilterBank filterBank;
+        bool active;
+        int numChannels;
+        qint64 delayNs;
+
+        QMutex mutex;
+        QWaitCondition dataReady;
+        QVector<QVector<qreal> > input;
+        QVector<Chunk> inputChunks;
+        QVector<QVector<qreal> > outputRaw, outputFiltered;
+        QVector<Chunk> outputChunks;
+        bool finished;
+        bool dirty;         // pushed to since the last flush
+        Chunk last;         // the last chunk pushed
+        double averageNs;
+
+        // the thread's own: what it's working on, the scans its output
+        // has yet to catch up with, and where they started
+        QVector<QVector<qreal> > working;
+        QVector<Chunk> workingChunks;
+        QVector<QVector<qreal> > rawPending;
+        QVector<QVector<qreal> > filtered;
+        QVector<QVector<qreal> > doneRaw, doneFiltered;
+        QVector<Chunk> doneChunks;
+        QVector<const qreal*> in;
+        QVector<qreal*> out;
+        qint64 resetScan;
+};
+
+#endif
@@ -0,0 +1,273 @@
+#include <QtCore>
+#include <QtNetwork>
+
+#include "HeadlessRecorder.h"
+
+static const char* controlSocketName = "GDAQRec-control";
+
+HeadlessRecorder::HeadlessRecorder(const QString& outputDir_) :
+    server(NULL),
+    outputDir(outputDir_),
+    numSpikes(0),
+    quitWhenStopped(false)
+{
+    daqSettings.restore();
+    daqReader.updateDAQSettings(daqSettings);
+    daqReader.addSink(&sampleFeed);
+    daqReader.addSink(&sharedClock);
+    daqReader.addSink(&streamServer);
+    daqReader.addSink(&diskWriter);
+    daqReader.addSink(&spikeDetector);
+    streamServer.updateSettings(daqSettings);
+
+    connect(&daqReader, SIGNAL(newData()), this, SLOT(discardData()));
+    connect(&daqReader, SIGNAL(daqError(const QString&)),
+            this, SLOT(daqError(const QString&)));
+    connect(&daqReader, SIGNAL(realtimeWarning(const QString&)),
+            this, SLOT(realtimeWarning(const QString&)));
+    connect(&daqReader, SIGNAL(finished()), this, SLOT(readerFinished()));
+}
+
+HeadlessRecorder::~HeadlessRecorder()
+{
+    daqReader.stop();
+    daqReader.wait();
+    diskWriter.close();
+}
+
+bool HeadlessRecorder::listen()
+{
+    server = new QLocalServer(this);
+    QLocalServer::removeServer(controlSocketName);
+
+    if (!server->listen(controlSocketName)) {
+        qWarning("GDAQrec: could not listen on %s: %s", controlSocketName,
+                qPrintable(server->errorString()));
+        return false;
+    }
+
+    connect(server, SIGNAL(newConnection()), this, SLOT(newConnection()));
+    return true;
+}
+
+void HeadlessRecorder::newConnection()
+{
+    while (server->hasPendingConnections()) {
+        QLocalSocket* socket = server->nextPendingConnection();
+        connect(socket, SIGNAL(readyRead()), this, SLOT(readCommands()));
+        connect(socket, SIGNAL(disconnected()), socket, SLOT(deleteLater()));
+    }
+}
+
+void HeadlessRecorder::readCommands()
+{
+    QLocalSocket* socket = qobject_cast<QLocalSocket*>(sender());
+
+    while (socket->canReadLine()) {
+        QString command = QString::fromUtf8(socket->readLine()).trimmed();
+
+        if (!command.isEmpty())
+            socket->write(execute(command).toUtf8() + "\n");
+    }
+}
+
+QString HeadlessRecorder::execute(const QString& command)
+{
+    QString verb = command.section(' ', 0, 0);
+    QString argument = command.section(' ', 1).trimmed();
+
+    if (verb == "start")
+        return start(argument);
+    else if (verb == "stop")
+        return stop();
+    else if (verb == "status")
+        return status();
+    else if (verb == "marker")
+        return marker(argument);
+    else if (verb == "trigger")
+        return trigger();
+    else if (verb == "quit") {
+        if (daqReader.isRunning()) {
+            quitWhenStopped = true;
+            return stop();
+        }
+
+        QCoreApplication::quit();
+        return "ok";
+    }
+
+    return "error unknown command \"" + verb + "\"";
+}
+
+QString HeadlessRecorder::start(const QString& requestedFileName)
+{
+    if (daqReader.isRunning())
+        return "error already recording to " + fileName;
+
+    if (requestedFileName.isEmpty()) {
+        fileName = QDateTime::currentDateTimeUtc().toString(Qt::ISODate)
+            + ".csv";
+        fileName.remove(':');
+    }
+    else {
+        fileName = requestedFileName;
+    }
+
+    fileName = QDir(outputDir).absoluteFilePath(fileName);
+
+    if (!diskWriter.open(fileName))
+        return "error could not create " + fileName;
+
+    markers.close();
+    markers.setFileName(fileName + ".markers");
+    spikeFile.close();
+    spikeFile.setFileName(fileName + ".spikes");
+    numSpikes = 0;
+
+    lastError = QString();
+    lastRealtimeWarning = QString();
+    elapsed.start();
+    daqReader.start();
+
+    return "ok recording to " + fileName;
+}
+
+QString HeadlessRecorder::stop()
+{
+    if (!daqReader.isRunning())
+        return "error not recording";
+
+    daqReader.stop();
+    return "ok";
+}
+
+QString HeadlessRecorder::marker(const QString& text)
+{
+    if (!daqReader.isRunning())
+        return "error not recording";
+
+    if (!markers.isOpen() && !markers.open(QIODevice::WriteOnly))
+        return "error could not create " + markers.fileName();
+
+    double time = daqReader.recordingTime();
+
+    markers.write(QString("%1,%2\n").arg(time, 0, 'f', 6).arg(text).toUtf8());
+    markers.flush();
+
+    return QString("ok %1").arg(time, 0, 'f', 6);
+}
+
+QString HeadlessRecorder::trigger()
+{
+    if (!daqReader.isRunning())
+        return "error not recording";
+
+    if (!daqReader.trigger())
+        return "error not recording only around triggers";
+
+    return "ok";
+}
+
+// Same format as Plotter's: time,channel on each line.
+void HeadlessRecorder::saveSpikes()
+{
+    newSpikes.resize(0);
+    if (spikeDetector.takeSpikes(&newSpikes, 0.0) == 0)
+        return;
+
+    numSpikes += newSpikes.count();
+
+    if (!spikeFile.isOpen() && !spikeFile.open(QIODevice::WriteOnly)) {
+        qWarning("GDAQrec: could not create %s",
+                qPrintable(spikeFile.fileName()));
+        return;
+    }
+
+    QByteArray lines;
+    for (int i = 0; i < newSpikes.count(); ++i) {
+        lines += QString("%1,%2\n").arg(newSpikes[i].time, 0, 'f', 6)
+            .arg(newSpikes[i].channel).toAscii();
+    }
+
+    spikeFile.write(lines);
+    spikeFile.flush();
+}
+
+QString HeadlessRecorder::status()
+{
+    bool recording = daqReader.isRunning();
+    qint64 scans = daqReader.scansAcquired();
+    double seconds = elapsed.isValid() ? elapsed.elapsed()/1000.0 : 0.0;
+
+    QString result = QString("ok state=%1 file=%2 seconds=%3 scans=%4 "
+            "rate=%5 dropped=%6 written=%7 bytes=%8 backlog=%9 ")
+        .arg(recording ? "recording" : "stopped")
+        .arg(fileName.isEmpty() ? "-" : fileName)
+        .arg(seconds, 0, 'f', 1)
+        .arg(scans)
+        .arg(seconds > 0.0 ? scans/seconds : 0.0, 0, 'f', 1)
+        .arg(daqReader.scansDropped())
+        .arg(diskWriter.scansWritten())
+        .arg(diskWriter.bytesWritten())
+        .arg(diskWriter.backlog());
+
+    AcquisitionStats stats = daqReader.acquisitionStats();
+
+    result += QString("max_backlog=%1 lost=%2 device_buffer=%3 "
+            "device_buffer_max=%4 device_buffer_size=%5 gaps=%6 "
+            "skew_ns=%7 padded=%8 ")
+        .arg(diskWriter.maxBacklog())
+        .arg(diskWriter.scansLost())
+        .arg(stats.bufferUsed)
+        .arg(stats.bufferHighWater)
+        .arg(stats.bufferSize)
+        .arg(stats.numGaps)
+        .arg(stats.skewNs)
+        .arg(stats.scansPadded);
+
+    result += QString("spikes=%1 filter_ns=%2 triggers=%3 kept=%4")
+        .arg(numSpikes)
+        .arg(stats.filterNsPerScan, 0, 'f', 1)
+        .arg(stats.numTriggers)
+        .arg(stats.scansKept);
+
+    if (!lastError.isEmpty())
+        result += " error=\"" + lastError.simplified() + "\"";
+    if (!lastRealtimeWarning.isEmpty())
+        result += " realtime=\"" + lastRealtimeWarning.simplified() + "\"";
+
+    return result;
+}
+
+void HeadlessRecorder::discardData()
+{
+    daqReader.discardData();
+    saveSpikes();
+}
+
+void HeadlessRecorder::daqError(const QString& errorMessage)
+{
+    lastError = errorMessage;
+    qWarning("GDAQrec: DAQ error: %s", qPrintable(errorMessage));
+}
+
+void HeadlessRecorder::realtimeWarning(const QString& message)
+{
+    lastRealtimeWarning = message;
+    qWarning("GDAQrec: %s", qPrintable(message));
+}
+
+void HeadlessRecorder::readerFinished()
+{
+    // also covers recordings that failed to start
+    diskWriter.close();
+    saveSpikes();
+    spikeFile.close();
+    markers.close();
+
+    if (daqReader.scansAcquired() > 0)
+        daqReader.writeStats(fileName + ".stats");
+
+    if (quitWhenStopped)
+        QCoreApplication::quit();
+}
@@ -0,0 +1,80 @@
+#ifndef HEADLESSRECORDER_H
+#define HEADLESSRECORDER_H
+
+#include <QObject>
+#include <QFile>
+#include <QElapsedTimer>
+#include "DAQReader.h"
+#include "DiskWriter.h"
+#include "SampleFeed.h"
+#include "SharedClock.h"
+#include "SpikeDetector.h"
+#include "StreamServer.h"
+
+class QLocalServer;
+
+// Records without the GUI (GDAQrec --headless), using the saved settings
+// and streaming straight to disk.  It is driven by one-line text commands
+// on the local socket GDAQRec-control, each answered with one line
+// starting "ok" or "error":
+//   start [file]   start recording to file (default: the start time, .csv)
+//   stop           stop recording
+//   status         state, throughput and buffer health as key=value pairs
+//                  (dropped and gaps are scans the DAQ's buffer lost; lost
+//                  is scans the disk writer couldn't keep up with; skew
+//                  and padded are for recordings from several boards)
+//   marker text    note text at the current time in <file>.markers
+//   trigger        a trigger now, when only the scans around triggers are
+//                  recorded (see TriggerGate)
+//   quit           stop recording and exit
+// Spikes found during the recording (see SpikeDetector) are appended to
+// <file>.spikes as they come in.
+class HeadlessRecorder : public QObject
+{
+    Q_OBJECT
+
+    public:
+        HeadlessRecorder(const QString& outputDir);
+        ~HeadlessRecorder();
+
+        bool listen();
+        QString start(const QString& fileName = QString());
+
+    private slots:
+        void newConnection();
+        void readCommands();
+        void discardData();
+        void daqError(const QString& errorMessage);
+        void realtimeWarning(const QString& message);
+        void readerFinished();
+
+    private:
+        QString execute(const QString& command);
+        QString stop();
+        QString status();
+        QString marker(const QString& text);
+        QString trigger();
+        void saveSpikes();
+
+        DAQSettings daqSettings;
+        SampleFeed sampleFeed;
+        SharedClock sharedClock;
+        StreamServer streamServer;
+        DiskWriter diskWriter;
+        SpikeDetector spikeDetector;
+        DAQReader daqReader;
+
+        QLocalServer* server;
+        QString outputDir;
+        QString fileName;
+        QFile markers;
+        QFile spikeFile;
+        QVector<Spike> newSpikes;
+        qint64 numSpikes;
+        QElapsedTimer elapsed;
+        QString lastError;
+        QString lastRealtimeWarning;
+        bool quitWhenStopped;
+};
+
+#endif
@@ -0,0 +1,192 @@
+#include <QtCore>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <limits>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "SampleFeed.h"
+
+SampleFeed::SampleFeed(const char* name_) :
+    name(name_),
+    map(NULL),
+    mapSize(0),
+    header(NULL),
+    numChannels(0),
+    capacity(0),
+    writeIndex(0)
+{
+}
+
+SampleFeed::~SampleFeed()
+{
+    close();
+}
+
+void SampleFeed::startedRecording(const DAQSettings& settings, double dt)
+{
+    close();
+
+    numChannels = qMin(settings.numChannels, int(GDAQ_FEED_MAX_CHANNELS));
+    writeIndex = 0;
+
+    capacity = 1;
+    while (capacity < quint64(bufferLength/dt)) {
+        capacity *= 2;
+    }
+
+    // samples start on a page boundary after the header
+    const size_t pageSize = sysconf(_SC_PAGESIZE);
+    size_t dataOffset =
+        (sizeof(gdaq_feed_header) + pageSize - 1) / pageSize * pageSize;
+    mapSize = dataOffset + numChannels*capacity*sizeof(double);
+
+    // Readers still attached to a previous recording keep their (stopped)
+    // segment; new readers get a fresh one sized for these settings.
+    shm_unlink(name.constData());
+    int fd = shm_open(name.constData(), O_RDWR | O_CREAT | O_EXCL, 0644);
+
+    if (fd < 0) {
+        qWarning("SampleFeed: could not create %s: %s",
+                name.constData(), strerror(errno));
+        return;
+    }
+
+    if (ftruncate(fd, mapSize) < 0) {
+        qWarning("SampleFeed: could not size %s: %s",
+                name.constData(), strerror(errno));
+        ::close(fd);
+        shm_unlink(name.constData());
+        return;
+    }
+
+    map = mmap(NULL, mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+
+    if (map == MAP_FAILED) {
+        qWarning("SampleFeed: could not map %s: %s",
+                name.constData(), strerror(errno));
+        map = NULL;
+        shm_unlink(name.constData());
+        return;
+    }
+
+    // touch every page now rather than on the first pass through the ring
+    memset(map, 0, mapSize);
+
+    header = static_cast<gdaq_feed_header*>(map);
+    header->magic = GDAQ_FEED_MAGIC;
+    header->version = GDAQ_FEED_VERSION;
+    header->header_size = sizeof(gdaq_feed_header);
+    header->num_channels = numChannels;
+    header->sample_format = GDAQ_FEED_FLOAT64;
+    header->session = QDateTime::currentMSecsSinceEpoch();
+    header->capacity = capacity;
+    header->sampling_rate = 1.0/dt;
+
+    for (int chan = 0; chan < numChannels; ++chan) {
+        gdaq_feed_channel& channel = header->channels[chan];
+        channel.physical_channel = settings.input[chan];
+        channel.device = settings.device[chan];
+        channel.min_voltage = settings.minVoltage[chan];
+        channel.max_voltage = settings.maxVoltage[chan];
+        channel.scale = 1.0;
+        channel.offset = 0.0;
+        channel.data_offset = dataOffset + chan*capacity*sizeof(double);
+
+        channelData[chan] = reinterpret_cast<double*>(
+                static_cast<char*>(map) + channel.data_offset);
+    }
+
+    __atomic_store_n(&header->state, quint32(GDAQ_FEED_RECORDING),
+            __ATOMIC_RELEASE);
+}
+
+void SampleFeed::newScans(const ScanBlock& block)
+{
+    if (header == NULL)
+        return;
+
+    int numScans = block.numScans;
+
+    // only the most recent capacity scans would survive anyway
+    int skip = 0;
+    if (quint64(numScans) > capacity) {
+        skip = numScans - int(capacity);
+        writeIndex += skip;
+        numScans = int(capacity);
+    }
+
+    // Announce the range about to be overwritten before touching it, so
+    // that readers can tell if the samples they used were replaced.
+    __atomic_store_n(&header->claim_index, writeIndex + numScans,
+            __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    quint64 first = writeIndex & (capacity - 1);
+    int beforeWrap = int(qMin(quint64(numScans), capacity - first));
+
+    for (int chan = 0; chan < numChannels; ++chan) {
+        const qreal* in = block.scans[chan] + skip;
+        std::copy(in, in + beforeWrap, channelData[chan] + first);
+        std::copy(in + beforeWrap, in + numScans, channelData[chan]);
+    }
+
+    writeIndex += numScans;
+    __atomic_store_n(&header->write_index, writeIndex, __ATOMIC_RELEASE);
+}
+
+// Publishes scans the device lost as NaN, so that ring indices stay equal
+// to scan numbers.
+void SampleFeed::scansLost(const ScanGap& gap)
+{
+    if (header == NULL)
+        return;
+
+    quint64 numScans = gap.numScans;
+
+    if (numScans > capacity) {
+        writeIndex += numScans - capacity;
+        numScans = capacity;
+    }
+
+    __atomic_store_n(&header->claim_index, writeIndex + numScans,
+            __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    quint64 first = writeIndex & (capacity - 1);
+    quint64 beforeWrap = qMin(numScans, capacity - first);
+    const double nan = std::numeric_limits<double>::quiet_NaN();
+
+    for (int chan = 0; chan < numChannels; ++chan) {
+        std::fill(channelData[chan] + first,
+                channelData[chan] + first + beforeWrap, nan);
+        std::fill(channelData[chan],
+                channelData[chan] + (numScans - beforeWrap), nan);
+    }
+
+    writeIndex += numScans;
+    __atomic_store_n(&header->write_index, writeIndex, __ATOMIC_RELEASE);
+}
+
+void SampleFeed::stoppedRecording()
+{
+    if (header != NULL) {
+        __atomic_store_n(&header->state, quint32(GDAQ_FEED_STOPPED),
+                __ATOMIC_RELEASE);
+    }
+}
+
+void SampleFeed::close()
+{
+    if (map != NULL) {
+        stoppedRecording();
+        munmap(map, mapSize);
+        shm_unlink(name.constData());
+    }
+
+    map = NULL;
+    header = NULL;
+}
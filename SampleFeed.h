@@ -0,0 +1,37 @@
+#ifndef SAMPLEFEED_H
+#define SAMPLEFEED_H
+
+#include <QByteArray>
+#include "DAQSink.h"
+#include "feed/gdaqfeed.h"
+
+// Publishes the live samples in POSIX shared memory for other processes on
+// this machine (see feed/gdaqfeed.h for the layout and a reader library).
+// Written directly from the acquisition thread.
+class SampleFeed : public DAQSink
+{
+    public:
+        SampleFeed(const char* name = GDAQ_FEED_DEFAULT_NAME);
+        ~SampleFeed();
+
+        void startedRecording(const DAQSettings& settings, double dt);
+        void newScans(const ScanBlock& block);
+        void scansLost(const ScanGap& gap);
+        void stoppedRecording();
+
+    private:
+        void close();
+
+        enum { bufferLength = 10 }; // seconds of data kept for readers
+
+        QByteArray name;
+        void* map;
+        size_t mapSize;
+        gdaq_feed_header* header;
+        double* channelData[GDAQ_FEED_MAX_CHANNELS];
+        int numChannels;
+        quint64 capacity;
+        quint64 writeIndex;
+};
+
+#endif
@@ -0,0 +1,700 @@
+#include <QDir>
+#include <QTemporaryFile>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include "SampleStore.h"
+
+
+SampleStore::Calibration SampleStore::Calibration::forRange(
+        double min, double max, unsigned long maxData)
+{
+    if (maxData > missingCode || maxData == 0)
+        maxData = maxCode;
+
+    Calibration calibration;
+    calibration.offset = min;
+    calibration.scale = (max - min)/maxData;
+    return calibration;
+}
+
+
+// The nearest code to volts, NaN as missingCode.
+static inline quint16 toCode(double volts, double offset, double perVolt)
+{
+    double code = (volts - offset)*perVolt;
+
+    if (volts != volts)
+        return SampleStore::missingCode;
+    if (code <= 0.0)
+        return 0;
+    if (code >= SampleStore::maxCode)
+        return SampleStore::maxCode;
+    return quint16(code + 0.5);
+}
+
+
+// Written as a straight loop so the compiler can vectorize it.
+static void codesToVolts(const quint16* in, int count,
+        const SampleStore::Calibration& calibration, double* out)
+{
+    const double offset = calibration.offset;
+    const double scale = calibration.scale;
+    const double nan = std::numeric_limits<double>::quiet_NaN();
+
+    for (int i = 0; i < count; ++i)
+        out[i] = in[i] == SampleStore::missingCode ? nan : offset + scale*in[i];
+}
+
+
+SampleStore::SampleStore() :
+    retention(0.0),
+    spillFile(NULL),
+    spillCache(spillCacheBytes)
+{
+    clear();
+}
+
+
+SampleStore::~SampleStore()
+{
+    removeSpillFile();
+}
+
+
+void SampleStore::clear()
+{
+    numChans = 0;
+    numInputs = 0;
+    numScans = 0;
+    raw = false;
+    calibration.clear();
+    volts.clear();
+    codes.clear();
+    vectorFirst = 0;
+    summary.clear();
+    segments.clear();
+    nextTime = 0.0;
+    contiguous = false;
+
+    removeSpillFile();
+    spillBlocks.clear();
+    spilledScans = 0;
+    spillBytes = 0;
+    spillFailure.clear();
+}
+
+
+void SampleStore::setRetention(double seconds)
+{
+    retention = qMax(0.0, seconds);
+    spillOldScans();
+}
+
+
+int SampleStore::bytesPerSample() const
+{
+    return raw ? sizeof(quint16) : sizeof(double);
+}
+
+
+void SampleStore::setLayout(int numChannels,
+        const QVector<Calibration>& calibration_)
+{
+    bool wantRaw = !calibration_.isEmpty();
+
+    if (numScans == 0) {
+        numChans = numInputs = numChannels;
+        raw = wantRaw;
+        calibration = calibration_;
+        volts = QVector<QVector<double> >(raw ? 0 : numChannels);
+        codes = QVector<QVector<quint16> >(raw ? numChannels : 0);
+        summary.setNumChannels(numChannels);
+        return;
+    }
+
+    numInputs = numChannels;
+
+    if (raw && wantRaw && numChannels == numChans
+            && calibration_ == calibration)
+        return;
+
+    // a different recording after this one: its channels needn't line up
+    // with these, so keep everything as volts from here on
+    convertToVolts();
+    widen(numChannels);
+}
+
+
+void SampleStore::appendScans(const qreal* const* channels, int numNew,
+        double dt)
+{
+    if (numNew <= 0)
+        return;
+
+    if (!contiguous || segments.last().dt != dt)
+        startSegment(nextTime, dt);
+
+    const double nan = std::numeric_limits<double>::quiet_NaN();
+    const int numKept = int(numScans - vectorFirst);
+
+    for (int chan = 0; chan < numChans; ++chan) {
+        const qreal* in = chan < numInputs ? channels[chan] : NULL;
+
+        if (raw) {
+            QVector<quint16>& stored = codes[chan];
+            stored.resize(numKept + numNew);
+            quint16* out = stored.data() + numKept;
+            const double offset = calibration[chan].offset;
+            const double perVolt = 1.0/calibration[chan].scale;
+
+            for (int i = 0; i < numNew; ++i)
+                out[i] = toCode(in[i], offset, perVolt);
+        }
+        else {
+            QVector<double>& stored = volts[chan];
+            stored.resize(numKept + numNew);
+            double* out = stored.data() + numKept;
+
+            for (int i = 0; i < numNew; ++i)
+                out[i] = in ? in[i] : nan;
+        }
+    }
+
+    summary.appendScans(channels, numInputs, numNew);
+    numScans += numNew;
+
+    const Segment& segment = segments.last();
+    nextTime = segment.firstTime + (numScans - segment.firstScan)*dt;
+    contiguous = true;
+
+    spillOldScans();
+}
+
+
+void SampleStore::skipScans(qint64 numSkipped, double dt)
+{
+    if (numSkipped <= 0)
+        return;
+
+    nextTime += numSkipped*dt;
+    contiguous = false;
+}
+
+
+// A block at a time, so that other's spilled scans are read back, and
+// this store's own retention window applies, as they're copied.
+void SampleStore::copyFrom(const SampleStore& other)
+{
+    clear();
+    setLayout(other.numChans, other.raw
+            ? other.calibration : QVector<Calibration>());
+
+    const int blockScans = 4096;
+    QVector<QVector<double> > buffer(numChans, QVector<double>(blockScans));
+    QVector<const qreal*> channels(numChans);
+
+    for (int chan = 0; chan < numChans; ++chan)
+        channels[chan] = buffer[chan].constData();
+
+    for (int s = 0; s < other.segments.count(); ++s) {
+        const Segment& segment = other.segments[s];
+        qint64 end = (s + 1 < other.segments.count())
+            ? other.segments[s + 1].firstScan : other.numScans;
+
+        nextTime = segment.firstTime;
+        contiguous = false;
+
+        for (qint64 first = segment.firstScan; first < end;
+                first += blockScans) {
+            int count = int(qMin(qint64(blockScans), end - first));
+
+            for (int chan = 0; chan < numChans; ++chan)
+                other.values(chan, first, count, buffer[chan].data());
+
+            appendScans(channels.constData(), count, segment.dt);
+        }
+    }
+
+    nextTime = other.nextTime;
+    contiguous = other.contiguous;
+}
+
+
+// A file's times are only written to the microsecond, so the spacing of
+// a run is re-estimated from the whole run as it grows, and a scan more
+// than half an interval from where the run predicts starts a new one.
+void SampleStore::appendScan(double time, const qreal* values)
+{
+    bool fits = false;
+
+    if (contiguous) {
+        Segment& segment = segments.last();
+        qint64 index = numScans - segment.firstScan;
+
+        if (index == 1 && time > segment.firstTime) {
+            fits = true;
+        }
+        else if (index > 1) {
+            double predicted = segment.firstTime + index*segment.dt;
+            fits = qAbs(time - predicted) <= 0.5*segment.dt;
+        }
+
+        if (fits)
+            segment.dt = (time - segment.firstTime)/index;
+    }
+
+    if (!fits)
+        startSegment(time, 0.0);
+
+    const double nan = std::numeric_limits<double>::quiet_NaN();
+
+    for (int chan = 0; chan < numChans; ++chan) {
+        double value = chan < numInputs ? values[chan] : nan;
+
+        if (raw) {
+            codes[chan].append(toCode(value, calibration[chan].offset,
+                        1.0/calibration[chan].scale));
+        }
+        else {
+            volts[chan].append(value);
+        }
+    }
+
+    summary.appendScan(values, numInputs);
+    ++numScans;
+
+    const Segment& segment = segments.last();
+    nextTime = time + segment.dt;
+    contiguous = true;
+
+    if (numScans % 4096 == 0)
+        spillOldScans();
+}
+
+
+void SampleStore::startSegment(double time, double dt)
+{
+    Segment segment;
+    segment.firstScan = numScans;
+    segment.firstTime = time;
+    segment.dt = dt;
+    segments.append(segment);
+}
+
+
+int SampleStore::segmentOf(qint64 scan) const
+{
+    int low = 0;
+    int high = segments.count();
+
+    // the last segment starting at or before scan
+    while (low + 1 < high) {
+        int mid = (low + high)/2;
+
+        if (segments[mid].firstScan <= scan)
+            low = mid;
+        else
+            high = mid;
+    }
+
+    return low;
+}
+
+
+double SampleStore::time(qint64 scan) const
+{
+    const Segment& segment = segments[segmentOf(scan)];
+    return segment.firstTime + (scan - segment.firstScan)*segment.dt;
+}
+
+
+double SampleStore::scanInterval(qint64 scan) const
+{
+    return segments[segmentOf(scan)].dt;
+}
+
+
+qint64 SampleStore::lowerBound(double t) const
+{
+    int low = 0;
+    int high = segments.count();
+
+    // the first segment starting after t
+    while (low < high) {
+        int mid = (low + high)/2;
+
+        if (segments[mid].firstTime <= t)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    if (low == 0)
+        return 0;
+
+    const Segment& segment = segments[low - 1];
+    qint64 end = low < segments.count() ? segments[low].firstScan : numScans;
+
+    if (t == segment.firstTime)
+        return segment.firstScan;
+    if (segment.dt <= 0.0)
+        return qMin(segment.firstScan + 1, end);
+
+    double index = std::ceil((t - segment.firstTime)/segment.dt);
+    return qint64(qMin(double(end), segment.firstScan + index));
+}
+
+
+// The whole blocks from the summary, and the part blocks either side of
+// them from the samples.
+ScanSummary::Statistics SampleStore::statistics(int chan, qint64 first,
+        qint64 end) const
+{
+    const int blockScans = ScanSummary::blockScans;
+    ScanSummary::Totals totals;
+    first = qMax(qint64(0), first);
+    end = qMin(end, numScans);
+
+    if (chan < 0 || chan >= numChans || end <= first)
+        return totals.statistics();
+
+    qint64 firstBlock = (first + blockScans - 1)/blockScans;
+    qint64 endBlock = end/blockScans;
+    qint64 low = end;
+    qint64 high = end;
+
+    if (firstBlock < endBlock) {
+        totals = summary.blockTotals(chan, firstBlock, endBlock);
+        low = firstBlock*blockScans;
+        high = endBlock*blockScans;
+    }
+
+    // at most a block's worth each
+    int numBefore = int(low - first);
+    int numAfter = int(end - high);
+    QVector<double> buffer(qMax(numBefore, numAfter));
+    values(chan, first, numBefore, buffer.data());
+    totals.add(buffer.constData(), numBefore);
+    values(chan, high, numAfter, buffer.data());
+    totals.add(buffer.constData(), numAfter);
+
+    return totals.statistics();
+}
+
+
+// Blocks from the summary, and the one still being filled, which isn't
+// in it yet, from the samples.
+bool SampleStore::blockRange(int chan, qint64 first, qint64 end,
+        double* min, double* max) const
+{
+    const int blockScans = ScanSummary::blockScans;
+    const qint64 numBlocks = numScans/blockScans;
+    qint64 firstBlock = (qMax(qint64(0), first) + blockScans - 1)/blockScans;
+    qint64 endBlock = (qMin(end, numScans) + blockScans - 1)/blockScans;
+
+    if (chan < 0 || chan >= numChans || endBlock <= firstBlock)
+        return false;
+
+    ScanSummary::Totals totals = summary.blockTotals(chan, int(firstBlock),
+            int(qMin(endBlock, numBlocks)));
+
+    if (endBlock > numBlocks) {
+        int numFilled = int(numScans - numBlocks*blockScans);
+        QVector<double> buffer(numFilled);
+        values(chan, numBlocks*blockScans, numFilled, buffer.data());
+        totals.add(buffer.constData(), numFilled);
+    }
+
+    if (totals.count == 0)
+        return false;
+
+    *min = totals.min;
+    *max = totals.max;
+    return true;
+}
+
+
+double SampleStore::value(int chan, qint64 scan) const
+{
+    double out;
+    values(chan, scan, 1, &out);
+    return out;
+}
+
+
+void SampleStore::times(qint64 first, int count, double* out) const
+{
+    int segment = segmentOf(first);
+
+    for (int done = 0; done < count; ++segment) {
+        const Segment& s = segments[segment];
+        qint64 end = segment + 1 < segments.count()
+            ? segments[segment + 1].firstScan : numScans;
+        int run = int(qMin(qint64(count - done), end - (first + done)));
+        qint64 index = first + done - s.firstScan;
+
+        for (int i = 0; i < run; ++i)
+            out[done + i] = s.firstTime + (index + i)*s.dt;
+
+        done += run;
+    }
+}
+
+
+void SampleStore::values(int chan, qint64 first, int count,
+        double* out) const
+{
+    if (first < spilledScans) {
+        int numSpilled = int(qMin(qint64(count), spilledScans - first));
+        readSpilled(chan, first, numSpilled, out);
+
+        first += numSpilled;
+        count -= numSpilled;
+        out += numSpilled;
+    }
+
+    if (count <= 0)
+        return;
+
+    if (raw) {
+        codesToVolts(codes[chan].constData() + first - vectorFirst, count,
+                calibration[chan], out);
+    }
+    else {
+        const double* in = volts[chan].constData() + first - vectorFirst;
+
+        for (int i = 0; i < count; ++i)
+            out[i] = in[i];
+    }
+}
+
+
+qint64 SampleStore::bytesUsed() const
+{
+    qint64 bytes = qint64(segments.capacity())*sizeof(Segment);
+
+    for (int chan = 0; chan < volts.count(); ++chan)
+        bytes += qint64(volts[chan].capacity())*sizeof(double);
+    for (int chan = 0; chan < codes.count(); ++chan)
+        bytes += qint64(codes[chan].capacity())*sizeof(quint16);
+
+    return bytes + summary.bytesUsed();
+}
+
+
+// The window, a block being filled, and as much again for what's been
+// spilled but not yet dropped from the vectors.
+qint64 SampleStore::memoryBudget() const
+{
+    if (retention <= 0.0 || segments.isEmpty() || segments.last().dt <= 0.0)
+        return 0;
+
+    qint64 windowScans = qint64(retention/segments.last().dt);
+    qint64 bytesPerScan = qint64(numChans)*bytesPerSample();
+
+    return 2*(windowScans*bytesPerScan + spillBlockBytes);
+}
+
+
+void SampleStore::convertToVolts()
+{
+    if (!raw)
+        return;
+
+    // only what's in memory; spilled blocks keep their own layout
+    const int numKept = int(numScans - spilledScans);
+    volts.resize(numChans);
+    for (int chan = 0; chan < numChans; ++chan) {
+        volts[chan].resize(numKept);
+        values(chan, spilledScans, numKept, volts[chan].data());
+    }
+
+    raw = false;
+    codes.clear();
+    calibration.clear();
+    vectorFirst = spilledScans;
+}
+
+
+void SampleStore::widen(int numChannels)
+{
+    if (numChannels <= numChans)
+        return;
+
+    volts.resize(numChannels);
+    for (int chan = numChans; chan < numChannels; ++chan) {
+        volts[chan].fill(std::numeric_limits<double>::quiet_NaN(),
+                int(numScans - vectorFirst));
+    }
+
+    numChans = numChannels;
+    summary.setNumChannels(numChannels);
+}
+
+
+// Spills whole blocks of scans older than the retention window.
+void SampleStore::spillOldScans()
+{
+    if (retention <= 0.0 || numScans == 0 || !spillFailure.isEmpty())
+        return;
+
+    const int blockScans = qMax(1024,
+            int(spillBlockBytes/qMax(1, numChans*bytesPerSample())));
+    const double keepFrom = lastTime() - retention;
+
+    while (numScans - spilledScans > blockScans
+            && time(spilledScans + blockScans) <= keepFrom) {
+        if (!spillBlock(blockScans))
+            break;
+    }
+
+    // Drop the spilled scans from the vectors once there are as many of
+    // them as there are scans left, so each scan is moved at most once.
+    int numDead = int(spilledScans - vectorFirst);
+
+    if (numDead > 0 && numDead >= numScans - spilledScans) {
+        for (int chan = 0; chan < codes.count(); ++chan)
+            codes[chan].remove(0, numDead);
+        for (int chan = 0; chan < volts.count(); ++chan)
+            volts[chan].remove(0, numDead);
+
+        vectorFirst = spilledScans;
+    }
+}
+
+
+bool SampleStore::spillBlock(int numBlockScans)
+{
+    if (spillFile == NULL) {
+        spillFile = new QTemporaryFile(
+                QDir::temp().filePath("GDAQrec_spill_XXXXXX"));
+
+        if (!spillFile->open()) {
+            spillFailure = spillFile->errorString();
+            removeSpillFile();
+            return false;
+        }
+    }
+
+    SpillBlock block;
+    block.firstScan = spilledScans;
+    block.numScans = numBlockScans;
+    block.offset = spillBytes;
+    block.numChannels = numChans;
+    block.raw = raw;
+    block.calibration = calibration;
+
+    const int index = int(spilledScans - vectorFirst);
+    const qint64 channelBytes = qint64(numBlockScans)*bytesPerSample();
+    bool ok = spillFile->seek(spillBytes);
+
+    for (int chan = 0; chan < numChans && ok; ++chan) {
+        const char* data = raw
+            ? reinterpret_cast<const char*>(codes[chan].constData() + index)
+            : reinterpret_cast<const char*>(volts[chan].constData() + index);
+
+        ok = spillFile->write(data, channelBytes) == channelBytes;
+    }
+
+    if (!ok) {
+        // what's already spilled can still be read back
+        spillFailure = spillFile->errorString();
+        return false;
+    }
+
+    spillBlocks.append(block);
+    spilledScans += numBlockScans;
+    spillBytes += channelBytes*numChans;
+    return true;
+}
+
+
+void SampleStore::readSpilled(int chan, qint64 first, int count,
+        double* out) const
+{
+    QMutexLocker lock(&spillMutex);
+    int low = 0;
+    int high = spillBlocks.count();
+
+    // the block holding first
+    while (low + 1 < high) {
+        int mid = (low + high)/2;
+
+        if (spillBlocks[mid].firstScan <= first)
+            low = mid;
+        else
+            high = mid;
+    }
+
+    for (int b = low; count > 0; ++b) {
+        const SpillBlock& block = spillBlocks[b];
+        int index = int(first - block.firstScan);
+        int numRead = qMin(count, block.numScans - index);
+        const QVector<double>* spilled = spilledChannel(b, chan);
+
+        if (spilled != NULL) {
+            std::copy(spilled->constData() + index,
+                    spilled->constData() + index + numRead, out);
+        }
+        else {
+            for (int i = 0; i < numRead; ++i)
+                out[i] = std::numeric_limits<double>::quiet_NaN();
+        }
+
+        first += numRead;
+        count -= numRead;
+        out += numRead;
+    }
+}
+
+
+// A channel of a spilled block in volts, from the cache or read into it;
+// NULL if it can't be read.  The cache may drop it at the next call, and
+// spillMutex must be held.
+const QVector<double>* SampleStore::spilledChannel(int b, int chan) const
+{
+    const qint64 key = qint64(b) << 16 | chan;
+    QVector<double>* cached = spillCache.object(key);
+
+    if (cached != NULL)
+        return cached;
+
+    const SpillBlock& block = spillBlocks[b];
+    if (chan >= block.numChannels)
+        return NULL;
+
+    const int size = block.raw ? sizeof(quint16) : sizeof(double);
+    const qint64 bytes = qint64(block.numScans)*size;
+    QVector<double>* channel = new QVector<double>(block.numScans);
+
+    if (block.raw)
+        spillBuffer.resize(block.numScans);
+
+    char* data = block.raw
+        ? reinterpret_cast<char*>(spillBuffer.data())
+        : reinterpret_cast<char*>(channel->data());
+
+    if (!spillFile->seek(block.offset + chan*bytes)
+            || spillFile->read(data, bytes) != bytes) {
+        delete channel;
+        return NULL;
+    }
+
+    if (block.raw) {
+        codesToVolts(spillBuffer.constData(), block.numScans,
+                block.calibration[chan], channel->data());
+    }
+
+    // a block's channel is never more than a few MB, well under the limit
+    spillCache.insert(key, channel, block.numScans*int(sizeof(double)));
+    return channel;
+}
+
+
+void SampleStore::removeSpillFile()
+{
+    spillCache.clear();
+    delete spillFile;
+    spillFile = NULL;
+}
@@ -0,0 +1,185 @@
+#ifndef SAMPLESTORE_H
+#define SAMPLESTORE_H
+
+#include <QCache>
+#include <QMutex>
+#include <QString>
+#include <QVector>
+#include <QtGlobal>
+#include "ScanSummary.h"
+
+class QTemporaryFile;
+
+// Everything recorded (or opened) so far, for drawing and saving.  The
+// channels share one time axis, kept as runs of evenly spaced scans
+// rather than a time per sample; a run ends wherever scans were lost.
+//
+// Each channel is either stored in volts, or (with rawStorage) as 16-bit
+// ADC codes and converted with its calibration only when it's read, which
+// takes a quarter of the memory.  Code 65535 is kept for missing (NaN)
+// samples, so a 16-bit board's full-scale code is stored as 65534.
+//
+// With a retention window set, scans older than that are spilled to a
+// temporary file a block at a time and read back from it when they're
+// drawn or saved, so memory stays bounded however long the recording.
+// Spilled blocks are never rewritten; each remembers its own layout.  The
+// channels of blocks read back last are kept, in volts, up to
+// spillCacheBytes, so a view going over the same spilled scans frame
+// after frame doesn't read them from the file each time.
+//
+// Scans are numbered in qint64, which a recording at 35 kS/s would
+// outgrow as int in under a day.
+//
+// A ScanSummary of every channel is kept up to date as scans are
+// appended, for statistics over a range without reading more than its
+// ends.
+//
+// Any number of threads can read at once, spilled scans included, as long
+// as nothing is appended, cleared or laid out meanwhile.
+class SampleStore
+{
+    public:
+        enum { maxCode = 65534, missingCode = 65535 };
+        enum { spillBlockBytes = 1 << 20, spillCacheBytes = 16 << 20 };
+
+        // volts = offset + scale*code
+        struct Calibration
+        {
+            double offset;
+            double scale;
+
+            // for a linear range whose codes run 0..maxData; boards with
+            // more than 16 bits are quantised to 16
+            static Calibration forRange(double min, double max,
+                    unsigned long maxData);
+
+            bool operator==(const Calibration& other) const
+            {
+                return offset == other.offset && scale == other.scale;
+            }
+        };
+
+        // scans firstScan onwards are at firstTime + (scan - firstScan)*dt
+        struct Segment
+        {
+            qint64 firstScan;
+            double firstTime;
+            double dt;
+        };
+
+        SampleStore();
+        ~SampleStore();
+
+        void clear();
+
+        // seconds of the most recent scans to keep in memory, 0 for all
+        void setRetention(double seconds);
+
+        // Set before appending: numChannels to come, and their
+        // calibrations, or none to store volts.  If that doesn't match
+        // what's already here, the store carries on in volts.
+        void setLayout(int numChannels,
+                const QVector<Calibration>& calibration);
+
+        // scans from a recording, numChannels (as set) channel pointers,
+        // following on dt after the last scan
+        void appendScans(const qreal* const* channels, int numScans,
+                double dt);
+        // leaves numScans*dt of time without scans before the next ones
+        void skipScans(qint64 numScans, double dt);
+        // one scan from a file, at whatever time it says
+        void appendScan(double time, const qreal* values);
+        // replaces everything here with a copy of other's scans
+        void copyFrom(const SampleStore& other);
+
+        int numChannels() const { return numChans; }
+        qint64 count() const { return numScans; }
+        bool isEmpty() const { return numScans == 0; }
+        bool isRaw() const { return raw; }
+
+        double time(qint64 scan) const;
+        double lastTime() const { return time(numScans - 1); }
+        // between scan and the next, were it evenly spaced with it
+        double scanInterval(qint64 scan) const;
+        // where appendScans() will put the next scan
+        double nextScanTime() const { return nextTime; }
+        // the first scan at or after t, or count() if there are none
+        qint64 lowerBound(double t) const;
+
+        double value(int chan, qint64 scan) const;
+        // the times and values of count scans from first, in one go
+        void times(qint64 first, int count, double* out) const;
+        void values(int chan, qint64 first, int count, double* out) const;
+        // of scans first to end - 1, reading at most a summary block's
+        // worth of samples at either end
+        ScanSummary::Statistics statistics(int chan, qint64 first,
+                qint64 end) const;
+        // For drawing: the lowest and highest of a channel's samples in
+        // the summary blocks that start at scans first to end - 1, so
+        // neighbouring ranges share none; false if they're all NaN.
+        bool blockRange(int chan, qint64 first, qint64 end, double* min,
+                double* max) const;
+
+        // in memory, and roughly the most the retention window needs
+        qint64 bytesUsed() const;
+        qint64 memoryBudget() const;
+        qint64 bytesSpilled() const { return spillBytes; }
+        qint64 scansSpilled() const { return spilledScans; }
+        // empty unless spilling has failed, in which case everything is
+        // kept in memory from then on
+        QString spillError() const { return spillFailure; }
+
+    private:
+        // blocks of scans written to spillFile, channel after channel
+        struct SpillBlock
+        {
+            qint64 firstScan;
+            int numScans;
+            qint64 offset;
+            int numChannels;
+            bool raw;
+            QVector<Calibration> calibration;
+        };
+
+        int segmentOf(qint64 scan) const;
+        void startSegment(double time, double dt);
+        void convertToVolts();
+        void widen(int numChannels);
+        int bytesPerSample() const;
+        void spillOldScans();
+        bool spillBlock(int numScans);
+        void readSpilled(int chan, qint64 first, int count,
+                double* out) const;
+        const QVector<double>* spilledChannel(int b, int chan) const;
+        void removeSpillFile();
+
+        int numChans;
+        int numInputs;          // channels appendScans() is given
+        qint64 numScans;
+        bool raw;
+        QVector<Calibration> calibration;
+        QVector<QVector<double> > volts;
+        QVector<QVector<quint16> > codes;
+        qint64 vectorFirst;     // the scan at index 0 of volts or codes
+
+        ScanSummary summary;
+
+        QVector<Segment> segments;
+        double nextTime;        // of the scan after the last
+        bool contiguous;        // whether that continues the last segment
+
+        double retention;
+        QTemporaryFile* spillFile;
+        QVector<SpillBlock> spillBlocks;
+        qint64 spilledScans;    // scans before this are only on disk
+        qint64 spillBytes;
+        QString spillFailure;
+        mutable QMutex spillMutex;  // for reading spillFile, and these
+        mutable QVector<quint16> spillBuffer;
+        // one channel of one block, by block << 16 | channel
+        mutable QCache<qint64, QVector<double> > spillCache;
+
+        Q_DISABLE_COPY(SampleStore)
+};
+
+#endif
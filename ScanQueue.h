@@ -0,0 +1,83 @@
+#ifndef SCANQUEUE_H
+#define SCANQUEUE_H
+
+#include <QAtomicInt>
+#include <QVector>
+#include <QtGlobal>
+
+// A fixed-size ring of scans passed from exactly one producer thread to
+// exactly one consumer thread without a lock.  Each scan is scanSize
+// values.  The producer only ever moves writeIndex and the consumer only
+// readIndex; one slot is always left empty so that a full ring can be told
+// from an empty one.
+class ScanQueue
+{
+    public:
+        ScanQueue(int scanSize_, int capacity) :
+            scanSize(scanSize_),
+            numSlots(capacity + 1),
+            data(scanSize_*(capacity + 1)),
+            readIndex(0),
+            writeIndex(0)
+        {
+        }
+
+        int capacity() const { return numSlots - 1; }
+
+        // consumer: scans that can be read now
+        int available()
+        {
+            int read = readIndex;
+            int write = writeIndex.fetchAndAddAcquire(0);
+            return (write - read + numSlots) % numSlots;
+        }
+
+        // producer: copies up to numScans in, returning how many fitted
+        int push(const qreal* scans, int numScans)
+        {
+            int write = writeIndex;
+            int read = readIndex.fetchAndAddAcquire(0);
+            int space = (read - write - 1 + numSlots) % numSlots;
+            int numPushed = qMin(numScans, space);
+
+            for (int done = 0; done < numPushed; ) {
+                int run = qMin(numPushed - done, numSlots - write);
+                qreal* out = data.data() + write*scanSize;
+                const qreal* in = scans + done*scanSize;
+
+                for (int i = 0; i < run*scanSize; ++i)
+                    out[i] = in[i];
+
+                done += run;
+                write = (write + run) % numSlots;
+            }
+
+            writeIndex.fetchAndStoreRelease(write);
+            return numPushed;
+        }
+
+        // consumer: the longest run of available scans that is contiguous
+        // in memory (at most numScans), or NULL if there are none
+        const qreal* peek(int numScans, int* runLength)
+        {
+            int read = readIndex;
+            *runLength = qMin(qMin(numScans, available()), numSlots - read);
+            return *runLength > 0 ? data.constData() + read*scanSize : NULL;
+        }
+
+        // consumer: done with the first numScans
+        void release(int numScans)
+        {
+            int read = readIndex;
+            readIndex.fetchAndStoreRelease((read + numScans) % numSlots);
+        }
+
+    private:
+        const int scanSize;
+        const int numSlots;
+        QVector<qreal> data;
+        QAtomicInt readIndex;
+        QAtomicInt writeIndex;
+};
+
+#endif
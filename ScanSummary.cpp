@@ -0,0 +1,261 @@
+#include <cmath>
+#include <limits>
+#include "ScanSummary.h"
+
+ScanSummary::ScanSummary() :
+    numScans(0)
+{
+}
+
+void ScanSummary::clear()
+{
+    channels.clear();
+    numScans = 0;
+}
+
+void ScanSummary::setNumChannels(int numChannels)
+{
+    const double infinity = std::numeric_limits<double>::infinity();
+    int numBlocks = int(numScans/blockScans);
+
+    for (int chan = channels.count(); chan < numChannels; ++chan) {
+        Channel channel;
+        channel.counts.fill(0, numBlocks + 1);
+        channel.sums.fill(0.0, numBlocks + 1);
+        channel.squares.fill(0.0, numBlocks + 1);
+
+        // the same shape of tree as the others, with nothing in it
+        if (!channels.isEmpty()) {
+            const Channel& other = channels[0];
+            channel.mins.resize(other.mins.count());
+            channel.maxes.resize(other.maxes.count());
+
+            for (int level = 0; level < other.mins.count(); ++level) {
+                channel.mins[level].fill(infinity, other.mins[level].count());
+                channel.maxes[level].fill(-infinity,
+                        other.maxes[level].count());
+            }
+        }
+
+        startBlock(&channel);
+        channels.append(channel);
+    }
+}
+
+void ScanSummary::startBlock(Channel* channel)
+{
+    channel->count = 0;
+    channel->sum = 0.0;
+    channel->square = 0.0;
+    channel->min = std::numeric_limits<double>::infinity();
+    channel->max = -std::numeric_limits<double>::infinity();
+}
+
+// Adds the finished block to the prefix sums and the tree, whose every
+// complete pair then gets a parent.
+void ScanSummary::endBlock(Channel* channel)
+{
+    channel->counts.append(channel->counts.last() + channel->count);
+    channel->sums.append(channel->sums.last() + channel->sum);
+    channel->squares.append(channel->squares.last() + channel->square);
+
+    double min = channel->min;
+    double max = channel->max;
+
+    for (int level = 0; ; ++level) {
+        if (level == channel->mins.count()) {
+            channel->mins.append(QVector<double>());
+            channel->maxes.append(QVector<double>());
+        }
+
+        QVector<double>& mins = channel->mins[level];
+        QVector<double>& maxes = channel->maxes[level];
+        mins.append(min);
+        maxes.append(max);
+
+        int index = mins.count() - 1;
+        if (index % 2 == 0)
+            break;
+
+        min = qMin(mins[index - 1], min);
+        max = qMax(maxes[index - 1], max);
+    }
+
+    startBlock(channel);
+}
+
+void ScanSummary::appendScans(const qreal* const* in, int numInputs,
+        int count)
+{
+    for (int chan = 0; chan < channels.count(); ++chan) {
+        Channel& channel = channels[chan];
+        const qreal* values = chan < numInputs ? in[chan] : NULL;
+        qint64 scan = numScans;
+
+        for (int i = 0; i < count; ) {
+            int n = qMin(count - i, int(blockScans - scan%blockScans));
+
+            if (values != NULL) {
+                qint64 numGood = 0;
+                double sum = 0.0, square = 0.0;
+                double min = channel.min, max = channel.max;
+
+                for (int j = i; j < i + n; ++j) {
+                    double value = values[j];
+
+                    if (value == value) {
+                        ++numGood;
+                        sum += value;
+                        square += value*value;
+                        min = qMin(min, value);
+                        max = qMax(max, value);
+                    }
+                }
+
+                channel.count += numGood;
+                channel.sum += sum;
+                channel.square += square;
+                channel.min = min;
+                channel.max = max;
+            }
+
+            i += n;
+            scan += n;
+
+            if (scan%blockScans == 0)
+                endBlock(&channel);
+        }
+    }
+
+    numScans += count;
+}
+
+void ScanSummary::appendScan(const qreal* values, int numInputs)
+{
+    ++numScans;
+
+    for (int chan = 0; chan < channels.count(); ++chan) {
+        Channel& channel = channels[chan];
+        double value = chan < numInputs ? values[chan] : 0.0;
+
+        if (chan < numInputs && value == value) {
+            ++channel.count;
+            channel.sum += value;
+            channel.square += value*value;
+            channel.min = qMin(channel.min, value);
+            channel.max = qMax(channel.max, value);
+        }
+
+        if (numScans%blockScans == 0)
+            endBlock(&channel);
+    }
+}
+
+ScanSummary::Totals ScanSummary::blockTotals(int chan, int firstBlock,
+        int endBlock) const
+{
+    Totals totals;
+
+    if (chan < 0 || chan >= channels.count())
+        return totals;
+
+    const Channel& channel = channels[chan];
+    int numBlocks = int(numScans/blockScans);
+    int high = qBound(0, endBlock, numBlocks);
+    int low = qBound(0, firstBlock, high);
+
+    totals.count = channel.counts[high] - channel.counts[low];
+    totals.sum = channel.sums[high] - channel.sums[low];
+    totals.square = channel.squares[high] - channel.squares[low];
+
+    // up the tree, taking whichever ends don't pair up at each level
+    for (int level = 0; low < high; ++level) {
+        if (low % 2 == 1) {
+            totals.min = qMin(totals.min, channel.mins[level][low]);
+            totals.max = qMax(totals.max, channel.maxes[level][low]);
+            ++low;
+        }
+
+        if (high % 2 == 1) {
+            --high;
+            totals.min = qMin(totals.min, channel.mins[level][high]);
+            totals.max = qMax(totals.max, channel.maxes[level][high]);
+        }
+
+        low /= 2;
+        high /= 2;
+    }
+
+    return totals;
+}
+
+ScanSummary::Totals::Totals() :
+    count(0),
+    sum(0.0),
+    square(0.0),
+    min(std::numeric_limits<double>::infinity()),
+    max(-std::numeric_limits<double>::infinity())
+{
+}
+
+void ScanSummary::Totals::add(const double* values, int numValues)
+{
+    for (int i = 0; i < numValues; ++i) {
+        double value = values[i];
+
+        if (value == value) {
+            ++count;
+            sum += value;
+            square += value*value;
+            min = qMin(min, value);
+            max = qMax(max, value);
+        }
+    }
+}
+
+void ScanSummary::Totals::add(const Totals& other)
+{
+    count += other.count;
+    sum += other.sum;
+    square += other.square;
+    min = qMin(min, other.min);
+    max = qMax(max, other.max);
+}
+
+ScanSummary::Statistics ScanSummary::Totals::statistics() const
+{
+    const double nan = std::numeric_limits<double>::quiet_NaN();
+    Statistics stats;
+    stats.count = count;
+
+    if (count == 0) {
+        stats.mean = stats.rms = stats.stdDev = stats.min = stats.max = nan;
+        return stats;
+    }
+
+    stats.mean = sum/count;
+    stats.rms = std::sqrt(square/count);
+    stats.stdDev = std::sqrt(qMax(0.0, square/count - stats.mean*stats.mean));
+    stats.min = min;
+    stats.max = max;
+    return stats;
+}
+
+qint64 ScanSummary::bytesUsed() const
+{
+    qint64 bytes = 0;
+
+    for (int chan = 0; chan < channels.count(); ++chan) {
+        const Channel& channel = channels[chan];
+        bytes += channel.counts.capacity()*sizeof(qint64)
+            + (channel.sums.capacity() + channel.squares.capacity())
+            *sizeof(double);
+
+        for (int level = 0; level < channel.mins.count(); ++level) {
+            bytes += (channel.mins[level].capacity()
+                    + channel.maxes[level].capacity())*sizeof(double);
+        }
+    }
+
+    return bytes;
+}
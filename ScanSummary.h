@@ -0,0 +1,88 @@
+#ifndef SCANSUMMARY_H
+#define SCANSUMMARY_H
+
+#include <QVector>
+#include <QtGlobal>
+
+// Running statistics of each channel of a SampleStore, summarised a block
+// of blockScans scans at a time as the scans are appended, so that the
+// totals of any run of whole blocks come from the summaries alone: the
+// count, sum and sum of squares from prefix sums over the blocks, and the
+// minimum and maximum from a tree of block minima and maxima, in
+// O(log n).  The store adds the scans either side of the whole blocks in
+// a range from its samples.  NaN samples are left out.  The summaries
+// stay in memory when the store spills its scans, at about 40 bytes a
+// block.
+class ScanSummary
+{
+    public:
+        enum { blockScans = 1024 };
+
+        struct Statistics
+        {
+            qint64 count;
+            double mean;
+            double rms;
+            double stdDev;
+            double min;
+            double max;
+        };
+
+        // what Statistics are worked out from, which add together
+        struct Totals
+        {
+            qint64 count;
+            double sum;
+            double square;
+            double min;
+            double max;
+
+            Totals();
+            void add(const double* values, int numValues);
+            void add(const Totals& other);
+            Statistics statistics() const;
+        };
+
+        ScanSummary();
+
+        void clear();
+        // channels added have no samples before the next scan
+        void setNumChannels(int numChannels);
+
+        // the next numScans scans; channels past numInputs are NaN
+        void appendScans(const qreal* const* channels, int numInputs,
+                int numScans);
+        void appendScan(const qreal* values, int numInputs);
+
+        // over the complete blocks firstBlock to endBlock - 1
+        Totals blockTotals(int chan, int firstBlock, int endBlock) const;
+
+        qint64 bytesUsed() const;
+
+    private:
+        struct Channel
+        {
+            // prefix sums over complete blocks, one more than there are
+            QVector<qint64> counts;
+            QVector<double> sums;
+            QVector<double> squares;
+            // [level][i]: over blocks i*2^level to (i+1)*2^level - 1
+            QVector<QVector<double> > mins;
+            QVector<QVector<double> > maxes;
+
+            // the block being filled
+            qint64 count;
+            double sum;
+            double square;
+            double min;
+            double max;
+        };
+
+        void startBlock(Channel* channel);
+        void endBlock(Channel* channel);
+
+        QVector<Channel> channels;
+        qint64 numScans;
+};
+
+#endif
@@ -0,0 +1,109 @@
+#include <QtCore>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "SharedClock.h"
+
+SharedClock::SharedClock(const char* name_) :
+    name(name_),
+    clock(NULL),
+    dt(0.0)
+{
+}
+
+SharedClock::~SharedClock()
+{
+    if (clock != NULL) {
+        munmap(clock, sizeof(*clock));
+        shm_unlink(name.constData());
+    }
+}
+
+void SharedClock::beginUpdate()
+{
+    __atomic_store_n(&clock->sequence, clock->sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+void SharedClock::endUpdate()
+{
+    __atomic_store_n(&clock->sequence, clock->sequence + 1, __ATOMIC_RELEASE);
+}
+
+void SharedClock::startedRecording(const DAQSettings& /* settings */,
+        double dt_)
+{
+    dt = dt_;
+
+    if (clock == NULL) {
+        int fd = shm_open(name.constData(), O_RDWR | O_CREAT, 0644);
+
+        if (fd < 0 || ftruncate(fd, sizeof(*clock)) < 0) {
+            qWarning("SharedClock: could not create %s: %s",
+                    name.constData(), strerror(errno));
+            if (fd >= 0)
+                ::close(fd);
+            return;
+        }
+
+        void* map = mmap(NULL, sizeof(*clock), PROT_READ | PROT_WRITE,
+                MAP_SHARED, fd, 0);
+        ::close(fd);
+
+        if (map == MAP_FAILED) {
+            qWarning("SharedClock: could not map %s: %s",
+                    name.constData(), strerror(errno));
+            return;
+        }
+
+        clock = static_cast<gdaq_clock*>(map);
+        clock->magic = GDAQ_CLOCK_MAGIC;
+        clock->version = GDAQ_CLOCK_VERSION;
+    }
+
+    beginUpdate();
+    clock->state = GDAQ_FEED_RECORDING;
+    clock->session = QDateTime::currentMSecsSinceEpoch();
+    clock->scans_acquired = 0;
+    clock->sampling_rate = 1.0/dt;
+    clock->first_scan_monotonic_ns = 0;
+    clock->first_scan_realtime_ns = 0;
+    clock->last_scan_monotonic_ns = 0;
+    clock->last_scan_realtime_ns = 0;
+    endUpdate();
+}
+
+void SharedClock::newScans(const ScanBlock& block)
+{
+    if (clock == NULL)
+        return;
+
+    beginUpdate();
+
+    if (clock->scans_acquired == 0) {
+        // the first scan of the block was acquired numScans - 1 intervals
+        // before the last one
+        qint64 leadNs = qint64((block.numScans - 1)*dt*1e9);
+        clock->first_scan_monotonic_ns = block.monotonicNs - leadNs;
+        clock->first_scan_realtime_ns = block.realtimeNs - leadNs;
+    }
+
+    clock->scans_acquired = block.firstScan + block.numScans;
+    clock->last_scan_monotonic_ns = block.monotonicNs;
+    clock->last_scan_realtime_ns = block.realtimeNs;
+
+    endUpdate();
+}
+
+void SharedClock::stoppedRecording()
+{
+    if (clock == NULL)
+        return;
+
+    beginUpdate();
+    clock->state = GDAQ_FEED_STOPPED;
+    endUpdate();
+}
@@ -0,0 +1,30 @@
+#ifndef SHAREDCLOCK_H
+#define SHAREDCLOCK_H
+
+#include <QByteArray>
+#include "DAQSink.h"
+#include "feed/gdaqfeed.h"
+
+// Publishes the recording's clock anchors in POSIX shared memory (see
+// struct gdaq_clock in feed/gdaqfeed.h), updated after every read under a
+// sequence lock so readers never see a half-written block.
+class SharedClock : public DAQSink
+{
+    public:
+        SharedClock(const char* name = GDAQ_CLOCK_DEFAULT_NAME);
+        ~SharedClock();
+
+        void startedRecording(const DAQSettings& settings, double dt);
+        void newScans(const ScanBlock& block);
+        void stoppedRecording();
+
+    private:
+        void beginUpdate();
+        void endUpdate();
+
+        QByteArray name;
+        gdaq_clock* clock;
+        double dt;
+};
+
+#endif
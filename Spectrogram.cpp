@@ -0,0 +1,318 @@
+#include <QtCore>
+#include <cmath>
+
+#include "Spectrogram.h"
+#include "SampleStore.h"
+
+static const double pi = 3.14159265358979323846;
+
+Spectrogram::Spectrogram() :
+    tiles(cacheBytes),
+    source(NULL),
+    requestsLeft(0),
+    generation(0),
+    finished(false)
+{
+}
+
+Spectrogram::~Spectrogram()
+{
+    {
+        QMutexLocker lock(&mutex);
+        finished = true;
+        requestReady.wakeOne();
+    }
+
+    wait();
+
+    qDeleteAll(queued);
+    qDeleteAll(done);
+}
+
+void Spectrogram::clear()
+{
+    ++generation;
+    tiles.clear();
+    inFlight.clear();
+
+    // a tile being transformed now is dropped when it's done
+    QMutexLocker lock(&mutex);
+    qDeleteAll(queued);
+    queued.clear();
+    qDeleteAll(done);
+    done.clear();
+}
+
+int Spectrogram::levelFor(double scansPerColumn)
+{
+    int level = 0;
+
+    while (level < maxLevel && (qint64(hop) << level) < scansPerColumn)
+        ++level;
+
+    return level;
+}
+
+qint64 Spectrogram::firstScan(int level, int column)
+{
+    return (qint64(column)*hop) << level;
+}
+
+int Spectrogram::numColumns(int level, qint64 numScans)
+{
+    if (numScans < fftSize)
+        return 0;
+
+    return int((numScans - fftSize)/(qint64(hop) << level)) + 1;
+}
+
+quint64 Spectrogram::tileKey(int chan, int level, int tile)
+{
+    return (quint64(chan) << 40) | (quint64(level) << 32) | quint32(tile);
+}
+
+const float* Spectrogram::column(const SampleStore& samples, int chan,
+        int level, int column)
+{
+    if (&samples != source) {
+        clear();
+        source = &samples;
+    }
+
+    int tile = column/tileColumns;
+    int index = column%tileColumns;
+    quint64 key = tileKey(chan, level, tile);
+    Tile* found = tiles.object(key);
+
+    if (found != NULL && index < found->numColumns)
+        return found->power.constData() + index*numBins;
+
+    if (!inFlight.contains(key))
+        request(samples, chan, level, tile, found ? found->numColumns : 0);
+
+    return NULL;
+}
+
+void Spectrogram::startRequests(int maxRequests)
+{
+    requestsLeft = maxRequests;
+}
+
+// Copies the samples for the tile's columns from firstColumn on (as many
+// as there are data for) and queues them.
+bool Spectrogram::request(const SampleStore& samples, int chan, int level,
+        int tile, int firstColumn)
+{
+    int available = qMin(numColumns(level, samples.count())
+            - tile*tileColumns, int(tileColumns));
+
+    if (requestsLeft <= 0 || available <= firstColumn)
+        return false;
+
+    Request* pending = new Request;
+    pending->key = tileKey(chan, level, tile);
+    pending->generation = generation;
+    pending->firstColumn = firstColumn;
+    pending->numColumns = available - firstColumn;
+    pending->samples.resize(pending->numColumns*fftSize);
+
+    QVector<double> values(fftSize);
+    int first = tile*tileColumns + firstColumn;
+
+    for (int i = 0; i < pending->numColumns; ++i) {
+        samples.values(chan, firstScan(level, first + i), fftSize,
+                values.data());
+
+        float* out = pending->samples.data() + i*fftSize;
+        for (int j = 0; j < fftSize; ++j)
+            out[j] = values[j];
+    }
+
+    qint64 scan = firstScan(level, first);
+    pending->dt = (samples.time(scan + fftSize - 1) - samples.time(scan))
+        /(fftSize - 1);
+
+    --requestsLeft;
+    inFlight.insert(pending->key);
+
+    if (!isRunning())
+        start();
+
+    QMutexLocker lock(&mutex);
+
+    // the oldest request is the least likely to still be in view
+    if (queued.count() >= maxQueued) {
+        Request* stale = queued.takeFirst();
+        inFlight.remove(stale->key);
+        delete stale;
+    }
+
+    queued.append(pending);
+    requestReady.wakeOne();
+    return true;
+}
+
+void Spectrogram::takeResults()
+{
+    QList<Request*> results;
+
+    {
+        QMutexLocker lock(&mutex);
+        results = done;
+        done.clear();
+    }
+
+    foreach (Request* result, results) {
+        if (result->generation != generation) {
+            delete result;
+            continue;
+        }
+
+        inFlight.remove(result->key);
+
+        // a tile that was dropped from the cache meanwhile starts again
+        Tile* tile = tiles.take(result->key);
+
+        if (tile == NULL && result->firstColumn == 0) {
+            tile = new Tile;
+            tile->power.resize(tileColumns*numBins);
+            tile->numColumns = 0;
+        }
+
+        if (tile != NULL) {
+            if (result->firstColumn == tile->numColumns) {
+                qCopy(result->power.constBegin(), result->power.constEnd(),
+                        tile->power.begin() + tile->numColumns*numBins);
+                tile->numColumns += result->numColumns;
+            }
+
+            tiles.insert(result->key, tile, tile->power.count()*sizeof(float));
+        }
+
+        delete result;
+    }
+}
+
+void Spectrogram::run()
+{
+    // the plan: a Hann window, and the FFT's twiddles and input order
+    window.resize(fftSize);
+    cosTable.resize(fftSize/2);
+    sinTable.resize(fftSize/2);
+    reversed.resize(fftSize);
+
+    for (int i = 0; i < fftSize; ++i)
+        window[i] = 0.5 - 0.5*std::cos(2.0*pi*i/fftSize);
+
+    for (int k = 0; k < fftSize/2; ++k) {
+        cosTable[k] = std::cos(2.0*pi*k/fftSize);
+        sinTable[k] = std::sin(2.0*pi*k/fftSize);
+    }
+
+    int numBits = 0;
+    while ((1 << numBits) < fftSize)
+        ++numBits;
+
+    for (int i = 0; i < fftSize; ++i) {
+        int r = 0;
+        for (int bit = 0; bit < numBits; ++bit)
+            r |= ((i >> bit) & 1) << (numBits - 1 - bit);
+        reversed[i] = r;
+    }
+
+    forever {
+        Request* next;
+
+        {
+            QMutexLocker lock(&mutex);
+
+            while (queued.isEmpty() && !finished)
+                requestReady.wait(&mutex);
+
+            if (finished)
+                return;
+
+            // the newest first, since that's what's being looked at
+            next = queued.takeLast();
+        }
+
+        transform(next);
+
+        // one signal for however many the GUI hasn't taken yet
+        bool wasEmpty;
+        {
+            QMutexLocker lock(&mutex);
+            wasEmpty = done.isEmpty();
+            done.append(next);
+        }
+
+        if (wasEmpty)
+            emit tilesReady();
+    }
+}
+
+// Each column with its mean taken out (NaN samples count as the mean),
+// windowed and transformed, as a one-sided power spectral density.
+void Spectrogram::transform(Request* request)
+{
+    double windowSquares = 0.0;
+    for (int i = 0; i < fftSize; ++i)
+        windowSquares += window[i]*window[i];
+
+    const double scale = request->dt/windowSquares;
+
+    re.resize(fftSize);
+    im.resize(fftSize);
+    request->power.resize(request->numColumns*numBins);
+
+    for (int col = 0; col < request->numColumns; ++col) {
+        const float* x = request->samples.constData() + col*fftSize;
+        double sum = 0.0;
+        int count = 0;
+
+        for (int i = 0; i < fftSize; ++i) {
+            if (x[i] == x[i]) {
+                sum += x[i];
+                ++count;
+            }
+        }
+
+        double mean = count > 0 ? sum/count : 0.0;
+
+        for (int i = 0; i < fftSize; ++i) {
+            double value = x[i] == x[i] ? x[i] - mean : 0.0;
+            re[reversed[i]] = value*window[i];
+            im[reversed[i]] = 0.0;
+        }
+
+        for (int size = 2; size <= fftSize; size *= 2) {
+            int half = size/2;
+            int step = fftSize/size;
+
+            for (int start = 0; start < fftSize; start += size) {
+                for (int j = 0; j < half; ++j) {
+                    double c = cosTable[j*step];
+                    double s = sinTable[j*step];
+                    int a = start + j;
+                    int b = a + half;
+                    double tr = re[b]*c + im[b]*s;
+                    double ti = im[b]*c - re[b]*s;
+
+                    re[b] = re[a] - tr;
+                    im[b] = im[a] - ti;
+                    re[a] += tr;
+                    im[a] += ti;
+                }
+            }
+        }
+
+        float* power = request->power.data() + col*numBins;
+
+        for (int bin = 0; bin < numBins; ++bin) {
+            double p = (re[bin]*re[bin] + im[bin]*im[bin])*scale;
+            power[bin] = (bin == 0 || bin == fftSize/2) ? p : 2.0*p;
+        }
+    }
+
+    request->samples.clear();
+}
@@ -0,0 +1,107 @@
+#ifndef SPECTROGRAM_H
+#define SPECTROGRAM_H
+
+#include <QCache>
+#include <QList>
+#include <QMutex>
+#include <QSet>
+#include <QThread>
+#include <QVector>
+#include <QWaitCondition>
+
+class SampleStore;
+
+// Short-time power spectra of a SampleStore's channels, for Plotter's
+// spectrum view.  Column c at level L is the Hann-windowed FFT of the
+// fftSize scans from c*hop*2^L, so level 0 overlaps by half and each
+// level above has half as many columns, for views too wide to need them
+// all.  Columns are worked out a tile at a time on the spectrogram's own
+// thread and kept (up to cacheBytes) so going back to them is free; a
+// tile still being recorded only has its new columns transformed.
+//
+// Everything but run() is for the GUI thread.  The store is only read
+// there: requests carry copies of the samples they need.
+class Spectrogram : public QThread
+{
+    Q_OBJECT
+
+    public:
+        enum { fftSize = 512, hop = fftSize/2, numBins = fftSize/2 + 1 };
+        enum { tileColumns = 64, maxLevel = 20 };
+        enum { cacheBytes = 64 << 20, maxQueued = 64 };
+
+        Spectrogram();
+        ~Spectrogram();
+
+        // forgets every column, for when the store's contents change
+        void clear();
+
+        // the coarsest level with at least a column every scansPerColumn
+        static int levelFor(double scansPerColumn);
+        // the first scan of a column
+        static qint64 firstScan(int level, int column);
+        // the columns there are data for in numScans scans
+        static int numColumns(int level, qint64 numScans);
+
+        // A column's power spectral density (V^2/Hz, numBins of them from
+        // 0 to the Nyquist frequency), or NULL if it hasn't been worked
+        // out yet, in which case its tile is queued (up to maxRequests
+        // tiles per call to startRequests()).
+        const float* column(const SampleStore& samples, int chan, int level,
+                int column);
+        void startRequests(int maxRequests);
+
+        // moves finished tiles into the cache; tilesReady() says when
+        void takeResults();
+
+    signals:
+        void tilesReady();
+
+    protected:
+        void run();
+
+    private:
+        struct Tile
+        {
+            QVector<float> power;   // [column*numBins + bin]
+            int numColumns;         // worked out so far
+        };
+
+        // the columns from firstColumn of a tile, and their samples
+        struct Request
+        {
+            quint64 key;
+            int generation;
+            int firstColumn;
+            int numColumns;
+            double dt;
+            QVector<float> samples; // fftSize per column
+            QVector<float> power;   // filled in by run()
+        };
+
+        static quint64 tileKey(int chan, int level, int tile);
+        bool request(const SampleStore& samples, int chan, int level,
+                int tile, int firstColumn);
+        void transform(Request* request);
+
+        QCache<quint64, Tile> tiles;
+        QSet<quint64> inFlight;     // tiles with a request outstanding
+        const SampleStore* source;
+        int requestsLeft;
+        int generation;
+
+        QMutex mutex;               // for everything below
+        QWaitCondition requestReady;
+        QList<Request*> queued;
+        QList<Request*> done;
+        bool finished;
+
+        // used only by run(): the window, and the FFT's twiddle factors
+        // and bit-reversed order
+        QVector<float> window;
+        QVector<double> cosTable, sinTable;
+        QVector<int> reversed;
+        QVector<double> re, im;
+};
+
+#endif
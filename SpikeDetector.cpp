@@ -0,0 +1,149 @@
+#include <QtCore>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "SpikeDetector.h"
+
+static bool earlier(const Spike& a, const Spike& b)
+{
+    return a.time < b.time;
+}
+
+SpikeDetector::SpikeDetector() :
+    dt(0.0),
+    numChannels(0),
+    adaptive(false),
+    refractoryScans(0)
+{
+}
+
+void SpikeDetector::startedRecording(const DAQSettings& settings, double dt_)
+{
+    QMutexLocker lock(&mutex);
+    const double nan = std::numeric_limits<double>::quiet_NaN();
+
+    dt = dt_;
+    numChannels = settings.numChannels;
+    adaptive = settings.spikeAdaptive;
+    refractoryScans = qint64(settings.spikeRefractory*1e-3/dt + 0.5);
+
+    setting = settings.spikeThreshold.mid(0, numChannels);
+    level = adaptive ? QVector<double>(numChannels, 0.0) : setting;
+    noise.fill(0.0, numChannels);
+    previous.fill(nan, numChannels);
+    nextAllowed.fill(0, numChannels);
+    found.clear();
+}
+
+// A single pass per channel: the comparison against the previous sample
+// is the only work per sample, and its branch is almost never taken.
+void SpikeDetector::newScans(const ScanBlock& block)
+{
+    QMutexLocker lock(&mutex);
+    int numBefore = found.count();
+
+    for (int chan = 0; chan < numChannels; ++chan) {
+        if (setting[chan] == 0.0)
+            continue;
+
+        const qreal* scans = block.scans[chan];
+
+        if (adaptive) {
+            estimateNoise(chan, scans, block.numScans);
+            level[chan] = setting[chan]*noise[chan];
+        }
+
+        if (level[chan] == 0.0)
+            continue;
+
+        // compare in the threshold's direction, so both signs are "rising"
+        const qreal sign = level[chan] > 0.0 ? 1.0 : -1.0;
+        const qreal threshold = sign*level[chan];
+        qreal last = sign*previous[chan];
+        qint64 allowed = nextAllowed[chan] - block.firstScan;
+
+        for (int i = 0; i < block.numScans; ++i) {
+            qreal value = sign*scans[i];
+
+            if (value >= threshold && last < threshold && i >= allowed) {
+                Spike spike;
+                spike.time = (block.firstScan + i)*dt;
+                spike.channel = chan;
+                found.append(spike);
+
+                allowed = i + refractoryScans;
+            }
+
+            last = value;
+        }
+
+        previous[chan] = scans[block.numScans - 1];
+        nextAllowed[chan] = block.firstScan + allowed;
+    }
+
+    // each channel's spikes are in order, but not with each other's
+    std::sort(found.begin() + numBefore, found.end(), earlier);
+}
+
+// A crossing isn't counted across scans that never arrived.
+void SpikeDetector::scansLost(const ScanGap& /* gap */)
+{
+    QMutexLocker lock(&mutex);
+    previous.fill(std::numeric_limits<qreal>::quiet_NaN(), numChannels);
+}
+
+int SpikeDetector::takeSpikes(QVector<Spike>* spikes, double timeOffset)
+{
+    QMutexLocker lock(&mutex);
+    int numSpikes = found.count();
+
+    for (int i = 0; i < numSpikes; ++i) {
+        Spike spike = found[i];
+        spike.time += timeOffset;
+        spikes->append(spike);
+    }
+
+    // keeps the capacity, so the acquisition thread needn't reallocate
+    found.resize(0);
+    return numSpikes;
+}
+
+double SpikeDetector::threshold(int chan)
+{
+    QMutexLocker lock(&mutex);
+    return chan < level.count() ? level[chan] : 0.0;
+}
+
+// Updates the channel's noise level from (at most a few thousand evenly
+// spread samples of) a block, ignoring NaN padding.
+void SpikeDetector::estimateNoise(int chan, const qreal* scans, int numScans)
+{
+    const int maxSamples = 4096;
+    const int step = qMax(1, numScans/maxSamples);
+
+    scratch.resize(0);
+    for (int i = 0; i < numScans; i += step) {
+        if (scans[i] == scans[i])
+            scratch.append(scans[i]);
+    }
+
+    if (scratch.isEmpty())
+        return;
+
+    qreal* begin = scratch.begin();
+    qreal* middle = begin + scratch.count()/2;
+    qreal* end = scratch.end();
+
+    std::nth_element(begin, middle, end);
+    qreal median = *middle;
+
+    for (qreal* x = begin; x != end; ++x)
+        *x = std::fabs(*x - median);
+
+    std::nth_element(begin, middle, end);
+    double sigma = *middle/0.6745;
+
+    // smoothed over roughly the last ten blocks
+    noise[chan] = noise[chan] == 0.0 ? sigma : 0.9*noise[chan] + 0.1*sigma;
+}
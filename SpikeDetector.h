@@ -0,0 +1,60 @@
+#ifndef SPIKEDETECTOR_H
+#define SPIKEDETECTOR_H
+
+#include <QMutex>
+#include <QVector>
+#include "DAQSink.h"
+
+// A threshold crossing on one channel.  time is in seconds from the start
+// of the recording until takeSpikes() adds the caller's offset.
+struct Spike
+{
+    double time;
+    int channel;
+};
+
+// Finds threshold crossings on the acquisition thread as each block
+// arrives, so the GUI only ever collects the results.  Each channel with
+// a nonzero DAQSettings::spikeThreshold is watched for crossings in the
+// direction of the threshold's sign; after a spike the channel is ignored
+// for the refractory period.  With spikeAdaptive the threshold is instead
+// that many times the channel's noise level, estimated from the median
+// absolute deviation of each block (MAD/0.6745) and smoothed over blocks.
+class SpikeDetector : public DAQSink
+{
+    public:
+        SpikeDetector();
+
+        void startedRecording(const DAQSettings& settings, double dt);
+        void newScans(const ScanBlock& block);
+        void scansLost(const ScanGap& gap);
+
+        // Moves the spikes found since the last call onto the end of
+        // spikes, in time order, adding timeOffset to their times; returns
+        // how many there were.
+        int takeSpikes(QVector<Spike>* spikes, double timeOffset);
+
+        // the current threshold on a channel, in volts (0 if none)
+        double threshold(int chan);
+
+    private:
+        void estimateNoise(int chan, const qreal* scans, int numScans);
+
+        QMutex mutex;           // for everything below
+        double dt;
+        int numChannels;
+        bool adaptive;
+        qint64 refractoryScans;
+
+        // per channel
+        QVector<double> setting;    // volts, or noise levels if adaptive
+        QVector<double> level;      // the threshold in use, in volts
+        QVector<double> noise;
+        QVector<qreal> previous;    // the last sample of the last block
+        QVector<qint64> nextAllowed;
+
+        QVector<Spike> found;
+        QVector<qreal> scratch;     // for estimateNoise()
+};
+
+#endif
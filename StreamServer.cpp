@@ -0,0 +1,543 @@
+#include <QtCore>
+#include <QtNetwork>
+#include <cstring>
+
+#include "StreamServer.h"
+
+static const char* socketName = "GDAQRec";
+static const qint64 highWater = 256*1024; // bytes buffered per socket
+static const qint64 minQueuedBytes = 64*1024;
+static const int maxDecimation = 64;
+
+struct StreamServer::Frame
+{
+    QByteArray data;
+    qint64 firstScan;
+    qint64 numScans;    // scans covered; 0 for control frames
+};
+
+struct StreamServer::Client
+{
+    QIODevice* socket;
+    Policy policy;
+    qint64 maxQueuedBytes;
+
+    QList<Frame> queue;
+    qint64 queuedBytes;
+    int decimation;
+    bool overflowed;
+
+    // scans dropped from the queue and not yet reported to the client
+    qint64 gapFirst;
+    qint64 gapScans;
+
+    QByteArray input;
+};
+
+
+StreamServer::StreamServer() :
+    localServer(NULL),
+    tcpServer(NULL),
+    numChannels(0),
+    bytesPerSecond(0.0),
+    flushPending(false)
+{
+    moveToThread(&thread);
+    thread.start();
+}
+
+StreamServer::~StreamServer()
+{
+    QMetaObject::invokeMethod(this, "shutdown", Qt::BlockingQueuedConnection);
+    thread.quit();
+    thread.wait();
+}
+
+void StreamServer::updateSettings(const DAQSettings& newSettings)
+{
+    {
+        QMutexLocker lock(&mutex);
+        settings = newSettings;
+
+        if (hello.isEmpty()) {
+            bytesPerSecond = 4.0*settings.samplingRate*settings.numChannels;
+        }
+    }
+
+    QMetaObject::invokeMethod(this, "applySettings", Qt::QueuedConnection);
+}
+
+void StreamServer::applySettings()
+{
+    DAQSettings current;
+    {
+        QMutexLocker lock(&mutex);
+        current = settings;
+
+        foreach (Client* client, clients) {
+            setBufferLength(client, current.streamBufferLength);
+        }
+    }
+
+    if (!current.streamEnabled) {
+        delete localServer;
+        localServer = NULL;
+        delete tcpServer;
+        tcpServer = NULL;
+
+        foreach (Client* client, clients) {
+            client->socket->close();
+        }
+        return;
+    }
+
+    if (localServer == NULL) {
+        localServer = new QLocalServer(this);
+        QLocalServer::removeServer(socketName);
+
+        if (localServer->listen(socketName)) {
+            connect(localServer, SIGNAL(newConnection()),
+                    this, SLOT(newLocalConnection()));
+        }
+        else {
+            qWarning("StreamServer: could not listen on %s: %s", socketName,
+                    qPrintable(localServer->errorString()));
+        }
+    }
+
+    if (tcpServer != NULL && tcpServer->serverPort() != current.streamTcpPort) {
+        delete tcpServer;
+        tcpServer = NULL;
+    }
+
+    if (tcpServer == NULL && current.streamTcpPort > 0) {
+        tcpServer = new QTcpServer(this);
+
+        if (tcpServer->listen(QHostAddress::LocalHost, current.streamTcpPort)) {
+            connect(tcpServer, SIGNAL(newConnection()),
+                    this, SLOT(newTcpConnection()));
+        }
+        else {
+            qWarning("StreamServer: could not listen on port %d: %s",
+                    current.streamTcpPort,
+                    qPrintable(tcpServer->errorString()));
+        }
+    }
+}
+
+void StreamServer::newLocalConnection()
+{
+    while (localServer->hasPendingConnections()) {
+        addClient(localServer->nextPendingConnection());
+    }
+}
+
+void StreamServer::newTcpConnection()
+{
+    while (tcpServer->hasPendingConnections()) {
+        QTcpSocket* socket = tcpServer->nextPendingConnection();
+        socket->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+        addClient(socket);
+    }
+}
+
+void StreamServer::addClient(QIODevice* socket)
+{
+    Client* client = new Client;
+    client->socket = socket;
+    client->queuedBytes = 0;
+    client->decimation = 1;
+    client->overflowed = false;
+    client->gapFirst = 0;
+    client->gapScans = 0;
+
+    connect(socket, SIGNAL(readyRead()), this, SLOT(readClient()));
+    connect(socket, SIGNAL(bytesWritten(qint64)), this, SLOT(flush()));
+    connect(socket, SIGNAL(disconnected()), this, SLOT(clientDisconnected()));
+
+    {
+        QMutexLocker lock(&mutex);
+
+        client->policy = Policy(settings.streamPolicy);
+        setBufferLength(client, settings.streamBufferLength);
+
+        // join a recording in progress
+        if (!hello.isEmpty()) {
+            Frame frame;
+            frame.data = hello;
+            frame.firstScan = 0;
+            frame.numScans = 0;
+            enqueue(client, frame);
+        }
+
+        clients.append(client);
+    }
+
+    flush();
+}
+
+StreamServer::Client* StreamServer::findClient(QObject* socket)
+{
+    foreach (Client* client, clients) {
+        if (client->socket == socket)
+            return client;
+    }
+
+    return NULL;
+}
+
+void StreamServer::clientDisconnected()
+{
+    QMutexLocker lock(&mutex);
+    Client* client = findClient(sender());
+
+    if (client != NULL) {
+        clients.removeAll(client);
+        client->socket->deleteLater();
+        delete client;
+    }
+}
+
+void StreamServer::readClient()
+{
+    Client* client;
+    {
+        QMutexLocker lock(&mutex);
+        client = findClient(sender());
+    }
+
+    if (client == NULL)
+        return;
+
+    client->input += client->socket->readAll();
+
+    while (client->input.size() >= headerSize) {
+        const uchar* p = reinterpret_cast<const uchar*>(client->input.constData());
+        quint32 frameMagic = qFromLittleEndian<quint32>(p);
+        quint16 type = qFromLittleEndian<quint16>(p + 4);
+        quint32 length = qFromLittleEndian<quint32>(p + 8);
+
+        if (frameMagic != quint32(magic) || length > 1024) {
+            client->socket->close();
+            return;
+        }
+
+        if (quint32(client->input.size()) < headerSize + length)
+            break;
+
+        if (type == Subscribe && length >= 8) {
+            quint32 policy = qFromLittleEndian<quint32>(p + headerSize);
+            quint32 bufferLength = qFromLittleEndian<quint32>(p + headerSize + 4);
+
+            QMutexLocker lock(&mutex);
+            client->policy = Policy(qMin(policy, quint32(Disconnect)));
+            setBufferLength(client, bufferLength > 0
+                    ? int(bufferLength) : settings.streamBufferLength);
+        }
+
+        client->input.remove(0, headerSize + length);
+    }
+}
+
+// mutex must be held
+void StreamServer::setBufferLength(Client* client, int bufferLength)
+{
+    client->maxQueuedBytes = qMax(minQueuedBytes,
+            qint64(bytesPerSecond*bufferLength/1000.0));
+}
+
+QByteArray StreamServer::frameHeader(FrameType type, int payloadLength)
+{
+    QByteArray header(headerSize, '\0');
+    uchar* p = reinterpret_cast<uchar*>(header.data());
+
+    qToLittleEndian<quint32>(magic, p);
+    qToLittleEndian<quint16>(type, p + 4);
+    qToLittleEndian<quint16>(0, p + 6);
+    qToLittleEndian<quint32>(payloadLength, p + 8);
+
+    return header;
+}
+
+QByteArray StreamServer::gapFrame(qint64 firstScan, qint64 numScans)
+{
+    QByteArray frame = frameHeader(Gap, 16);
+    frame.resize(headerSize + 16);
+    uchar* p = reinterpret_cast<uchar*>(frame.data()) + headerSize;
+
+    qToLittleEndian<quint64>(firstScan, p);
+    qToLittleEndian<quint64>(numScans, p + 8);
+
+    return frame;
+}
+
+void StreamServer::startedRecording(const DAQSettings& recordingSettings,
+        double dt)
+{
+    QMutexLocker lock(&mutex);
+
+    numChannels = recordingSettings.numChannels;
+    bytesPerSecond = 4.0*numChannels/dt;
+
+    hello = frameHeader(Hello, 16 + 16*numChannels);
+    hello.resize(headerSize + 16 + 16*numChannels);
+    uchar* p = reinterpret_cast<uchar*>(hello.data()) + headerSize;
+
+    double rate = 1.0/dt;
+    quint64 bits;
+
+    qToLittleEndian<quint32>(version, p);
+    qToLittleEndian<quint32>(numChannels, p + 4);
+    memcpy(&bits, &rate, 8);
+    qToLittleEndian<quint64>(bits, p + 8);
+    p += 16;
+
+    for (int chan = 0; chan < numChannels; ++chan) {
+        memcpy(&bits, &recordingSettings.minVoltage[chan], 8);
+        qToLittleEndian<quint64>(bits, p);
+        memcpy(&bits, &recordingSettings.maxVoltage[chan], 8);
+        qToLittleEndian<quint64>(bits, p + 8);
+        p += 16;
+    }
+
+    Frame frame;
+    frame.data = hello;
+    frame.firstScan = 0;
+    frame.numScans = 0;
+
+    foreach (Client* client, clients) {
+        setBufferLength(client, settings.streamBufferLength);
+        client->decimation = 1;
+        client->gapScans = 0;
+        enqueue(client, frame);
+    }
+
+    requestFlush();
+}
+
+QByteArray StreamServer::encodeScans(const ScanBlock& block, int decimation)
+{
+    // only send scans whose index is a multiple of the decimation, so that
+    // decimated frames line up from one block to the next
+    int offset = int((decimation - block.firstScan % decimation) % decimation);
+    int count = (offset < block.numScans)
+        ? (block.numScans - offset + decimation - 1)/decimation : 0;
+
+    if (count == 0)
+        return QByteArray();
+
+    int payloadLength = 16 + 4*count*numChannels;
+    QByteArray frame = frameHeader(Scans, payloadLength);
+    frame.resize(headerSize + payloadLength);
+    uchar* p = reinterpret_cast<uchar*>(frame.data()) + headerSize;
+
+    qToLittleEndian<quint64>(block.firstScan + offset, p);
+    qToLittleEndian<quint32>(count, p + 8);
+    qToLittleEndian<quint32>(decimation, p + 12);
+    p += 16;
+
+    for (int scan = offset; scan < block.numScans; scan += decimation) {
+        for (int chan = 0; chan < numChannels; ++chan) {
+            float value = float(block.scans[chan][scan]);
+            quint32 bits;
+            memcpy(&bits, &value, 4);
+            qToLittleEndian<quint32>(bits, p);
+            p += 4;
+        }
+    }
+
+    return frame;
+}
+
+void StreamServer::newScans(const ScanBlock& block)
+{
+    QMutexLocker lock(&mutex);
+
+    if (clients.isEmpty())
+        return;
+
+    // encode once for each decimation in use, and share the bytes
+    QMap<int, QByteArray> encoded;
+
+    foreach (Client* client, clients) {
+        if (!encoded.contains(client->decimation)) {
+            encoded.insert(client->decimation,
+                    encodeScans(block, client->decimation));
+        }
+
+        Frame frame;
+        frame.data = encoded.value(client->decimation);
+        frame.firstScan = block.firstScan;
+        frame.numScans = block.numScans;
+
+        if (!frame.data.isEmpty())
+            enqueue(client, frame);
+    }
+
+    requestFlush();
+}
+
+void StreamServer::scansLost(const ScanGap& gap)
+{
+    QMutexLocker lock(&mutex);
+
+    // sent as a control frame, so it can't itself be dropped
+    Frame frame;
+    frame.data = gapFrame(gap.firstScan, gap.numScans);
+    frame.firstScan = 0;
+    frame.numScans = 0;
+
+    foreach (Client* client, clients) {
+        enqueue(client, frame);
+    }
+
+    requestFlush();
+}
+
+void StreamServer::stoppedRecording()
+{
+    QMutexLocker lock(&mutex);
+
+    hello.clear();
+
+    Frame frame;
+    frame.data = frameHeader(Stopped, 0);
+    frame.firstScan = 0;
+    frame.numScans = 0;
+
+    foreach (Client* client, clients) {
+        enqueue(client, frame);
+    }
+
+    requestFlush();
+}
+
+// mutex must be held
+void StreamServer::enqueue(Client* client, const Frame& frame)
+{
+    if (client->overflowed)
+        return;
+
+    qint64 size = frame.data.size();
+
+    if (frame.numScans > 0
+            && client->queuedBytes + size > client->maxQueuedBytes) {
+        switch (client->policy) {
+            case Disconnect:
+                client->overflowed = true;
+                client->queue.clear();
+                client->queuedBytes = 0;
+                return;
+
+            case Decimate:
+                // send less from now on, and make room like DropOldest
+                if (client->decimation < maxDecimation)
+                    client->decimation *= 2;
+                // fall through
+
+            case DropOldest:
+            default:
+                dropOldest(client, size);
+                break;
+        }
+    }
+
+    client->queue.append(frame);
+    client->queuedBytes += size;
+}
+
+// Drops the oldest data frames (never control frames) until bytesNeeded
+// more will fit, remembering the scans lost so the client can be told.
+void StreamServer::dropOldest(Client* client, qint64 bytesNeeded)
+{
+    for (int i = 0; i < client->queue.count()
+            && client->queuedBytes + bytesNeeded > client->maxQueuedBytes; ) {
+        const Frame& frame = client->queue[i];
+
+        if (frame.numScans == 0) {
+            ++i;
+            continue;
+        }
+
+        if (client->gapScans == 0)
+            client->gapFirst = frame.firstScan;
+        client->gapScans = frame.firstScan + frame.numScans - client->gapFirst;
+
+        client->queuedBytes -= frame.data.size();
+        client->queue.removeAt(i);
+    }
+}
+
+// mutex must be held
+void StreamServer::requestFlush()
+{
+    if (!flushPending) {
+        flushPending = true;
+        QMetaObject::invokeMethod(this, "flush", Qt::QueuedConnection);
+    }
+}
+
+void StreamServer::flush()
+{
+    QList<Client*> current;
+    {
+        QMutexLocker lock(&mutex);
+        flushPending = false;
+        current = clients;
+    }
+
+    foreach (Client* client, current) {
+        if (client->overflowed) {
+            client->socket->close();
+            continue;
+        }
+
+        while (client->socket->bytesToWrite() < highWater) {
+            QByteArray gap;
+            Frame frame;
+            {
+                QMutexLocker lock(&mutex);
+
+                if (client->queue.isEmpty()) {
+                    // caught up; try sending more detail again
+                    if (client->decimation > 1)
+                        client->decimation /= 2;
+                    break;
+                }
+
+                frame = client->queue.takeFirst();
+                client->queuedBytes -= frame.data.size();
+
+                if (frame.numScans > 0 && client->gapScans > 0) {
+                    gap = gapFrame(client->gapFirst, client->gapScans);
+                    client->gapScans = 0;
+                }
+            }
+
+            if (!gap.isEmpty())
+                client->socket->write(gap);
+            client->socket->write(frame.data);
+        }
+    }
+}
+
+void StreamServer::shutdown()
+{
+    delete localServer;
+    localServer = NULL;
+    delete tcpServer;
+    tcpServer = NULL;
+
+    QList<Client*> closing;
+    {
+        QMutexLocker lock(&mutex);
+        closing = clients;
+        clients.clear();
+    }
+
+    foreach (Client* client, closing) {
+        client->socket->disconnect(this);
+        delete client->socket;
+        delete client;
+    }
+}
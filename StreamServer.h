@@ -0,0 +1,96 @@
+#ifndef STREAMSERVER_H
+#define STREAMSERVER_H
+
+#include <QObject>
+#include <QThread>
+#include <QMutex>
+#include <QList>
+#include <QByteArray>
+#include "DAQSink.h"
+
+class QIODevice;
+class QLocalServer;
+class QTcpServer;
+
+// Serves the live data to other processes over a local socket (and
+// optionally TCP on localhost).  The acquisition thread only encodes each
+// block once and appends it to every client's bounded queue; the sockets
+// are serviced on the server's own thread, so a slow client can only lose
+// its own data, never hold up DAQReader.
+//
+// Wire format: every frame starts with a 12 byte little-endian header,
+//   u32 magic ("GDQS"), u16 type, u16 flags (0), u32 payload length.
+// Server to client:
+//   Hello      u32 version, u32 channels, f64 scans/s,
+//              channels x (f64 min volts, f64 max volts)
+//   Scans      u64 first scan, u32 scans, u32 decimation,
+//              scans x channels f32 volts, scan by scan; scan i of the
+//              frame is scan (first + i*decimation) of the recording
+//   Gap        u64 first scan, u64 scans lost by the device or dropped
+//              from this client's queue
+//   Stopped    no payload
+// Client to server, optional, at any time:
+//   Subscribe  u32 policy, u32 buffer length in ms (0 for the default)
+class StreamServer : public QObject, public DAQSink
+{
+    Q_OBJECT
+
+    public:
+        // what to do when a client's queue is full
+        enum Policy { DropOldest, Decimate, Disconnect };
+
+        enum FrameType {
+            Hello = 1, Scans = 2, Gap = 3, Stopped = 4,
+            Subscribe = 16
+        };
+
+        enum { magic = 0x53514447, version = 1, headerSize = 12 };
+
+        StreamServer();
+        ~StreamServer();
+
+        void updateSettings(const DAQSettings& settings);
+
+        void startedRecording(const DAQSettings& settings, double dt);
+        void newScans(const ScanBlock& block);
+        void scansLost(const ScanGap& gap);
+        void stoppedRecording();
+
+    private slots:
+        void applySettings();
+        void newLocalConnection();
+        void newTcpConnection();
+        void flush();
+        void readClient();
+        void clientDisconnected();
+        void shutdown();
+
+    private:
+        struct Frame;
+        struct Client;
+
+        static QByteArray frameHeader(FrameType type, int payloadLength);
+        static QByteArray gapFrame(qint64 firstScan, qint64 numScans);
+        QByteArray encodeScans(const ScanBlock& block, int decimation);
+        void addClient(QIODevice* socket);
+        Client* findClient(QObject* socket);
+        void enqueue(Client* client, const Frame& frame);
+        void dropOldest(Client* client, qint64 bytesNeeded);
+        void setBufferLength(Client* client, int bufferLength);
+        void requestFlush();
+
+        QThread thread;
+        QLocalServer* localServer;
+        QTcpServer* tcpServer;
+
+        // everything below is shared with the acquisition thread
+        QMutex mutex;
+        DAQSettings settings;
+        QList<Client*> clients;
+        QByteArray hello;
+        int numChannels;
+        double bytesPerSecond;
+        bool flushPending;
+};
+
+#endif
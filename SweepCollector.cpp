@@ -0,0 +1,258 @@
+#include <QtCore>
+#include <limits>
+
+#include "SweepCollector.h"
+
+SweepCollector::SweepCollector() :
+    dt(0.0),
+    numChannels(0),
+    triggerChannel(-1),
+    sign(1.0),
+    threshold(0.0),
+    preScans(0),
+    postScans(1),
+    ringPos(0),
+    ringFilled(0),
+    previous(0.0),
+    captured(0),
+    capturing(false),
+    sweepCount(0)
+{
+}
+
+// Everything the acquisition thread will need is allocated here, so that
+// newScans() never allocates.
+void SweepCollector::startedRecording(const DAQSettings& settings,
+        double dt_)
+{
+    QMutexLocker lock(&mutex);
+
+    dt = dt_;
+    numChannels = settings.numChannels;
+    triggerChannel = settings.triggerChannel < numChannels
+        ? settings.triggerChannel : -1;
+    sign = settings.triggerLevel < 0.0 ? -1.0 : 1.0;
+    threshold = sign*settings.triggerLevel;
+    preScans = qMax(0, int(settings.triggerPre*1e-3/dt + 0.5));
+    postScans = qMax(1, int(settings.triggerPost*1e-3/dt + 0.5));
+
+    // each its own copy, not one shared until written
+    ring.resize(numChannels);
+    sweep.resize(numChannels);
+    counts.resize(numChannels);
+    sums.resize(numChannels);
+    numSummed.resize(numChannels);
+
+    for (int chan = 0; chan < numChannels; ++chan) {
+        ring[chan] = QVector<qreal>(preScans);
+        sweep[chan] = QVector<qreal>(preScans + postScans);
+        counts[chan] = QVector<quint32>(numColumns*numLevels, 0);
+        sums[chan] = QVector<double>(preScans + postScans, 0.0);
+        numSummed[chan] = QVector<int>(preScans + postScans, 0);
+    }
+
+    ringPos = 0;
+    ringFilled = 0;
+    previous = std::numeric_limits<qreal>::quiet_NaN();
+    capturing = false;
+    triggers.resize(0);
+    triggers.reserve(maxTriggers);
+
+    minVoltage = settings.minVoltage.mid(0, numChannels);
+    maxVoltage = settings.maxVoltage.mid(0, numChannels);
+    sweepCount = 0;
+}
+
+void SweepCollector::newScans(const ScanBlock& block)
+{
+    QMutexLocker lock(&mutex);
+
+    if (triggerChannel < 0)
+        return;
+
+    const qreal* trigger = block.scans[triggerChannel];
+
+    for (int i = 0; i < block.numScans; ++i) {
+        qreal value = sign*trigger[i];
+
+        if (value >= threshold && previous < threshold) {
+            // more than the GUI can mark anyway; no reallocating for them
+            if (triggers.count() < maxTriggers)
+                triggers.append(block.firstScan + i);
+
+            // a sweep needs its whole pre-trigger window
+            if (!capturing && ringFilled == preScans)
+                startSweep();
+        }
+
+        previous = value;
+
+        if (capturing) {
+            for (int chan = 0; chan < numChannels; ++chan)
+                sweep[chan][preScans + captured] = block.scans[chan][i];
+
+            if (++captured == postScans)
+                finishSweep();
+        }
+
+        if (preScans > 0) {
+            for (int chan = 0; chan < numChannels; ++chan)
+                ring[chan][ringPos] = block.scans[chan][i];
+
+            ringPos = (ringPos + 1)%preScans;
+            ringFilled = qMin(ringFilled + 1, preScans);
+        }
+    }
+}
+
+// A sweep isn't captured across scans that never arrived.
+void SweepCollector::scansLost(const ScanGap& /* gap */)
+{
+    QMutexLocker lock(&mutex);
+    capturing = false;
+    ringFilled = 0;
+    previous = std::numeric_limits<qreal>::quiet_NaN();
+}
+
+void SweepCollector::clear()
+{
+    QMutexLocker lock(&mutex);
+
+    for (int chan = 0; chan < counts.count(); ++chan) {
+        counts[chan].fill(0);
+        sums[chan].fill(0.0);
+        numSummed[chan].fill(0);
+    }
+
+    sweepCount = 0;
+}
+
+int SweepCollector::numSweeps()
+{
+    QMutexLocker lock(&mutex);
+    return sweepCount;
+}
+
+void SweepCollector::window(double* pre, double* post)
+{
+    QMutexLocker lock(&mutex);
+    *pre = preScans*dt;
+    *post = postScans*dt;
+}
+
+int SweepCollector::takeTriggers(QVector<double>* times, double timeOffset)
+{
+    QMutexLocker lock(&mutex);
+    int numTriggers = triggers.count();
+
+    for (int i = 0; i < numTriggers; ++i)
+        times->append(triggers[i]*dt + timeOffset);
+
+    // keeps the capacity, so the acquisition thread needn't reallocate
+    triggers.resize(0);
+    return numTriggers;
+}
+
+int SweepCollector::snapshot(int chan, QVector<quint32>* counts_,
+        QVector<double>* average, double* minVoltage_, double* maxVoltage_)
+{
+    QMutexLocker lock(&mutex);
+
+    if (chan >= counts.count()) {
+        counts_->clear();
+        average->clear();
+        return 0;
+    }
+
+    // a copy of its own: if the caller shared ours, the next finishSweep()
+    // would have to detach it on the acquisition thread
+    const QVector<quint32>& image = counts[chan];
+    counts_->resize(image.count());
+    qCopy(image.constBegin(), image.constEnd(), counts_->begin());
+
+    *minVoltage_ = minVoltage[chan];
+    *maxVoltage_ = maxVoltage[chan];
+
+    const QVector<double>& sum = sums[chan];
+    average->resize(sum.count());
+    for (int k = 0; k < sum.count(); ++k) {
+        (*average)[k] = numSummed[chan][k] > 0
+            ? sum[k]/numSummed[chan][k]
+            : std::numeric_limits<double>::quiet_NaN();
+    }
+
+    return sweepCount;
+}
+
+// The pre-trigger window comes out of the ring oldest first.
+void SweepCollector::startSweep()
+{
+    for (int chan = 0; chan < numChannels; ++chan) {
+        const qreal* from = ring[chan].constData();
+        qreal* to = sweep[chan].data();
+
+        for (int k = 0; k < preScans; ++k)
+            to[k] = from[(ringPos + k)%preScans];
+    }
+
+    captured = 0;
+    capturing = true;
+}
+
+// Each column of the image counts the levels from the lowest to the
+// highest sample in it, joined to the last sample of the column before,
+// so the trace is unbroken however many or few scans a column has.
+void SweepCollector::finishSweep()
+{
+    const int numScans = preScans + postScans;
+
+    for (int chan = 0; chan < numChannels; ++chan) {
+        const qreal* x = sweep[chan].constData();
+        double* sum = sums[chan].data();
+        int* summed = numSummed[chan].data();
+
+        for (int k = 0; k < numScans; ++k) {
+            if (x[k] == x[k]) {
+                sum[k] += x[k];
+                ++summed[k];
+            }
+        }
+
+        double span = maxVoltage[chan] - minVoltage[chan];
+        if (span <= 0.0)
+            continue;
+
+        const double scale = (numLevels - 1)/span;
+        quint32* cells = counts[chan].data();
+        int last = -1;
+
+        for (int col = 0; col < numColumns; ++col) {
+            int first = int(qint64(col)*numScans/numColumns);
+            int end = qMax(first + 1,
+                    int(qint64(col + 1)*numScans/numColumns));
+            int low = last >= 0 ? last : numLevels;
+            int high = last;
+
+            for (int k = first; k < end; ++k) {
+                if (x[k] != x[k]) {
+                    last = -1;
+                    continue;
+                }
+
+                int level = qBound(0,
+                        int((x[k] - minVoltage[chan])*scale + 0.5),
+                        numLevels - 1);
+                low = qMin(low, level);
+                high = qMax(high, level);
+                last = level;
+            }
+
+            quint32* cell = cells + col*numLevels;
+            for (int level = low; level <= high; ++level)
+                ++cell[level];
+        }
+    }
+
+    ++sweepCount;
+    capturing = false;
+}
@@ -0,0 +1,85 @@
+#ifndef SWEEPCOLLECTOR_H
+#define SWEEPCOLLECTOR_H
+
+#include <QMutex>
+#include <QVector>
+#include "DAQSink.h"
+
+// Oscilloscope-style sweeps for Plotter's sweep view.  On the acquisition
+// thread each crossing of DAQSettings::triggerLevel on the trigger channel
+// (in the direction of the level's sign, so a TTL line recorded on an
+// analog input triggers at, say, 2.5) captures triggerPre ms before it,
+// from a ring kept for the purpose, and triggerPost ms after it, for every
+// channel.  Triggers during a sweep are ignored.  Each finished sweep is
+// added to a persistence image per channel (numColumns across the window
+// by numLevels over the channel's voltage range, counting the sweeps that
+// passed through each cell) and to a running sum for the average, so the
+// cost of a sweep doesn't depend on how many came before it.  Every
+// trigger, during a sweep or not, is also kept for takeTriggers(), up to
+// maxTriggers between calls.
+class SweepCollector : public DAQSink
+{
+    public:
+        enum { numColumns = 512, numLevels = 256, maxTriggers = 4096 };
+
+        SweepCollector();
+
+        void startedRecording(const DAQSettings& settings, double dt);
+        void newScans(const ScanBlock& block);
+        void scansLost(const ScanGap& gap);
+
+        // forgets the sweeps so far
+        void clear();
+
+        // the sweeps collected since the recording started or clear()
+        int numSweeps();
+        // the window around the trigger, in seconds (pre is positive)
+        void window(double* pre, double* post);
+
+        // Moves the times of the triggers since the last call (in seconds
+        // from the start of the recording, plus timeOffset) onto the end
+        // of times; returns how many there were.
+        int takeTriggers(QVector<double>* times, double timeOffset);
+
+        // A channel's persistence image ([column*numLevels + level], level
+        // 0 at minVoltage) and average (one per scan of the window, NaN
+        // where no sweep had data); returns the number of sweeps in them.
+        int snapshot(int chan, QVector<quint32>* counts,
+                QVector<double>* average, double* minVoltage,
+                double* maxVoltage);
+
+    private:
+        void startSweep();
+        void finishSweep();
+
+        QMutex mutex;           // for everything below
+        double dt;
+        int numChannels;
+        int triggerChannel;     // -1 for none
+        qreal sign;             // the crossing's direction
+        qreal threshold;        // times sign
+        int preScans;
+        int postScans;
+
+        // per channel: the last preScans scans, oldest at ringPos once full
+        QVector<QVector<qreal> > ring;
+        int ringPos;
+        int ringFilled;
+        qreal previous;         // the trigger channel's last sample
+        QVector<qint64> triggers;   // scans, since takeTriggers()
+
+        // the sweep being captured, if capturing
+        QVector<QVector<qreal> > sweep;
+        int captured;
+        bool capturing;
+
+        // per channel, the accumulated sweeps
+        QVector<double> minVoltage;
+        QVector<double> maxVoltage;
+        QVector<QVector<quint32> > counts;
+        QVector<QVector<double> > sums;
+        QVector<QVector<int> > numSummed;
+        int sweepCount;
+};
+
+#endif
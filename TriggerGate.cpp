@@ -0,0 +1,154 @@
+#include <QtCore>
+#include <limits>
+
+#include "TriggerGate.h"
+#include "DAQSettingsDialog/DAQSettingsDialog.h"
+
+TriggerGate::TriggerGate() :
+    active(false),
+    numChannels(0),
+    triggerChannel(-1),
+    sign(1.0),
+    threshold(0.0),
+    preScans(0),
+    postScans(1),
+    ringPos(0),
+    ringFilled(0),
+    previous(0.0),
+    triggerPending(false),
+    postLeft(0),
+    triggerCount(0),
+    keptCount(0)
+{
+}
+
+bool TriggerGate::configure(const DAQSettings& settings, double dt)
+{
+    active = settings.triggeredRecording;
+    numChannels = settings.numChannels;
+    triggerChannel = settings.triggerChannel < numChannels
+        ? settings.triggerChannel : -1;
+    sign = settings.triggerLevel < 0.0 ? -1.0 : 1.0;
+    threshold = sign*settings.triggerLevel;
+    preScans = qMax(0, int(settings.triggerPre*1e-3/dt + 0.5));
+    postScans = qMax(1, int(settings.triggerPost*1e-3/dt + 0.5));
+
+    // each its own copy, not one shared until written
+    ring.resize(active ? numChannels : 0);
+    ringScans.resize(ring.count());
+    kept.resize(active ? numChannels : 0);
+
+    for (int chan = 0; chan < ring.count(); ++chan) {
+        ring[chan] = QVector<qreal>(preScans);
+        ringScans[chan] = ring[chan].constData();
+        kept[chan].resize(0);
+        kept[chan].reserve(preScans + postScans);
+    }
+
+    keptRuns.resize(0);
+    ringPos = 0;
+    ringFilled = 0;
+    previous = std::numeric_limits<qreal>::quiet_NaN();
+    triggerPending = false;
+    postLeft = 0;
+    triggerCount = 0;
+    keptCount = 0;
+
+    return active;
+}
+
+void TriggerGate::trigger()
+{
+    triggerPending = true;
+}
+
+void TriggerGate::process(const qreal* const* scans, qint64 firstScan,
+        int numScans)
+{
+    if (!active)
+        return;
+
+    const qreal* trigger = triggerChannel >= 0 ? scans[triggerChannel] : NULL;
+
+    for (int i = 0; i < numScans; ++i) {
+        qint64 scan = firstScan + i;
+        bool triggered = triggerPending;
+        triggerPending = false;
+
+        if (trigger != NULL) {
+            qreal value = sign*trigger[i];
+
+            if (value >= threshold && previous < threshold)
+                triggered = true;
+
+            previous = value;
+        }
+
+        if (triggered) {
+            ++triggerCount;
+
+            // the ring, oldest first, leads up to this scan
+            if (postLeft == 0) {
+                int oldest = preScans > 0
+                    ? (ringPos - ringFilled + preScans)%preScans : 0;
+
+                for (int k = 0; k < ringFilled; ++k) {
+                    keep(ringScans.constData(), (oldest + k)%preScans,
+                            scan - ringFilled + k);
+                }
+
+                ringPos = 0;
+                ringFilled = 0;
+            }
+
+            postLeft = postScans;
+        }
+
+        if (postLeft > 0) {
+            keep(scans, i, scan);
+            --postLeft;
+        }
+        else if (preScans > 0) {
+            for (int chan = 0; chan < numChannels; ++chan)
+                ring[chan][ringPos] = scans[chan][i];
+
+            ringPos = (ringPos + 1)%preScans;
+            ringFilled = qMin(ringFilled + 1, preScans);
+        }
+    }
+}
+
+void TriggerGate::skip()
+{
+    ringPos = 0;
+    ringFilled = 0;
+    previous = std::numeric_limits<qreal>::quiet_NaN();
+}
+
+// Keeps the capacity, so the acquisition thread needn't reallocate; a run
+// still being kept carries on as a new one.
+void TriggerGate::take()
+{
+    for (int chan = 0; chan < kept.count(); ++chan)
+        kept[chan].resize(0);
+
+    keptRuns.resize(0);
+}
+
+void TriggerGate::keep(const qreal* const* scans, int index, qint64 scan)
+{
+    if (keptRuns.isEmpty()
+            || keptRuns.last().firstScan + keptRuns.last().numScans != scan) {
+        Run run;
+        run.firstScan = scan;
+        run.index = count();
+        run.numScans = 0;
+        keptRuns.append(run);
+    }
+
+    for (int chan = 0; chan < numChannels; ++chan)
+        kept[chan].append(scans[chan][index]);
+
+    ++keptRuns.last().numScans;
+    ++keptCount;
+}
@@ -0,0 +1,84 @@
+#ifndef TRIGGERGATE_H
+#define TRIGGERGATE_H
+
+#include <QVector>
+#include <QtGlobal>
+
+struct DAQSettings;
+
+// DAQSettings::triggeredRecording: of everything acquired, keeps only the
+// scans from triggerPre ms before each trigger to triggerPost ms after it,
+// so that sparse events don't cost a continuous recording's memory and
+// disk.  Triggers are crossings of the sweep trigger level on the trigger
+// channel, or trigger() (the keyboard or a control socket command).  The
+// scans before a trigger come from a ring of the latest scans not already
+// kept; a trigger during the scans after another extends them, so windows
+// never overlap.
+//
+// What's kept is handed out as runs of contiguous scans, each with its
+// offset in scans from the start of the recording (counting scans the
+// device lost), to be stored with the gaps between them.  Runs the
+// windows of nearby triggers make contiguous are merged.
+class TriggerGate
+{
+    public:
+        struct Run
+        {
+            qint64 firstScan;   // since the recording started
+            int index;          // of its first scan in scans()
+            int numScans;
+        };
+
+        TriggerGate();
+
+        // Sets up for a recording, emptying the ring and what's kept;
+        // returns isActive().
+        bool configure(const DAQSettings& settings, double dt);
+        bool isActive() const { return active; }
+
+        // a trigger at the next scan to be processed
+        void trigger();
+
+        // the next numScans scans, the first firstScan since the start
+        void process(const qreal* const* scans, qint64 firstScan,
+                int numScans);
+        // scans were lost, so the ring no longer leads up to the next one
+        void skip();
+
+        // what's been kept, per channel, and its runs, until take()
+        const QVector<QVector<qreal> >& scans() const { return kept; }
+        const QVector<Run>& runs() const { return keptRuns; }
+        int count() const { return kept.isEmpty() ? 0 : kept[0].count(); }
+        void take();
+
+        qint64 numTriggers() const { return triggerCount; }
+        qint64 scansKept() const { return keptCount; }
+
+    private:
+        void keep(const qreal* const* scans, int index, qint64 scan);
+
+        bool active;
+        int numChannels;
+        int triggerChannel;     // -1 for manual triggers only
+        qreal sign;             // the crossing's direction
+        qreal threshold;        // times sign
+        int preScans;
+        int postScans;
+
+        // per channel: the latest scans not kept, oldest at ringPos once
+        // full
+        QVector<QVector<qreal> > ring;
+        int ringPos;
+        int ringFilled;
+        qreal previous;         // the trigger channel's last sample
+        bool triggerPending;
+        int postLeft;           // of the window being kept, 0 if none
+
+        QVector<QVector<qreal> > kept;
+        QVector<Run> keptRuns;
+        QVector<const qreal*> ringScans;    // ring, for keep()
+        qint64 triggerCount;
+        qint64 keptCount;
+};
+
+#endif
@@ -0,0 +1,997 @@
+#include <QtGui>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+#include "plotter.h"
+#include "DAQReader.h"
+#include "EventAverage.h"
+#include "FilterBank.h"
+#include "SpikeDetector.h"
+
+// Synthetic recordings cover the rigs we actually run: one to 64 channels
+// (32 and 64 spread over several boards, only where feasible() says the
+// boards keep up) at 1 kS/s up to the 35 kS/s DAQReader maximum.
+static const int channelCounts[] = { 1, 2, 4, 8, 32, 64 };
+static const int samplingRates[] = { 1000, 10000, 35000 };
+static const double zoomSpans[] = { 0.1, 1.0, 10.0 }; // seconds
+
+static const int numChannelCounts =
+    sizeof(channelCounts)/sizeof(channelCounts[0]);
+static const int numSamplingRates =
+    sizeof(samplingRates)/sizeof(samplingRates[0]);
+static const int numZoomSpans = sizeof(zoomSpans)/sizeof(zoomSpans[0]);
+
+static const double recordingLength = 10.0; // seconds, for rendering
+static const double fileLength = 2.0;       // seconds, for CSV I/O
+static const int updatesPerSecond = 10;     // matches the comedi read size
+static const int plotWidth = 1200;
+static const int plotHeight = 800;
+
+// -r: keep the stores as raw ADC codes (DAQSettings::rawStorage)
+static bool rawStorage = false;
+
+#if defined(USE_NIDAQMXBASE)
+static const char* daqLibName = "nidaqmxbase";
+#elif defined(USE_COMEDI)
+static const char* daqLibName = "comedi";
+#elif defined(USE_SIMULATED_DAQ)
+static const char* daqLibName = "simulated";
+#endif
+
+
+// a few slow sines plus mains hum and noise, roughly what a nerve
+// recording looks like at this zoom level.
+static double syntheticSample(int chan, int scan, int samplingRate)
+{
+    const double twoPi = 6.28318530717958647692;
+    double t = double(scan)/samplingRate;
+
+    return 5.0*sin(twoPi*(chan + 1)*t)
+        + 0.5*sin(twoPi*60.0*t)
+        + 0.001*(qrand() % 2001 - 1000);
+}
+
+
+class Benchmark
+{
+    public:
+        Benchmark(const QString& name_, int numChannels_ = 0,
+                int samplingRate_ = 0, double parameter_ = 0.0) :
+            name(name_),
+            numChannels(numChannels_),
+            samplingRate(samplingRate_),
+            parameter(parameter_)
+        {
+        }
+
+        virtual ~Benchmark() {}
+
+        // called once, before any timing
+        virtual void setUp() {}
+        // called before each timed iteration; not included in the timing
+        virtual void prepare() {}
+        // the timed operation
+        virtual void run() = 0;
+        virtual void tearDown() {}
+
+        // number of samples handled by one call to run()
+        virtual qint64 samplesPerRun() const = 0;
+
+        QString name;
+        int numChannels;
+        int samplingRate;
+        double parameter;
+};
+
+
+struct BenchmarkResult
+{
+    QString name;
+    int numChannels;
+    int samplingRate;
+    double parameter;
+    qint64 iterations;
+    double meanNs;
+    qint64 minNs;
+    double samplesPerSecond;
+};
+
+
+static BenchmarkResult runBenchmark(Benchmark* benchmark, qint64 minTimeNs)
+{
+    const int minIterations = 5;
+
+    benchmark->setUp();
+
+    // one untimed pass to warm up caches and the allocator
+    benchmark->prepare();
+    benchmark->run();
+
+    QElapsedTimer timer;
+    qint64 totalNs = 0;
+    qint64 minNs = -1;
+    qint64 iterations = 0;
+
+    while (totalNs < minTimeNs || iterations < minIterations) {
+        benchmark->prepare();
+
+        timer.start();
+        benchmark->run();
+        qint64 ns = timer.nsecsElapsed();
+
+        totalNs += ns;
+        if (minNs < 0 || ns < minNs)
+            minNs = ns;
+        ++iterations;
+    }
+
+    benchmark->tearDown();
+
+    BenchmarkResult result;
+    result.name = benchmark->name;
+    result.numChannels = benchmark->numChannels;
+    result.samplingRate = benchmark->samplingRate;
+    result.parameter = benchmark->parameter;
+    result.iterations = iterations;
+    result.meanNs = double(totalNs)/iterations;
+    result.minNs = minNs;
+    result.samplesPerSecond =
+        benchmark->samplesPerRun()*1.0e9/result.meanNs;
+
+    return result;
+}
+
+
+// Gives the acquisition benchmarks access to DAQReader's buffers, so that
+// they can stand in for the acquisition thread.
+class BenchDAQReader : public DAQReader
+{
+    public:
+        BenchDAQReader(int numChannels, int samplingRate)
+        {
+            DAQSettings settings;
+            settings.setNumChannels(numChannels);
+            settings.samplingRate = samplingRate;
+            settings.rawStorage = rawStorage;
+
+            updateDAQSettings(settings);
+        }
+
+        void queueScans(int numScans, int samplingRate)
+        {
+            QMutexLocker lock(&mutex);
+
+            for (int chan = 0; chan < numChannels; ++chan) {
+                newDataBuffer[chan].reserve(
+                        newDataBuffer[chan].count() + numScans);
+
+                for (int scan = 0; scan < numScans; ++scan) {
+                    newDataBuffer[chan].push_back(
+                            syntheticSample(chan, scan, samplingRate));
+                }
+            }
+        }
+
+        void discardScans()
+        {
+            QMutexLocker lock(&mutex);
+
+            for (int chan = 0; chan < numChannels; ++chan) {
+                newDataBuffer[chan].clear();
+            }
+        }
+
+#ifdef USE_COMEDI
+        void setUpConversion(int overSampling_)
+        {
+            range.min = -10.0;
+            range.max = 10.0;
+            range.unit = UNIT_volt;
+
+            for (int chan = 0; chan < numChannels; ++chan) {
+                crange[chan] = &range;
+                maxdata[chan] = 0xffff;
+            }
+
+            overSampling = overSampling_;
+            resetOverSampling();
+        }
+
+        void convert(const sampl_t* buffer, int numSamples)
+        {
+            convertSamples(buffer, numSamples);
+        }
+
+    private:
+        comedi_range range;
+#endif
+};
+
+
+class AppendDataBenchmark : public Benchmark
+{
+    public:
+        AppendDataBenchmark(int numChannels, int samplingRate) :
+            Benchmark("DAQReader::appendData", numChannels, samplingRate),
+            reader(numChannels, samplingRate),
+            scansPerUpdate(samplingRate/updatesPerSecond)
+        {
+        }
+
+        void prepare()
+        {
+            // keep the store from growing for the whole run, but let it
+            // grow far enough to see reallocation costs
+            if (samples.count() > 60*samplingRate) {
+                samples.clear();
+            }
+
+            reader.queueScans(scansPerUpdate, samplingRate);
+        }
+
+        void run()
+        {
+            reader.appendData(&samples);
+        }
+
+        qint64 samplesPerRun() const
+        {
+            return qint64(scansPerUpdate)*numChannels;
+        }
+
+    private:
+        BenchDAQReader reader;
+        int scansPerUpdate;
+        SampleStore samples;
+};
+
+
+// Statistics over random ranges of a recording, from the store's
+// summaries; the throughput is of the samples the ranges cover.
+class StatisticsBenchmark : public Benchmark
+{
+    public:
+        enum { numQueries = 1000 };
+
+        StatisticsBenchmark(int numChannels, int samplingRate) :
+            Benchmark("SampleStore::statistics", numChannels, samplingRate),
+            reader(numChannels, samplingRate),
+            samplesCovered(0)
+        {
+        }
+
+        void setUp()
+        {
+            reader.queueScans(int(recordingLength*samplingRate),
+                    samplingRate);
+            reader.appendData(&samples);
+
+            for (int i = 0; i < numQueries; ++i) {
+                qint64 first = qrand() % samples.count();
+                qint64 end = first + 1 + qrand() % (samples.count() - first);
+
+                firsts.append(first);
+                ends.append(end);
+                samplesCovered += qint64(end - first)*numChannels;
+            }
+        }
+
+        void run()
+        {
+            for (int i = 0; i < numQueries; ++i) {
+                for (int chan = 0; chan < numChannels; ++chan)
+                    samples.statistics(chan, firsts[i], ends[i]);
+            }
+        }
+
+        qint64 samplesPerRun() const
+        {
+            return samplesCovered;
+        }
+
+    private:
+        BenchDAQReader reader;
+        SampleStore samples;
+        QVector<qint64> firsts;
+        QVector<qint64> ends;
+        qint64 samplesCovered;
+};
+
+
+// Averages of every channel around an event every 100 ms of a recording,
+// 10 ms before to 50 ms after, split across threads as for a file.
+class EventAverageBenchmark : public Benchmark
+{
+    public:
+        EventAverageBenchmark(int numChannels, int samplingRate) :
+            Benchmark("EventAverage::computeAll", numChannels, samplingRate),
+            reader(numChannels, samplingRate)
+        {
+        }
+
+        void setUp()
+        {
+            reader.queueScans(int(recordingLength*samplingRate),
+                    samplingRate);
+            reader.appendData(&samples);
+
+            for (qint64 scan = 0; scan < samples.count();
+                    scan += samplingRate/10)
+                events.append(scan);
+
+            average.reset(numChannels, samplingRate/100, samplingRate/20);
+        }
+
+        void run()
+        {
+            average.computeAll(samples, events, -1, 0.0);
+        }
+
+        qint64 samplesPerRun() const
+        {
+            return qint64(events.count())
+                *(average.preScans() + average.postScans())*numChannels;
+        }
+
+    private:
+        BenchDAQReader reader;
+        SampleStore samples;
+        QVector<qint64> events;
+        EventAverage average;
+};
+
+
+// One acquisition block at a time through spike detection, with fixed
+// thresholds (parameter 0) or adaptive ones (parameter 1).
+class SpikeDetectorBenchmark : public Benchmark
+{
+    public:
+        SpikeDetectorBenchmark(int numChannels, int samplingRate,
+                bool adaptive) :
+            Benchmark("SpikeDetector::newScans", numChannels, samplingRate,
+                    adaptive ? 1.0 : 0.0),
+            scansPerUpdate(samplingRate/updatesPerSecond)
+        {
+        }
+
+        void setUp()
+        {
+            DAQSettings settings;
+            settings.setNumChannels(numChannels);
+            settings.spikeAdaptive = (parameter != 0.0);
+            settings.spikeThreshold.fill(settings.spikeAdaptive ? -4.0 : -3.0);
+            detector.startedRecording(settings, 1.0/samplingRate);
+
+            data.resize(numChannels);
+            channels.resize(numChannels);
+
+            for (int chan = 0; chan < numChannels; ++chan) {
+                for (int scan = 0; scan < scansPerUpdate; ++scan) {
+                    data[chan].push_back(
+                            syntheticSample(chan, scan, samplingRate));
+                }
+
+                channels[chan] = data[chan].constData();
+            }
+
+            block.scans = channels.constData();
+            block.numScans = scansPerUpdate;
+            block.firstScan = 0;
+            block.monotonicNs = 0;
+            block.realtimeNs = 0;
+        }
+
+        void prepare()
+        {
+            spikes.resize(0);
+            detector.takeSpikes(&spikes, 0.0);
+        }
+
+        void run()
+        {
+            detector.newScans(block);
+            block.firstScan += scansPerUpdate;
+        }
+
+        qint64 samplesPerRun() const
+        {
+            return qint64(scansPerUpdate)*numChannels;
+        }
+
+    private:
+        int scansPerUpdate;
+        SpikeDetector detector;
+        QVector<QVector<qreal> > data;
+        QVector<const qreal*> channels;
+        ScanBlock block;
+        QVector<Spike> spikes;
+};
+
+
+// One acquisition block at a time through every channel's highpass and
+// 60 Hz notch (parameter 0), or those and the FIR lowpass (parameter 1),
+// in place as with "Display and recording".
+class FilterBankBenchmark : public Benchmark
+{
+    public:
+        FilterBankBenchmark(int numChannels, int samplingRate, bool lowpass) :
+            Benchmark("FilterBank::process", numChannels, samplingRate,
+                    lowpass ? 1.0 : 0.0),
+            scansPerUpdate(samplingRate/updatesPerSecond)
+        {
+        }
+
+        void setUp()
+        {
+            DAQSettings settings;
+            settings.setNumChannels(numChannels);
+            settings.highpass.fill(0.01*samplingRate);
+            settings.notch.fill(60.0);
+            settings.lowpass.fill(parameter != 0.0 ? 0.25*samplingRate : 0.0);
+            filters.configure(settings, 1.0/samplingRate);
+
+            data.resize(numChannels);
+            channels.resize(numChannels);
+
+            for (int chan = 0; chan < numChannels; ++chan) {
+                for (int scan = 0; scan < scansPerUpdate; ++scan) {
+                    data[chan].push_back(
+                            syntheticSample(chan, scan, samplingRate));
+                }
+
+                channels[chan] = data[chan].data();
+            }
+        }
+
+        void run()
+        {
+            filters.process(channels.constData(), channels.constData(),
+                    scansPerUpdate);
+        }
+
+        qint64 samplesPerRun() const
+        {
+            return qint64(scansPerUpdate)*numChannels;
+        }
+
+    private:
+        int scansPerUpdate;
+        FilterBank filters;
+        QVector<QVector<qreal> > data;
+        QVector<qreal*> channels;
+};
+
+
+#ifdef USE_COMEDI
+class ConversionBenchmark : public Benchmark
+{
+    public:
+        ConversionBenchmark(int numChannels, int samplingRate) :
+            Benchmark("DAQReader::convertSamples", numChannels, samplingRate),
+            reader(numChannels, samplingRate)
+        {
+            // same oversampling as DAQReader::run()
+            overSampling = std::max(1, 250000/numChannels/samplingRate);
+
+            int numSamples = samplingRate/updatesPerSecond
+                * overSampling * numChannels;
+            buffer.resize(numSamples);
+
+            for (int i = 0; i < numSamples; ++i) {
+                int chan = i % numChannels;
+                int scan = i / numChannels / overSampling;
+                double v = syntheticSample(chan, scan, samplingRate);
+                buffer[i] = sampl_t(qBound(0, int((v + 10.0)/20.0*0xffff),
+                            0xffff));
+            }
+
+            parameter = overSampling;
+        }
+
+        void setUp()
+        {
+            reader.setUpConversion(overSampling);
+        }
+
+        void prepare()
+        {
+            reader.discardScans();
+        }
+
+        void run()
+        {
+            reader.convert(buffer.constData(), buffer.count());
+        }
+
+        qint64 samplesPerRun() const
+        {
+            return buffer.count();
+        }
+
+    private:
+        BenchDAQReader reader;
+        int overSampling;
+        QVector<sampl_t> buffer;
+};
+#endif
+
+
+// Friend of Plotter, so the rendering and file benchmarks can reach its
+// private members without going through the GUI.
+class PlotterBenchmark : public Benchmark
+{
+    public:
+        PlotterBenchmark(const QString& name, int numChannels = 0,
+                int samplingRate = 0, double parameter = 0.0) :
+            Benchmark(name, numChannels, samplingRate, parameter),
+            plotter(NULL)
+        {
+        }
+
+        void setUp()
+        {
+            plotter = new Plotter;
+            plotter->resize(plotWidth, plotHeight);
+        }
+
+        void tearDown()
+        {
+            delete plotter;
+            plotter = NULL;
+        }
+
+    protected:
+        void fillCurves(double seconds)
+        {
+            int numScans = int(seconds*samplingRate);
+            SampleStore& samples = plotter->samples;
+            samples.clear();
+
+            QVector<SampleStore::Calibration> calibration;
+            if (rawStorage) {
+                calibration.fill(SampleStore::Calibration::forRange(
+                            -10.0, 10.0, 65535), numChannels);
+            }
+            samples.setLayout(numChannels, calibration);
+
+            QVector<QVector<qreal> > data(numChannels);
+            QVector<const qreal*> channels(numChannels);
+
+            for (int chan = 0; chan < numChannels; ++chan) {
+                data[chan].reserve(numScans);
+
+                for (int scan = 0; scan < numScans; ++scan) {
+                    data[chan].push_back(
+                            syntheticSample(chan, scan, samplingRate));
+                }
+
+                channels[chan] = data[chan].constData();
+            }
+
+            samples.appendScans(channels.constData(), numScans,
+                    1.0/samplingRate);
+        }
+
+        void setView(double minX, double maxX)
+        {
+            PlotSettings& settings = plotter->zoomStack[plotter->curZoom];
+            settings.minX = minX;
+            settings.maxX = maxX;
+            settings.minY = -10.0;
+            settings.maxY = 10.0;
+        }
+
+        void drawGrid(QPainter* painter) { plotter->drawGrid(painter); }
+        void drawCurves(QPainter* painter) { plotter->drawCurves(painter); }
+        void startOverwrite() { plotter->startOverwrite(plotter->size()); }
+        void overwriteScans(qint64 end) { plotter->overwriteScans(end); }
+        void fitY()
+        {
+            plotter->fitY(&plotter->zoomStack[plotter->curZoom]);
+        }
+        bool readFile(const QString& f) { return plotter->readFile(f); }
+        bool writeFile(const QString& f) { return plotter->writeFile(f); }
+
+        Plotter* plotter;
+};
+
+
+class DrawCurvesBenchmark : public PlotterBenchmark
+{
+    public:
+        DrawCurvesBenchmark(int numChannels, int samplingRate, double span) :
+            PlotterBenchmark("Plotter::drawCurves", numChannels,
+                    samplingRate, span)
+        {
+        }
+
+        void setUp()
+        {
+            PlotterBenchmark::setUp();
+            fillCurves(recordingLength);
+            setView(recordingLength - parameter, recordingLength);
+            image = QImage(plotWidth, plotHeight, QImage::Format_RGB32);
+        }
+
+        void prepare()
+        {
+            image.fill(0);
+        }
+
+        void run()
+        {
+            QPainter painter(&image);
+            drawCurves(&painter);
+        }
+
+        qint64 samplesPerRun() const
+        {
+            return qint64(parameter*samplingRate)*numChannels;
+        }
+
+    private:
+        QImage image;
+};
+
+
+// One frame of the overwrite view: the last tenth of a second drawn over
+// a pass of parameter seconds.
+class OverwriteBenchmark : public PlotterBenchmark
+{
+    public:
+        OverwriteBenchmark(int numChannels, int samplingRate, double span) :
+            PlotterBenchmark("Plotter::overwriteScans", numChannels,
+                    samplingRate, span),
+            frameScans(0)
+        {
+        }
+
+        void setUp()
+        {
+            PlotterBenchmark::setUp();
+            fillCurves(recordingLength);
+            setView(recordingLength - parameter, recordingLength);
+            frameScans = samplingRate/10;
+        }
+
+        void prepare()
+        {
+            startOverwrite();
+            overwriteScans(plotter->samples.count() - frameScans);
+        }
+
+        void run()
+        {
+            overwriteScans(plotter->samples.count());
+        }
+
+        qint64 samplesPerRun() const
+        {
+            return qint64(frameScans)*numChannels;
+        }
+
+    private:
+        int frameScans;
+};
+
+
+// Auto-scaling the voltage axis to parameter seconds in view, from the
+// summaries, as done every frame with Auto down.
+class FitBenchmark : public PlotterBenchmark
+{
+    public:
+        FitBenchmark(int numChannels, int samplingRate, double span) :
+            PlotterBenchmark("Plotter::fitY", numChannels, samplingRate,
+                    span)
+        {
+        }
+
+        void setUp()
+        {
+            PlotterBenchmark::setUp();
+            fillCurves(recordingLength);
+        }
+
+        void prepare()
+        {
+            setView(recordingLength - parameter, recordingLength);
+        }
+
+        void run()
+        {
+            fitY();
+        }
+
+        qint64 samplesPerRun() const
+        {
+            return qint64(parameter*samplingRate)*numChannels;
+        }
+};
+
+
+class DrawGridBenchmark : public PlotterBenchmark
+{
+    public:
+        DrawGridBenchmark() :
+            PlotterBenchmark("Plotter::drawGrid")
+        {
+        }
+
+        void setUp()
+        {
+            PlotterBenchmark::setUp();
+            image = QImage(plotWidth, plotHeight, QImage::Format_RGB32);
+        }
+
+        void prepare()
+        {
+            image.fill(0);
+        }
+
+        void run()
+        {
+            QPainter painter(&image);
+            drawGrid(&painter);
+        }
+
+        qint64 samplesPerRun() const
+        {
+            return 0;
+        }
+
+    private:
+        QImage image;
+};
+
+
+class SaveBenchmark : public PlotterBenchmark
+{
+    public:
+        SaveBenchmark(int numChannels, int samplingRate) :
+            PlotterBenchmark("Plotter::save", numChannels, samplingRate),
+            fileName(QDir::temp().filePath("GDAQrec_benchmark_save.csv"))
+        {
+        }
+
+        void setUp()
+        {
+            PlotterBenchmark::setUp();
+            fillCurves(fileLength);
+        }
+
+        void run()
+        {
+            writeFile(fileName);
+        }
+
+        void tearDown()
+        {
+            QFile::remove(fileName);
+            PlotterBenchmark::tearDown();
+        }
+
+        qint64 samplesPerRun() const
+        {
+            return qint64(fileLength*samplingRate)*numChannels;
+        }
+
+    private:
+        QString fileName;
+};
+
+
+class OpenBenchmark : public PlotterBenchmark
+{
+    public:
+        OpenBenchmark(int numChannels, int samplingRate) :
+            PlotterBenchmark("Plotter::open", numChannels, samplingRate),
+            fileName(QDir::temp().filePath("GDAQrec_benchmark_open.csv"))
+        {
+        }
+
+        void setUp()
+        {
+            PlotterBenchmark::setUp();
+            fillCurves(fileLength);
+            writeFile(fileName);
+        }
+
+        void run()
+        {
+            readFile(fileName);
+        }
+
+        void tearDown()
+        {
+            QFile::remove(fileName);
+            PlotterBenchmark::tearDown();
+        }
+
+        qint64 samplesPerRun() const
+        {
+            return qint64(fileLength*samplingRate)*numChannels;
+        }
+
+    private:
+        QString fileName;
+};
+
+
+// The boards manage 250 kS/s in total, so the larger channel counts only
+// run at the rates they could actually record at.
+static bool feasible(int numChannels, int samplingRate)
+{
+    return numChannels <= 8 || numChannels*samplingRate <= 250000;
+}
+
+
+static QList<Benchmark*> createBenchmarks()
+{
+    QList<Benchmark*> benchmarks;
+
+    for (int c = 0; c < numChannelCounts; ++c) {
+        for (int r = 0; r < numSamplingRates; ++r) {
+            if (!feasible(channelCounts[c], samplingRates[r]))
+                continue;
+
+            benchmarks.append(new AppendDataBenchmark(
+                        channelCounts[c], samplingRates[r]));
+            benchmarks.append(new StatisticsBenchmark(
+                        channelCounts[c], samplingRates[r]));
+            benchmarks.append(new EventAverageBenchmark(
+                        channelCounts[c], samplingRates[r]));
+            benchmarks.append(new SpikeDetectorBenchmark(
+                        channelCounts[c], samplingRates[r], false));
+            benchmarks.append(new SpikeDetectorBenchmark(
+                        channelCounts[c], samplingRates[r], true));
+            benchmarks.append(new FilterBankBenchmark(
+                        channelCounts[c], samplingRates[r], false));
+            benchmarks.append(new FilterBankBenchmark(
+                        channelCounts[c], samplingRates[r], true));
+#ifdef USE_COMEDI
+            benchmarks.append(new ConversionBenchmark(
+                        channelCounts[c], samplingRates[r]));
+#endif
+        }
+    }
+
+    for (int c = 0; c < numChannelCounts; ++c) {
+        for (int r = 0; r < numSamplingRates; ++r) {
+            if (!feasible(channelCounts[c], samplingRates[r]))
+                continue;
+
+            for (int z = 0; z < numZoomSpans; ++z) {
+                benchmarks.append(new DrawCurvesBenchmark(
+                            channelCounts[c], samplingRates[r], zoomSpans[z]));
+                benchmarks.append(new OverwriteBenchmark(
+                            channelCounts[c], samplingRates[r], zoomSpans[z]));
+                benchmarks.append(new FitBenchmark(
+                            channelCounts[c], samplingRates[r], zoomSpans[z]));
+            }
+        }
+    }
+
+    benchmarks.append(new DrawGridBenchmark);
+
+    for (int c = 0; c < numChannelCounts; ++c) {
+        for (int r = 0; r < numSamplingRates; ++r) {
+            if (!feasible(channelCounts[c], samplingRates[r]))
+                continue;
+
+            benchmarks.append(new SaveBenchmark(
+                        channelCounts[c], samplingRates[r]));
+            benchmarks.append(new OpenBenchmark(
+                        channelCounts[c], samplingRates[r]));
+        }
+    }
+
+    return benchmarks;
+}
+
+
+static void writeJson(QTextStream& out, const QList<BenchmarkResult>& results)
+{
+    out << "{\n";
+    out << "  \"context\": {\n";
+    out << "    \"date\": \""
+        << QDateTime::currentDateTimeUtc().toString(Qt::ISODate) << "\",\n";
+    out << "    \"qtVersion\": \"" << qVersion() << "\",\n";
+    out << "    \"daqLib\": \"" << daqLibName << "\",\n";
+    out << "    \"rawStorage\": " << (rawStorage ? "true" : "false") << "\n";
+    out << "  },\n";
+    out << "  \"benchmarks\": [\n";
+
+    for (int i = 0; i < results.count(); ++i) {
+        const BenchmarkResult& r = results[i];
+
+        out << "    {"
+            << "\"name\": \"" << r.name << "\", "
+            << "\"channels\": " << r.numChannels << ", "
+            << "\"samplingRate\": " << r.samplingRate << ", "
+            << "\"parameter\": " << r.parameter << ", "
+            << "\"iterations\": " << r.iterations << ", "
+            << "\"meanNs\": " << r.meanNs << ", "
+            << "\"minNs\": " << r.minNs << ", "
+            << "\"samplesPerSecond\": " << r.samplesPerSecond
+            << (i + 1 < results.count() ? "},\n" : "}\n");
+    }
+
+    out << "  ]\n";
+    out << "}\n";
+}
+
+
+static void usage()
+{
+    fprintf(stderr,
+            "usage: benchmark [-o results.json] [-t seconds] [-r] [name filter]\n"
+            "  -o  write the JSON results to a file instead of stdout\n"
+            "  -t  minimum time spent on each benchmark (default 0.5 s)\n"
+            "  -r  store raw ADC codes rather than volts\n");
+}
+
+
+int main(int argc, char *argv[])
+{
+    QApplication app(argc, argv);
+
+    QString outputFilename;
+    QString filter;
+    double minTime = 0.5;
+
+    QStringList args = app.arguments();
+    for (int i = 1; i < args.count(); ++i) {
+        if (args[i] == "-o" && i + 1 < args.count()) {
+            outputFilename = args[++i];
+        }
+        else if (args[i] == "-t" && i + 1 < args.count()) {
+            minTime = args[++i].toDouble();
+        }
+        else if (args[i] == "-r") {
+            rawStorage = true;
+        }
+        else if (args[i].startsWith('-')) {
+            usage();
+            return 1;
+        }
+        else {
+            filter = args[i];
+        }
+    }
+
+    QList<Benchmark*> benchmarks = createBenchmarks();
+    QList<BenchmarkResult> results;
+
+    foreach (Benchmark* benchmark, benchmarks) {
+        if (!filter.isEmpty() && !benchmark->name.contains(filter))
+            continue;
+
+        BenchmarkResult result = runBenchmark(benchmark, qint64(minTime*1e9));
+        results.append(result);
+
+        fprintf(stderr, "%-28s %d ch %6d S/s %6g: %12.0f ns/iter\n",
+                qPrintable(result.name), result.numChannels,
+                result.samplingRate, result.parameter, result.meanNs);
+    }
+
+    qDeleteAll(benchmarks);
+
+    if (outputFilename.isEmpty()) {
+        QTextStream out(stdout);
+        writeJson(out, results);
+    }
+    else {
+        QFile file(outputFilename);
+
+        if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+            fprintf(stderr, "could not open %s\n", qPrintable(outputFilename));
+            return 1;
+        }
+
+        QTextStream out(&file);
+        writeJson(out, results);
+    }
+
+    return 0;
+}
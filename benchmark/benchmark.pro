@@ -0,0 +1,14 @@
+######################################################################
+# Benchmarks for the acquisition, storage and rendering hot paths.
+# Build with "qmake && make" in this directory, run "./benchmark".
+######################################################################
+
+TEMPLATE = app
+TARGET = benchmark
+DEPENDPATH += .
+INCLUDEPATH += .
+
+# Input
+SOURCES += benchmark.cpp
+
+include(../gdaqrec.pri)
@@ -0,0 +1,31 @@
+#!/usr/bin/python
+# Compares two benchmark result files and prints the change in mean time
+# per iteration, flagging anything that got slower by more than 10%.
+import json
+import sys
+
+if len(sys.argv) != 3:
+    print("usage: compare.py old.json new.json")
+    sys.exit(1)
+
+def load(filename):
+    with open(filename) as f:
+        results = json.load(f)
+    return dict(((b["name"], b["channels"], b["samplingRate"], b["parameter"]), b)
+            for b in results["benchmarks"])
+
+old = load(sys.argv[1])
+new = load(sys.argv[2])
+regressions = 0
+
+for key in sorted(new):
+    if key not in old:
+        continue
+    ratio = new[key]["meanNs"] / old[key]["meanNs"]
+    flag = ""
+    if ratio > 1.1:
+        flag = "  <-- slower"
+        regressions += 1
+    print("%-28s %d ch %6d S/s %6g: %7.2fx%s" % (key + (ratio, flag)))
+
+sys.exit(1 if regressions else 0)
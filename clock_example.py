@@ -0,0 +1,50 @@
+#!/usr/bin/python
+# Reads the binary clock block GDAQrec updates after every read (see
+# struct gdaq_clock in feed/gdaqfeed.h) and prints how far into the
+# recording we are, both from the most recent scan and extrapolated to now.
+# Unlike ~/.GDAQRec_timestamp this is never torn and is accurate to well
+# under a millisecond.
+import mmap
+import os
+import struct
+import time
+
+clock_filename = "/dev/shm/GDAQRec_clock"
+
+CLOCK = struct.Struct("<IIIIQQdqqqq")
+MAGIC = 0x4b4c4347
+RECORDING = 1
+
+def read_clock(clock):
+    # sequence lock: retry while the writer is part way through an update
+    while True:
+        before = struct.unpack_from("<I", clock, 8)[0]
+        fields = CLOCK.unpack_from(clock, 0)
+        after = struct.unpack_from("<I", clock, 8)[0]
+        if before % 2 == 0 and before == after:
+            return fields
+
+def monotonic_ns():
+    return int(time.monotonic() * 1e9)
+
+while True:
+    time.sleep(0.5) # every half second
+
+    if not os.path.exists(clock_filename):
+        print("not recording")
+        continue
+
+    with open(clock_filename, "rb") as f:
+        clock = mmap.mmap(f.fileno(), CLOCK.size, prot=mmap.PROT_READ)
+
+    (magic, version, sequence, state, session, scans, rate,
+            first_mono, first_real, last_mono, last_real) = read_clock(clock)
+    clock.close()
+
+    if magic != MAGIC or state != RECORDING or scans == 0:
+        print("not recording")
+        continue
+
+    last_scan_time = (scans - 1) / rate
+    now = (monotonic_ns() - first_mono) * 1e-9
+    print("%13.6f (last scan %13.6f, %d scans)" % (now, last_scan_time, scans))
@@ -0,0 +1,33 @@
+# Selects the DAQ backend library; shared by every project that builds
+# DAQReader.cpp.  Override with "qmake DAQLIB=nidaqmxbase", or use
+# "qmake DAQLIB=simulated" to generate test signals without any hardware.
+
+isEmpty (DAQLIB) {
+	DAQLIB+=comedi
+}
+
+unix:!macx {
+	contains(DAQLIB, nidaqmxbase) {
+		INCLUDEPATH += /usr/local/natinst/nidaqmxbase/include/ 
+		LIBS += -lnidaqmxbase 
+		DEFINES += USE_NIDAQMXBASE
+	}
+	
+	contains(DAQLIB, comedi) {
+		LIBS += -lcomedi
+		DEFINES += USE_COMEDI
+	}
+}
+
+macx {
+	contains(DAQLIB, nidaqmxbase) {
+		INCLUDEPATH += "/Applications/National\ Instruments/NI-DAQmx\ Base/includes/"
+		LIBS += -framework nidaqmxbase
+		LIBS += -framework nidaqmxbaselv
+		DEFINES += USE_NIDAQMXBASE
+	}
+}	
+
+contains(DAQLIB, simulated) {
+	DEFINES += USE_SIMULATED_DAQ
+}
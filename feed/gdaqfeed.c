@@ -0,0 +1,209 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "gdaqfeed.h"
+
+/* the Python example and any other reader depend on this exact layout */
+typedef char gdaq_feed_header_layout_check[
+    (sizeof(struct gdaq_feed_header) == 128 + 48*GDAQ_FEED_MAX_CHANNELS)
+    ? 1 : -1];
+
+struct gdaq_feed {
+    const struct gdaq_feed_header* header;
+    size_t size;
+};
+
+/* A capacity that's a power of two, and every channel's ring inside the
+ * segment, so that the ring index arithmetic can't reach outside it. */
+static int layout_is_valid(const struct gdaq_feed_header* header,
+        size_t size)
+{
+    uint64_t capacity = header->capacity;
+    uint64_t ring_bytes;
+    unsigned chan;
+
+    if (capacity == 0 || (capacity & (capacity - 1)) != 0
+            || capacity > size/sizeof(double))
+        return 0;
+
+    ring_bytes = capacity*sizeof(double);
+
+    for (chan = 0; chan < header->num_channels; ++chan) {
+        uint64_t offset = header->channels[chan].data_offset;
+
+        if (offset < sizeof(*header) || offset % sizeof(double) != 0
+                || offset > size || ring_bytes > size - offset)
+            return 0;
+    }
+
+    return 1;
+}
+
+gdaq_feed* gdaq_feed_open(const char* name)
+{
+    struct stat st;
+    const struct gdaq_feed_header* header;
+    gdaq_feed* feed;
+    void* map;
+    int fd;
+
+    fd = shm_open(name ? name : GDAQ_FEED_DEFAULT_NAME, O_RDONLY, 0);
+    if (fd < 0)
+        return NULL;
+
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(*header)) {
+        close(fd);
+        errno = EPROTO;
+        return NULL;
+    }
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (map == MAP_FAILED)
+        return NULL;
+
+    header = (const struct gdaq_feed_header*)map;
+
+    if (header->magic != GDAQ_FEED_MAGIC
+            || header->version != GDAQ_FEED_VERSION
+            || header->sample_format != GDAQ_FEED_FLOAT64
+            || header->num_channels > GDAQ_FEED_MAX_CHANNELS
+            || !layout_is_valid(header, st.st_size)) {
+        munmap(map, st.st_size);
+        errno = EPROTO;
+        return NULL;
+    }
+
+    feed = (gdaq_feed*)malloc(sizeof(*feed));
+    if (feed == NULL) {
+        munmap(map, st.st_size);
+        return NULL;
+    }
+
+    feed->header = header;
+    feed->size = st.st_size;
+    return feed;
+}
+
+void gdaq_feed_close(gdaq_feed* feed)
+{
+    if (feed != NULL) {
+        munmap((void*)feed->header, feed->size);
+        free(feed);
+    }
+}
+
+const struct gdaq_feed_header* gdaq_feed_get_header(const gdaq_feed* feed)
+{
+    return feed->header;
+}
+
+int gdaq_feed_is_live(const gdaq_feed* feed)
+{
+    return __atomic_load_n(&feed->header->state, __ATOMIC_ACQUIRE)
+        == GDAQ_FEED_RECORDING;
+}
+
+uint64_t gdaq_feed_write_index(const gdaq_feed* feed)
+{
+    return __atomic_load_n(&feed->header->write_index, __ATOMIC_ACQUIRE);
+}
+
+uint64_t gdaq_feed_available(const gdaq_feed* feed, uint64_t* cursor,
+        uint64_t* lost)
+{
+    uint64_t written = gdaq_feed_write_index(feed);
+    uint64_t capacity = feed->header->capacity;
+
+    if (written < *cursor) {
+        /* a cursor from some other session; start over */
+        *cursor = written;
+    }
+
+    if (written - *cursor > capacity) {
+        if (lost != NULL)
+            *lost += written - capacity - *cursor;
+        *cursor = written - capacity;
+    }
+
+    return written - *cursor;
+}
+
+const double* gdaq_feed_samples(const gdaq_feed* feed, unsigned channel,
+        uint64_t cursor, uint64_t* count)
+{
+    const struct gdaq_feed_header* header = feed->header;
+    uint64_t first = cursor & (header->capacity - 1);
+
+    if (channel >= header->num_channels) {
+        *count = 0;
+        return NULL;
+    }
+
+    *count = header->capacity - first;
+    return (const double*)((const char*)header
+            + header->channels[channel].data_offset) + first;
+}
+
+int gdaq_feed_still_valid(const gdaq_feed* feed, uint64_t cursor)
+{
+    uint64_t claimed;
+
+    /* order our earlier reads of the samples before this check */
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    claimed = __atomic_load_n(&feed->header->claim_index, __ATOMIC_RELAXED);
+
+    return claimed - cursor <= feed->header->capacity;
+}
+
+const struct gdaq_clock* gdaq_clock_open(const char* name)
+{
+    const struct gdaq_clock* clock;
+    void* map;
+    int fd;
+
+    fd = shm_open(name ? name : GDAQ_CLOCK_DEFAULT_NAME, O_RDONLY, 0);
+    if (fd < 0)
+        return NULL;
+
+    map = mmap(NULL, sizeof(*clock), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (map == MAP_FAILED)
+        return NULL;
+
+    clock = (const struct gdaq_clock*)map;
+
+    if (clock->magic != GDAQ_CLOCK_MAGIC
+            || clock->version != GDAQ_CLOCK_VERSION) {
+        munmap(map, sizeof(*clock));
+        errno = EPROTO;
+        return NULL;
+    }
+
+    return clock;
+}
+
+void gdaq_clock_close(const struct gdaq_clock* clock)
+{
+    if (clock != NULL)
+        munmap((void*)clock, sizeof(*clock));
+}
+
+void gdaq_clock_read(const struct gdaq_clock* clock, struct gdaq_clock* out)
+{
+    uint32_t before, after;
+
+    do {
+        before = __atomic_load_n(&clock->sequence, __ATOMIC_ACQUIRE);
+        memcpy(out, clock, sizeof(*out));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        after = __atomic_load_n(&clock->sequence, __ATOMIC_RELAXED);
+    } while ((before & 1) || before != after);
+}
@@ -0,0 +1,151 @@
+/*
+ * Reader for the live sample feed GDAQrec publishes in POSIX shared memory
+ * while it records.
+ *
+ * The segment starts with a gdaq_feed_header, followed by one ring buffer
+ * of `capacity` float64 samples (volts) per channel.  Scan n of a channel
+ * is at ring index n & (capacity - 1).  The acquisition thread writes new
+ * scans and then advances write_index; readers follow along with their own
+ * cursor and never write to the segment, so any number of them can attach
+ * without affecting the recorder.
+ *
+ *     gdaq_feed* feed = gdaq_feed_open(NULL);
+ *     uint64_t cursor = gdaq_feed_write_index(feed), lost = 0, n;
+ *
+ *     for (;;) {
+ *         uint64_t available = gdaq_feed_available(feed, &cursor, &lost);
+ *         const double* v = gdaq_feed_samples(feed, 0, cursor, &n);
+ *         if (n > available)
+ *             n = available;
+ *         ... use v[0..n-1] ...
+ *         if (!gdaq_feed_still_valid(feed, cursor))
+ *             ... the writer overwrote them while we were looking ...
+ *         cursor += n;
+ *     }
+ *
+ * Scans the device lost (see the DAQ buffer statistics) are published as
+ * NaN, so scan numbers and ring indices always agree.
+ *
+ * Each recording creates a new segment with a new session number; when
+ * gdaq_feed_is_live() turns false the reader should close and reopen.
+ *
+ * GDAQrec also publishes a small clock block, updated by the acquisition
+ * thread after every read, for aligning other software with the
+ * recording.  Scan k of the recording was acquired at approximately
+ * first_scan_*_ns + k*1e9/sampling_rate; the last_scan anchors give the
+ * time the most recent scan (number scans_acquired - 1) was read.  The
+ * block is protected by a sequence lock, so use gdaq_clock_read() rather
+ * than reading the fields directly.
+ */
+
+#ifndef GDAQFEED_H
+#define GDAQFEED_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define GDAQ_FEED_DEFAULT_NAME "/GDAQRec_samples"
+#define GDAQ_FEED_MAGIC 0x51414447u   /* "GDAQ" */
+#define GDAQ_FEED_VERSION 2
+#define GDAQ_FEED_MAX_CHANNELS 64
+
+enum gdaq_feed_format {
+    GDAQ_FEED_FLOAT64 = 1
+};
+
+enum gdaq_feed_state {
+    GDAQ_FEED_STOPPED = 0,
+    GDAQ_FEED_RECORDING = 1
+};
+
+struct gdaq_feed_channel {
+    uint32_t physical_channel;  /* the board's analog input */
+    uint32_t device;            /* the board: /dev/comediN, or NI-DAQ DevN+1 */
+    double min_voltage;         /* input range of the channel */
+    double max_voltage;
+    double scale;               /* volts = sample*scale + offset */
+    double offset;
+    uint64_t data_offset;       /* bytes from the start of the segment */
+};
+
+struct gdaq_feed_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t header_size;
+    uint32_t num_channels;
+    uint32_t sample_format;     /* enum gdaq_feed_format */
+    uint32_t state;             /* enum gdaq_feed_state */
+    uint64_t session;
+    uint64_t capacity;          /* scans per channel ring, a power of two */
+    double sampling_rate;       /* scans per second */
+    uint64_t reserved0[2];
+
+    /* on their own cache line, since they change with every read */
+    uint64_t write_index;       /* scans published so far */
+    uint64_t claim_index;       /* scans published or being written */
+    uint64_t reserved1[6];
+
+    struct gdaq_feed_channel channels[GDAQ_FEED_MAX_CHANNELS];
+};
+
+#define GDAQ_CLOCK_DEFAULT_NAME "/GDAQRec_clock"
+#define GDAQ_CLOCK_MAGIC 0x4b4c4347u  /* "GCLK" */
+#define GDAQ_CLOCK_VERSION 1
+
+struct gdaq_clock {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t sequence;          /* odd while the writer is updating */
+    uint32_t state;             /* enum gdaq_feed_state */
+    uint64_t session;
+    uint64_t scans_acquired;    /* including any the device lost */
+    double sampling_rate;
+    int64_t first_scan_monotonic_ns;    /* CLOCK_MONOTONIC */
+    int64_t first_scan_realtime_ns;     /* CLOCK_REALTIME */
+    int64_t last_scan_monotonic_ns;
+    int64_t last_scan_realtime_ns;
+};
+
+typedef struct gdaq_feed gdaq_feed;
+
+/* Maps the feed read-only; name may be NULL for the default.  Returns NULL
+ * (with errno set) if GDAQrec isn't publishing a compatible feed, or its
+ * header describes rings that aren't all within the segment. */
+gdaq_feed* gdaq_feed_open(const char* name);
+void gdaq_feed_close(gdaq_feed* feed);
+
+const struct gdaq_feed_header* gdaq_feed_get_header(const gdaq_feed* feed);
+int gdaq_feed_is_live(const gdaq_feed* feed);
+uint64_t gdaq_feed_write_index(const gdaq_feed* feed);
+
+/* Number of scans that can be read starting at *cursor.  If the writer has
+ * lapped the reader, *cursor is moved up to the oldest scan still in the
+ * ring and the number of scans skipped is added to *lost. */
+uint64_t gdaq_feed_available(const gdaq_feed* feed, uint64_t* cursor,
+        uint64_t* lost);
+
+/* Pointer to the samples of one channel starting at scan `cursor`, without
+ * copying; *count is set to the number of contiguous scans before the ring
+ * wraps, which may be more than are available. */
+const double* gdaq_feed_samples(const gdaq_feed* feed, unsigned channel,
+        uint64_t cursor, uint64_t* count);
+
+/* Nonzero if the scans from cursor onwards have not been overwritten;
+ * check this after using data obtained from gdaq_feed_samples. */
+int gdaq_feed_still_valid(const gdaq_feed* feed, uint64_t cursor);
+
+/* Maps the clock block read-only; name may be NULL for the default. */
+const struct gdaq_clock* gdaq_clock_open(const char* name);
+void gdaq_clock_close(const struct gdaq_clock* clock);
+
+/* Takes a consistent snapshot of the clock block. */
+void gdaq_clock_read(const struct gdaq_clock* clock, struct gdaq_clock* out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* GDAQFEED_H */
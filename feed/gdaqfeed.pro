@@ -0,0 +1,18 @@
+######################################################################
+# Reader library for GDAQrec's shared-memory sample feed.  Plain C with
+# no Qt dependency; build with "qmake && make" in this directory.
+######################################################################
+
+TEMPLATE = lib
+TARGET = gdaqfeed
+VERSION = 1.0.0
+CONFIG -= qt
+CONFIG += warn_on
+
+# Input
+HEADERS += gdaqfeed.h
+SOURCES += gdaqfeed.c
+
+unix:!macx {
+	LIBS += -lrt
+}
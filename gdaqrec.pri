@@ -0,0 +1,37 @@
+# Sources shared by GDAQrec and the programs that exercise it (benchmark,
+# soak).
+
+QT += network
+
+DEPENDPATH += $$PWD
+INCLUDEPATH += $$PWD
+
+# Input
+HEADERS += $$PWD/plotter.h $$PWD/DAQReader.h $$PWD/DAQSink.h \
+    $$PWD/SampleFeed.h $$PWD/SharedClock.h $$PWD/StreamServer.h \
+    $$PWD/DiskWriter.h $$PWD/ScanQueue.h $$PWD/ComediDevice.h \
+    $$PWD/SampleStore.h $$PWD/SpikeDetector.h $$PWD/FilterBank.h \
+    $$PWD/Spectrogram.h $$PWD/ScanSummary.h $$PWD/SweepCollector.h \
+    $$PWD/EventAverage.h $$PWD/TriggerGate.h \
+    $$PWD/FilterThread.h
+SOURCES += $$PWD/plotter.cpp $$PWD/DAQReader.cpp $$PWD/SampleFeed.cpp \
+    $$PWD/SharedClock.cpp $$PWD/StreamServer.cpp \
+    $$PWD/DiskWriter.cpp $$PWD/ComediDevice.cpp $$PWD/SampleStore.cpp \
+    $$PWD/SpikeDetector.cpp $$PWD/FilterBank.cpp $$PWD/Spectrogram.cpp \
+    $$PWD/ScanSummary.cpp $$PWD/SweepCollector.cpp $$PWD/EventAverage.cpp \
+    $$PWD/TriggerGate.cpp $$PWD/FilterThread.cpp
+RESOURCES += $$PWD/plotter.qrc
+
+# Input
+HEADERS += $$PWD/DAQSettingsDialog/DAQSettingsDialog.h
+FORMS += $$PWD/DAQSettingsDialog/DAQSettingsDialog.ui
+SOURCES += $$PWD/DAQSettingsDialog/DAQSettingsDialog.cpp
+
+# Input
+HEADERS += $$PWD/feed/gdaqfeed.h
+
+unix:!macx {
+	LIBS += -lrt
+}
+
+include(daqlib.pri)
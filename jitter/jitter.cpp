@@ -0,0 +1,270 @@
+#include <QtCore>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+
+#include "DAQReader.h"
+
+// Runs DAQReader with the saved settings four times -- with and without
+// the realtime settings, each with and without load -- and reports how
+// regularly the acquisition thread got to read the device, from the
+// monotonic read times DAQReader hands its sinks.
+
+class IntervalSink : public DAQSink
+{
+    public:
+        IntervalSink(int maxReads) :
+            intervals(maxReads),
+            numIntervals(0),
+            lastNs(0)
+        {
+        }
+
+        void startedRecording(const DAQSettings&, double)
+        {
+            numIntervals = 0;
+            lastNs = 0;
+        }
+
+        void newScans(const ScanBlock& block)
+        {
+            if (lastNs != 0 && numIntervals < intervals.count())
+                intervals[numIntervals++] = block.monotonicNs - lastNs;
+
+            lastNs = block.monotonicNs;
+        }
+
+        QVector<qint64> intervals;
+        int numIntervals;
+
+    private:
+        qint64 lastNs;
+};
+
+
+class LoadThread : public QThread
+{
+    public:
+        LoadThread() : shouldStop(false) {}
+
+        volatile bool shouldStop;
+};
+
+
+// Keeps one core busy.
+class CpuLoad : public LoadThread
+{
+    public:
+        void run()
+        {
+            volatile double x = 0.0;
+
+            while (!shouldStop) {
+                for (int i = 0; i < 100000; ++i)
+                    x += sqrt(double(i));
+            }
+        }
+};
+
+
+// Writes and syncs a scratch file as fast as the disk allows.
+class DiskLoad : public LoadThread
+{
+    public:
+        void run()
+        {
+            const int chunkSize = 1 << 20;
+            const int chunksPerFile = 256;
+            QByteArray chunk(chunkSize, 'x');
+            FILE* file = tmpfile();
+
+            if (file == NULL)
+                return;
+
+            for (int n = 0; !shouldStop; ++n) {
+                if (n % chunksPerFile == 0)
+                    rewind(file);
+
+                fwrite(chunk.constData(), 1, chunkSize, file);
+                fflush(file);
+                fdatasync(fileno(file));
+            }
+
+            fclose(file);
+        }
+};
+
+
+class WarningCollector : public QObject
+{
+    Q_OBJECT
+
+    public:
+        QString warnings;
+
+    public slots:
+        void realtimeWarning(const QString& message)
+        {
+            warnings = message;
+        }
+};
+
+
+struct JitterOptions
+{
+    double duration;
+    int priority;
+    int cpu;
+    bool lockMemory;
+};
+
+
+static void runOnce(const char* label, DAQSettings settings,
+        bool load, const JitterOptions& options)
+{
+    DAQReader daqReader;
+    IntervalSink sink(int(options.duration*1000) + 1000);
+    WarningCollector collector;
+    QList<LoadThread*> loadThreads;
+
+    daqReader.updateDAQSettings(settings);
+    daqReader.addSink(&sink);
+    QObject::connect(&daqReader, SIGNAL(realtimeWarning(const QString&)),
+            &collector, SLOT(realtimeWarning(const QString&)));
+
+    if (load) {
+        for (int i = 0; i < QThread::idealThreadCount(); ++i)
+            loadThreads.append(new CpuLoad);
+        loadThreads.append(new DiskLoad);
+
+        foreach (LoadThread* thread, loadThreads)
+            thread->start();
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    daqReader.start();
+
+    while (timer.elapsed() < options.duration*1000 && daqReader.isRunning()) {
+        usleep(100000);
+        daqReader.discardData();
+        QCoreApplication::processEvents();
+    }
+
+    daqReader.stop();
+    daqReader.wait();
+    QCoreApplication::processEvents();
+
+    foreach (LoadThread* thread, loadThreads)
+        thread->shouldStop = true;
+    foreach (LoadThread* thread, loadThreads)
+        thread->wait();
+    qDeleteAll(loadThreads);
+
+    QVector<qint64> sorted = sink.intervals.mid(0, sink.numIntervals);
+    std::sort(sorted.begin(), sorted.end());
+    int n = sorted.count();
+
+    if (n == 0) {
+        printf("%s,%s,0,,,,,,,\n", label, load ? "yes" : "no");
+        return;
+    }
+
+    double sum = 0.0, sumSquares = 0.0;
+    foreach (qint64 interval, sorted) {
+        sum += interval;
+        sumSquares += double(interval)*interval;
+    }
+
+    double mean = sum/n;
+    double stddev = sqrt(qMax(0.0, sumSquares/n - mean*mean));
+    qint64 median = sorted[n/2];
+    int late = int(sorted.end()
+            - std::upper_bound(sorted.begin(), sorted.end(), 2*median));
+
+    printf("%s,%s,%d,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%d",
+            label, load ? "yes" : "no", n,
+            mean*1e-6, stddev*1e-6, median*1e-6,
+            sorted[qMin(n - 1, int(n*0.99))]*1e-6,
+            sorted[qMin(n - 1, int(n*0.999))]*1e-6,
+            sorted[n - 1]*1e-6, late);
+
+    if (!collector.warnings.isEmpty())
+        printf(",\"%s\"", qPrintable(collector.warnings.simplified()));
+
+    printf("\n");
+    fflush(stdout);
+}
+
+
+static void usage()
+{
+    fprintf(stderr,
+            "usage: jitter [--duration s] [--priority 1-99] [--cpu N]\n"
+            "              [--no-lock]\n"
+            "Runs the saved DAQ settings for --duration seconds (default\n"
+            "30) in each of four configurations and prints read interval\n"
+            "statistics in ms as CSV.  The realtime runs use SCHED_FIFO\n"
+            "--priority (default 80) on --cpu (default the last one) with\n"
+            "memory locked.\n");
+}
+
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    JitterOptions options;
+    options.duration = 30.0;
+    options.priority = 80;
+    options.cpu = QThread::idealThreadCount() - 1;
+    options.lockMemory = true;
+
+    QStringList args = app.arguments();
+    for (int i = 1; i < args.count(); ++i) {
+        if (args[i] == "--duration" && i + 1 < args.count()) {
+            options.duration = args[++i].toDouble();
+        }
+        else if (args[i] == "--priority" && i + 1 < args.count()) {
+            options.priority = args[++i].toInt();
+        }
+        else if (args[i] == "--cpu" && i + 1 < args.count()) {
+            options.cpu = args[++i].toInt();
+        }
+        else if (args[i] == "--no-lock") {
+            options.lockMemory = false;
+        }
+        else {
+            usage();
+            return 2;
+        }
+    }
+
+    DAQSettings normal;
+    normal.restore();
+    normal.realtimePriority = 0;
+    normal.cpuAffinity = -1;
+    normal.lockMemory = false;
+
+    DAQSettings realtime = normal;
+    realtime.realtimePriority = options.priority;
+    realtime.cpuAffinity = options.cpu;
+    realtime.lockMemory = options.lockMemory;
+
+    fprintf(stderr, "%d channels at %d S/s, %g s per run\n",
+            normal.numChannels, normal.samplingRate, options.duration);
+
+    printf("config,load,reads,mean_ms,stddev_ms,p50_ms,p99_ms,p999_ms,"
+            "max_ms,late,warnings\n");
+
+    runOnce("normal", normal, false, options);
+    runOnce("normal", normal, true, options);
+    runOnce("realtime", realtime, false, options);
+    runOnce("realtime", realtime, true, options);
+
+    return 0;
+}
+
+#include "jitter.moc"
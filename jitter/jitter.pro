@@ -0,0 +1,15 @@
+######################################################################
+# Measures the interval between successive device reads, with and
+# without the realtime settings and synthetic CPU and disk load.  Build
+# with "qmake DAQLIB=comedi && make" in this directory, run "./jitter".
+######################################################################
+
+TEMPLATE = app
+TARGET = jitter
+DEPENDPATH += .
+INCLUDEPATH += .
+
+# Input
+SOURCES += jitter.cpp
+
+include(../gdaqrec.pri)
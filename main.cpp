@@ -1,8 +1,44 @@
 #include <QtGui>
+#include <cstdio>
+#include <cstring>
 #include "plotter.h"
+#include "HeadlessRecorder.h"
+
+// GDAQrec --headless [--output-dir dir] [--start] records without the GUI;
+// see HeadlessRecorder.h for the control commands.
+static int runHeadless(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QString outputDir = QDir::currentPath();
+    bool startNow = false;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--output-dir") == 0 && i + 1 < argc)
+            outputDir = QFile::decodeName(argv[++i]);
+        else if (strcmp(argv[i], "--start") == 0)
+            startNow = true;
+    }
+
+    HeadlessRecorder recorder(outputDir);
+
+    if (!recorder.listen())
+        return 1;
+
+    if (startNow) {
+        fprintf(stdout, "%s\n", qPrintable(recorder.start()));
+        fflush(stdout);
+    }
+
+    return app.exec();
+}
 
 int main(int argc, char *argv[])
 {
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--headless") == 0)
+            return runHeadless(argc, argv);
+    }
+
     QApplication app(argc, argv);
     Plotter plotter;
     plotter.setWindowTitle(QObject::tr("GDAQ recorder"));
@@ -1,5 +1,7 @@
 #include <QtGui>
+#include <algorithm>
 #include <cmath>
+#include <limits>
 
 #include "plotter.h"
 
@@ -13,10 +15,20 @@ Plotter::Plotter(QWidget *parent) :
     recording(false),
 #endif
     QWidget(parent),
-    sharedTimestamp(QDir::homePath() + QString("/.GDAQRec_timestamp"))
+    sharedTimestamp(QDir::homePath() + QString("/.GDAQRec_timestamp")),
+    sharedTimestampMemMap(NULL),
+    spikeTimeOffset(0.0),
+    sweepsTaken(-1),
+    averageStale(true)
 {
     daqSettings.restore();
     daqReader.updateDAQSettings(daqSettings);
+    daqReader.addSink(&sampleFeed);
+    daqReader.addSink(&sharedClock);
+    daqReader.addSink(&streamServer);
+    daqReader.addSink(&spikeDetector);
+    daqReader.addSink(&sweepCollector);
+    streamServer.updateSettings(daqSettings);
 
     setAutoFillBackground(true);
     setSizePolicy(QSizePolicy::Expanding, QSizePolicy::Expanding);
@@ -43,6 +55,62 @@ Plotter::Plotter(QWidget *parent) :
     settingsButton->adjustSize();
     connect(settingsButton, SIGNAL(clicked()), this, SLOT(settings()));
 
+    spectrumButton = new QToolButton(this);
+    spectrumButton->setText("Spectrum");
+    spectrumButton->setCheckable(true);
+    spectrumButton->adjustSize();
+    connect(spectrumButton, SIGNAL(toggled(bool)), this,
+            SLOT(showSpectrum(bool)));
+    connect(&spectrogram, SIGNAL(tilesReady()), this, SLOT(spectrumReady()));
+    connect(&averageWatcher, SIGNAL(finished()), this,
+            SLOT(averageComputed()));
+
+    statsButton = new QToolButton(this);
+    statsButton->setText("Stats");
+    statsButton->setCheckable(true);
+    statsButton->adjustSize();
+    connect(statsButton, SIGNAL(toggled(bool)), this, SLOT(showStats(bool)));
+
+    sweepsButton = new QToolButton(this);
+    sweepsButton->setText("Sweeps");
+    sweepsButton->setCheckable(true);
+    sweepsButton->adjustSize();
+    connect(sweepsButton, SIGNAL(toggled(bool)), this,
+            SLOT(showSweeps(bool)));
+
+    averageButton = new QToolButton(this);
+    averageButton->setText("Average");
+    averageButton->setCheckable(true);
+    averageButton->adjustSize();
+    connect(averageButton, SIGNAL(toggled(bool)), this,
+            SLOT(showAverage(bool)));
+
+    overwriteButton = new QToolButton(this);
+    overwriteButton->setText("Overwrite");
+    overwriteButton->setCheckable(true);
+    overwriteButton->adjustSize();
+    connect(overwriteButton, SIGNAL(toggled(bool)), this,
+            SLOT(showOverwrite(bool)));
+
+    stripsButton = new QToolButton(this);
+    stripsButton->setText("Strips");
+    stripsButton->setCheckable(true);
+    stripsButton->adjustSize();
+    connect(stripsButton, SIGNAL(toggled(bool)), this,
+            SLOT(showStrips(bool)));
+
+    fitButton = new QToolButton(this);
+    fitButton->setText("Fit");
+    fitButton->adjustSize();
+    connect(fitButton, SIGNAL(clicked()), this, SLOT(fitView()));
+
+    autoScaleButton = new QToolButton(this);
+    autoScaleButton->setText("Auto");
+    autoScaleButton->setCheckable(true);
+    autoScaleButton->adjustSize();
+    connect(autoScaleButton, SIGNAL(toggled(bool)), this,
+            SLOT(autoScale(bool)));
+
     recordButton = new QToolButton(this);
     recordButton->setIcon(QIcon(":/images/record.png"));
     recordButton->adjustSize();
@@ -58,9 +126,18 @@ Plotter::Plotter(QWidget *parent) :
     zoomOutButton->adjustSize();
     connect(zoomOutButton, SIGNAL(clicked()), this, SLOT(zoomOut()));
 
+    bufferLabel = new QLabel(this);
+
+    statsLabel = new QLabel(this);
+    statsLabel->setAutoFillBackground(true);
+    statsLabel->setMargin(5);
+    statsLabel->hide();
+
     connect(&daqReader, SIGNAL(newData()), this, SLOT(newData()));
     connect(&daqReader, SIGNAL(daqError(const QString&)), this,
             SLOT(daqError(const QString&)));
+    connect(&daqReader, SIGNAL(realtimeWarning(const QString&)), this,
+            SLOT(realtimeWarning(const QString&)));
     connect(&daqReader, SIGNAL(startedRecording()), this, SLOT(startedRecording()));
 #ifdef Q_WS_MAC
     connect(&daqReader, SIGNAL(stoppedRecording()), this, SLOT(stoppedRecording()));
@@ -85,11 +162,16 @@ void Plotter::clearPlot()
     zoomStack.append(settings);
     zoomStack.append(settings); // start zoomed in, since the top zoom shows the entire waveform
     curZoom = 1;
+    overwrite.nextScan = -1;
+
+    // the strips keep their ranges, but not what they last drew
+    for (int chan = 0; chan < strips.count(); ++chan)
+        strips[chan].lastScan = -1;
 
     // make the top level zoom as wide as the data
-    if (!curveMap[0].isEmpty()
-            && zoomStack[0].maxX < curveMap[0].last().x()) {
-        zoomStack[0].maxX = curveMap[0].last().x();
+    if (!samples.isEmpty()
+            && zoomStack[0].maxX < samples.lastTime()) {
+        zoomStack[0].maxX = samples.lastTime();
     }
 
     zoomInButton->hide();
@@ -109,8 +191,8 @@ void Plotter::zoomOut()
         // if this view was sliding right as the trace grew, keep it on the right
         // side of the trace.
         if (zoomStack[curZoom].includesRightEdge) {
-            double newMaxX = curveMap[0].empty()
-                ? zoomStack[curZoom].maxX : curveMap[0].last().x();
+            double newMaxX = samples.isEmpty()
+                ? zoomStack[curZoom].maxX : samples.lastTime();
             double dx = newMaxX - zoomStack[curZoom].maxX;
             zoomStack[curZoom].minX += dx;
             zoomStack[curZoom].maxX += dx;
@@ -131,8 +213,8 @@ void Plotter::zoomIn()
         // if this view was sliding right as the trace grew, keep it on the right
         // side of the trace.
         if (zoomStack[curZoom].includesRightEdge) {
-            double newMaxX = curveMap[0].empty()
-                ? zoomStack[curZoom].maxX : curveMap[0].last().x();
+            double newMaxX = samples.isEmpty()
+                ? zoomStack[curZoom].maxX : samples.lastTime();
             double dx = newMaxX - zoomStack[curZoom].maxX;
             zoomStack[curZoom].minX += dx;
             zoomStack[curZoom].maxX += dx;
@@ -145,6 +227,18 @@ void Plotter::startedRecording()
 {
     recordButton->setIcon(QIcon(":/images/stop.png"));
     recordButton->setEnabled(true);
+    sweepsTaken = -1;
+
+    // the averages carry on from everything before this recording
+    if (averageStale)
+        computeAverage();
+    eventTimes.clear();
+
+    // The text timestamp is only kept for older scripts; SharedClock
+    // publishes a more precise one from the acquisition thread.
+    if (!daqSettings.legacyTimestamp)
+        return;
+
     sharedTimestamp.open(QIODevice::ReadWrite);
 
     // Create a file containing the current recording time
@@ -164,9 +258,12 @@ void Plotter::stoppedRecording()
     settingsButton->setEnabled(true);
 
     // delete the shared recording timestamp
-    sharedTimestamp.unmap(sharedTimestampMemMap);
-    sharedTimestamp.close();
-    sharedTimestamp.remove();
+    if (sharedTimestampMemMap != NULL) {
+        sharedTimestamp.unmap(sharedTimestampMemMap);
+        sharedTimestamp.close();
+        sharedTimestamp.remove();
+        sharedTimestampMemMap = NULL;
+    }
 }
 
 void Plotter::toggleRecording()
@@ -182,6 +279,7 @@ void Plotter::toggleRecording()
         else {
             recordButton->setEnabled(false);
             settingsButton->setEnabled(false);
+            spikeTimeOffset = samples.nextScanTime();
 #ifdef Q_WS_MAC
             recording = true;
             daqReader.run();
@@ -230,9 +328,15 @@ void Plotter::toggleRecording()
     void Plotter::newDocument()
     {
         if (offerToSave()) {
+            averageWatcher.waitForFinished();
             saved = true;
             filename.clear();
-            curveMap.clear();
+            samples.clear();
+            filteredSamples.clear();
+            spectrogram.clear();
+            sweepCollector.clear();
+            spikes.clear();
+            averageStale = true;
             clearPlot();
         }
     }
@@ -245,9 +349,7 @@ void Plotter::toggleRecording()
                     tr("Data files (*.csv);;All Files (*)"));
 
             if (!newFilename.isEmpty()) {
-                QFile file(newFilename);
-
-                if (!file.open(QIODevice::ReadOnly)) {
+                if (!readFile(newFilename)) {
                     QMessageBox::critical(this, tr("GDAQrec"),
                             tr("Could not open file ") + newFilename,
                             QMessageBox::Ok | QMessageBox::Default
@@ -257,27 +359,97 @@ void Plotter::toggleRecording()
                 {
                     saved = true;
                     filename = newFilename;
-                    curveMap.clear();
+                    clearPlot();
+                }
+            }
+        }
+    }
 
-                    QTextStream in(&file);
+    bool Plotter::readFile(const QString& fileName)
+    {
+        QFile file(fileName);
 
-                    while (!in.atEnd()) {
-                        QString line = in.readLine();
-                        QStringList coords = line.split(',', QString::SkipEmptyParts);
+        if (!file.open(QIODevice::ReadOnly)) {
+            return false;
+        }
 
-                        // TODO: real error checking/recovery
-                        if (coords.count() >= 2) {
-                            double time = coords[0].toDouble();
-                            for (int i=1; i < coords.size(); ++i) {
-                                curveMap[i-1].append(QPointF(time, coords[i].toDouble()));
-                            }
-                        }
-                    }
+        averageWatcher.waitForFinished();
+        samples.clear();
+        filteredSamples.clear();
+        spectrogram.clear();
+
+        QTextStream in(&file);
+        QVector<qreal> values;
+
+        while (!in.atEnd()) {
+            QString line = in.readLine();
+            QStringList coords = line.split(',', QString::SkipEmptyParts);
+
+            // TODO: real error checking/recovery
+            if (coords.count() >= 2) {
+                // the first line says how many channels there are
+                if (samples.isEmpty()) {
+                    values.resize(coords.count() - 1);
+                    samples.setLayout(values.count(),
+                            QVector<SampleStore::Calibration>());
+                }
 
-                    clearPlot();
+                for (int i = 0; i < values.count(); ++i) {
+                    values[i] = i + 1 < coords.count()
+                        ? coords[i + 1].toDouble() : qQNaN();
                 }
+
+                samples.appendScan(coords[0].toDouble(), values.constData());
             }
         }
+
+        spikes.clear();
+        if (QFile::exists(fileName + ".spikes"))
+            readSpikes(fileName + ".spikes");
+        averageStale = true;
+
+        return true;
+    }
+
+    // One spike per line: its time, and the channel it was found on.
+    bool Plotter::readSpikes(const QString& fileName)
+    {
+        QFile file(fileName);
+
+        if (!file.open(QIODevice::ReadOnly)) {
+            return false;
+        }
+
+        QTextStream in(&file);
+
+        while (!in.atEnd()) {
+            QStringList fields = in.readLine().split(',');
+
+            if (fields.count() == 2) {
+                Spike spike;
+                spike.time = fields[0].toDouble();
+                spike.channel = fields[1].toInt();
+                spikes.append(spike);
+            }
+        }
+
+        return true;
+    }
+
+    bool Plotter::writeSpikes(const QString& fileName)
+    {
+        FILE* file = fopen(fileName.toAscii(), "w");
+
+        if (file == NULL) {
+            return false;
+        }
+
+        for (int i = 0; i < spikes.count(); ++i) {
+            fprintf(file, "%.6f,%d\n", spikes[i].time, spikes[i].channel);
+        }
+
+        fclose(file);
+        return true;
     }
 
     void Plotter::save()
@@ -291,25 +463,14 @@ void Plotter::toggleRecording()
         }
 
         if (!filename.isEmpty()) {
-            FILE* file = fopen(filename.toAscii(), "w");
-
-            if (file != NULL) {
-                int maxScans = curveMap[0].count()-1;
-                // the -1 is to ignore partial scans on comedi
-
-                for (int scan = 0; scan < maxScans; ++scan) {
-                    fprintf(file, "%.6f", curveMap[0][scan].x());
-
-                    for (CurveMap::iterator chanIter = curveMap.begin();
-                            chanIter != curveMap.end(); ++chanIter) {
-                        fprintf(file, ",%.6f", (*chanIter)[scan].y());
-                    }
-
-                    fprintf(file, "\n");
-                }
-
-                fclose(file);
+            if (writeFile(filename)) {
                 saved = true;
+
+                // buffer statistics, gaps and spikes go alongside the data
+                if (daqReader.scansAcquired() > 0)
+                    daqReader.writeStats(filename + ".stats");
+                if (!spikes.isEmpty())
+                    writeSpikes(filename + ".spikes");
             }
             else {
                 filename = QString();
@@ -328,6 +489,47 @@ void Plotter::toggleRecording()
         }
     }
 
+    bool Plotter::writeFile(const QString& fileName)
+    {
+        FILE* file = fopen(fileName.toAscii(), "w");
+
+        if (file == NULL) {
+            return false;
+        }
+
+        qint64 maxScans = samples.count()-1;
+        // the -1 is to ignore partial scans on comedi
+
+        // converted a block at a time, since the store may hold raw codes
+        const int numChans = samples.numChannels();
+        const int blockScans = 4096;
+        QVector<double> times(blockScans);
+        QVector<double> values(numChans*blockScans);
+
+        for (qint64 first = 0; first < maxScans; first += blockScans) {
+            int numScans = int(qMin(qint64(blockScans), maxScans - first));
+
+            samples.times(first, numScans, times.data());
+            for (int chan = 0; chan < numChans; ++chan) {
+                samples.values(chan, first, numScans,
+                        values.data() + chan*blockScans);
+            }
+
+            for (int scan = 0; scan < numScans; ++scan) {
+                fprintf(file, "%.6f", times[scan]);
+
+                for (int chan = 0; chan < numChans; ++chan) {
+                    fprintf(file, ",%.6f", values[chan*blockScans + scan]);
+                }
+
+                fprintf(file, "\n");
+            }
+        }
+
+        fclose(file);
+        return true;
+    }
+
     void Plotter::settings()
     {
         DAQSettingsDialog dialog(daqSettings, this);
@@ -339,6 +541,68 @@ void Plotter::toggleRecording()
         }
     }
 
+    // The views are exclusive: checking one unchecks the rest.
+    void Plotter::uncheckOtherViews(QToolButton* view)
+    {
+        QToolButton* views[] = { spectrumButton, sweepsButton, averageButton,
+            overwriteButton, stripsButton };
+
+        for (int i = 0; i < int(sizeof views/sizeof views[0]); ++i) {
+            if (views[i] != view)
+                views[i]->setChecked(false);
+        }
+    }
+
+    void Plotter::showSpectrum(bool show)
+    {
+        if (show)
+            uncheckOtherViews(spectrumButton);
+        refreshPixmap();
+    }
+
+    void Plotter::showSweeps(bool show)
+    {
+        if (show)
+            uncheckOtherViews(sweepsButton);
+        refreshPixmap();
+    }
+
+    void Plotter::showAverage(bool show)
+    {
+        if (show)
+            uncheckOtherViews(averageButton);
+        refreshPixmap();
+    }
+
+    void Plotter::showOverwrite(bool show)
+    {
+        if (show)
+            uncheckOtherViews(overwriteButton);
+        overwrite.nextScan = -1;
+        refreshPixmap();
+    }
+
+    void Plotter::showStrips(bool show)
+    {
+        if (show)
+            uncheckOtherViews(stripsButton);
+        refreshPixmap();
+    }
+
+    void Plotter::showStats(bool show)
+    {
+        statsLabel->setVisible(show);
+        updateStatsLabel();
+    }
+
+    void Plotter::spectrumReady()
+    {
+        spectrogram.takeResults();
+
+        if (spectrumButton->isChecked())
+            refreshPixmap();
+    }
+
     class UpdateTimer
     {
         QTime timer;
@@ -360,13 +624,25 @@ void Plotter::toggleRecording()
 
     void Plotter::newData()
     {
-        if (updateTimer.shouldSkip())
+        // the scans wait in the reader while the average reads the store
+        if (updateTimer.shouldSkip() || averageWatcher.isRunning())
             return;
 
-        double oldMaxX = curveMap[0].empty()
-            ? zoomStack[curZoom].maxX : curveMap[0].last().x();
+        double oldMaxX = samples.isEmpty()
+            ? zoomStack[curZoom].maxX : samples.lastTime();
+
+        // the display's filtered copy starts as a copy of what's already
+        // here, so that the two line up
+        bool filterDisplay = displayFiltered();
+        if (filterDisplay && filteredSamples.count() != samples.count())
+            filteredSamples.copyFrom(samples);
 
-        int numScansRead = daqReader.appendData(&curveMap);
+        int numScansRead = daqReader.appendData(&samples,
+                filterDisplay ? &filteredSamples : NULL);
+        int firstNewSpike = spikes.count();
+        spikeDetector.takeSpikes(&spikes, spikeTimeOffset);
+        updateAverage(firstNewSpike);
+        updateBufferLabel();
 
         if (numScansRead > 0) {
             if (saved) {
@@ -375,15 +651,15 @@ void Plotter::toggleRecording()
             }
 
             // expand the top level zoom, if needed.
-            if (zoomStack[0].maxX < curveMap[0].last().x()) {
-                zoomStack[0].maxX = curveMap[0].last().x();
+            if (zoomStack[0].maxX < samples.lastTime()) {
+                zoomStack[0].maxX = samples.lastTime();
             }
 
 
             // scroll right if this causes the plot to go from on the page to off of
             // the page
-            double newMaxX = curveMap[0].empty()
-                ? zoomStack[curZoom].maxX : curveMap[0].last().x();
+            double newMaxX = samples.isEmpty()
+                ? zoomStack[curZoom].maxX : samples.lastTime();
             if (zoomStack[curZoom].minX <= oldMaxX
                     && oldMaxX <= zoomStack[curZoom].maxX
                     && newMaxX > zoomStack[curZoom].maxX
@@ -400,13 +676,145 @@ void Plotter::toggleRecording()
             }
 
             // update the shared timestamp
-            qsnprintf((char*)sharedTimestampMemMap, sharedTimestampSize, 
-                    sharedTimestampFormat, curveMap[0].last().x());
+            if (sharedTimestampMemMap != NULL) {
+                qsnprintf((char*)sharedTimestampMemMap, sharedTimestampSize, 
+                        sharedTimestampFormat, samples.lastTime());
+            }
 
             refreshPixmap();
         }
     }
 
+    // Shows how full the DAQ's buffer got, and any scans it lost.
+    void Plotter::updateBufferLabel()
+    {
+        AcquisitionStats stats = daqReader.acquisitionStats();
+        QString text;
+
+        if (stats.bufferSize > 0) {
+            text = tr("DAQ buffer %1% (max %2%)")
+                .arg(100*stats.bufferUsed/stats.bufferSize)
+                .arg(100*stats.bufferHighWater/stats.bufferSize);
+        }
+
+        if (stats.scansDropped > 0) {
+            text += tr(", %1 scans lost in %2 gaps")
+                .arg(stats.scansDropped).arg(stats.numGaps);
+        }
+
+        if (daqSettings.numDevices() > 1) {
+            text += tr(", boards started %1 us apart")
+                .arg(stats.skewNs*1e-3, 0, 'f', 1);
+
+            if (stats.scansPadded > 0)
+                text += tr(", %1 scans padded").arg(stats.scansPadded);
+        }
+
+        if (stats.filterNsPerScan > 0.0) {
+            // of the time between scans, which is all there is at full rate
+            text += tr(", filters %1 us/scan (%2% of the scan interval)")
+                .arg(stats.filterNsPerScan*1e-3, 0, 'f', 2)
+                .arg(stats.filterNsPerScan*1e-7*daqSettings.samplingRate,
+                        0, 'f', 1);
+        }
+
+        if (daqSettings.triggeredRecording && stats.scansAcquired > 0) {
+            text += tr(", %1 triggers, %2% of scans kept")
+                .arg(stats.numTriggers)
+                .arg(100.0*stats.scansKept/stats.scansAcquired, 0, 'f', 1);
+        }
+
+        // including the display's filtered copy, if it has one
+        if (samples.memoryBudget() > 0) {
+            text += tr(", %1 of %2 MB in memory, %3 MB on disk")
+                .arg((samples.bytesUsed() + filteredSamples.bytesUsed())/1048576)
+                .arg((samples.memoryBudget()
+                            + filteredSamples.memoryBudget())/1048576)
+                .arg((samples.bytesSpilled()
+                            + filteredSamples.bytesSpilled())/1048576);
+        }
+
+        if (!samples.spillError().isEmpty())
+            text += tr(", can't spill to disk: %1").arg(samples.spillError());
+
+        bool lost = stats.scansDropped > 0 || stats.scansPadded > 0
+            || !samples.spillError().isEmpty();
+        QPalette palette = bufferLabel->palette();
+        palette.setColor(QPalette::WindowText,
+                lost ? QColor(Qt::red) : daqSettings.fgColor);
+        bufferLabel->setPalette(palette);
+        bufferLabel->setText(text);
+        bufferLabel->adjustSize();
+    }
+
+    bool Plotter::displayFiltered() const
+    {
+        return daqSettings.filterMode == DAQSettings::filterDisplay
+            && daqSettings.hasFilters();
+    }
+
+    // the filtered copy only once it has everything
+    const SampleStore& Plotter::shownSamples() const
+    {
+        if (displayFiltered() && filteredSamples.count() == samples.count())
+            return filteredSamples;
+        return samples;
+    }
+
+    // Each channel's statistics over the rubber band while it's being
+    // dragged, or else over the view, from the store's summaries alone so
+    // that it can keep up with the mouse.
+    void Plotter::updateStatsLabel()
+    {
+        if (!statsButton->isChecked())
+            return;
+
+        PlotSettings settings = zoomStack[curZoom];
+        double minX = settings.minX;
+        double maxX = settings.maxX;
+        QString range = tr("in view");
+
+        if (rubberBandIsShown) {
+            QRect band = rubberBandRect.normalized();
+            double dx = settings.spanX()/(width() - 2*Margin);
+            minX = settings.minX + dx*(band.left() - Margin);
+            maxX = settings.minX + dx*(band.right() - Margin);
+            range = tr("selected");
+        }
+
+        const SampleStore& shown = shownSamples();
+        qint64 first = shown.lowerBound(minX);
+        qint64 end = shown.lowerBound(maxX);
+
+        QString text = tr("<b>%1 to %2 s, %3</b>").arg(minX, 0, 'f', 3)
+            .arg(maxX, 0, 'f', 3).arg(range);
+
+        for (int chan = 0; chan < shown.numChannels(); ++chan) {
+            ScanSummary::Statistics stats = shown.statistics(chan, first, end);
+            QColor colour = chan < daqSettings.color.count()
+                ? daqSettings.color[chan] : DAQSettings::defaultColor(chan);
+
+            text += tr("<br><font color=\"%1\">%2: mean %3 V, rms %4 V, "
+                    "sd %5 V, min %6 V, max %7 V</font>")
+                .arg(colour.name())
+                .arg(DAQSettings::channelName(chan))
+                .arg(stats.mean, 0, 'g', 4)
+                .arg(stats.rms, 0, 'g', 4)
+                .arg(stats.stdDev, 0, 'g', 4)
+                .arg(stats.min, 0, 'g', 4)
+                .arg(stats.max, 0, 'g', 4);
+        }
+
+        QPalette palette = statsLabel->palette();
+        palette.setColor(QPalette::Window, daqSettings.bgColor);
+        palette.setColor(QPalette::WindowText, daqSettings.fgColor);
+        statsLabel->setPalette(palette);
+        statsLabel->setText(text);
+        statsLabel->adjustSize();
+        statsLabel->move(width() - Margin - statsLabel->width() - 5,
+                Margin + 5);
+    }
+
     void Plotter::daqError(const QString& errorMessage)
     {
         QMessageBox::critical(this, tr("GDAQrec"),
@@ -415,6 +823,20 @@ void Plotter::toggleRecording()
                 );
     }
 
+    void Plotter::realtimeWarning(const QString& message)
+    {
+        // recording goes on regardless, so only mention each problem once
+        if (message == lastRealtimeWarning)
+            return;
+
+        lastRealtimeWarning = message;
+        QMessageBox::warning(this, tr("GDAQrec"),
+                tr("Recording without some of the realtime settings:\n")
+                + message + tr("\n\nRunning GDAQrec with CAP_SYS_NICE and "
+                    "CAP_IPC_LOCK, or raising the rtprio and memlock limits, "
+                    "should fix this."));
+    }
+
     QSize Plotter::minimumSizeHint() const
     {
         return QSize(6 * Margin, 4 * Margin);
@@ -452,6 +874,14 @@ void Plotter::toggleRecording()
                 + openButton->width() + gap
                 + saveButton->width() + gap
                 + settingsButton->width() + gap
+                + spectrumButton->width() + gap
+                + statsButton->width() + gap
+                + sweepsButton->width() + gap
+                + averageButton->width() + gap
+                + overwriteButton->width() + gap
+                + stripsButton->width() + gap
+                + fitButton->width() + gap
+                + autoScaleButton->width() + gap
                 + recordButton->width() + gap
                 + zoomInButton->width() + gap
                 + zoomOutButton->width() + gap);
@@ -464,6 +894,22 @@ void Plotter::toggleRecording()
         x += saveButton->width() + gap;
         settingsButton->move(x, gap);
         x += settingsButton->width() + gap;
+        spectrumButton->move(x, gap);
+        x += spectrumButton->width() + gap;
+        statsButton->move(x, gap);
+        x += statsButton->width() + gap;
+        sweepsButton->move(x, gap);
+        x += sweepsButton->width() + gap;
+        averageButton->move(x, gap);
+        x += averageButton->width() + gap;
+        overwriteButton->move(x, gap);
+        x += overwriteButton->width() + gap;
+        stripsButton->move(x, gap);
+        x += stripsButton->width() + gap;
+        fitButton->move(x, gap);
+        x += fitButton->width() + gap;
+        autoScaleButton->move(x, gap);
+        x += autoScaleButton->width() + gap;
         recordButton->move(x, gap);
         x += recordButton->width() + gap;
         zoomInButton->move(x, gap);
@@ -471,6 +917,8 @@ void Plotter::toggleRecording()
         zoomOutButton->move(x, gap);
         x += zoomOutButton->width() + gap;
 
+        bufferLabel->move(Margin, gap);
+
         refreshPixmap();
     }
 
@@ -496,6 +944,7 @@ void Plotter::toggleRecording()
             updateRubberBandRegion();
             rubberBandRect.setBottomRight(event->pos());
             updateRubberBandRegion();
+            updateStatsLabel();
         }
     }
 
@@ -527,6 +976,28 @@ void Plotter::toggleRecording()
         }
     }
 
+    // In the strips view, fits the strip double-clicked to its data in
+    // view, with a little room either side, or with Shift puts back the
+    // channel's input range.
+    void Plotter::mouseDoubleClickEvent(QMouseEvent *event)
+    {
+        int chan = stripsButton->isChecked() ? stripAt(event->pos()) : -1;
+
+        if (chan < 0 || chan >= strips.count()) {
+            QWidget::mouseDoubleClickEvent(event);
+            return;
+        }
+
+        if (event->modifiers() & Qt::ShiftModifier) {
+            resetStrip(chan);
+        }
+        else {
+            fitStrip(chan, zoomStack[curZoom]);
+        }
+
+        refreshPixmap();
+    }
+
     void Plotter::keyPressEvent(QKeyEvent *event)
     {
         switch (event->key()) {
@@ -568,6 +1039,16 @@ void Plotter::toggleRecording()
                 traceOffset += 0.01;
                 refreshPixmap();
                 break;
+            case Qt::Key_F:
+                fitView();
+                break;
+            case Qt::Key_Home:
+                fitAll();
+                break;
+            case Qt::Key_T:
+                // a manual trigger, when recording only around triggers
+                daqReader.trigger();
+                break;
             default:
                 QWidget::keyPressEvent(event);
         }
@@ -596,6 +1077,9 @@ void Plotter::toggleRecording()
 #ifdef Q_WS_MAC
         daqReader.stop();
 #endif
+        if (event->isAccepted())
+            averageWatcher.waitForFinished();
+
         if (event->isAccepted() && daqReader.isRunning()) {
             daqReader.stop();
             daqReader.wait();
@@ -617,10 +1101,31 @@ void Plotter::toggleRecording()
         pixmap.fill(this, 0, 0);
         pixmap.fill(daqSettings.bgColor);
 
+        // the trace views' voltage axes follow the data, if set to
+        if (autoScaleButton->isChecked() && !spectrumButton->isChecked()
+                && !sweepsButton->isChecked() && !averageButton->isChecked())
+            fitY(&zoomStack[curZoom]);
+
         QPainter painter(&pixmap);
         painter.initFrom(this);
         drawGrid(&painter);
-        drawCurves(&painter);
+        if (spectrumButton->isChecked())
+            drawSpectra(&painter);
+        else if (sweepsButton->isChecked())
+            drawSweeps(&painter);
+        else if (averageButton->isChecked())
+            drawAverage(&painter);
+        else if (overwriteButton->isChecked())
+            drawOverwrite(&painter);
+        else if (stripsButton->isChecked())
+            drawStrips(&painter);
+        else
+            drawCurves(&painter);
+        // the other views' time axes aren't the recording's
+        if (!sweepsButton->isChecked() && !averageButton->isChecked()
+                && !overwriteButton->isChecked())
+            drawSpikes(&painter);
+        updateStatsLabel();
         update();
     }
 
@@ -639,10 +1144,21 @@ void Plotter::toggleRecording()
                 );
         QPen light = daqSettings.fgColor;
 
+        // the sweep and average views' time axis is in ms from the event
+        bool sweeps = sweepsButton->isChecked() || averageButton->isChecked();
+        double pre = 0.0, post = 0.0;
+        if (sweeps)
+            eventWindow(&pre, &post);
+
+        // and the overwrite view's is in seconds into each pass
+        double minX = overwriteButton->isChecked() ? 0.0 : settings.minX;
+
         for (int i = 0; i <= settings.numXTicks; ++i) {
             int x = rect.left() + (i * (rect.width() - 1)
                     / settings.numXTicks);
-            double label = settings.minX + (i * settings.spanX()
+            double label = sweeps
+                ? 1e3*(-pre + i*(pre + post)/settings.numXTicks)
+                : minX + (i * settings.spanX()
                     / settings.numXTicks);
             painter->setPen(quiteDark);
             painter->drawLine(x, rect.top(), x, rect.bottom());
@@ -652,7 +1168,10 @@ void Plotter::toggleRecording()
                     Qt::AlignHCenter | Qt::AlignTop,
                     QString::number(label));
         }
-        for (int j = 0; j <= settings.numYTicks; ++j) {
+        // the spectrum and strips views label their own Y axes
+        for (int j = 0; j <= settings.numYTicks
+                && !spectrumButton->isChecked()
+                && !stripsButton->isChecked(); ++j) {
             int y = rect.bottom() - (j * (rect.height() - 1)
                     / settings.numYTicks);
             double label = settings.minY + (j * settings.spanY()
@@ -668,6 +1187,96 @@ void Plotter::toggleRecording()
         painter->drawRect(rect.adjusted(0, 0, -1, -1));
     }
 
+    // A channel's scans first to last - 1 as a line in rect, for the given
+    // ranges of time and voltage.  Since there can be many points per
+    // pixel, it just goes from the minimum in each pixel column to the
+    // maximum (and then to the next column), which speeds up drawing
+    // dramatically.  With several summary blocks to a column the minima
+    // and maxima come from the store's summaries instead, so a view of
+    // hours costs about what one of seconds does and nothing is read back
+    // from the spill file.
+    static QPolygonF tracePolyline(const SampleStore& shown, int chan,
+            qint64 first, qint64 last, const QRect& rect, double minX,
+            double spanX, double minY, double spanY)
+    {
+        // at most two points per pixel column
+        QPolygonF polyline;
+        polyline.reserve(2*rect.width() + 4);
+
+        if (last - first >= 4*qint64(ScanSummary::blockScans)*rect.width()) {
+            const double columnSpan = spanX/(rect.width() - 1);
+            qint64 columnFirst = first;
+
+            for (int column = 0; column < rect.width(); ++column) {
+                qint64 columnEnd = column + 1 < rect.width()
+                    ? shown.lowerBound(minX + (column + 1)*columnSpan)
+                    : last;
+                double low, high;
+
+                if (shown.blockRange(chan, columnFirst, columnEnd,
+                            &low, &high)) {
+                    double x = rect.left() + column;
+                    polyline.append(QPointF(x, int(rect.bottom()
+                                    - (high - minY)*(rect.height() - 1)
+                                    /spanY)));
+                    polyline.append(QPointF(x, int(rect.bottom()
+                                    - (low - minY)*(rect.height() - 1)
+                                    /spanY)));
+                }
+
+                columnFirst = columnEnd;
+            }
+
+            return polyline;
+        }
+
+        // times and values are converted a block at a time
+        const int blockScans = 4096;
+        QVector<double> times(blockScans);
+        QVector<double> values(blockScans);
+
+        int prevX = rect.left()-2;
+        int minPixel = 0, maxPixel = 0; // reinitialized below
+        bool firstPoint = true;
+
+        for (qint64 block = first; block < last; block += blockScans) {
+            int numScans = int(min(qint64(blockScans), last - block));
+            shown.times(block, numScans, times.data());
+            shown.values(chan, block, numScans, values.data());
+
+            for (int j = 0; j < numScans; ++j) {
+                // lost scans padded as NaN have nothing to draw
+                if (values[j] != values[j])
+                    continue;
+
+                double dx = times[j] - minX;
+                double dy = values[j] - minY;
+                double x = rect.left() + (dx * (rect.width() - 1)
+                        / spanX);
+                double y = rect.bottom() - (dy * (rect.height() - 1)
+                        / spanY);
+                if (firstPoint) {
+                    minPixel = maxPixel = (int)y;
+                    firstPoint = false;
+                }
+
+                if (int(x) != prevX) {
+                    polyline.append(QPointF(x,minPixel));
+                    polyline.append(QPointF(x,maxPixel));
+
+                    prevX = int(x);
+                    minPixel = maxPixel = int(y);
+                }
+                else {
+                    minPixel = min(int(y), minPixel);
+                    maxPixel = max(int(y), maxPixel);
+                }
+            }
+        }
+
+        return polyline;
+    }
+
     void Plotter::drawCurves(QPainter *painter)
     {
         PlotSettings settings = zoomStack[curZoom];
@@ -678,83 +1287,1014 @@ void Plotter::toggleRecording()
 
         painter->setClipRect(rect.adjusted(+1, +1, -1, -1));
 
-        QMapIterator<int, QVector<QPointF> > i(curveMap);
+        const SampleStore& shown = shownSamples();
+        if (shown.isEmpty())
+            return;
+
+        // the scans in view, and one either side
+        qint64 first = max(qint64(0), shown.lowerBound(settings.minX) - 1);
+        qint64 last = min(shown.count(), shown.lowerBound(settings.maxX) + 1);
+
+        double offset = 0.0;
+        for (int id = 0; id < shown.numChannels(); ++id) {
+            QPolygonF polyline = tracePolyline(shown, id, first, last, rect,
+                    settings.minX, settings.spanX(), settings.minY - offset,
+                    settings.spanY());
+
+            // files opened from disk may have more channels than we record
+            painter->setPen(id < daqSettings.color.count()
+                    ? daqSettings.color[id] : DAQSettings::defaultColor(id));
+            painter->drawPolyline(polyline);
+
+            offset -= traceOffset;
+        }
+    }
+
+    // Each channel in a strip of its own, across the view's time, on the
+    // strip's own voltage range: at first the channel's input range, or as
+    // fitted to what's in view by double-clicking it, Fit or Auto.
+    // A strip's layer is only drawn again when its range, the view's time
+    // or the scans in it change, so a still view costs a blit per strip.
+    void Plotter::drawStrips(QPainter *painter)
+    {
+        PlotSettings settings = zoomStack[curZoom];
+        QRect rect(Margin, Margin,
+                width() - 2 * Margin, height() - 2 * Margin);
+        if (!rect.isValid())
+            return;
+
+        const SampleStore& shown = shownSamples();
+        const int numChans = numStrips();
+        while (strips.count() < numChans)
+            resetStrip(strips.count());
+
+        if (numChans == 0)
+            return;
+
+        const int stripHeight = (rect.height() - 2)/numChans;
+        if (stripHeight < 4)
+            return;
+
+        // the scans in view, and one either side
+        qint64 first = 0, last = 0;
+        if (!shown.isEmpty()) {
+            first = max(qint64(0), shown.lowerBound(settings.minX) - 1);
+            last = min(shown.count(), shown.lowerBound(settings.maxX) + 1);
+        }
+
+        QSize size(rect.width() - 2, stripHeight - 1);
+
+        for (int chan = 0; chan < numChans; ++chan) {
+            Strip& strip = strips[chan];
+            int top = rect.top() + 1 + chan*stripHeight;
+
+            if (strip.layer.size() != size
+                    || strip.layerMinX != settings.minX
+                    || strip.layerMaxX != settings.maxX
+                    || strip.layerMinY != strip.minY
+                    || strip.layerMaxY != strip.maxY
+                    || strip.firstScan != first || strip.lastScan != last)
+                drawStrip(chan, size, first, last);
+
+            painter->drawImage(rect.left() + 1, top, strip.layer);
+
+            QColor colour = chan < daqSettings.color.count()
+                ? daqSettings.color[chan] : DAQSettings::defaultColor(chan);
+            painter->setPen(daqSettings.fgColor);
+            painter->drawLine(rect.left(), top + stripHeight - 1,
+                    rect.right(), top + stripHeight - 1);
+            painter->drawText(rect.left() - Margin, top, Margin - 5, 20,
+                    Qt::AlignRight | Qt::AlignTop,
+                    QString::number(strip.maxY, 'g', 3));
+            if (stripHeight >= 40) {
+                painter->drawText(rect.left() - Margin,
+                        top + stripHeight - 21, Margin - 5, 20,
+                        Qt::AlignRight | Qt::AlignBottom,
+                        QString::number(strip.minY, 'g', 3));
+            }
+            painter->setPen(colour);
+            painter->drawText(rect.left() + 5, top, rect.width() - 10, 20,
+                    Qt::AlignLeft | Qt::AlignTop,
+                    DAQSettings::channelName(chan));
+        }
+    }
+
+    // The strip's layer, transparent but for its trace.
+    void Plotter::drawStrip(int chan, const QSize& size, qint64 first,
+            qint64 last)
+    {
+        const SampleStore& shown = shownSamples();
+        PlotSettings settings = zoomStack[curZoom];
+        Strip& strip = strips[chan];
+
+        if (strip.layer.size() != size) {
+            strip.layer = QImage(size, QImage::Format_ARGB32_Premultiplied);
+        }
+        strip.layer.fill(0);
+        strip.layerMinX = settings.minX;
+        strip.layerMaxX = settings.maxX;
+        strip.layerMinY = strip.minY;
+        strip.layerMaxY = strip.maxY;
+        strip.firstScan = first;
+        strip.lastScan = last;
+
+        if (chan >= shown.numChannels() || first >= last)
+            return;
+
+        QPolygonF polyline = tracePolyline(shown, chan, first, last,
+                QRect(QPoint(0, 0), size), settings.minX, settings.spanX(),
+                strip.minY, strip.maxY - strip.minY);
+
+        QPainter painter(&strip.layer);
+        painter.setPen(chan < daqSettings.color.count()
+                ? daqSettings.color[chan] : DAQSettings::defaultColor(chan));
+        painter.drawPolyline(polyline);
+    }
+
+    // the data's channels, or the settings' before there are any
+    int Plotter::numStrips() const
+    {
+        const SampleStore& shown = shownSamples();
+        return shown.isEmpty() ? daqSettings.numChannels : shown.numChannels();
+    }
+
+    // the strip under pos, or -1
+    int Plotter::stripAt(const QPoint& pos) const
+    {
+        QRect rect(Margin, Margin,
+                width() - 2 * Margin, height() - 2 * Margin);
+        int numChans = numStrips();
+
+        if (!rect.contains(pos) || numChans == 0)
+            return -1;
+
+        int stripHeight = (rect.height() - 2)/numChans;
+        int chan = stripHeight > 0 ? (pos.y() - rect.top() - 1)/stripHeight
+            : -1;
+
+        return chan >= 0 && chan < numChans ? chan : -1;
+    }
+
+    // back to the channel's input range; chan may be the next strip
+    void Plotter::resetStrip(int chan)
+    {
+        if (chan == strips.count()) {
+            strips.append(Strip());
+            strips[chan].lastScan = -1;
+        }
+
+        bool known = chan < daqSettings.numChannels;
+        strips[chan].minY = known ? daqSettings.minVoltage[chan] : -10.0;
+        strips[chan].maxY = known ? daqSettings.maxVoltage[chan] : 10.0;
+    }
+
+    // A little room either side of a range, and some for a flat one.
+    static void padRange(double* low, double* high)
+    {
+        double margin = *high > *low
+            ? 0.05*(*high - *low) : max(1e-3, 0.05*fabs(*high));
+        *low -= margin;
+        *high += margin;
+    }
+
+    // The strip's range from its data in view, rounded out to ticks so
+    // that small changes leave it, and its layer, as they are.
+    void Plotter::fitStrip(int chan, const PlotSettings& settings)
+    {
+        double low, high;
+        int numTicks;
+
+        if (chan >= strips.count()
+                || !rangeInView(chan, settings, &low, &high))
+            return;
+
+        padRange(&low, &high);
+        PlotSettings::adjustAxis(low, high, numTicks);
+        strips[chan].minY = low;
+        strips[chan].maxY = high;
+    }
+
+    // The voltage axis from the data in the settings' time span, across
+    // the channels as the S, A and D keys spread them, or in the strips
+    // view each strip's own.  Only the summaries are read, a few blocks
+    // per channel, so it can be done every frame; rounding out to ticks
+    // keeps the axis (and the overwrite view's layer) still until the
+    // data move out of them.
+    void Plotter::fitY(PlotSettings* settings)
+    {
+        if (stripsButton->isChecked()) {
+            for (int chan = 0; chan < strips.count(); ++chan)
+                fitStrip(chan, *settings);
+            return;
+        }
+
+        const SampleStore& shown = shownSamples();
+        double low = numeric_limits<double>::infinity();
+        double high = -low;
         double offset = 0.0;
-        while (i.hasNext()) {
-            i.next();
 
-            int id = i.key();
-            const QVector<QPointF> &data = i.value();
+        for (int chan = 0; chan < shown.numChannels(); ++chan) {
+            double chanLow, chanHigh;
+
+            if (rangeInView(chan, *settings, &chanLow, &chanHigh)) {
+                low = min(low, chanLow + offset);
+                high = max(high, chanHigh + offset);
+            }
 
-            if (data.count() != 0) {
-                QVector<QPointF> points;
+            offset -= traceOffset;
+        }
 
-                int j;
+        if (low > high)
+            return;
 
-                // skip points off the left edge of the graph
-                // (use a binary search, since there may be a lot of data)
-                int lowbound = 0;
-                int highbound = data.count()-1;
+        padRange(&low, &high);
+        settings->minY = low;
+        settings->maxY = high;
+        PlotSettings::adjustAxis(settings->minY, settings->maxY,
+                settings->numYTicks);
+    }
 
-                while (lowbound + 1 < highbound) {
-                    int mid = (lowbound + highbound)/2;
+    // Fit and F fit once; while Auto is down, refreshPixmap() fits every
+    // frame.
+    void Plotter::fitView()
+    {
+        fitY(&zoomStack[curZoom]);
+        refreshPixmap();
+    }
 
-                    if (data[mid].x() < settings.minX) {
-                        lowbound = mid;
+    // turning Auto off leaves the view as it was
+    void Plotter::autoScale(bool on)
+    {
+        if (on)
+            fitView();
+    }
+
+    // Everything recorded or opened, time and voltage, as a new zoom
+    // level, so that zooming out goes back to where it was.
+    void Plotter::fitAll()
+    {
+        const SampleStore& shown = shownSamples();
+        if (shown.count() < 2)
+            return;
+
+        PlotSettings settings = zoomStack[curZoom];
+        settings.minX = shown.time(0);
+        settings.maxX = shown.lastTime();
+        settings.includesRightEdge = true;
+        fitY(&settings);
+
+        zoomStack.resize(curZoom + 1);
+        zoomStack.append(settings);
+        zoomIn();
+    }
+
+    // The lowest and highest of a channel's samples in view, from the
+    // store's summaries and the samples at either end, so it costs the
+    // same however much is in view; false if there are none.
+    bool Plotter::rangeInView(int chan, const PlotSettings& settings,
+            double* min, double* max) const
+    {
+        const SampleStore& shown = shownSamples();
+
+        if (chan >= shown.numChannels() || shown.isEmpty())
+            return false;
+
+        qint64 first = shown.lowerBound(settings.minX);
+        qint64 end = std::max(first + 1, shown.lowerBound(settings.maxX));
+        if (first >= shown.count())
+            return false;
+
+        ScanSummary::Statistics stats = shown.statistics(chan, first,
+                std::min(end, shown.count()));
+        if (stats.count == 0)
+            return false;
+
+        *min = stats.min;
+        *max = stats.max;
+        return true;
+    }
+
+    // The view's span of time wrapped across the plot, like a chart
+    // recorder: a cursor moves left to right over the last pass, each
+    // frame drawing only the scans that arrived since the one before into
+    // a layer kept between frames, and clearing a gap ahead of itself.  A
+    // frame costs what its new scans do, however wide the view or many
+    // the channels; anything else about the view changing starts afresh.
+    void Plotter::drawOverwrite(QPainter *painter)
+    {
+        PlotSettings settings = zoomStack[curZoom];
+        QRect rect(Margin, Margin,
+                width() - 2 * Margin, height() - 2 * Margin);
+        if (!rect.isValid())
+            return;
+
+        const SampleStore& shown = shownSamples();
+
+        if (overwrite.nextScan < 0
+                || overwrite.layer.size() != rect.size()
+                || overwrite.period != settings.spanX()
+                || overwrite.minY != settings.minY
+                || overwrite.maxY != settings.maxY
+                || overwrite.traceOffset != traceOffset
+                || overwrite.nextScan > shown.count()
+                || overwrite.ends.count() != shown.numChannels())
+            startOverwrite(rect.size());
+
+        overwriteScans(shown.count());
+
+        painter->setClipRect(rect.adjusted(+1, +1, -1, -1));
+        painter->drawImage(rect.topLeft(), overwrite.layer);
+
+        if (overwrite.lastTime == overwrite.lastTime) {
+            int x = rect.left() + overwriteColumn(overwrite.lastTime);
+            painter->setPen(daqSettings.fgColor);
+            painter->drawLine(x, rect.top(), x, rect.bottom());
+        }
+    }
+
+    // An empty layer, to be drawn from the last pass's worth of scans,
+    // less the gap ahead of the cursor.
+    void Plotter::startOverwrite(const QSize& size)
+    {
+        const SampleStore& shown = shownSamples();
+        PlotSettings settings = zoomStack[curZoom];
+
+        overwrite.layer = QImage(size, QImage::Format_ARGB32_Premultiplied);
+        overwrite.layer.fill(0);
+        overwrite.period = settings.spanX();
+        overwrite.minY = settings.minY;
+        overwrite.maxY = settings.maxY;
+        overwrite.traceOffset = traceOffset;
+        overwrite.lastTime = numeric_limits<double>::quiet_NaN();
+        overwrite.ends.fill(QPointF(-1.0, 0.0), shown.numChannels());
+        overwrite.nextScan = 0;
+
+        if (!shown.isEmpty()) {
+            int gap = max(4, size.width()/64);
+            overwrite.nextScan = shown.lowerBound(shown.lastTime()
+                    - overwrite.period*(size.width() - gap)/size.width());
+        }
+    }
+
+    // Draws the scans from nextScan to end - 1 into the layer.
+    void Plotter::overwriteScans(qint64 end)
+    {
+        const SampleStore& shown = shownSamples();
+        qint64 first = overwrite.nextScan;
+        if (first >= end)
+            return;
+
+        const int w = overwrite.layer.width();
+        const int h = overwrite.layer.height();
+        const int gap = max(4, w/64);
+        const double dy = (h - 1)/(overwrite.maxY - overwrite.minY);
+        const double endTime = shown.time(end - 1);
+        QPainter painter(&overwrite.layer);
+
+        // the columns the new scans cover, and the gap ahead of them
+        if (overwrite.lastTime == overwrite.lastTime) {
+            int from = overwriteColumn(overwrite.lastTime) + 1;
+            int numColumns = endTime - overwrite.lastTime >= overwrite.period
+                ? w : (overwriteColumn(endTime) - from + 1 + w)%w + gap;
+            numColumns = min(w, numColumns);
+            from %= w;
+
+            painter.setCompositionMode(QPainter::CompositionMode_Source);
+            painter.fillRect(from, 0, min(numColumns, w - from), h,
+                    Qt::transparent);
+            if (numColumns > w - from) {
+                painter.fillRect(0, 0, numColumns - (w - from), h,
+                        Qt::transparent);
+            }
+            painter.setCompositionMode(QPainter::CompositionMode_SourceOver);
+        }
+
+        const int blockScans = 4096;
+        QVector<double> times(blockScans);
+        QVector<double> values(blockScans);
+
+        double offset = 0.0;
+        for (int id = 0; id < shown.numChannels(); ++id) {
+            // from the end of what the last frame drew, a line from the
+            // minimum to the maximum in each pixel column and on to the
+            // next, broken where the cursor wraps or the data do
+            QPolygonF polyline;
+            QPointF last = overwrite.ends[id];
+            int column = int(last.x());
+            double low = last.y(), high = last.y();
+            double lastTime = overwrite.lastTime;
+
+            if (column >= 0)
+                polyline.append(last);
+
+            painter.setPen(id < daqSettings.color.count()
+                    ? daqSettings.color[id] : DAQSettings::defaultColor(id));
+
+            for (qint64 block = first; block < end; block += blockScans) {
+                int numScans = int(min(qint64(blockScans), end - block));
+                shown.times(block, numScans, times.data());
+                shown.values(id, block, numScans, values.data());
+
+                for (int j = 0; j < numScans; ++j) {
+                    int x = overwriteColumn(times[j]);
+                    double y = h - 1
+                        - (values[j] - overwrite.minY + offset)*dy;
+                    bool broken = values[j] != values[j] || x < column
+                        || times[j] - lastTime >= overwrite.period;
+                    lastTime = times[j];
+
+                    if (broken || x != column) {
+                        if (column >= 0) {
+                            polyline.append(QPointF(column, low));
+                            polyline.append(QPointF(column, high));
+                        }
+                        if (broken) {
+                            painter.drawPolyline(polyline);
+                            polyline.clear();
+                        }
+                        if (values[j] != values[j]) {
+                            column = -1;
+                            continue;
+                        }
+
+                        column = x;
+                        low = high = y;
+                        polyline.append(QPointF(x, y));
                     }
                     else {
-                        highbound = mid;
+                        low = min(low, y);
+                        high = max(high, y);
                     }
+
+                    last = QPointF(x, y);
                 }
-                j = max(0, lowbound-1);
-
-                // since there can be many points per pixel, just draw a line
-                // from the minumum in that pixel to the maximum in that pixel
-                // (and then to the next pixel) (This speeds up drawing
-                // dramatically)
-                int prevX = rect.left()-2;
-                int minY = 0, maxY = 0; // reinitialized below
-                bool firstPoint = true;
-
-                for (; j < data.count()
-                        && (j == 0 || data[j-1].x() < settings.maxX); ++j) {
-                    double dx = data[j].x() - settings.minX;
-                    double dy = data[j].y() - settings.minY + offset;
-                    double x = rect.left() + (dx * (rect.width() - 1)
-                            / settings.spanX());
-                    double y = rect.bottom() - (dy * (rect.height() - 1)
-                            / settings.spanY());
-                    if (firstPoint) {
-                        minY = maxY = (int)y;
-                        firstPoint = false;
-                    }
+            }
 
-                    if (int(x) != prevX) {
-                        points.append(QPointF(x,minY));
-                        points.append(QPointF(x,maxY));
+            if (column >= 0) {
+                polyline.append(QPointF(column, low));
+                polyline.append(QPointF(column, high));
+                polyline.append(last);
+            }
+            painter.drawPolyline(polyline);
+            overwrite.ends[id] = column >= 0 ? last : QPointF(-1.0, 0.0);
 
-                        prevX = int(x);
-                        minY = maxY = int(y);
-                    }
-                    else {
-                        minY = min(int(y), minY);
-                        maxY = max(int(y), maxY);
-                    }
+            offset -= traceOffset;
+        }
+
+        overwrite.lastTime = endTime;
+        overwrite.nextScan = end;
+    }
+
+    // The layer's column for a time, counting passes from time 0.
+    int Plotter::overwriteColumn(double time) const
+    {
+        double phase = fmod(time, overwrite.period);
+        if (phase < 0.0)
+            phase += overwrite.period;
+
+        return min(overwrite.layer.width() - 1,
+                int(phase*overwrite.layer.width()/overwrite.period));
+    }
+
+    static bool spikeBefore(const Spike& spike, double time)
+    {
+        return spike.time < time;
+    }
+
+    // A raster along the top of the plot: a row of ticks per channel, in
+    // the channel's colour, at most one per pixel column.
+    void Plotter::drawSpikes(QPainter *painter)
+    {
+        PlotSettings settings = zoomStack[curZoom];
+        QRect rect(Margin, Margin,
+                width() - 2 * Margin, height() - 2 * Margin);
+        if (!rect.isValid() || spikes.isEmpty())
+            return;
+
+        const int rowHeight = 6;
+        QVector<QVector<QLineF> > ticks;
+        QVector<int> lastX;
+
+        const Spike* spike = std::lower_bound(spikes.constBegin(),
+                spikes.constEnd(), settings.minX, spikeBefore);
+
+        for (; spike != spikes.constEnd() && spike->time <= settings.maxX;
+                ++spike) {
+            int chan = spike->channel;
+            int x = rect.left() + int((spike->time - settings.minX)
+                    * (rect.width() - 1) / settings.spanX());
+
+            if (chan < 0 || chan >= DAQSettings::maxChannels)
+                continue;
+
+            if (chan >= ticks.count()) {
+                int oldCount = ticks.count();
+                ticks.resize(chan + 1);
+                lastX.resize(chan + 1);
+
+                for (int c = oldCount; c <= chan; ++c)
+                    lastX[c] = -1;
+            }
+
+            if (x == lastX[chan])
+                continue;
+
+            int y = rect.top() + 2 + chan*rowHeight;
+            ticks[chan].append(QLineF(x, y, x, y + rowHeight - 2));
+            lastX[chan] = x;
+        }
+
+        for (int chan = 0; chan < ticks.count(); ++chan) {
+            painter->setPen(chan < daqSettings.color.count()
+                    ? daqSettings.color[chan] : DAQSettings::defaultColor(chan));
+            painter->drawLines(ticks[chan]);
+        }
+    }
+
+    // A band per channel: its spectrogram, with frequency up the band and
+    // the power in dB (the view's loudest minus dynamicRange up to it) as
+    // the brightness of the channel's colour, and to the right the power
+    // spectrum averaged over the view.  Columns the spectrogram hasn't
+    // worked out yet are left blank and filled in as they arrive.
+    void Plotter::drawSpectra(QPainter *painter)
+    {
+        PlotSettings settings = zoomStack[curZoom];
+        QRect rect(Margin, Margin,
+                width() - 2 * Margin, height() - 2 * Margin);
+        if (!rect.isValid())
+            return;
+
+        const SampleStore& shown = shownSamples();
+        const int numChans = shown.numChannels();
+        if (shown.count() < Spectrogram::fftSize)
+            return;
+
+        const double dynamicRange = 80.0; // dB
+        const int panelWidth = min(120, rect.width()/5);
+        const int imageWidth = rect.width() - panelWidth - 2;
+        const int bandHeight = (rect.height() - 2)/numChans;
+        if (imageWidth < 1 || bandHeight < 2)
+            return;
+
+        // which column each pixel column shows, at the finest level with
+        // no more than a column per pixel
+        qint64 firstScan = shown.lowerBound(settings.minX);
+        qint64 lastScan = shown.lowerBound(settings.maxX);
+        int level = Spectrogram::levelFor(
+                double(lastScan - firstScan)/imageWidth);
+        int numColumns = Spectrogram::numColumns(level, shown.count());
+        qint64 spacing = Spectrogram::firstScan(level, 1);
+        QVector<int> columnAt(imageWidth, -1);
+
+        for (int x = 0; x < imageWidth; ++x) {
+            double t = settings.minX + (x + 0.5)*settings.spanX()/imageWidth;
+            if (t < shown.time(0) || t > shown.lastTime())
+                continue;
+
+            qint64 start = shown.lowerBound(t) - Spectrogram::fftSize/2;
+            int column = int(max(qint64(0), start + spacing/2)/spacing);
+            if (column < numColumns)
+                columnAt[x] = column;
+        }
+
+        qint64 scan = min(firstScan, shown.count() - 2);
+        double nyquist = 0.5/(shown.time(scan + 1) - shown.time(scan));
+
+        spectrogram.startRequests(16);
+
+        QVector<const float*> spectra(imageWidth);
+        QVector<double> average(Spectrogram::numBins);
+        QVector<QRgb> colours(256);
+        QImage image(imageWidth, bandHeight, QImage::Format_RGB32);
+
+        for (int chan = 0; chan < numChans; ++chan) {
+            int top = rect.top() + 1 + chan*bandHeight;
+            QColor colour = chan < daqSettings.color.count()
+                ? daqSettings.color[chan] : DAQSettings::defaultColor(chan);
+
+            // each column once for the average, however many pixels wide
+            double maxPower = 0.0;
+            int numAveraged = 0;
+            int lastColumn = -1;
+            average.fill(0.0);
+
+            for (int x = 0; x < imageWidth; ++x) {
+                spectra[x] = columnAt[x] < 0 ? NULL : spectrogram.column(
+                        shown, chan, level, columnAt[x]);
+
+                if (spectra[x] == NULL || columnAt[x] == lastColumn)
+                    continue;
+
+                for (int bin = 0; bin < Spectrogram::numBins; ++bin) {
+                    average[bin] += spectra[x][bin];
+                    maxPower = max(maxPower, double(spectra[x][bin]));
                 }
 
-                QPolygonF polyline(points);
+                lastColumn = columnAt[x];
+                ++numAveraged;
+            }
+
+            painter->setPen(daqSettings.fgColor);
+            painter->drawLine(rect.left(), top + bandHeight - 1,
+                    rect.right(), top + bandHeight - 1);
+            painter->drawText(rect.left() - Margin, top, Margin - 5, 20,
+                    Qt::AlignRight | Qt::AlignTop,
+                    nyquist >= 1000.0
+                    ? tr("%1k").arg(nyquist/1000.0, 0, 'g', 3)
+                    : QString::number(nyquist, 'g', 3));
+
+            if (numAveraged == 0 || maxPower <= 0.0)
+                continue;
+
+            const double ceiling = 10.0*log10(maxPower);
+            const double bottom = ceiling - dynamicRange;
+
+            for (int i = 0; i < 256; ++i) {
+                double a = i/255.0;
+                colours[i] = qRgb(
+                        int((1 - a)*daqSettings.bgColor.red() + a*colour.red()),
+                        int((1 - a)*daqSettings.bgColor.green()
+                            + a*colour.green()),
+                        int((1 - a)*daqSettings.bgColor.blue()
+                            + a*colour.blue()));
+            }
+
+            image.fill(daqSettings.bgColor.rgb());
+
+            for (int y = 0; y < bandHeight - 1; ++y) {
+                int bin = (bandHeight - 2 - y)*(Spectrogram::numBins - 1)
+                    /max(1, bandHeight - 2);
+                QRgb* line = reinterpret_cast<QRgb*>(image.scanLine(y));
+
+                for (int x = 0; x < imageWidth; ++x) {
+                    if (spectra[x] == NULL)
+                        continue;
+
+                    double db = 10.0*log10(double(spectra[x][bin]));
+                    int index = int(255.0*(db - bottom)/dynamicRange);
+                    line[x] = colours[max(0, min(255, index))];
+                }
+            }
+
+            painter->drawImage(rect.left() + 1, top, image,
+                    0, 0, imageWidth, bandHeight - 1);
+
+            // the average, louder to the right, in the same dB scale
+            int panelLeft = rect.right() - panelWidth;
+            QPolygonF spectrum;
+            spectrum.reserve(Spectrogram::numBins);
+
+            for (int bin = 0; bin < Spectrogram::numBins; ++bin) {
+                double db = 10.0*log10(average[bin]/numAveraged);
+                double fraction = max(0.0,
+                        min(1.0, (db - bottom)/dynamicRange));
+                spectrum.append(QPointF(panelLeft + fraction*(panelWidth - 1),
+                            top + bandHeight - 2 - double(bin)*(bandHeight - 2)
+                            /(Spectrogram::numBins - 1)));
+            }
+
+            painter->setPen(daqSettings.fgColor);
+            painter->drawLine(panelLeft, top, panelLeft, top + bandHeight - 1);
+            painter->drawText(panelLeft + 2, top, panelWidth - 4, 20,
+                    Qt::AlignRight | Qt::AlignTop,
+                    tr("%1 dB").arg(ceiling, 0, 'f', 0));
+            painter->setPen(colour);
+            painter->drawPolyline(spectrum);
+        }
+    }
+
+    // Each channel's sweeps on the view's voltage axis, across the window
+    // around the trigger: the persistence image, brighter where more
+    // sweeps passed, with the average drawn over it.
+    void Plotter::drawSweeps(QPainter *painter)
+    {
+        PlotSettings settings = zoomStack[curZoom];
+        QRect rect(Margin, Margin,
+                width() - 2 * Margin, height() - 2 * Margin);
+        if (!rect.isValid())
+            return;
+
+        painter->setClipRect(rect.adjusted(+1, +1, -1, -1));
+
+        // only new sweeps make the images worth building again
+        if (sweepCollector.numSweeps() != sweepsTaken)
+            takeSweeps();
+
+        const double dy = (rect.height() - 1)/settings.spanY();
+        double offset = 0.0;
+
+        for (int id = 0; id < sweepViews.count(); ++id) {
+            const SweepView& view = sweepViews[id];
+            int numScans = view.average.count();
+
+            if (!view.image.isNull() && numScans > 1) {
+                double top = rect.bottom()
+                    - (view.maxVoltage - settings.minY + offset)*dy;
+                double bottom = rect.bottom()
+                    - (view.minVoltage - settings.minY + offset)*dy;
+                painter->drawImage(QRectF(rect.left(), top, rect.width(),
+                            bottom - top), view.image);
+
+                // a point or two per pixel column, broken where no sweep
+                // had data
+                int step = qMax(1, numScans/(2*rect.width()));
+                QPolygonF polyline;
+                painter->setPen(QPen(id < daqSettings.color.count()
+                            ? daqSettings.color[id]
+                            : DAQSettings::defaultColor(id), 2));
+
+                for (int k = 0; k < numScans; k += step) {
+                    double value = view.average[k];
+
+                    if (value != value) {
+                        painter->drawPolyline(polyline);
+                        polyline.clear();
+                        continue;
+                    }
+
+                    double x = rect.left()
+                        + double(k)*(rect.width() - 1)/(numScans - 1);
+                    double y = rect.bottom()
+                        - (value - settings.minY + offset)*dy;
+                    polyline.append(QPointF(x, y));
+                }
 
-                painter->setPen(daqSettings.color[uint(id) % 8]);
                 painter->drawPolyline(polyline);
+            }
+
+            offset -= traceOffset;
+        }
+
+        painter->setPen(daqSettings.fgColor);
+        painter->drawText(rect.adjusted(5, 5, -5, -5),
+                Qt::AlignLeft | Qt::AlignBottom,
+                tr("%1 sweeps").arg(sweepsTaken));
+    }
+
+    // Turns each channel's counts into its colour, with an opacity that
+    // grows with the log of the count, so that rare excursions still show
+    // next to the path most sweeps take.
+    void Plotter::takeSweeps()
+    {
+        const int numColumns = SweepCollector::numColumns;
+        const int numLevels = SweepCollector::numLevels;
+        QVector<quint32> counts;
+
+        sweepViews.resize(daqSettings.numChannels);
+        sweepsTaken = 0;
+
+        for (int id = 0; id < sweepViews.count(); ++id) {
+            SweepView& view = sweepViews[id];
+            sweepsTaken = sweepCollector.snapshot(id, &counts, &view.average,
+                    &view.minVoltage, &view.maxVoltage);
+
+            if (counts.isEmpty()) {
+                view.image = QImage();
+                continue;
+            }
+
+            quint32 maxCount = *std::max_element(counts.constBegin(),
+                    counts.constEnd());
+            double scale = maxCount > 0 ? 255.0/log(1.0 + maxCount) : 0.0;
+            QRgb colour = (id < daqSettings.color.count()
+                    ? daqSettings.color[id]
+                    : DAQSettings::defaultColor(id)).rgb();
+
+            view.image = QImage(numColumns, numLevels, QImage::Format_ARGB32);
+
+            for (int level = 0; level < numLevels; ++level) {
+                // the highest level at the top
+                QRgb* line = reinterpret_cast<QRgb*>(
+                        view.image.scanLine(numLevels - 1 - level));
+
+                for (int col = 0; col < numColumns; ++col) {
+                    quint32 count = counts[col*numLevels + level];
+                    int alpha = count > 0
+                        ? int(log(1.0 + count)*scale + 0.5) : 0;
+                    line[col] = qRgba(qRed(colour), qGreen(colour),
+                            qBlue(colour), alpha);
+                }
+            }
+        }
+    }
+
+    static void drawBand(QPainter *painter, QPolygonF* upper,
+            QPolygonF* lower, const QColor& colour)
+    {
+        if (upper->count() > 1) {
+            QPolygonF band = *upper;
+            for (int i = lower->count() - 1; i >= 0; --i)
+                band.append((*lower)[i]);
+
+            painter->save();
+            painter->setPen(Qt::NoPen);
+            painter->setBrush(colour);
+            painter->drawPolygon(band);
+            painter->restore();
+        }
+
+        upper->clear();
+        lower->clear();
+    }
+
+    // Each channel's event-triggered average on the view's voltage axis,
+    // across the window around the events, in a shaded band showing its
+    // 95% confidence interval.
+    void Plotter::drawAverage(QPainter *painter)
+    {
+        PlotSettings settings = zoomStack[curZoom];
+        QRect rect(Margin, Margin,
+                width() - 2 * Margin, height() - 2 * Margin);
+        if (!rect.isValid())
+            return;
 
+        painter->setClipRect(rect.adjusted(+1, +1, -1, -1));
+
+        if (averageStale)
+            computeAverage();
+
+        const double dy = (rect.height() - 1)/settings.spanY();
+        int numOffsets = eventAverage.preScans() + eventAverage.postScans();
+        int step = qMax(1, numOffsets/(2*rect.width()));
+        QVector<double> mean, halfWidth;
+        double offset = 0.0;
+
+        for (int id = 0; id < eventAverage.numChannels(); ++id) {
+            eventAverage.band(id, &mean, &halfWidth);
+
+            QColor colour = id < daqSettings.color.count()
+                ? daqSettings.color[id] : DAQSettings::defaultColor(id);
+            QColor shade = colour;
+            shade.setAlpha(80);
+            painter->setPen(QPen(colour, 2));
+
+            // broken wherever there's no mean, or no interval
+            QPolygonF line, upper, lower;
+
+            for (int k = 0; k < numOffsets; k += step) {
+                double x = rect.left() + double(k)*(rect.width() - 1)
+                    /qMax(1, numOffsets - 1);
+                double y = rect.bottom()
+                    - (mean[k] - settings.minY + offset)*dy;
+
+                if (halfWidth[k] == halfWidth[k]) {
+                    upper.append(QPointF(x, y - halfWidth[k]*dy));
+                    lower.append(QPointF(x, y + halfWidth[k]*dy));
+                }
+                else {
+                    drawBand(painter, &upper, &lower, shade);
+                }
+
+                if (mean[k] == mean[k]) {
+                    line.append(QPointF(x, y));
+                }
+                else {
+                    painter->drawPolyline(line);
+                    line.clear();
+                }
             }
+
+            drawBand(painter, &upper, &lower, shade);
+            painter->drawPolyline(line);
+
             offset -= traceOffset;
         }
+
+        painter->setPen(daqSettings.fgColor);
+        painter->drawText(rect.adjusted(5, 5, -5, -5),
+                Qt::AlignLeft | Qt::AlignBottom,
+                averageWatcher.isRunning() ? tr("Averaging...")
+                : tr("%1 events").arg(eventAverage.numEvents()));
+    }
+
+    static void averageAll(EventAverage* average, const SampleStore* store,
+            QVector<qint64> events, int markerChannel, double level)
+    {
+        average->computeAll(*store, events, markerChannel, level);
+    }
+
+    // The averages of everything recorded or opened so far, from scratch,
+    // split across threads.  It's left to a pool thread, and
+    // averageComputed() takes it over; until then eventAverage is empty.
+    void Plotter::computeAverage()
+    {
+        // the next goes once this one is in
+        if (averageWatcher.isRunning())
+            return;
+
+        // a recording just started may not have set the store's layout yet
+        double dt = scanInterval();
+        eventAverage.reset(qMax(samples.numChannels(),
+                    daqSettings.numChannels),
+                int(daqSettings.triggerPre*1e-3/dt + 0.5),
+                int(daqSettings.triggerPost*1e-3/dt + 0.5));
+        averageStale = false;
+        newAverage = eventAverage;
+
+        if (daqSettings.averageEvents == DAQSettings::averageTriggers) {
+            if (daqSettings.triggerChannel >= 0
+                    && daqSettings.triggerChannel < samples.numChannels()) {
+                averageWatcher.setFuture(QtConcurrent::run(averageAll,
+                            &newAverage, &samples, QVector<qint64>(),
+                            daqSettings.triggerChannel,
+                            daqSettings.triggerLevel));
+            }
+        }
+        else if (daqSettings.averageEvents == DAQSettings::averageSpikes) {
+            QVector<qint64> events;
+
+            for (int i = 0; i < spikes.count(); ++i) {
+                if (spikes[i].channel == daqSettings.averageSpikeChannel)
+                    events.append(samples.lowerBound(spikes[i].time));
+            }
+
+            averageWatcher.setFuture(QtConcurrent::run(averageAll,
+                        &newAverage, &samples, events, -1, 0.0));
+        }
+    }
+
+    // The events that came in meanwhile are added by the next
+    // updateAverage(), unless the settings changed under it.
+    void Plotter::averageComputed()
+    {
+        if (averageStale) {
+            computeAverage();
+            return;
+        }
+
+        eventAverage = newAverage;
+
+        if (averageButton->isChecked())
+            refreshPixmap();
+    }
+
+    // Adds the events found since the last call, once the data have caught
+    // up with them, and whatever has arrived of the windows still filling.
+    void Plotter::updateAverage(int firstNewSpike)
+    {
+        // taken regardless, so that they don't pile up
+        QVector<double> triggers;
+        sweepCollector.takeTriggers(&triggers, spikeTimeOffset);
+
+        if (averageStale)
+            return;
+
+        if (daqSettings.averageEvents == DAQSettings::averageTriggers) {
+            eventTimes += triggers;
+        }
+        else if (daqSettings.averageEvents == DAQSettings::averageSpikes) {
+            for (int i = firstNewSpike; i < spikes.count(); ++i) {
+                if (spikes[i].channel == daqSettings.averageSpikeChannel)
+                    eventTimes.append(spikes[i].time);
+            }
+        }
+
+        int numReady = 0;
+        while (numReady < eventTimes.count() && !samples.isEmpty()
+                && eventTimes[numReady] <= samples.lastTime()) {
+            eventAverage.addEvent(samples.lowerBound(eventTimes[numReady]));
+            ++numReady;
+        }
+
+        eventTimes.remove(0, numReady);
+        eventAverage.update(samples);
+    }
+
+    // the window around each event in the sweep or average view, in seconds
+    void Plotter::eventWindow(double* pre, double* post)
+    {
+        if (averageButton->isChecked()) {
+            double dt = scanInterval();
+            *pre = eventAverage.preScans()*dt;
+            *post = eventAverage.postScans()*dt;
+        }
+        else {
+            sweepCollector.window(pre, post);
+        }
+    }
+
+    // of the latest scans, or as set if there aren't enough to tell
+    double Plotter::scanInterval() const
+    {
+        double dt = samples.isEmpty()
+            ? 0.0 : samples.scanInterval(samples.count() - 1);
+        return dt > 0.0 ? dt : 1.0/daqSettings.samplingRate;
     }
 
     void Plotter::updateSettings()
     {
+        averageWatcher.waitForFinished();
         daqReader.updateDAQSettings(daqSettings);
+        streamServer.updateSettings(daqSettings);
+        samples.setRetention(60.0*daqSettings.retention);
+        filteredSamples.setRetention(60.0*daqSettings.retention);
+        if (!displayFiltered())
+            filteredSamples.clear();
+        spectrogram.clear();
+        sweepsTaken = -1;
+        averageStale = true;
+        overwrite.nextScan = -1;
+        strips.clear();
         refreshPixmap();
     }
 
@@ -1,16 +1,28 @@
 #ifndef PLOTTER_H
 #define PLOTTER_H
 
+#include <QImage>
 #include <QMap>
 #include <QPixmap>
+#include <QPointF>
 #include <QVector>
 #include <QWidget>
 #include <QTimer>
 #include <QMutex>
 #include <QDateTime>
 #include <QFile>
+#include <QFutureWatcher>
 #include "DAQReader.h"
-
+#include "EventAverage.h"
+#include "SampleStore.h"
+#include "SampleFeed.h"
+#include "SharedClock.h"
+#include "Spectrogram.h"
+#include "SpikeDetector.h"
+#include "StreamServer.h"
+#include "SweepCollector.h"
+
+class QLabel;
 class QToolButton;
 class PlotSettings;
 
@@ -18,6 +30,9 @@ class Plotter : public QWidget
 {
     Q_OBJECT
 
+    friend class PlotterBenchmark;
+    friend class SoakTest;
+
     public:
         Plotter(QWidget *parent = 0);
 
@@ -30,12 +45,24 @@ class Plotter : public QWidget
         void toggleRecording();
         void newData();
         void daqError(const QString& errorMessage);
+        void realtimeWarning(const QString& message);
         void startedRecording();
         void stoppedRecording();
         void newDocument();
         void open();
         void save();
         void settings();
+        void showSpectrum(bool show);
+        void showStats(bool show);
+        void showSweeps(bool show);
+        void showAverage(bool show);
+        void showOverwrite(bool show);
+        void showStrips(bool show);
+        void fitView();
+        void autoScale(bool on);
+        void fitAll();
+        void spectrumReady();
+        void averageComputed();
 
     protected:
         void paintEvent(QPaintEvent *event);
@@ -43,18 +70,51 @@ class Plotter : public QWidget
         void mousePressEvent(QMouseEvent *event);
         void mouseMoveEvent(QMouseEvent *event);
         void mouseReleaseEvent(QMouseEvent *event);
+        void mouseDoubleClickEvent(QMouseEvent *event);
         void keyPressEvent(QKeyEvent *event);
         void wheelEvent(QWheelEvent *event);
         void closeEvent(QCloseEvent* event);
 
     private:
         bool offerToSave();
+        bool readFile(const QString& fileName);
+        bool writeFile(const QString& fileName);
+        bool readSpikes(const QString& fileName);
+        bool writeSpikes(const QString& fileName);
         void clearPlot();
         void updateRubberBandRegion();
         void refreshPixmap();
         void drawGrid(QPainter *painter);
         void drawCurves(QPainter *painter);
+        void drawSpikes(QPainter *painter);
+        void drawSpectra(QPainter *painter);
+        void drawSweeps(QPainter *painter);
+        void takeSweeps();
+        void drawAverage(QPainter *painter);
+        void computeAverage();
+        void updateAverage(int firstNewSpike);
+        void eventWindow(double* pre, double* post);
+        void drawOverwrite(QPainter *painter);
+        void startOverwrite(const QSize& size);
+        void overwriteScans(qint64 end);
+        int overwriteColumn(double time) const;
+        void drawStrips(QPainter *painter);
+        void drawStrip(int chan, const QSize& size, qint64 first,
+                qint64 last);
+        int numStrips() const;
+        int stripAt(const QPoint& pos) const;
+        void resetStrip(int chan);
+        bool rangeInView(int chan, const PlotSettings& settings,
+                double* min, double* max) const;
+        void fitStrip(int chan, const PlotSettings& settings);
+        void fitY(PlotSettings* settings);
+        void uncheckOtherViews(QToolButton* view);
+        double scanInterval() const;
         void updateSettings();
+        void updateBufferLabel();
+        void updateStatsLabel();
+        bool displayFiltered() const;
+        const SampleStore& shownSamples() const;
 
         enum { Margin = 50 };
 
@@ -64,11 +124,21 @@ class Plotter : public QWidget
         QToolButton *openButton;
         QToolButton *saveButton;
         QToolButton *settingsButton;
+        QToolButton *spectrumButton;
+        QToolButton *statsButton;
+        QToolButton *sweepsButton;
+        QToolButton *averageButton;
+        QToolButton *overwriteButton;
+        QToolButton *stripsButton;
+        QToolButton *fitButton;
+        QToolButton *autoScaleButton;
         QToolButton *recordButton;
         QToolButton *zoomInButton;
         QToolButton *zoomOutButton;
-        typedef QMap<int, QVector<QPointF> > CurveMap;
-        CurveMap curveMap;
+        QLabel *bufferLabel;
+        QLabel *statsLabel;
+        SampleStore samples;
+        SampleStore filteredSamples;    // drawn, if only it's filtered
         QVector<PlotSettings> zoomStack;
         int curZoom;
         bool rubberBandIsShown;
@@ -76,11 +146,70 @@ class Plotter : public QWidget
         QPixmap pixmap;
         bool saved;
         QDateTime startTime;
+        SampleFeed sampleFeed;
+        SharedClock sharedClock;
+        StreamServer streamServer;
+        SpikeDetector spikeDetector;
+        Spectrogram spectrogram;
+        SweepCollector sweepCollector;
+        QVector<Spike> spikes;      // in time order
+        double spikeTimeOffset;     // the current recording's start
         DAQReader daqReader;
         QString filename;
         double traceOffset;
         QFile sharedTimestamp;
         uchar* sharedTimestampMemMap;
+        QString lastRealtimeWarning;
+
+        // a channel's sweeps as last taken from sweepCollector
+        struct SweepView
+        {
+            QImage image;
+            QVector<double> average;
+            double minVoltage;
+            double maxVoltage;
+        };
+        QVector<SweepView> sweepViews;
+        int sweepsTaken;            // -1 to take them again
+
+        EventAverage eventAverage;
+        bool averageStale;          // computed afresh when next drawn
+        // computeAverage()'s, on a pool thread; nothing is appended to
+        // samples until it's done
+        EventAverage newAverage;
+        QFutureWatcher<void> averageWatcher;
+        QVector<double> eventTimes; // ahead of the data, for the average
+
+        // the overwrite view's traces, as last drawn
+        struct OverwriteView
+        {
+            QImage layer;
+            double period;          // seconds across the layer
+            double minY;
+            double maxY;
+            double traceOffset;
+            qint64 nextScan;        // to draw, -1 to start afresh
+            double lastTime;        // of the last scan drawn, NaN if none
+            QVector<QPointF> ends;  // per channel, the last point drawn
+        };
+        OverwriteView overwrite;
+
+        // the strips view: a channel per strip, on its own voltage range,
+        // drawn into a layer only when what it shows changes
+        struct Strip
+        {
+            double minY;
+            double maxY;
+            QImage layer;
+            // what the layer shows
+            double layerMinX;
+            double layerMaxX;
+            double layerMinY;
+            double layerMaxY;
+            qint64 firstScan;
+            qint64 lastScan;
+        };
+        QVector<Strip> strips;
 
 #ifdef Q_WS_MAC
         bool recording;
@@ -94,6 +223,8 @@ class PlotSettings
 
         void scroll(double dx, double dy);
         void adjust();
+        // rounds a range out to whole ticks
+        static void adjustAxis(double &min, double &max, int &numTicks);
         double spanX() const { return maxX - minX; }
         double spanY() const { return maxY - minY; }
 
@@ -105,9 +236,6 @@ class PlotSettings
         int numYTicks;
 
         bool includesRightEdge;
-
-    private:
-        static void adjustAxis(double &min, double &max, int &numTicks);
 };
 
 #endif
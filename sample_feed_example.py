@@ -0,0 +1,76 @@
+#!/usr/bin/python
+# Follows the live samples GDAQrec publishes in shared memory (see
+# feed/gdaqfeed.h for the layout) and prints the mean of each channel over
+# every block that arrives.  Samples are read in place through memoryviews
+# rather than copied out of the ring.
+import mmap
+import os
+import struct
+import time
+
+feed_filename = "/dev/shm/GDAQRec_samples"
+
+HEADER = struct.Struct("<6IQQd")       # up to sampling_rate
+INDICES = struct.Struct("<QQ")         # write_index, claim_index at 64
+CHANNEL = struct.Struct("<IIddddQ")    # per channel, starting at 128
+MAGIC = 0x51414447
+RECORDING = 1
+
+def open_feed():
+    with open(feed_filename, "rb") as f:
+        feed = mmap.mmap(f.fileno(), 0, prot=mmap.PROT_READ)
+    (magic, version, header_size, num_channels, sample_format, state,
+            session, capacity, sampling_rate) = HEADER.unpack_from(feed, 0)
+    if magic != MAGIC or version != 1 or sample_format != 1:
+        raise IOError("not a GDAQrec sample feed")
+    rings = []
+    for chan in range(num_channels):
+        data_offset = CHANNEL.unpack_from(feed, 128 + chan*CHANNEL.size)[6]
+        rings.append(memoryview(feed)[data_offset:data_offset + 8*capacity]
+                .cast("d"))
+    return feed, num_channels, capacity, sampling_rate, rings
+
+def state(feed):
+    return struct.unpack_from("<I", feed, 20)[0]
+
+while True:
+    if not os.path.exists(feed_filename):
+        print("not recording")
+        time.sleep(0.5)
+        continue
+
+    feed, num_channels, capacity, sampling_rate, rings = open_feed()
+    if state(feed) != RECORDING:
+        del rings
+        feed.close()
+        print("not recording")
+        time.sleep(0.5)
+        continue
+
+    print("%d channels at %g S/s" % (num_channels, sampling_rate))
+    cursor = INDICES.unpack_from(feed, 64)[0]
+
+    while state(feed) == RECORDING:
+        time.sleep(0.05)
+
+        write_index = INDICES.unpack_from(feed, 64)[0]
+        if write_index - cursor > capacity:
+            print("fell behind, skipped %d scans" %
+                    (write_index - capacity - cursor))
+            cursor = write_index - capacity
+        if write_index == cursor:
+            continue
+
+        first = cursor % capacity
+        count = min(write_index - cursor, capacity - first)
+        means = [sum(ring[first:first + count]) / count for ring in rings]
+
+        # make sure the writer didn't overwrite them while we were reading
+        claim_index = INDICES.unpack_from(feed, 64)[1]
+        if claim_index - cursor <= capacity:
+            print("%d: %s" % (cursor,
+                    " ".join("%8.4f" % mean for mean in means)))
+        cursor += count
+
+    del rings
+    feed.close()
@@ -0,0 +1,90 @@
+#include <cstdlib>
+#include "AllocationCounter.h"
+
+// Counts every heap allocation in the process, including the ones Qt makes
+// through qMalloc, by interposing the C allocator.  glibc exports its own
+// implementation under __libc_*, so the executable can wrap it without
+// dlsym tricks; on other C libraries the counts are just unavailable.
+//
+// Aligned allocations (posix_memalign and friends) are not intercepted, but
+// their frees are, so the live count can only drift downwards and a leak
+// still shows up as growth.
+
+#ifdef __GLIBC__
+
+extern "C" {
+    void* __libc_malloc(size_t size);
+    void* __libc_calloc(size_t n, size_t size);
+    void* __libc_realloc(void* ptr, size_t size);
+    void __libc_free(void* ptr);
+}
+
+static qint64 mallocCount = 0;
+static qint64 reallocCount = 0;
+static qint64 freeCount = 0;
+
+extern "C" void* malloc(size_t size)
+{
+    __sync_fetch_and_add(&mallocCount, 1);
+    return __libc_malloc(size);
+}
+
+extern "C" void* calloc(size_t n, size_t size)
+{
+    __sync_fetch_and_add(&mallocCount, 1);
+    return __libc_calloc(n, size);
+}
+
+extern "C" void* realloc(void* ptr, size_t size)
+{
+    if (ptr == NULL) {
+        __sync_fetch_and_add(&mallocCount, 1);
+    }
+    else if (size == 0) {
+        __sync_fetch_and_add(&freeCount, 1);
+    }
+    else {
+        __sync_fetch_and_add(&reallocCount, 1);
+    }
+
+    return __libc_realloc(ptr, size);
+}
+
+extern "C" void free(void* ptr)
+{
+    if (ptr != NULL) {
+        __sync_fetch_and_add(&freeCount, 1);
+    }
+
+    __libc_free(ptr);
+}
+
+bool allocationCountingEnabled()
+{
+    return true;
+}
+
+AllocationCounts allocationCounts()
+{
+    AllocationCounts counts;
+    counts.mallocs = __sync_fetch_and_add(&mallocCount, 0);
+    counts.reallocs = __sync_fetch_and_add(&reallocCount, 0);
+    counts.frees = __sync_fetch_and_add(&freeCount, 0);
+    return counts;
+}
+
+#else
+
+bool allocationCountingEnabled()
+{
+    return false;
+}
+
+AllocationCounts allocationCounts()
+{
+    AllocationCounts counts;
+    counts.mallocs = counts.reallocs = counts.frees = 0;
+    return counts;
+}
+
+#endif
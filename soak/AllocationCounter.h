@@ -0,0 +1,18 @@
+#ifndef ALLOCATIONCOUNTER_H
+#define ALLOCATIONCOUNTER_H
+
+#include <QtGlobal>
+
+struct AllocationCounts
+{
+    qint64 mallocs;
+    qint64 reallocs;
+    qint64 frees;
+
+    qint64 live() const { return mallocs - frees; }
+};
+
+bool allocationCountingEnabled();
+AllocationCounts allocationCounts();
+
+#endif
@@ -0,0 +1,268 @@
+#include <QtGui>
+#include <cstdio>
+#include <unistd.h>
+
+#include "SoakTest.h"
+#include "plotter.h"
+
+SoakOptions::SoakOptions() :
+    numChannels(2),
+    samplingRate(1000),
+    duration(3600.0),
+    sampleInterval(60.0),
+    warmup(60.0),
+    memoryBudget(64.0),
+    allocationBudget(100000),
+    latencyBudget(500.0),
+    lagBudget(2.0)
+{
+}
+
+bool SoakOptions::parse(const QStringList& args)
+{
+    for (int i = 1; i < args.count(); ++i) {
+        if (i + 1 >= args.count())
+            return false;
+
+        const QString& option = args[i];
+        const QString& value = args[++i];
+
+        if (option == "--channels") {
+            numChannels = value.toInt();
+        }
+        else if (option == "--rate") {
+            samplingRate = value.toInt();
+        }
+        else if (option == "--duration") {
+            duration = value.toDouble();
+        }
+        else if (option == "--interval") {
+            sampleInterval = value.toDouble();
+        }
+        else if (option == "--warmup") {
+            warmup = value.toDouble();
+        }
+        else if (option == "--memory-budget") {
+            memoryBudget = value.toDouble();
+        }
+        else if (option == "--allocation-budget") {
+            allocationBudget = value.toLongLong();
+        }
+        else if (option == "--latency-budget") {
+            latencyBudget = value.toDouble();
+        }
+        else if (option == "--lag-budget") {
+            lagBudget = value.toDouble();
+        }
+        else {
+            return false;
+        }
+    }
+
+    return numChannels >= 1 && numChannels <= DAQSettings::maxChannels
+        && samplingRate > 0 && duration > 0 && sampleInterval > 0;
+}
+
+
+static qint64 residentBytes()
+{
+    QFile statm("/proc/self/statm");
+
+    if (!statm.open(QIODevice::ReadOnly))
+        return 0;
+
+    QList<QByteArray> fields = statm.readAll().split(' ');
+    if (fields.count() < 2)
+        return 0;
+
+    return fields[1].toLongLong() * sysconf(_SC_PAGESIZE);
+}
+
+
+SoakTest::SoakTest(const SoakOptions& options_, QObject* parent) :
+    QObject(parent),
+    options(options_),
+    plotter(new Plotter),
+    out(stdout),
+    finishing(false),
+    haveBaseline(false),
+    baselineRss(0),
+    baselineStore(0),
+    baselineLive(0),
+    updates(0),
+    updateMsTotal(0.0),
+    updateMsMax(0.0),
+    worstUpdateMs(0.0)
+{
+    plotter->resize(plotter->sizeHint());
+
+    // don't touch the user's saved settings
+    plotter->daqSettings.setNumChannels(options.numChannels);
+    plotter->daqSettings.samplingRate = options.samplingRate;
+    plotter->updateSettings();
+
+    // route the reader's updates through here so that each one is timed
+    disconnect(&plotter->daqReader, SIGNAL(newData()),
+            plotter, SLOT(newData()));
+    connect(&plotter->daqReader, SIGNAL(newData()), this, SLOT(newData()));
+    connect(&plotter->daqReader, SIGNAL(finished()), this, SLOT(stopped()));
+    connect(&sampleTimer, SIGNAL(timeout()), this, SLOT(sample()));
+}
+
+SoakTest::~SoakTest()
+{
+    delete plotter;
+}
+
+void SoakTest::start()
+{
+    fprintf(stderr, "soak: %d channels at %d S/s for %g s%s\n",
+            options.numChannels, options.samplingRate, options.duration,
+            allocationCountingEnabled() ? "" : " (allocation counts unavailable)");
+
+    out << "elapsed_s,rss_mb,store_mb,mallocs,reallocs,live_allocs,"
+        "updates,mean_update_ms,max_update_ms,lag_s,dropped_scans\n";
+    out.flush();
+
+    elapsed.start();
+    sampleTimer.start(int(options.sampleInterval*1000));
+    QTimer::singleShot(int(options.duration*1000), this, SLOT(finish()));
+
+    plotter->toggleRecording();
+}
+
+void SoakTest::newData()
+{
+    qint64 oldCount = plotter->samples.count();
+
+    callTimer.start();
+    plotter->newData();
+    double ms = callTimer.nsecsElapsed()*1e-6;
+
+    // Plotter::newData throttles itself; only time the calls that did work
+    if (plotter->samples.count() != oldCount) {
+        ++updates;
+        updateMsTotal += ms;
+        updateMsMax = qMax(updateMsMax, ms);
+    }
+}
+
+qint64 SoakTest::storeBytes()
+{
+    return plotter->samples.bytesUsed();
+}
+
+void SoakTest::sample()
+{
+    if (!failure.isEmpty())
+        return;
+
+    double seconds = elapsed.elapsed()/1000.0;
+    qint64 rss = residentBytes();
+    qint64 store = storeBytes();
+    AllocationCounts counts = allocationCounts();
+    qint64 dropped = plotter->daqReader.scansDropped();
+    double lag = (plotter->daqReader.scansAcquired()
+            - plotter->samples.count()) / double(options.samplingRate);
+    double meanUpdateMs = updates ? updateMsTotal/updates : 0.0;
+
+    out << seconds << ","
+        << rss/1048576.0 << ","
+        << store/1048576.0 << ","
+        << counts.mallocs << ","
+        << counts.reallocs << ","
+        << counts.live() << ","
+        << updates << ","
+        << meanUpdateMs << ","
+        << updateMsMax << ","
+        << lag << ","
+        << dropped << "\n";
+    out.flush();
+
+    worstUpdateMs = qMax(worstUpdateMs, updateMsMax);
+    updates = 0;
+    updateMsTotal = 0.0;
+    updateMsMax = 0.0;
+
+    if (seconds < options.warmup)
+        return;
+
+    // memory held by the sample store is expected to grow; anything else
+    // growing is a leak
+    if (!haveBaseline) {
+        haveBaseline = true;
+        baselineRss = rss;
+        baselineStore = store;
+        baselineLive = counts.live();
+        worstUpdateMs = 0.0;
+        return;
+    }
+
+    double unexplainedMB =
+        ((rss - store) - (baselineRss - baselineStore))/1048576.0;
+
+    if (unexplainedMB > options.memoryBudget) {
+        fail(QString("memory grew by %1 MB beyond the sample store")
+                .arg(unexplainedMB));
+    }
+    else if (allocationCountingEnabled()
+            && counts.live() - baselineLive > options.allocationBudget) {
+        fail(QString("%1 more live allocations than at the baseline")
+                .arg(counts.live() - baselineLive));
+    }
+    else if (worstUpdateMs > options.latencyBudget) {
+        fail(QString("a display update took %1 ms").arg(worstUpdateMs));
+    }
+    else if (lag > options.lagBudget) {
+        fail(QString("the display trails acquisition by %1 s").arg(lag));
+    }
+    else if (dropped > 0) {
+        fail(QString("%1 scans were dropped").arg(dropped));
+    }
+}
+
+void SoakTest::fail(const QString& reason)
+{
+    failure = reason;
+    finish();
+}
+
+void SoakTest::finish()
+{
+    if (finishing)
+        return;
+
+    if (failure.isEmpty()) {
+        // one last check, so a failure at the very end is caught
+        sample();
+
+        if (finishing)
+            return;
+    }
+
+    finishing = true;
+    sampleTimer.stop();
+
+    if (plotter->daqReader.isRunning()) {
+        plotter->toggleRecording();
+    }
+    else {
+        stopped();
+    }
+}
+
+void SoakTest::stopped()
+{
+    if (!finishing) {
+        failure = "acquisition stopped before the end of the run";
+    }
+
+    if (failure.isEmpty()) {
+        fprintf(stderr, "soak: PASS\n");
+        qApp->exit(0);
+    }
+    else {
+        fprintf(stderr, "soak: FAIL: %s\n", qPrintable(failure));
+        qApp->exit(1);
+    }
+}
@@ -0,0 +1,71 @@
+#ifndef SOAKTEST_H
+#define SOAKTEST_H
+
+#include <QObject>
+#include <QElapsedTimer>
+#include <QTimer>
+#include <QTextStream>
+#include "AllocationCounter.h"
+
+class Plotter;
+
+struct SoakOptions
+{
+    int numChannels;
+    int samplingRate;
+    double duration;            // seconds
+    double sampleInterval;      // seconds between statistics lines
+    double warmup;              // seconds before the baseline is taken
+    double memoryBudget;        // MB of RSS growth not explained by data
+    qint64 allocationBudget;    // growth in live heap allocations
+    double latencyBudget;       // ms for a single Plotter::newData call
+    double lagBudget;           // seconds the display may trail acquisition
+
+    SoakOptions();
+    bool parse(const QStringList& args);
+};
+
+class SoakTest : public QObject
+{
+    Q_OBJECT
+
+    public:
+        SoakTest(const SoakOptions& options, QObject* parent = 0);
+        ~SoakTest();
+
+    public slots:
+        void start();
+
+    private slots:
+        void newData();
+        void sample();
+        void finish();
+        void stopped();
+
+    private:
+        void fail(const QString& reason);
+        qint64 storeBytes();
+
+        SoakOptions options;
+        Plotter* plotter;
+        QTextStream out;
+
+        QTimer sampleTimer;
+        QElapsedTimer elapsed;
+        QElapsedTimer callTimer;
+        bool finishing;
+
+        bool haveBaseline;
+        qint64 baselineRss;
+        qint64 baselineStore;
+        qint64 baselineLive;
+
+        qint64 updates;
+        double updateMsTotal;
+        double updateMsMax;
+        double worstUpdateMs;
+
+        QString failure;
+};
+
+#endif
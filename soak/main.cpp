@@ -0,0 +1,25 @@
+#include <QtGui>
+#include <cstdio>
+#include "SoakTest.h"
+
+int main(int argc, char *argv[])
+{
+    QApplication app(argc, argv);
+
+    SoakOptions options;
+    if (!options.parse(app.arguments())) {
+        fprintf(stderr,
+                "usage: soak [--channels N] [--rate S/s] [--duration s]\n"
+                "            [--interval s] [--warmup s] [--memory-budget MB]\n"
+                "            [--allocation-budget N] [--latency-budget ms]\n"
+                "            [--lag-budget s]\n"
+                "Statistics are written to stdout as CSV; the exit status is\n"
+                "nonzero if any budget was exceeded.\n");
+        return 2;
+    }
+
+    SoakTest test(options);
+    QTimer::singleShot(0, &test, SLOT(start()));
+
+    return app.exec();
+}
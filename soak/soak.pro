@@ -0,0 +1,18 @@
+######################################################################
+# Long-running soak test of the DAQReader -> Plotter pipeline, driven by
+# the simulated DAQ backend.  Build with "qmake && make" in this
+# directory, run "./soak --help".
+######################################################################
+
+TEMPLATE = app
+TARGET = soak
+DEPENDPATH += .
+INCLUDEPATH += .
+
+DAQLIB = simulated
+
+# Input
+HEADERS += SoakTest.h AllocationCounter.h
+SOURCES += main.cpp SoakTest.cpp AllocationCounter.cpp
+
+include(../gdaqrec.pri)
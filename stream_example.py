@@ -0,0 +1,57 @@
+#!/usr/bin/python
+# Connects to GDAQrec's live data server (see StreamServer.h for the
+# framing) and prints the mean of each channel for every block received.
+# Pass a port number to connect over TCP instead of the local socket.
+import socket
+import struct
+import sys
+
+socket_filename = "/tmp/GDAQRec"
+
+HEADER = struct.Struct("<IHHI")
+MAGIC = 0x53514447
+HELLO, SCANS, GAP, STOPPED, SUBSCRIBE = 1, 2, 3, 4, 16
+DROP_OLDEST, DECIMATE, DISCONNECT = 0, 1, 2
+
+def read_exactly(sock, size):
+    data = b""
+    while len(data) < size:
+        chunk = sock.recv(size - len(data))
+        if not chunk:
+            raise EOFError("GDAQrec closed the connection")
+        data += chunk
+    return data
+
+if len(sys.argv) > 1:
+    sock = socket.create_connection(("localhost", int(sys.argv[1])))
+else:
+    sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+    sock.connect(socket_filename)
+
+# ask for decimation rather than gaps if we fall more than a second behind
+sock.sendall(HEADER.pack(MAGIC, SUBSCRIBE, 0, 8)
+        + struct.pack("<II", DECIMATE, 1000))
+
+num_channels = 0
+while True:
+    magic, frame_type, flags, length = HEADER.unpack(
+            read_exactly(sock, HEADER.size))
+    if magic != MAGIC:
+        raise IOError("not a GDAQrec stream")
+    payload = read_exactly(sock, length)
+
+    if frame_type == HELLO:
+        version, num_channels, rate = struct.unpack_from("<IId", payload)
+        print("%d channels at %g S/s" % (num_channels, rate))
+    elif frame_type == SCANS:
+        first, count, decimation = struct.unpack_from("<QII", payload)
+        values = struct.unpack_from("<%df" % (count*num_channels), payload, 16)
+        means = [sum(values[chan::num_channels]) / count
+                for chan in range(num_channels)]
+        print("%d (1/%d): %s" % (first, decimation,
+                " ".join("%8.4f" % mean for mean in means)))
+    elif frame_type == GAP:
+        first, count = struct.unpack_from("<QQ", payload)
+        print("lost scans %d to %d" % (first, first + count - 1))
+    elif frame_type == STOPPED:
+        print("stopped recording")